@@ -0,0 +1,81 @@
+#ifndef ADDRESSTABLE_HPP
+#define ADDRESSTABLE_HPP
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/*
+ * Peer address as 16 bytes, IPv4 peers are stored as v4-mapped IPv6
+*/
+struct PeerAddress {
+    uint8_t bytes[16];
+    bool valid;
+
+    PeerAddress();
+
+    static PeerAddress fromSockaddr(const struct sockaddr* addr, socklen_t length);
+    static PeerAddress fromSocket(int fd);
+    socklen_t toSockaddr(struct sockaddr_storage& storage) const;
+    bool isV4() const;
+    bool operator==(const PeerAddress& other) const;
+    std::string toString() const;
+};
+
+enum AdmitResult {
+    ADMIT_OK,
+    ADMIT_TOO_MANY,
+    ADMIT_TOO_FAST
+};
+
+/*
+ * Open-addressing hash table of connection counts, keyed by address and by
+ * IPv6 /64 prefix. Slots are plain structs in one vector, lookups probe
+ * linearly and stale entries are dropped by rebuilding the table in sweep().
+ * The slot of an address also counts its failed SASL logins, which outlive
+ * its connections until their window ends.
+*/
+class AddressTable {
+private:
+    struct Slot {
+        uint8_t key[16];
+        uint8_t prefix_len;
+        uint8_t used;
+        uint16_t window_count;
+        uint16_t sasl_failures;
+        uint32_t connections;
+        uint32_t window_start;
+        uint32_t sasl_window_start;
+    };
+
+    std::vector<Slot> slots;
+    size_t used_count;
+    uint32_t max_per_ip;
+    uint32_t max_per_prefix;
+    uint32_t max_rate;
+    uint32_t rate_window;
+    uint32_t max_sasl_failures;
+    uint32_t sasl_window;
+
+    static uint32_t hash(const uint8_t* key, uint8_t prefix_len);
+    static void makeKey(const PeerAddress& address, uint8_t prefix_len, uint8_t* key);
+    Slot* find(const uint8_t* key, uint8_t prefix_len);
+    Slot& insert(const uint8_t* key, uint8_t prefix_len);
+    void rehash(size_t capacity);
+
+public:
+    AddressTable();
+
+    void setLimits(uint32_t max_per_ip, uint32_t max_per_prefix, uint32_t max_rate, uint32_t rate_window);
+    void setSaslLimits(uint32_t max_failures, uint32_t window);
+    bool saslAllowed(const PeerAddress& address, time_t now);
+    void saslFailed(const PeerAddress& address, time_t now);
+    AdmitResult admit(const PeerAddress& address, time_t now);
+    void release(const PeerAddress& address);
+    void sweep(time_t now);
+    size_t size() const;
+};
+
+#endif
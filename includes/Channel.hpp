@@ -2,6 +2,21 @@
 #define CHANNEL_HPP
 
 #include "Client.hpp"
+#include "ChannelHistory.hpp"
+#include "MaskMatcher.hpp"
+
+enum MaskList {
+    MASK_BAN,
+    MASK_EXCEPTION,
+    MASK_INVITE,
+    MASK_LIST_COUNT
+};
+
+struct ChannelMask {
+    std::string mask;
+    std::string setter;
+    time_t time;
+};
 
 class Channel {
 private:
@@ -11,21 +26,45 @@ private:
     bool inviteOnly;
     std::string name;
     std::string topic;
+    time_t topic_time;
+    time_t creation_time;
     std::string channel_password;
     std::map<std::string, Client*> clients;
     std::map<std::string, Client*> invited_clients;
     std::vector<std::string> operators;
+    ChannelHistory history;
+    std::vector<ChannelMask> mask_lists[MASK_LIST_COUNT];
+    MaskMatcher mask_matchers[MASK_LIST_COUNT];
+
+    struct MaskStatus {
+        uint32_t generation;
+        bool banned;
+        bool invite_exempt;
+    };
+    std::map<uint32_t, MaskStatus> mask_cache;
+
+    const MaskStatus& maskStatus(const Client& client);
+
+    static unsigned long max_members;
+    static unsigned long default_limit;
+    static unsigned long max_masks;
 
 public:
+    static void setLimits(unsigned long max_members, unsigned long default_limit, unsigned long max_masks);
+    static unsigned long getDefaultLimit();
+    bool hasUserLimit() const;
+
     Channel();
     ~Channel();
 
     Channel& operator=(const Channel& other);
 
     std::string getNamesList();
-    void updateList(int client_fd, std::string server_name, std::string nickname);
+    void updateList(Client& client, std::string server_name, std::string nickname);
 
     void broadcast(std::string const &send_msg);
+    void broadcast(const Message& message, int except_fd);
+    void broadcastEphemeral(const Message& message, int except_fd, const std::string& key);
 
     std::string getModes() const;
 
@@ -50,6 +89,11 @@ public:
 
     const std::string& getTopic() const;
     void setTopic(const std::string& topic);
+    time_t getTopicTime() const;
+    void setTopicTime(time_t topic_time);
+
+    time_t getCreationTime() const;
+    void setCreationTime(time_t creation_time);
 
     const std::string& getPassword() const;
     void setPassword(const std::string& password);
@@ -68,12 +112,22 @@ public:
 
     void addClient(const std::string& nickname, Client* client);
     void removeClient(const std::string& nickname);
+    void renameClient(const std::string& old_nickname, const std::string& new_nickname);
 
     void addOperator(const std::string& nickname, std::string server_name);
     void removeOperator(const std::string& nickname, std::string server_name);
 
     bool isOperator(const std::string& nickname) const;
     bool isClient(const std::string& nickname) const;
+
+    bool addMask(int list, const std::string& mask, const std::string& setter, time_t time);
+    bool removeMask(int list, const std::string& mask);
+    const std::vector<ChannelMask>& getMasks(int list) const;
+    bool isBanned(const Client& client);
+    bool isInviteExempt(const Client& client);
+
+    const ChannelHistory& getHistory() const;
+    ChannelHistory& getHistory();
 };
 
 #endif
@@ -0,0 +1,55 @@
+#ifndef CHANNELHISTORY_HPP
+#define CHANNELHISTORY_HPP
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * Bounded ring of the last messages of a channel. Every record is stored as a
+ * small header (timestamp, sender id, length) followed by the wire-formatted
+ * line, all in one contiguous buffer, so a replay is a plain copy.
+*/
+class ChannelHistory {
+public:
+    struct Entry {
+        uint64_t time_ms;
+        uint32_t sender_id;
+        const char* data;
+        uint32_t length;
+    };
+
+private:
+    struct RecordHeader {
+        uint64_t time_ms;
+        uint32_t sender_id;
+        uint32_t length;
+    };
+
+    std::vector<char> buffer;
+    std::deque<size_t> offsets;
+    size_t start;
+    size_t max_lines;
+    size_t max_bytes;
+
+    void evictFront();
+    void compact();
+
+public:
+    ChannelHistory();
+
+    void setLimits(size_t max_lines, size_t max_bytes);
+    void append(uint64_t time_ms, uint32_t sender_id, const std::string& line);
+    void clear();
+
+    size_t size() const;
+    size_t byteSize() const;
+    size_t memoryUsage() const;
+
+    Entry at(size_t index) const;
+    size_t lowerBound(uint64_t time_ms) const;
+    size_t upperBound(uint64_t time_ms) const;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef CHANNELLOG_HPP
+#define CHANNELLOG_HPP
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * Append-only per-channel message log (format in ChannelLogReader.hpp).
+ * The loop only copies a record into a queue; a writer thread takes the
+ * whole queue at once and writes each channel's records with one write()
+ * (group commit), and fsyncs the files it touched about once a second.
+*/
+class ChannelLog {
+private:
+    struct Record {
+        std::string channel;
+        uint64_t time_ms;
+        std::string line;
+    };
+
+    struct File {
+        int fd;
+        int index_fd;
+        uint64_t size;
+        uint64_t next_index;        // Records until the next index entry
+        bool dirty;
+        uint64_t last_write_ms;
+    };
+
+    // Loop thread only
+    std::string dir;
+    std::set<std::string> channels;
+    bool all_channels;
+    bool running;
+
+    // Shared, under lock
+    pthread_mutex_t lock;
+    pthread_cond_t has_work;
+    std::vector<Record> queue;
+    size_t queued_bytes;
+    bool stopping;
+    uint64_t dropped;
+
+    // Writer thread only
+    pthread_t thread;
+    std::map<std::string, File> files;
+
+    ChannelLog(const ChannelLog&);
+    ChannelLog& operator=(const ChannelLog&);
+
+    static void* threadMain(void* arg);
+    void work();
+    void writeBatch(std::vector<Record>& batch);
+    File* openFile(const std::string& channel);
+    void syncFiles(uint64_t now_ms, bool closing);
+
+public:
+    ChannelLog();
+    ~ChannelLog();
+
+    void configure(const std::string& dir, const std::vector<std::string>& channels);
+    bool isLogged(const std::string& channel) const;
+    void append(const std::string& channel, uint64_t time_ms, const char* line, size_t length);
+    void stop();
+    const std::string& getDir() const;
+    uint64_t getDropped();
+};
+
+#endif
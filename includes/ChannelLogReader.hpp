@@ -0,0 +1,61 @@
+#ifndef CHANNELLOGREADER_HPP
+#define CHANNELLOGREADER_HPP
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Channel log files, one per logged channel:
+ *   <channel>.log  "IRCLOG01", then records: u32 length, u64 time_ms, <length> bytes of IRC line
+ *   <channel>.idx  one u64 time_ms, u64 offset pair every CHANNEL_LOG_INDEX_STRIDE records
+ * Both are append-only and in host byte order, like the other files the server writes.
+ * The writer only ever shrinks them to cut a torn tail at open, under an
+ * exclusive flock on the .log; readers hold it shared while they map the files.
+*/
+#define CHANNEL_LOG_MAGIC "IRCLOG01"
+#define CHANNEL_LOG_MAGIC_SIZE 8
+#define CHANNEL_LOG_RECORD_HEADER 12
+#define CHANNEL_LOG_INDEX_ENTRY 16
+#define CHANNEL_LOG_INDEX_STRIDE 64
+
+struct LogRecord {
+    uint64_t time_ms;
+    std::string line;
+};
+
+/*
+ * Read-only view of a channel log. Both files are memory-mapped; a query
+ * binary-searches the index and scans at most one stride of records before
+ * the first match, however large the log is.
+*/
+class ChannelLogReader {
+private:
+    const char* log;
+    size_t log_size;
+    const char* index;
+    size_t index_size;      // Whole entries only
+    size_t index_mapped;    // What munmap needs, a torn last entry included
+    int lock_fd;            // The .log, flock'ed shared while mapped
+
+    ChannelLogReader(const ChannelLogReader&);
+    ChannelLogReader& operator=(const ChannelLogReader&);
+
+public:
+    ChannelLogReader();
+    ~ChannelLogReader();
+
+    bool open(const std::string& log_path, std::string& error);
+    void close();
+    size_t seek(uint64_t from_ms) const;
+    size_t lowerBound(uint64_t time_ms) const;
+    size_t upperBound(uint64_t time_ms) const;
+    bool next(size_t& offset, LogRecord& record) const;
+    size_t query(uint64_t from_ms, uint64_t to_ms, size_t limit, std::vector<LogRecord>& records) const;
+};
+
+std::string channel_log_path(const std::string& dir, const std::string& channel);
+bool lock_file(int fd, int operation);
+
+#endif
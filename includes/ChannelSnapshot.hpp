@@ -0,0 +1,58 @@
+#ifndef CHANNELSNAPSHOT_HPP
+#define CHANNELSNAPSHOT_HPP
+
+#include <map>
+#include <set>
+#include <string>
+#include <stdint.h>
+
+class Channel;
+
+/*
+ * Binary snapshot of the channel state (topic, key, modes, operators, invites,
+ * ban and exception lists).
+ *
+ * Layout: a fixed header, the channel records, then an index of record offsets
+ * sorted by channel name. The file is memory-mapped and only the header is read
+ * when it is opened; a channel is decoded the first time it is looked up.
+*/
+class ChannelSnapshot {
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t channel_count;
+        uint64_t index_offset;
+    };
+
+    const char* data;
+    size_t data_size;
+    uint32_t channel_count;
+    uint64_t index_offset;
+    std::set<std::string> consumed;
+
+    ChannelSnapshot(const ChannelSnapshot& other);
+    ChannelSnapshot& operator=(const ChannelSnapshot& other);
+
+    uint64_t recordOffset(uint32_t index) const;
+    bool recordName(uint64_t offset, std::string& name) const;
+    bool findRecord(const std::string& name, uint64_t& offset, size_t& size) const;
+
+public:
+    ChannelSnapshot();
+    ~ChannelSnapshot();
+
+    bool open(const std::string& path);
+    void close();
+
+    bool restore(const std::string& name, Channel& channel);
+    size_t size() const;
+
+    static void serializeChannel(const Channel& channel, std::string& out);
+    static bool deserializeChannel(const char* record, size_t size, Channel& channel);
+
+    std::string build(const std::map<std::string, Channel>& channels) const;
+    static bool writeFile(const std::string& path, const std::string& contents);
+};
+
+#endif
@@ -11,14 +11,42 @@ private:
     bool authenticated;
     bool admin;
     std::string buffer;
+    std::string sendq;
+    std::string controlq;
+    bool bulk_partial;
+    std::map<std::string, std::string> ephemeral;
     int fd;
+    uint32_t id;
+    std::string uid;
+    int route_fd;
+    uint64_t recv_load;
+    PeerAddress address;
+    std::string hostname;
+    bool host_pending;
+    bool cap_negotiating;
+    unsigned int caps;
+    std::string account;
+    std::string resume_token;
+    int sasl_state;
+    std::string sasl_buffer;
+    unsigned int sasl_failures;
+    uint32_t mask_generation;
+    double flood_tokens;
+    uint64_t flood_refill_ms;
+    time_t ping_sent;
     bool registered;
     bool has_nick;
     bool has_user;
 	time_t time_to_connect;
     time_t last_activity_time;
 
+    static size_t max_nickname_length;
+
+    ssize_t writeLane(std::string& lane, size_t length);
+
 public:
+    static void setMaxNicknameLength(size_t length);
+
     Client();
     Client(int fd);
     ~Client();
@@ -43,8 +71,62 @@ public:
     const std::string& getBuffer() const;
     void appendToBuffer(const std::string& data);
     void setBuffer(const std::string& buffer);
+    bool extractLine(std::string& line);
+
+    void queueMessage(const std::string& msg, int lane = LANE_BULK);
+    size_t getSendQueueSize() const;
+    size_t getControlQueueSize() const;
+    std::string getPendingOutput() const;
+    void dropPartialLine();
+    bool hasPendingOutput() const;
+    bool flushSendQueue();
+
+    void queueMessage(const char* data, size_t length);
+    void setSendQueue(const std::string& sendq);
+    bool queueEphemeral(const std::string& key, const std::string& msg);
+
+    const PeerAddress& getAddress() const;
+    void setAddress(const PeerAddress& address);
+    const std::string& getHostname() const;
+    void setHostname(const std::string& hostname);
+    bool isHostPending() const;
+    std::string getMask() const;
+    uint32_t getMaskGeneration() const;
+    void setHostPending(bool pending);
+
+    bool isCapNegotiating() const;
+    void setCapNegotiating(bool negotiating);
+    unsigned int getCaps() const;
+    void setCaps(unsigned int caps);
+
+    const std::string& getAccount() const;
+    void setAccount(const std::string& account);
+    int getSaslState() const;
+    void setSaslState(int state);
+    std::string& getSaslBuffer();
+    unsigned int addSaslFailure();
+
+    const std::string& getResumeToken() const;
+    void setResumeToken(const std::string& token);
+
+    bool takeFloodToken(uint64_t now_ms, unsigned long rate, unsigned long burst);
+    time_t getPingSent() const;
+    void setPingSent(time_t ping_sent);
+
+    void addRecvLoad(size_t bytes);
+    void decayRecvLoad();
+    uint64_t getRecvLoad() const;
 
     int getFd() const;
+    uint32_t getId() const;
+    void setId(uint32_t id);
+
+    const std::string& getUid() const;
+    void setUid(const std::string& uid);
+
+    bool isRemote() const;
+    int getRouteFd() const;
+    void setRouteFd(int route_fd);
     void setFd(int fd);
 
     bool isRegistered() const;
@@ -0,0 +1,100 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string>
+#include <vector>
+
+enum LogLevel {
+    LOG_ERROR,
+    LOG_INFO,
+    LOG_DEBUG
+};
+
+enum ConnectionClassId {
+    CLASS_USER,
+    CLASS_ACCOUNT,
+    CLASS_COUNT
+};
+
+/*
+ * Limits of a class of connections: clients logged in to an account get the
+ * "account" class, everyone else the "user" class.
+*/
+struct ConnectionClass {
+    unsigned long sendq;
+    unsigned long flood_burst;
+    unsigned long flood_rate;
+    unsigned long ping_interval;
+    unsigned long ping_timeout;
+};
+
+/*
+ * A server allowed to link with this one, from a "[link <name>]" section. It
+ * must announce itself as <name> with this SID and password, and connect from
+ * an address that host resolves to.
+*/
+struct LinkBlock {
+    std::string name;
+    std::string sid;
+    std::string host;
+    unsigned long port;     // 0 to only accept the link, never connect out
+    std::string password;
+    bool compress;
+
+    LinkBlock();
+};
+
+/*
+ * Everything read from the configuration file. A loaded config is never
+ * modified: a reload parses and validates a new one off to the side, then the
+ * server swaps its pointer, so handlers only ever read plain fields.
+*/
+struct ServerConfig {
+    unsigned long backlog;
+    unsigned long worker_threads;
+
+    unsigned long max_clients;
+    unsigned long max_connections_per_ip;
+    unsigned long max_connections_per_prefix;
+    unsigned long connect_rate_limit;
+    unsigned long connect_rate_window;
+    unsigned long nick_length;
+    unsigned long channel_max_members;
+    unsigned long channel_default_limit;
+    unsigned long channel_max_masks;
+    unsigned long history_max_lines;
+    unsigned long history_max_bytes;
+
+    unsigned long registration_timeout;
+    unsigned long resolve_deadline_ms;
+    unsigned long sasl_max_failures;        // Per connection, then it is closed
+    unsigned long sasl_ip_failures;         // Per address and window, 0 for no limit
+    unsigned long sasl_failure_window;
+    unsigned long resume_grace;
+    unsigned long resume_buffer;
+
+    unsigned long lag_defer_accept_ms;
+    unsigned long lag_throttle_ms;
+    unsigned long lag_reject_ms;
+    unsigned long latency_sample_rate;
+    unsigned long slowlog_threshold_us;
+
+    int log_level;
+    ConnectionClass classes[CLASS_COUNT];
+    std::vector<std::string> plugins;       // "<path> [args]", loaded at startup only
+    std::string channel_log_dir;            // Empty disables the channel log
+    std::vector<std::string> channel_logs;  // Channel names, or "*" for every channel
+    std::string filter_file;                // Pattern file, filtering is off while it does not exist
+    std::string filter_report;              // Channel told about "report" matches, empty for the log only
+    std::string server_name;                // Startup only, empty for "localhost:<port>"
+    std::string server_id;                  // Startup only, required once a link is configured
+    std::vector<LinkBlock> links;
+
+    ServerConfig();
+
+    bool load(const std::string& path, std::string& error);
+};
+
+ServerConfig* read_startup_config(const std::string& path);
+
+#endif
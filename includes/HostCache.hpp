@@ -0,0 +1,35 @@
+#ifndef HOSTCACHE_HPP
+#define HOSTCACHE_HPP
+
+#include <ctime>
+#include <list>
+#include <map>
+#include <string>
+
+/*
+ * Reverse DNS results shared by every connection, keyed by IP. Entries
+ * expire after their TTL and the least recently used one is evicted once the
+ * cache is full. A failed lookup is cached as an empty host name.
+*/
+class HostCache {
+private:
+    struct Entry {
+        std::string host;
+        time_t expires;
+        std::list<std::string>::iterator lru;
+    };
+
+    std::map<std::string, Entry> entries;
+    std::list<std::string> lru;
+    size_t capacity;
+
+public:
+    HostCache();
+
+    void setCapacity(size_t capacity);
+    bool lookup(const std::string& ip, time_t now, std::string& host);
+    void store(const std::string& ip, const std::string& host, time_t ttl, time_t now);
+    size_t size() const;
+};
+
+#endif
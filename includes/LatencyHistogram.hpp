@@ -0,0 +1,53 @@
+#ifndef LATENCYHISTOGRAM_HPP
+#define LATENCYHISTOGRAM_HPP
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+
+/*
+ * @brief Read a cheap monotonic tick counter (the TSC on x86, nanoseconds elsewhere)
+ * @return The current tick
+*/
+inline uint64_t cycle_now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+void calibrate_cycle_clock();
+double cycles_to_us(uint64_t cycles);
+
+/*
+ * Log-linear histogram in the HDR style: every power of two is split into
+ * 16 linear sub-buckets, so any value is kept within ~6% with a fixed 4KB
+ * table and recording is a couple of shifts.
+*/
+class LatencyHistogram {
+private:
+    enum { SUB_BUCKET_BITS = 4, SUB_BUCKETS = 1 << SUB_BUCKET_BITS, BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS };
+
+    uint32_t counts[BUCKET_COUNT];
+    uint64_t total;
+    uint64_t max_value;
+
+    static int bucketIndex(uint64_t value);
+    static uint64_t bucketUpperBound(int index);
+
+public:
+    LatencyHistogram();
+
+    void record(uint64_t value);
+    void reset();
+    uint64_t count() const;
+    uint64_t max() const;
+    uint64_t percentile(double percent) const;
+};
+
+#endif
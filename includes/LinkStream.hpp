@@ -0,0 +1,51 @@
+#ifndef LINKSTREAM_HPP
+#define LINKSTREAM_HPP
+
+#include <stdint.h>
+#include <string>
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+/*
+ * The zlib streams of a compressed server link. Lines written during a loop
+ * iteration are deflated together and flushed with Z_SYNC_FLUSH, so the peer
+ * can always inflate everything it has received. Built without zlib, no link
+ * is ever compressed and available() says so.
+*/
+class LinkStream {
+private:
+#ifdef HAVE_ZLIB
+    z_stream deflater;
+    z_stream inflater;
+#endif
+    bool valid;
+    std::string pending;
+    uint64_t raw_out;
+    uint64_t wire_out;
+    uint64_t raw_in;
+    uint64_t wire_in;
+
+    LinkStream(const LinkStream&);
+    LinkStream& operator=(const LinkStream&);
+
+public:
+    LinkStream();
+    ~LinkStream();
+
+    static bool available();
+
+    bool isValid() const;
+    void write(const std::string& data);
+    bool hasPending() const;
+    bool flush(std::string& out);
+    bool read(const char* data, size_t length, std::string& out);
+
+    uint64_t getRawOut() const;
+    uint64_t getWireOut() const;
+    uint64_t getRawIn() const;
+    uint64_t getWireIn() const;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef MASKMATCHER_HPP
+#define MASKMATCHER_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * A set of nick!user@host masks compiled for matching. Each mask is filed
+ * under the longer of its literal ends: in a trie of prefixes walked forward
+ * over the subject, or in a trie of suffixes walked backward (the usual
+ * *!*@host ban). Only the masks met along those two walks, plus the few with
+ * no literal end at all, are glob-matched, so a check costs about the length
+ * of the subject rather than the number of masks.
+*/
+class MaskMatcher {
+private:
+    struct Node {
+        std::map<char, uint32_t> children;
+        std::vector<uint32_t> masks;
+    };
+
+    std::vector<std::string> masks;
+    std::vector<Node> prefixes;
+    std::vector<Node> suffixes;
+    std::vector<uint32_t> fallback;
+
+    static void insert(std::vector<Node>& trie, const std::string& key, uint32_t id);
+    bool walk(const std::vector<Node>& trie, const std::string& subject, bool backward) const;
+
+public:
+    MaskMatcher();
+
+    void add(const std::string& mask);
+    void remove(const std::string& mask);
+    void clear();
+    bool matches(const std::string& subject) const;
+    size_t size() const;
+
+    static std::string normalize(const std::string& mask);
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef MESSAGE_HPP
+#define MESSAGE_HPP
+
+#include <string>
+#include <stdint.h>
+
+#define MESSAGE_VARIANTS 4
+
+/* Outbound lanes of a client, control traffic is written before bulk traffic */
+enum OutputLane {
+    LANE_CONTROL,
+    LANE_BULK
+};
+
+/*
+ * A line to deliver along with the tags a recipient may be shown. What a
+ * recipient sees depends only on its server-time and message-tags
+ * capabilities, so a fan-out renders at most MESSAGE_VARIANTS strings,
+ * whatever the number of recipients.
+*/
+class Message {
+private:
+    std::string line;
+    std::string client_tags;
+    uint64_t time_ms;
+
+public:
+    Message(const std::string& line, uint64_t time_ms);
+    Message(const std::string& line, uint64_t time_ms, const std::string& client_tags);
+
+    static unsigned int variant(unsigned int caps);
+    static int lane(const std::string& line);
+    std::string render(unsigned int variant) const;
+    std::string renderFor(unsigned int caps) const;
+
+    const std::string& getLine() const;
+    uint64_t getTime() const;
+};
+
+#endif
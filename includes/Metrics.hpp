@@ -0,0 +1,107 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define METRICS_MAGIC 0x3152544d43524931ULL /* "1IRCMTR1" */
+#define METRICS_VERSION 4
+#define METRICS_CACHE_LINE 64
+#define METRICS_MAX_THREADS 8
+#define METRICS_MAX_VERBS 32
+#define METRICS_VERB_LEN 16
+
+/* Monotonic counters, one copy per thread, summed by the reader */
+enum MetricCounter {
+    METRIC_CONNECTIONS,
+    METRIC_DISCONNECTIONS,
+    METRIC_REGISTRATIONS,
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_COMMANDS,
+    METRIC_BROADCASTS,
+    METRIC_BROADCAST_FANOUT,
+    METRIC_LOOP_ITERATIONS,
+    METRIC_LOOP_WAKEUPS,
+    METRIC_OVERLOAD_TRANSITIONS,
+    METRIC_OVERLOAD_REJECTS,
+    METRIC_ACCEPT_REJECTS,
+    METRIC_TAGMSG_DROPPED,
+    METRIC_TAGMSG_REPLACED,
+    METRIC_COUNTER_COUNT
+};
+
+/* Point in time values, only written by the event loop */
+enum MetricGauge {
+    GAUGE_CLIENTS,
+    GAUGE_CHANNELS,
+    GAUGE_SENDQ_BYTES,
+    GAUGE_SENDQ_MAX,
+    GAUGE_LOOP_LAG_US,
+    GAUGE_READY_LAG_US,
+    GAUGE_ITERATION_US,
+    GAUGE_OVERLOAD_STAGE,
+    GAUGE_THROTTLED_CLIENTS,
+    GAUGE_COUNT
+};
+
+/*
+ * Counters owned by one thread. Each slot fills whole cache lines so two
+ * threads never write to the same line.
+*/
+struct MetricsSlot {
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    uint64_t verbs[METRICS_MAX_VERBS];
+} __attribute__((aligned(METRICS_CACHE_LINE)));
+
+/*
+ * Layout of the shared-memory segment. The server only writes to it, a reader
+ * maps it read-only and never talks to the server.
+*/
+struct MetricsPage {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t thread_count;
+    int64_t pid;
+    uint64_t start_time;
+    uint32_t verb_count;
+    uint32_t reserved;
+    char verb_names[METRICS_MAX_VERBS][METRICS_VERB_LEN];
+    uint64_t gauges[GAUGE_COUNT] __attribute__((aligned(METRICS_CACHE_LINE)));
+    MetricsSlot slots[METRICS_MAX_THREADS];
+};
+
+/* Slot of the calling thread, always valid (a scratch slot until attached) */
+extern __thread MetricsSlot* t_metrics;
+
+/*
+ * Owner side of the metrics segment
+*/
+class Metrics {
+private:
+    std::string name;
+    MetricsPage* page;
+
+    Metrics(const Metrics&);
+    Metrics& operator=(const Metrics&);
+
+public:
+    Metrics();
+    ~Metrics();
+
+    bool open(const std::string& segment_name);
+    void close();
+    bool attachThread();
+    int registerVerb(const std::string& verb);
+
+    void setGauge(MetricGauge gauge, uint64_t value) {
+        if (page) {
+            page->gauges[gauge] = value;
+        }
+    }
+};
+
+std::string metrics_segment_name(int port);
+
+#endif
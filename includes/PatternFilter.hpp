@@ -0,0 +1,73 @@
+#ifndef PATTERNFILTER_HPP
+#define PATTERNFILTER_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#define FILTER_PATTERN_MIN 2
+#define FILTER_PATTERN_MAX 400
+#define FILTER_MAX_STATES (1U << 21)
+#define FILTER_SIMD_STARTS 4
+#define FILTER_SKIP_STARTS 24
+
+/* Actions of a pattern, a higher bit is more severe */
+enum FilterAction {
+    FILTER_TAG = 1,
+    FILTER_REPORT = 2,
+    FILTER_BLOCK = 4
+};
+
+/* Result of a scan: every action hit, and the pattern behind the most severe one, or -1 */
+struct FilterMatch {
+    unsigned int actions;
+    int pattern;
+};
+
+/*
+ * A pattern set compiled into an Aho-Corasick automaton. Patterns match as
+ * substrings, ignoring ASCII case. Bytes are mapped to classes first, and all
+ * the bytes no pattern uses share class 0. The transition table is therefore
+ * states x classes and stays small. A scan costs one lookup per byte, whatever
+ * the number of patterns. A filter is never modified once built, a new pattern
+ * set is compiled into a new filter.
+*/
+class PatternFilter {
+private:
+    std::vector<std::string> patterns;
+    std::vector<unsigned char> pattern_actions;
+    unsigned char classes[256];
+    bool starts[256];
+    unsigned char start_bytes[FILTER_SIMD_STARTS];
+    size_t start_count;
+    size_t class_count;
+    std::vector<uint32_t> delta;
+    std::vector<unsigned char> state_actions;
+    std::vector<int32_t> state_pattern;
+
+    PatternFilter(const PatternFilter&);
+    PatternFilter& operator=(const PatternFilter&);
+
+    void inherit(uint32_t state, uint32_t from);
+    const unsigned char* skipToStart(const unsigned char* byte, const unsigned char* end) const;
+
+public:
+    PatternFilter();
+
+    static bool parseActions(const std::string& text, unsigned int& actions);
+    static std::string actionNames(unsigned int actions);
+
+    bool load(const std::string& path, std::string& error);
+    bool add(const std::string& pattern, unsigned int actions);
+    bool build(std::string& error);
+    FilterMatch scan(const char* data, size_t length) const;
+
+    const std::string& getPattern(int index) const;
+    unsigned int getPatternActions(int index) const;
+    size_t getPatternCount() const;
+    size_t getStateCount() const;
+    size_t getClassCount() const;
+    size_t getMemoryUsage() const;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef PLUGINAPI_HPP
+#define PLUGINAPI_HPP
+
+/*
+ * ABI between ircserv and in-process service plugins. A plugin is a shared
+ * object exporting irc_plugin_entry(), listed in ircserv.conf as
+ * "plugin = <path> [args]". It only sees the plain C structures below, so it
+ * can be built with any compiler and does not depend on server internals.
+ *
+ * Every plugin is a service: it sends as "<name>!service@<server>", and
+ * private messages to <name> reach it as IRC_EVENT_PRIVATE. Callbacks run on
+ * the event loop and must return within PLUGIN_CALLBACK_BUDGET_US, or the
+ * plugin is disabled after PLUGIN_MAX_OVERRUNS overruns in a row. A plugin
+ * with IRC_PLUGIN_THREADED gets a thread of its own instead, fed through a
+ * queue; the api functions may then be called from that thread.
+*/
+
+#define IRC_PLUGIN_API_VERSION 1
+#define IRC_PLUGIN_ENTRY "irc_plugin_entry"
+
+#define IRC_PLUGIN_THREADED 1
+
+enum irc_event_type {
+    IRC_EVENT_MESSAGE = 1,      // PRIVMSG to a channel
+    IRC_EVENT_PRIVATE = 2,      // PRIVMSG to the plugin
+    IRC_EVENT_JOIN = 4,
+    IRC_EVENT_PART = 8
+};
+
+struct irc_event {
+    int type;
+    const char* nick;
+    const char* mask;           // nick!user@host
+    const char* account;        // Empty if not logged in
+    const char* channel;        // Empty for IRC_EVENT_PRIVATE
+    const char* text;           // Message text or part reason
+    unsigned long long time_ms;
+};
+
+struct irc_server_api {
+    unsigned int version;
+    void* handle;               // Pass back as the first argument of the functions below
+
+    // Send to a channel or a nickname, return 0 on success and -1 if the target does not exist
+    int (*privmsg)(void* handle, const char* target, const char* text);
+    int (*notice)(void* handle, const char* target, const char* text);
+    void (*log)(void* handle, const char* text);
+};
+
+struct irc_plugin {
+    unsigned int version;       // IRC_PLUGIN_API_VERSION
+    const char* name;           // Also the service nickname
+    unsigned int events;        // Mask of irc_event_type to receive
+    unsigned int flags;         // IRC_PLUGIN_THREADED or 0
+
+    // Return the plugin state, or NULL to refuse loading. api stays valid until shutdown.
+    void* (*init)(const irc_server_api* api, const char* args);
+    void (*on_event)(void* state, const irc_event* event);
+    void (*shutdown)(void* state);
+};
+
+extern "C" {
+    typedef const irc_plugin* (*irc_plugin_entry_fn)(void);
+}
+
+#endif
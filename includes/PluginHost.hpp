@@ -0,0 +1,94 @@
+#ifndef PLUGINHOST_HPP
+#define PLUGINHOST_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "PluginApi.hpp"
+
+class Server;
+class WorkerPool;
+class PluginHost;
+
+// An event with its own copies of the strings, so it can wait in a plugin queue
+struct PluginEvent {
+    int type;
+    std::string nick;
+    std::string mask;
+    std::string account;
+    std::string channel;
+    std::string text;
+    uint64_t time_ms;
+};
+
+struct LoadedPlugin {
+    PluginHost* host;
+    std::string path;
+    std::string name;
+    void* library;
+    const irc_plugin* plugin;
+    void* state;
+    irc_server_api api;
+    bool disabled;
+    unsigned int overrun_streak;
+    uint64_t calls;
+    uint64_t overruns;
+    uint64_t dropped;
+
+    // Only used with IRC_PLUGIN_THREADED
+    bool threaded;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    std::deque<PluginEvent> queue;
+    bool stopping;
+};
+
+/*
+ * Loads service plugins (see PluginApi.hpp) and feeds them events. Loop
+ * plugins are called inline and timed; threaded plugins get the event in
+ * their queue, and what they send comes back to the loop as a WorkerJob.
+*/
+class PluginHost {
+private:
+    Server* server;
+    WorkerPool* workers;
+    std::vector<LoadedPlugin*> plugins;
+    std::map<std::string, LoadedPlugin*> services;  // Lowercase name to plugin
+    unsigned int event_mask;                        // Union of the events wanted by enabled plugins
+
+    PluginHost(const PluginHost&);
+    PluginHost& operator=(const PluginHost&);
+
+    static void* threadMain(void* arg);
+    static int apiPrivmsg(void* handle, const char* target, const char* text);
+    static int apiNotice(void* handle, const char* target, const char* text);
+    static void apiLog(void* handle, const char* text);
+    static int apiSend(void* handle, const char* command, const char* target, const char* text);
+
+    void deliver(LoadedPlugin* loaded, const PluginEvent& event);
+    void call(LoadedPlugin* loaded, const PluginEvent& event);
+    void unload(LoadedPlugin* loaded);
+    void updateMask();
+
+public:
+    PluginHost();
+    ~PluginHost();
+
+    void attach(Server* server, WorkerPool* workers);
+    bool load(const std::string& spec, std::string& error);
+    void unloadAll();
+
+    bool wants(int type) const;
+    bool isService(const std::string& nick) const;
+    void dispatch(const PluginEvent& event);
+    bool deliverPrivate(const std::string& service, const PluginEvent& event);
+    const std::vector<LoadedPlugin*>& getPlugins() const;
+    uint64_t getCalls(LoadedPlugin* loaded) const;
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef PROBES_HPP
+#define PROBES_HPP
+
+/*
+ * USDT tracepoints of the "ircserv" provider. With <sys/sdt.h> available the
+ * Makefile defines HAVE_SYS_SDT_H and every probe is a single nop plus an ELF
+ * note that bpftrace/perf can attach to; without it the probes compile away.
+ *
+ *   accept(fd)                        new client socket
+ *   recv(fd, bytes)                   bytes read from a client
+ *   command_parsed(fd, verb, args_len)
+ *   command_start(fd, verb)           around the handler in process_command
+ *   command_done(fd, verb)
+ *   broadcast(channel, fanout)        Channel::broadcast
+ *   enqueue(fd, bytes, sendq_bytes)   message added to a SendQ
+ *   flush(fd, sent, sendq_bytes)      SendQ written to the socket
+ *   close(fd)                         client closed
+*/
+#ifdef HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+# define IRC_PROBE1(name, a) DTRACE_PROBE1(ircserv, name, a)
+# define IRC_PROBE2(name, a, b) DTRACE_PROBE2(ircserv, name, a, b)
+# define IRC_PROBE3(name, a, b, c) DTRACE_PROBE3(ircserv, name, a, b, c)
+#else
+# define IRC_PROBE1(name, a) do {} while (0)
+# define IRC_PROBE2(name, a, b) do {} while (0)
+# define IRC_PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef SEARCHINDEX_HPP
+#define SEARCHINDEX_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * Inverted index over the channel log files. A thread tails every .log in the
+ * log directory and indexes new records in batches, so the loop never
+ * tokenizes; the index is rebuilt from the logs on startup. A document is the
+ * offset of its record in the log, so a hit is read back with ChannelLogReader
+ * and a time range becomes an offset range through the log's time index.
+*/
+class SearchIndex {
+private:
+    struct PostingList {
+        std::string deltas;                                  // Varint gaps between record offsets
+        std::vector<std::pair<uint64_t, uint32_t> > skips;   // Offset before each block of SEARCH_SKIP_INTERVAL, and where it starts
+        uint64_t last;
+        uint32_t count;
+
+        PostingList() : last(0), count(0) {}
+    };
+
+    struct ChannelIndex {
+        std::map<std::string, PostingList> terms;
+        uint64_t records;
+
+        ChannelIndex() : records(0) {}
+    };
+
+    class Cursor;
+
+    // Set while the thread is stopped
+    std::string dir;
+    bool running;
+
+    // Shared, under lock
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stopping;
+    std::map<std::string, ChannelIndex> channels;
+
+    // Indexer thread only
+    pthread_t thread;
+    std::map<std::string, uint64_t> progress;
+
+    SearchIndex(const SearchIndex&);
+    SearchIndex& operator=(const SearchIndex&);
+
+    static void* threadMain(void* arg);
+    void work();
+    void indexFile(const std::string& path);
+    static void addPosting(PostingList& list, uint64_t offset);
+
+public:
+    SearchIndex();
+    ~SearchIndex();
+
+    void configure(const std::string& dir);
+    void stop();
+    bool search(const std::string& log_path, const std::vector<std::string>& terms, uint64_t min_offset, uint64_t max_offset,
+                size_t keep, std::vector<uint64_t>& offsets);
+    void getStats(uint64_t& records, uint64_t& terms, uint64_t& bytes);
+
+    static void tokenize(const char* text, size_t length, std::vector<std::string>& terms);
+};
+
+#endif
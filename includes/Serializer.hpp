@@ -0,0 +1,74 @@
+#ifndef SERIALIZER_HPP
+#define SERIALIZER_HPP
+
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+/*
+ * Helpers for the binary formats written by the server (snapshots, hot upgrade
+ * state). Values are stored in host byte order: the files never leave the host.
+*/
+inline void put_u16(std::string& out, uint16_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void put_u32(std::string& out, uint32_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void put_u64(std::string& out, uint64_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void put_string(std::string& out, const std::string& str) {
+    uint16_t len = str.size() > 0xffff ? 0xffff : static_cast<uint16_t>(str.size());
+    put_u16(out, len);
+    out.append(str.data(), len);
+}
+
+inline void put_blob(std::string& out, const std::string& blob) {
+    put_u32(out, static_cast<uint32_t>(blob.size()));
+    out.append(blob);
+}
+
+/*
+ * Bounds-checked reader, every getter fails once the input is exhausted.
+*/
+struct ByteReader {
+    const char* cur;
+    const char* end;
+
+    ByteReader(const char* data, size_t size) : cur(data), end(data + size) {}
+
+    bool read(void* dst, size_t size) {
+        if (static_cast<size_t>(end - cur) < size) {
+            return false;
+        }
+        std::memcpy(dst, cur, size);
+        cur += size;
+        return true;
+    }
+
+    bool readString(std::string& str) {
+        uint16_t len;
+        if (!read(&len, sizeof(len)) || static_cast<size_t>(end - cur) < len) {
+            return false;
+        }
+        str.assign(cur, len);
+        cur += len;
+        return true;
+    }
+
+    bool readBlob(std::string& blob) {
+        uint32_t len;
+        if (!read(&len, sizeof(len)) || static_cast<size_t>(end - cur) < len) {
+            return false;
+        }
+        blob.assign(cur, len);
+        cur += len;
+        return true;
+    }
+};
+
+#endif
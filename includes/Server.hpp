@@ -2,12 +2,85 @@
 #define SERVER_HPP
 
 #include "Channel.hpp"
+#include "ChannelSnapshot.hpp"
+#include "LatencyHistogram.hpp"
+#include <deque>
+#include <set>
+
+struct ListQuery {
+    std::vector<std::string> masks;
+    long min_users;
+    long max_users;
+    long topic_newer_than;
+    long topic_older_than;
+    std::string cursor;
+    bool started;
+
+    ListQuery();
+};
+
+struct LinkInfo {
+    std::string sid;
+    std::string name;
+    std::string peer;       // The [link] section it connects to or authenticated as
+    bool outgoing;
+    bool authenticated;
+    bool established;
+    bool offered_zip;       // Our CAPAB offered compression
+    bool peer_zip;          // The peer's CAPAB offered it
+    LinkStream* stream;     // Set once both sides compress, owned, freed when the link is lost
+
+    LinkInfo();
+};
+
+enum OverloadStage {
+    OVERLOAD_NONE,
+    OVERLOAD_DEFER_ACCEPT,
+    OVERLOAD_THROTTLE,
+    OVERLOAD_REJECT
+};
+
+struct SlowCommand {
+    time_t time;
+    std::string verb;
+    size_t args_length;
+    long channel_size;
+    double duration_us;
+};
+
+/*
+ * A registered client whose connection dropped. It stays in its channels and
+ * keeps receiving into its SendQ until it resumes or the grace period ends.
+*/
+struct ResumeSession {
+    Client client;
+    time_t expires;
+
+    ResumeSession(const Client& client, time_t expires);
+};
+
+/*
+ * A configured link: where its host resolves to, and the connection to it if
+ * there is one. Incoming links are only accepted from those addresses.
+*/
+struct LinkPeer {
+    LinkBlock block;
+    std::vector<PeerAddress> addresses;
+    time_t resolved_at;     // 0 until host has resolved once
+    bool resolving;
+    int fd;
+    time_t next_attempt;
+    int backoff;
+
+    LinkPeer();
+};
 
 class Server {
 private:
     int server_fd;
-    std::string clientInput;
     std::string password;
+    const ServerConfig* config;
+    std::string config_path;
     std::vector<struct pollfd> poll_fds;
     std::map<int, Client> clients;
     std::map<std::string, Channel> channels;
@@ -15,17 +88,81 @@ private:
     std::string server_version;
     std::string server_creation_date;
     bool requires_password;
+    std::map<int, ListQuery> pending_lists;
+    size_t history_max_lines;
+    size_t history_max_bytes;
+    ChannelSnapshot snapshot;
+    Metrics metrics;
+    WorkerPool workers;
+    PluginHost plugins;
+    ChannelLog channel_log;
+    SearchIndex search_index;
+    HostCache host_cache;
+    std::map<std::string, std::vector<int> > pending_lookups;
+    std::map<int, uint64_t> lookup_deadlines;
+    uint64_t resolve_deadline_ms;
+    std::string accounts_path;
+    std::map<std::string, std::string> accounts;
+    std::string dummy_password_hash;
+    std::string snapshot_path;
+    time_t next_snapshot_time;
+    pid_t snapshot_pid;
+    std::vector<std::string> upgrade_argv;
+    std::string sid;
+    std::map<int, LinkInfo> links;
+    std::vector<LinkPeer> link_peers;
+    std::map<std::string, Client> remote_clients;
+    std::map<std::string, Client*> clients_by_uid;
+    std::map<std::string, ResumeSession> detached_sessions;
+    PatternFilter* message_filter;
+    uint64_t filter_generation;
+    uint64_t filter_scanned_bytes;
+    uint64_t filter_scan_cycles;
+    uint64_t filter_hits[3];
 
     void complete_registration(int client_fd);
+    void initialize_server(int port);
+    void apply_config();
+    void load_plugins();
+    PluginEvent make_plugin_event(int type, const Client& client, const std::string& channel, const std::string& text) const;
+    void reload_config();
+    const ConnectionClass& client_class(const Client& client) const;
+    void check_client_timeouts(time_t now);
+    void drop_client(int client_fd, const std::string& reason, bool resumable = false);
+    void send_welcome(int client_fd);
+    bool detach_session(Client& client);
+    void end_session(std::map<std::string, ResumeSession>::iterator session, const std::string& reason);
+    void expire_sessions(time_t now);
+    Client* find_detached_client(const std::string& nickname);
+    void rebuild_filter();
+    bool filter_message(int client_fd, const std::string& target, const std::string& text, std::string& tags);
 
     typedef void (Server::*CommandHandler)(int client_fd, const std::string& args);
     std::map<std::string, CommandHandler> command_map;
+    std::string message_tags;
+    std::map<std::string, int> command_verbs;
+    std::vector<LatencyHistogram> command_latency;
+    unsigned int latency_sample_rate;
+    unsigned int latency_countdown;
+    double slowlog_threshold_us;
+    std::deque<SlowCommand> slowlog;
+    int overload_stage;
+    time_t overload_changed;
+    double loop_lag_us;
+    double lag_thresholds_us[OVERLOAD_REJECT + 1];
+    std::set<int> throttled_fds;
+    time_t next_load_decay;
+    AddressTable address_table;
+    time_t next_address_sweep;
 
     void initialize_command_map();
 
     void handle_new_connection();
     void handle_client_data(size_t i);
-    void close_client(int i);
+    void close_client(int i, bool resumable = false);
+    void disconnect_client(int client_fd, bool resumable = false);
+    bool flush_client(size_t i);
+    void send_to_client(int client_fd, const std::string& msg);
 
     void parse_command(const std::string& input, std::string& command, std::string& args);
     void process_command(int client_fd, const std::string& command, const std::string& args);
@@ -35,6 +172,7 @@ private:
     void handle_user(int client_fd, const std::string& args);
     void handle_join(int client_fd, const std::string& args);
     void handle_privmsg(int client_fd, const std::string& args);
+    void handle_tagmsg(int client_fd, const std::string& args);
     void handle_pass(int client_fd, const std::string& args);
     void handle_quit(int client_fd, const std::string& args);
     void handle_part(int client_fd, const std::string& args);
@@ -51,22 +189,112 @@ private:
     void handle_topic(int client_fd, const std::string& args);
     void handle_mode(int client_fd, const std::string& args);
     void handle_who(int client_fd, const std::string& args);
+    void handle_list(int client_fd, const std::string& args);
+    void handle_chathistory(int client_fd, const std::string& args);
+    void handle_chanlog(int client_fd, const std::string& args);
+    void handle_search(int client_fd, const std::string& args);
+    void handle_stats(int client_fd, const std::string& args);
+    void handle_authenticate(int client_fd, const std::string& args);
+    void handle_resume(int client_fd, const std::string& args);
+
+    void replay_history(Client& client, const std::string& target, const ChannelHistory& history, size_t begin, size_t end);
+    void report_history_stats(int client_fd);
+    void record_command_latency(int verb_index, const std::string& command, const std::string& args, uint64_t cycles);
+    void report_latency_stats(int client_fd);
+    void report_slowlog(int client_fd);
+    void report_log_stats(int client_fd);
+    void report_plugin_stats(int client_fd);
+    void report_filter_stats(int client_fd);
+    void report_link_stats(int client_fd);
+
+    bool parse_list_filter(const std::string& token, ListQuery& query);
+    bool list_entry_matches(const ListQuery& query, const Channel& channel, time_t now);
+    void send_list_entry(int client_fd, const Channel& channel);
+    bool continue_list(int client_fd, ListQuery& query);
+    void process_pending_lists();
+    bool has_runnable_lists();
+
+    int compute_poll_timeout();
+    void run_timers();
+    void update_loop_lag(uint64_t iteration_cycles, uint64_t ready_cycles);
+    void select_throttled_clients();
+    void reject_connection(int fd, const char* message, size_t length);
+
+    void start_host_lookup(int client_fd, bool announce);
+    void apply_host_lookup(int client_fd, const std::string& host, bool announce);
+    void expire_host_lookups();
+    void forget_host_lookup(int client_fd);
+    void process_worker_completions();
+    void load_accounts();
+    void verify_sasl_plain(int client_fd, const std::string& payload);
+    void abort_sasl(int client_fd, const std::string& numeric, const std::string& reason);
+    void fail_sasl(int client_fd);
+    bool restore_channel(const std::string& channel_name);
+    void start_background_snapshot();
+    void reap_snapshot_writer(bool wait);
+    bool save_snapshot();
+
+    bool hot_upgrade();
+    std::string serialize_state(std::vector<int>& fds);
+    bool restore_state(const std::string& state, const std::vector<int>& fds);
+    void receive_handoff(int handoff_fd);
+
+    std::string make_uid(uint32_t id) const;
+    bool is_link_handshake(const std::string& line) const;
+    void sync_link_peers();
+    LinkPeer* find_link_peer(const std::string& name);
+    void resolve_link_peer(LinkPeer& peer);
+    void connect_to_peer(LinkPeer& peer);
+    void reject_link(int link_fd, const std::string& reason);
+    void send_link_handshake(int link_fd);
+    void start_link_compression(int link_fd);
+    void flush_link_streams();
+    void send_burst(int link_fd);
+    std::string make_uid_line(const Client& client) const;
+    std::string make_sjoin_line(const Channel& channel, int except_fd) const;
+    void broadcast_to_links(const std::string& line, int except_fd);
+    void route_to_channel_links(Channel& channel, const std::string& line, int except_fd);
+    void propagate_channel_mode(int client_fd, const Channel& channel, const std::string& change, const std::string& param);
+    void process_link_message(int link_fd, const std::string& line);
+    void handle_link_handshake(int link_fd, const std::string& command, const std::vector<std::string>& params);
+    void link_uid(int link_fd, const std::string& prefix, const std::vector<std::string>& params);
+    void link_join(int link_fd, const std::vector<std::string>& members, const std::string& channel_name, time_t ts, const std::vector<std::string>& modes);
+    void link_part(int link_fd, const std::string& prefix, const std::vector<std::string>& params);
+    void link_privmsg(int link_fd, const std::string& prefix, const std::vector<std::string>& params);
+    void link_nick(int link_fd, const std::string& prefix, const std::vector<std::string>& params);
+    void link_kill(int link_fd, const std::vector<std::string>& params);
+    void link_kick(int link_fd, const std::string& prefix, const std::vector<std::string>& params);
+    void link_topic(int link_fd, const std::string& prefix, const std::vector<std::string>& params, bool burst);
+    void link_tmode(int link_fd, const std::string& prefix, const std::vector<std::string>& params);
+    void link_bmask(int link_fd, const std::vector<std::string>& params);
+    void remove_remote_client(const std::string& uid, const std::string& reason);
+    void handle_link_lost(int link_fd);
+    void propagate_local_quit(Client& client, const std::string& reason);
 
     void handle_invite_only_mode(int client_fd, Channel& channel, bool adding_mode);
     void handle_channel_key_mode(int client_fd, Channel& channel, bool adding_mode, const std::string& parameters);
     void handle_operator_mode(int client_fd, Channel& channel, bool adding_mode, const std::string& parameters);
     void handle_topic_restriction_mode(int client_fd, Channel& channel, bool adding_mode);
     void handle_user_limit_mode(int client_fd, Channel& channel, bool adding_mode, const std::string& parameters);
+    void handle_mask_list_mode(int client_fd, Channel& channel, char flag, bool adding_mode, const std::string& parameters);
+    void send_mask_list(int client_fd, Channel& channel, char flag);
 
     bool already_taken_nickname(const std::string& nickname);
 
 public:
     Server(int port, const std::string& password);
+    Server(int port, const std::string& password, int handoff_fd);
     ~Server();
 
     void run();
 
     void send_ping(int client_fd);
+    void set_upgrade_command(int argc, char** argv);
+    void finish_link_resolve(const std::string& name, const std::string& host, const std::vector<PeerAddress>& addresses);
+    void finish_host_lookup(const PeerAddress& address, const std::string& host);
+    void finish_sasl(int client_fd, uint32_t client_id, const std::string& account, bool accepted);
+    void install_filter(uint64_t generation, PatternFilter* filter, const std::string& path, const std::string& error, uint64_t build_ms);
+    bool send_service_message(const std::string& service, const std::string& command, const std::string& target, const std::string& text);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef SHA256_HPP
+#define SHA256_HPP
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+/*
+ * SHA-256 (FIPS 180-4), used for account password hashes
+*/
+class Sha256 {
+private:
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[SHA256_BLOCK_SIZE];
+    size_t used;
+
+    void compress(const uint8_t* data);
+
+public:
+    Sha256();
+
+    void update(const void* data, size_t size);
+    void final(uint8_t digest[SHA256_DIGEST_SIZE]);
+};
+
+void hmac_sha256(const std::string& key, const void* data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]);
+std::string pbkdf2_sha256(const std::string& password, const std::string& salt, uint32_t iterations, size_t length);
+
+#endif
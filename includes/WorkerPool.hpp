@@ -0,0 +1,56 @@
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+class Server;
+class Metrics;
+
+/*
+ * A unit of blocking work. run() is called on a worker thread and must not
+ * touch server state; complete() is called back on the event loop.
+*/
+class WorkerJob {
+public:
+    virtual ~WorkerJob() {}
+    virtual void run() = 0;
+    virtual void complete(Server& server) = 0;
+};
+
+/*
+ * Fixed pool of threads running WorkerJobs. Finished jobs are queued and the
+ * event loop is woken through an eventfd it polls.
+*/
+class WorkerPool {
+private:
+    std::vector<pthread_t> threads;
+    std::deque<WorkerJob*> pending;
+    std::deque<WorkerJob*> completed;
+    pthread_mutex_t lock;
+    pthread_cond_t has_work;
+    int event_fd;
+    bool stopping;
+    Metrics* metrics;
+
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    static void* threadMain(void* arg);
+    void work();
+
+public:
+    WorkerPool();
+    ~WorkerPool();
+
+    bool start(size_t thread_count, Metrics* metrics);
+    void stop();
+    void submit(WorkerJob* job);
+    void post(WorkerJob* job);
+    void takeCompleted(std::vector<WorkerJob*>& jobs);
+    int getEventFd() const;
+    size_t backlog();
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef BOTPLUGIN_HPP
+#define BOTPLUGIN_HPP
+
+#include <string>
+#include <ctime>
+
+class Bot;
+class CommandRegistry;
+struct LookupResult;
+
+/*
+ * A "!command" addressed to the bot, as handed to the plugin that registered it
+*/
+struct CommandContext {
+    std::string sender;     // Nickname of the user who typed the command
+    std::string target;     // Where the reply goes: the channel, or the sender for a private message
+    std::string channel;    // The channel, empty for a private message
+    std::string command;    // Lowercase command name, without the '!'
+    std::string args;       // Everything after the command name, trimmed
+    int id;                 // The id the plugin gave the command when registering it
+};
+
+/*
+ * Bot functionality lives in plugins: a plugin registers its commands into
+ * the registry once, then receives the commands and events it asked for.
+ * The bot owns its plugins and deletes them on exit.
+*/
+class BotPlugin {
+public:
+    virtual ~BotPlugin() {}
+
+    virtual const char* name() const = 0;
+    virtual void registerCommands(CommandRegistry& registry) = 0;
+    virtual void handleCommand(Bot& bot, const CommandContext& ctx) = 0;
+
+    // Optional events, the defaults ignore them
+    virtual void onJoin(Bot& bot, const std::string& channel) { (void)bot; (void)channel; }
+    virtual void onMessage(Bot& bot, const std::string& sender, const std::string& channel, const std::string& text) {
+        (void)bot; (void)sender; (void)channel; (void)text;
+    }
+    virtual void onTick(Bot& bot, time_t now) { (void)bot; (void)now; }
+    // The answer to a Bot::lookup, with the context given when asking
+    virtual void onLookup(Bot& bot, const CommandContext& ctx, const LookupResult& result) {
+        (void)bot; (void)ctx; (void)result;
+    }
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef COMMANDREGISTRY_HPP
+#define COMMANDREGISTRY_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class BotPlugin;
+
+struct CommandEntry {
+    std::string name;
+    std::string help;
+    BotPlugin* plugin;
+    int id;
+    uint32_t hash;
+};
+
+/*
+ * Maps command names to the plugins that handle them. An open addressing table
+ * keyed by the FNV-1a hash of the lowercase name, so dispatching a line costs one
+ * hash and usually one string comparison, however many commands are registered.
+*/
+class CommandRegistry {
+private:
+    std::vector<CommandEntry> _entries;     // In registration order, for !help
+    std::vector<int> _slots;                // Index into _entries, -1 when empty
+    size_t _mask;
+
+    void rehash(size_t capacity);
+
+public:
+    CommandRegistry();
+
+    static uint32_t hash(const std::string& name);
+
+    bool add(const std::string& name, BotPlugin* plugin, int id, const std::string& help);
+    const CommandEntry* find(const std::string& name) const;
+    const std::vector<CommandEntry>& entries() const;
+};
+
+#endif
@@ -8,14 +8,54 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <poll.h>
+#include <signal.h>
 #include <map>
+#include <vector>
 #include <cstdlib>
 #include <cerrno>
+#include <ctime>
+#include <stdint.h>
 
-// Structure for trivia questions
-struct TriviaQuestion {
-    std::string question;
-    std::string answer;
+#include "bot/IrcMessage.hpp"
+#include "bot/BotPlugin.hpp"
+#include "bot/CommandRegistry.hpp"
+#include "bot/LookupService.hpp"
+
+#define BOT_COMMAND_PREFIX '!'
+#define BOT_BACKOFF_MIN 1           // Seconds before the first reconnection attempt
+#define BOT_BACKOFF_MAX 60          // Cap of the exponential backoff
+#define BOT_CONNECT_TIMEOUT 10      // Seconds allowed for connect() and registration
+#define BOT_TICK_INTERVAL 1         // Seconds between two onTick calls
+#define BOT_SENDQ_MAX 65536         // Bytes queued before the connection is considered stuck
+
+#define BOT_TRIVIA_PATH "trivia.txt"
+#define BOT_SCORES_PATH "trivia.scores"
+#define TRIVIA_ROUND_TIMEOUT 60     // Seconds before an unanswered question is revealed
+#define TRIVIA_SAVE_INTERVAL 10     // Seconds between two scoreboard writes
+#define TRIVIA_TOP_DEFAULT 5
+#define TRIVIA_TOP_MAX 10
+
+#define BOT_LOOKUP_WORKERS 2
+#define BOT_LOOKUP_TIMEOUT_MS 5000  // Hard limit of an external lookup, resolution included
+#define BOT_WEATHER_URL "http://wttr.in/%s?format=3"
+#define BOT_WEATHER_TTL 600
+#define BOT_CRYPTO_URL "http://api.coincap.io/v2/assets/%s"
+#define BOT_CRYPTO_TTL 30
+
+extern volatile sig_atomic_t g_bot_stop;
+
+enum BotState {
+    BOT_DISCONNECTED,   // Waiting for the next attempt
+    BOT_CONNECTING,     // Non-blocking connect() in progress
+    BOT_REGISTERING,    // PASS/NICK/USER sent, waiting for 001
+    BOT_READY           // Registered, channels joined
+};
+
+// Per-channel state kept across reconnections
+struct BotChannel {
+    std::string name;
+    bool joined;
+    time_t joined_at;
 };
 
 class Bot {
@@ -24,31 +64,55 @@ private:
     std::string _server;
     int _port;
     std::string _nickname;
-    std::string _channel;
+    std::string _current_nick;
     std::string _password;
-    struct pollfd _pfd;
-    // map of trivia questions
-    std::map<std::string, std::string> _triviaQuestions;
-    int _current_question_index;
+    std::map<std::string, BotChannel> _channels;   // Keyed by lowercase name
+    std::vector<BotPlugin*> _plugins;
+    CommandRegistry _commands;
+    LookupService _lookups;
 
-    void send_msg(const std::string& msg);
-    void handle_server_message(const std::string& message);
+    BotState _state;
+    std::string _recvq;
+    std::string _sendq;
+    time_t _next_attempt;
+    time_t _state_deadline;
+    time_t _next_tick;
+    unsigned int _backoff;
+    uint64_t _connect_started_ms;
+
+    bool start_connect();
+    void on_connected();
+    void disconnect(const std::string& reason);
+    void schedule_reconnect();
+    bool flush();
+    bool read_lines();
+    int poll_timeout(time_t now) const;
+
+    void handle_server_message(const std::string& line);
+    void handle_privmsg(const IrcMessage& msg);
+    void join_channels();
 
 public:
-    Bot(const std::string& server, int port, const std::string& nickname, const std::string& password, const std::string& channel);
-    Bot();
+    Bot(const std::string& server, int port, const std::string& nickname, const std::string& password, const std::vector<std::string>& channels);
     ~Bot();
 
-    bool connect_to_server();
+    void add_plugin(BotPlugin* plugin);
     void run();
 
-    void initialize_trivia();
-    void ask_trivia_question();
-    void check_trivia_answer(const std::string& user_answer);
-
-    void fetch_weather(const std::string& location);
-    void fetch_crypto_price(const std::string& crypto_symbol);
-    
+    void send_msg(const std::string& msg);
+    void reply(const CommandContext& ctx, const std::string& text);
+    void lookup(BotPlugin* plugin, const CommandContext& ctx, const std::string& key, const std::string& url, unsigned int ttl);
+    const std::string& get_nickname() const;
+    const CommandRegistry& get_commands() const;
+    const BotChannel* find_channel(const std::string& name) const;
 };
 
+std::string bot_lowercase(const std::string& text);
+uint64_t bot_time_ms();
+
+// Built-in plugins, defined in bot.cpp
+BotPlugin* make_core_plugin();
+BotPlugin* make_trivia_plugin();
+BotPlugin* make_web_plugin();
+
 #endif // BOT_HPP
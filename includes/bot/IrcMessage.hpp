@@ -0,0 +1,22 @@
+#ifndef IRCMESSAGE_HPP
+#define IRCMESSAGE_HPP
+
+#include <string>
+#include <vector>
+
+/*
+ * One line from the server, split as in RFC 1459 section 2.3.1:
+ * [":" prefix " "] command {" " param} [" :" trailing]
+ * The trailing parameter is stored as the last element of params.
+*/
+struct IrcMessage {
+    std::string prefix;
+    std::string command;
+    std::vector<std::string> params;
+
+    bool parse(const std::string& line);
+    std::string nick() const;
+    const std::string& param(size_t index) const;
+};
+
+#endif
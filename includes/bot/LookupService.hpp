@@ -0,0 +1,95 @@
+#ifndef LOOKUPSERVICE_HPP
+#define LOOKUPSERVICE_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <ctime>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "bot/BotPlugin.hpp"
+
+class Bot;
+
+struct LookupResult {
+    bool ok;                // True for a 2xx answer
+    int status;             // HTTP status, 0 if no answer was received
+    std::string body;
+    std::string error;      // Why the lookup failed, empty on success
+};
+
+/*
+ * HTTP GETs for the bot, run on a few worker threads so the event loop never
+ * waits on the network. Results wake the loop through an eventfd and are
+ * handed back with BotPlugin::onLookup. Answers are cached by key for the TTL
+ * the caller gives, and a request for a key already in flight just joins the
+ * waiters of the first one. The deadline is enforced by the loop, so a worker
+ * stuck in the resolver still cannot hold a command past it.
+*/
+class LookupService {
+private:
+    struct Job {
+        uint32_t id;
+        std::string key;
+        std::string url;
+        uint64_t deadline_ms;
+        LookupResult result;
+    };
+
+    struct Waiter {
+        BotPlugin* plugin;
+        CommandContext ctx;
+    };
+
+    struct Pending {
+        uint32_t id;
+        uint64_t deadline_ms;
+        unsigned int ttl;
+        std::vector<Waiter> waiters;
+    };
+
+    struct CacheEntry {
+        LookupResult result;
+        time_t expires;
+    };
+
+    std::map<std::string, Pending> _pending;
+    std::map<std::string, CacheEntry> _cache;
+    uint32_t _next_id;
+
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+    std::deque<Job*> _queue;    // Waiting for a worker
+    std::deque<Job*> _done;     // Waiting for the loop
+    std::vector<pthread_t> _threads;
+    int _eventfd;
+    bool _stopping;
+
+    static void* worker_main(void* arg);
+    void worker_loop();
+    void finish(Bot& bot, const std::string& key, const LookupResult& result);
+    void store(const std::string& key, const LookupResult& result, unsigned int ttl);
+
+    LookupService(const LookupService&);
+    LookupService& operator=(const LookupService&);
+
+public:
+    LookupService();
+    ~LookupService();
+
+    bool start(size_t workers);
+    void stop();
+    int get_fd() const;
+
+    void request(Bot& bot, BotPlugin* plugin, const CommandContext& ctx, const std::string& key, const std::string& url, unsigned int ttl);
+    void complete(Bot& bot);
+    void expire(Bot& bot, uint64_t now_ms);
+    uint64_t next_deadline() const;
+};
+
+bool http_get(const std::string& url, uint64_t deadline_ms, LookupResult& result);
+std::string url_encode(const std::string& text);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SCOREBOARD_HPP
+#define SCOREBOARD_HPP
+
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+
+/*
+ * Trivia points per player, saved to a file. Scores are kept twice: by
+ * name for updates, and in a set ordered by score for the ranking, so a
+ * point costs O(log n) and the top N are the first N elements of the set.
+*/
+class Scoreboard {
+private:
+    typedef std::pair<unsigned long, std::string> Rank;   // Score, then lowercase name
+
+    struct ByScore {
+        bool operator()(const Rank& a, const Rank& b) const {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        }
+    };
+
+    std::string _path;
+    std::map<std::string, std::pair<std::string, unsigned long> > _players;   // Lowercase name to display name and score
+    std::set<Rank, ByScore> _ranking;
+    bool _dirty;
+
+    void set_score(const std::string& name, unsigned long score);
+
+public:
+    explicit Scoreboard(const std::string& path);
+
+    void load();
+    bool save();
+    bool is_dirty() const;
+
+    unsigned long add(const std::string& name, unsigned long points);
+    unsigned long score(const std::string& name) const;
+    size_t rank(const std::string& name) const;
+    std::vector<std::pair<std::string, unsigned long> > top(size_t count) const;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef TRIVIASTORE_HPP
+#define TRIVIASTORE_HPP
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The trivia questions, memory-mapped from a text file with one
+ * "question<TAB>answer[|other answer...]" per line. Only an index of offsets
+ * is built at load time, so a large file costs one pass and no copies, and
+ * any question is reached in O(1).
+*/
+class TriviaStore {
+private:
+    struct Entry {
+        uint32_t question;
+        uint32_t question_length;
+        uint32_t answer;
+        uint32_t answer_length;
+    };
+
+    const char* _data;
+    size_t _size;
+    std::vector<Entry> _entries;
+
+    void unload();
+
+    TriviaStore(const TriviaStore&);
+    TriviaStore& operator=(const TriviaStore&);
+
+public:
+    TriviaStore();
+    ~TriviaStore();
+
+    bool load(const std::string& path, std::string& error);
+
+    size_t size() const;
+    std::string question(size_t index) const;
+    std::string answer(size_t index) const;
+
+    static std::string normalize(const std::string& text);
+    static bool within_distance(const std::string& a, const std::string& b, size_t max);
+    static bool matches(const std::string& guess, const std::vector<std::string>& answers);
+};
+
+#endif
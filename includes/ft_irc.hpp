@@ -22,6 +22,8 @@
 # include <signal.h>
 # include <cerrno>
 # include <sys/wait.h>
+# include <sys/time.h>
+# include <stdint.h>
 #include <cstdio>
 # define RPL_WELCOME 001
 # define RPL_YOURHOST 002
@@ -29,18 +31,162 @@
 # define RPL_MYINFO 004
 # define RPL_ISUPPORT 005
 
-# define BACKLOG 5
+# define CONFIG_PATH "ircserv.conf"
+# define BACKLOG 128
 # define MAX_CLIENTS 10
+# define NICK_LENGTH 9
+# define CHANNEL_MAX_MEMBERS 1000
+# define CHANNEL_DEFAULT_LIMIT 100
+# define REGISTRATION_TIMEOUT 60
+# define SENDQ_MAX 1048576
+# define FLOOD_BURST 50
+# define FLOOD_RATE 10
+# define PING_INTERVAL 120
+# define PING_TIMEOUT 60
 
+# define HISTORY_MAX_LINES 256
+# define HISTORY_MAX_BYTES 65536
+# define CHATHISTORY_MAX_LIMIT 100
+
+# define SNAPSHOT_PATH "ircserv.snapshot"
+# define SNAPSHOT_INTERVAL 300
+
+# define HANDOFF_ENV "IRCSERV_HANDOFF_FD"
+# define HANDOFF_TIMEOUT_MS 10000
+
+# define LINK_RETRY_MIN 2
+# define LINK_RETRY_MAX 60
+# define LINK_RESOLVE_INTERVAL 300
+
+# define LIST_BATCH_SIZE 64
+# define LIST_SCAN_BUDGET 1024
+# define LIST_SENDQ_WATERMARK 16384
+
+# define TAGMSG_SENDQ_WATERMARK 4096
+# define TAGMSG_PENDING_MAX 32
+
+# define LATENCY_SAMPLE_RATE 1
+# define SLOWLOG_THRESHOLD_US 5000
+# define SLOWLOG_MAX_ENTRIES 64
+
+# define LAG_DEFER_ACCEPT_MS 50
+# define LAG_THROTTLE_MS 100
+# define LAG_REJECT_MS 250
+# define LAG_CHECK_INTERVAL_MS 100
+# define LAG_STAGE_HOLD 2
+# define LAG_RETRY_AFTER 30
+# define THROTTLE_SHARE 4
+
+# define MAX_CONNECTIONS_PER_IP 5
+# define MAX_CONNECTIONS_PER_PREFIX 10
+# define CONNECT_RATE_LIMIT 10
+# define CONNECT_RATE_WINDOW 10
+# define ADDRESS_SWEEP_INTERVAL 60
+
+# define WORKER_THREADS 2
+# define RESOLVE_DEADLINE_MS 3000
+# define HOST_CACHE_SIZE 4096
+# define HOST_CACHE_TTL 3600
+# define HOST_CACHE_NEGATIVE_TTL 300
+# define HOSTLEN 63
+
+# define ACCOUNTS_PATH "ircserv.accounts"
+# define PBKDF2_ITERATIONS 100000
+# define SASL_CHUNK_SIZE 400
+# define SASL_MAX_PAYLOAD 4096
+# define SASL_MAX_FAILURES 3         // Failed logins before a connection is closed
+# define SASL_IP_FAILURES 10         // Failed logins per address and window, further attempts are refused unchecked
+# define SASL_FAILURE_WINDOW 300
+
+# define MAX_CLIENT_TAGS_LENGTH 4094
+
+# define MAX_CHANNEL_MASKS 4096
+# define MASK_CACHE_MAX 4096
+
+# define PLUGIN_CALLBACK_BUDGET_US 2000
+# define PLUGIN_MAX_OVERRUNS 3
+# define PLUGIN_QUEUE_MAX 4096
+# define SERVICE_MESSAGE_MAX 400
+
+# define RESUME_GRACE 120
+# define RESUME_BUFFER_MAX 65536
+# define RESUME_TOKEN_SIZE 16
+
+# define CHANNEL_LOG_COMMIT_MS 50
+# define CHANNEL_LOG_BATCH_BYTES 65536
+# define CHANNEL_LOG_FSYNC_MS 1000
+# define CHANNEL_LOG_QUEUE_MAX (8 * 1024 * 1024)
+# define CHANNEL_LOG_IDLE_CLOSE_MS 60000
+# define CHANLOG_MAX_LINES 100
+
+# define SEARCH_POLL_MS 250
+# define SEARCH_BATCH_BYTES (1024 * 1024)
+# define SEARCH_SKIP_INTERVAL 128
+# define SEARCH_TERM_MIN 2
+# define SEARCH_TERM_MAX 32
+# define SEARCH_MAX_TERMS 8
+# define SEARCH_MAX_RESULTS 20
+
+# define FILTER_PATH "ircserv.filters"
+# define FILTER_TAG_NAME "ircserv/flagged"
+
+enum Capability {
+    CAP_SASL = 1 << 0,
+    CAP_SERVER_TIME = 1 << 1,
+    CAP_MESSAGE_TAGS = 1 << 2,
+    CAP_ECHO_MESSAGE = 1 << 3,
+    CAP_BATCH = 1 << 4,
+    CAP_MULTI_PREFIX = 1 << 5,
+    CAP_NO_IMPLICIT_NAMES = 1 << 6,
+    CAP_RESUME = 1 << 7
+};
+
+// The capabilities that change how a line is rendered for a client
+# define CAP_RENDERING (CAP_SERVER_TIME | CAP_MESSAGE_TAGS | CAP_ECHO_MESSAGE | CAP_BATCH | CAP_MULTI_PREFIX)
+
+enum SaslState {
+    SASL_NONE,
+    SASL_AWAITING_PAYLOAD,
+    SASL_VERIFYING
+};
+
+# include "Metrics.hpp"
+# include "Probes.hpp"
+# include "AddressTable.hpp"
+# include "WorkerPool.hpp"
+# include "PluginHost.hpp"
+# include "ChannelLog.hpp"
+# include "ChannelLogReader.hpp"
+# include "SearchIndex.hpp"
+# include "PatternFilter.hpp"
+# include "HostCache.hpp"
+# include "LinkStream.hpp"
+# include "Sha256.hpp"
+# include "Message.hpp"
+# include "Config.hpp"
 # include "Server.hpp"
 
 extern Server* g_server_instance;
+extern volatile sig_atomic_t g_upgrade_requested;
+extern volatile sig_atomic_t g_reload_requested;
+extern volatile sig_atomic_t g_shutdown_requested;
+extern int g_log_level;
 
 std::string intToString(int number);
 bool is_valid_nickname_char(char c);
 bool is_valid_realname_char(char c);
 bool user_in_channel(const std::map<std::string, Client*>& clients_in_channel, const std::string& nickname);
 bool isValidModeString(const std::string& flags);
+std::string make_server_id(int port);
+bool match_mask(const std::string& mask, const std::string& str);
+uint64_t current_time_ms();
+std::string format_server_time(uint64_t time_ms);
+bool parse_server_time(const std::string& text, uint64_t& time_ms);
+bool base64_decode(const std::string& text, std::string& out);
+std::string hex_encode(const std::string& bytes);
+bool hex_decode(const std::string& text, std::string& out);
+std::string make_password_hash(const std::string& password, uint32_t iterations);
+bool check_password_hash(const std::string& record, const std::string& password);
 void setup_signal_handling();
 
 #endif
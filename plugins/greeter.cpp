@@ -0,0 +1,49 @@
+#include "PluginApi.hpp"
+#include <string>
+#include <cstring>
+
+/*
+ * Sample loop plugin: greets users joining a channel and answers "help" in private.
+ * ircserv.conf: plugin = plugins/greeter.so Welcome to the channel!
+*/
+
+struct GreeterState {
+    const irc_server_api* api;
+    std::string greeting;
+};
+
+static void* greeter_init(const irc_server_api* api, const char* args) {
+    GreeterState* state = new GreeterState();
+    state->api = api;
+    state->greeting = args && *args ? args : "Welcome!";
+    api->log(api->handle, "ready");
+    return state;
+}
+
+static void greeter_on_event(void* data, const irc_event* event) {
+    GreeterState* state = static_cast<GreeterState*>(data);
+    if (event->type == IRC_EVENT_JOIN) {
+        std::string text = std::string(event->nick) + ": " + state->greeting;
+        state->api->notice(state->api->handle, event->channel, text.c_str());
+    } else if (event->type == IRC_EVENT_PRIVATE) {
+        state->api->notice(state->api->handle, event->nick, "I greet people joining channels, there is nothing else to ask.");
+    }
+}
+
+static void greeter_shutdown(void* data) {
+    delete static_cast<GreeterState*>(data);
+}
+
+static const irc_plugin greeter = {
+    IRC_PLUGIN_API_VERSION,
+    "Greeter",
+    IRC_EVENT_JOIN | IRC_EVENT_PRIVATE,
+    0,
+    greeter_init,
+    greeter_on_event,
+    greeter_shutdown
+};
+
+extern "C" const irc_plugin* irc_plugin_entry(void) {
+    return &greeter;
+}
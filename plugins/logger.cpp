@@ -0,0 +1,70 @@
+#include "PluginApi.hpp"
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+/*
+ * Sample threaded plugin: appends channel traffic to a file. Writing to disk
+ * can stall, so it asks for its own thread and never slows the event loop.
+ * ircserv.conf: plugin = plugins/logger.so channels.log
+*/
+
+struct LoggerState {
+    const irc_server_api* api;
+    FILE* file;
+};
+
+static void* logger_init(const irc_server_api* api, const char* args) {
+    const char* path = args && *args ? args : "channels.log";
+    FILE* file = std::fopen(path, "a");
+    if (!file) {
+        api->log(api->handle, "cannot open the log file");
+        return NULL;
+    }
+    LoggerState* state = new LoggerState();
+    state->api = api;
+    state->file = file;
+    return state;
+}
+
+static void logger_on_event(void* data, const irc_event* event) {
+    LoggerState* state = static_cast<LoggerState*>(data);
+    time_t seconds = static_cast<time_t>(event->time_ms / 1000);
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", std::gmtime(&seconds));
+    switch (event->type) {
+        case IRC_EVENT_MESSAGE:
+            std::fprintf(state->file, "%s %s <%s> %s\n", stamp, event->channel, event->nick, event->text);
+            break;
+        case IRC_EVENT_JOIN:
+            std::fprintf(state->file, "%s %s * %s joined\n", stamp, event->channel, event->mask);
+            break;
+        case IRC_EVENT_PART:
+            std::fprintf(state->file, "%s %s * %s left (%s)\n", stamp, event->channel, event->nick, event->text);
+            break;
+        case IRC_EVENT_PRIVATE:
+            state->api->notice(state->api->handle, event->nick, "Channel traffic is being logged.");
+            break;
+    }
+    std::fflush(state->file);
+}
+
+static void logger_shutdown(void* data) {
+    LoggerState* state = static_cast<LoggerState*>(data);
+    std::fclose(state->file);
+    delete state;
+}
+
+static const irc_plugin logger = {
+    IRC_PLUGIN_API_VERSION,
+    "Logger",
+    IRC_EVENT_MESSAGE | IRC_EVENT_JOIN | IRC_EVENT_PART | IRC_EVENT_PRIVATE,
+    IRC_PLUGIN_THREADED,
+    logger_init,
+    logger_on_event,
+    logger_shutdown
+};
+
+extern "C" const irc_plugin* irc_plugin_entry(void) {
+    return &logger;
+}
@@ -0,0 +1,86 @@
+"""Hot upgrade: clients stay connected and keep their nicks, channels and topics across SIGUSR2, and detached sessions stay resumable."""
+
+import os
+import re
+import signal
+
+from irc import Client, Server, check, run
+
+
+def main():
+    server = Server()
+    new_pid = None
+    try:
+        resume = ("draft/resume-0.5",)
+        alice = Client(server.port, "alice", caps=resume)
+        alice_token = alice.expect(r"RESUME TOKEN").split()[-1]
+        bob = Client(server.port, "bob")
+        for client in (alice, bob):
+            for channel in ("#upgrade", "#other"):
+                client.send("JOIN " + channel)
+                client.expect(r" 353 \S+ = %s " % channel)
+        alice.send("TOPIC #upgrade :before the upgrade")
+        bob.expect(r"TOPIC #upgrade :before the upgrade")
+        alice.send("MODE #upgrade +b carol!*@*")
+        bob.expect(r"MODE #upgrade \+b carol!\*@\*")
+        dora = Client(server.port, "dora", caps=resume)
+        dora_token = dora.expect(r"RESUME TOKEN").split()[-1]
+        dora.send("JOIN #upgrade")
+        dora.expect(r" 353 ")
+        dora.close()
+        check(server.wait_log(r"\(dora\) detached") is not None, "dora's connection dropped, her session is detached")
+        alice.send("PRIVMSG #upgrade :while dora is away")
+        alice.drain()
+        bob.drain()
+
+        server.signal(signal.SIGUSR2)
+        done = server.wait_log(r"new process (\d+) took over")
+        check(done is not None, "the new process took over")
+        new_pid = int(done.group(1))
+        check(server.process.wait(5) == 0, "the old process exited cleanly")
+        check(re.search(r"Resumed 2 clients, 1 detached sessions and 2 channels", server.log()) is not None, "the new process resumed both clients, dora's session and the channels")
+        fd_dir = "/proc/%d/fd" % new_pid
+        inherited = sorted(os.readlink(os.path.join(fd_dir, fd)) for fd in os.listdir(fd_dir) if int(fd) > 2)
+        kinds = [re.sub(r":\[\d+\]$", "", target) for target in inherited]
+        check(kinds == ["anon_inode:[eventfd]", "socket", "socket", "socket"],
+              "the new process holds the listening socket, both clients and its own eventfd, nothing leaked (%s)" % ", ".join(inherited))
+
+        alice.send("PING :still-here")
+        check("still-here" in alice.expect(r"PONG"), "the connection of alice survived")
+        alice.send("PRIVMSG #upgrade :after the upgrade")
+        check(bob.expect(r"PRIVMSG #upgrade").startswith(":alice"), "bob still gets alice's channel messages, under the same nick")
+        bob.send("LIST #other")
+        check(bob.expect(r" 322 ").split()[4] == "2", "#other still has both members")
+        alice.send("PRIVMSG #other :members only")
+        check("members only" in bob.expect(r"PRIVMSG #other"), "and delivers to them")
+        bob.send("TOPIC #upgrade")
+        check("before the upgrade" in bob.expect(r" 332 "), "the topic was handed over")
+        bob.send("PRIVMSG alice :direct")
+        check(alice.expect(r"PRIVMSG alice").startswith(":bob"), "private messages still reach the right nick")
+        carol = Client(server.port, "carol")
+        carol.send("JOIN #upgrade")
+        check(carol.expect(r" (474|353) ").split()[1] == "474", "the ban set before the upgrade still keeps carol out")
+        alice.send("MODE #upgrade b")
+        check("carol!*@*" in alice.expect(r" 367 "), "and is still listed")
+        check(not alice.closed and not bob.closed, "no client was disconnected")
+        check(not any("QUIT" in line for line in bob.drain()), "and nobody saw dora quit")
+
+        dora = Client(server.port, register=False)
+        dora.send("CAP REQ :draft/resume-0.5")
+        dora.send("CAP END")
+        dora.send("PASS pw")
+        dora.send("RESUME " + dora_token)
+        check("dora" in dora.expect(r"RESUME (SUCCESS|FAIL)"), "dora resumes with the token she got from the old process")
+        check("while dora is away" in dora.expect(r"PRIVMSG #upgrade"), "and gets the message buffered before the upgrade")
+        alice2 = Client(server.port, register=False)
+        alice2.send("CAP REQ :draft/resume-0.5")
+        alice2.send("CAP END")
+        alice2.send("PASS pw")
+        alice2.send("RESUME " + alice_token)
+        check("alice" in alice2.expect(r"RESUME (SUCCESS|FAIL)"), "the token of a client connected through the upgrade still works")
+    finally:
+        server.stop(new_pid)
+        server.cleanup()
+
+
+run(main)
@@ -0,0 +1,188 @@
+"""Helpers shared by the checks: start ircserv in a scratch directory and talk to it."""
+
+import os
+import re
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+IRCSERV = os.path.join(ROOT, "ircserv")
+
+
+class CheckFailed(Exception):
+    pass
+
+
+def check(condition, what):
+    if not condition:
+        raise CheckFailed(what)
+    print("  ok   " + what)
+
+
+def wait_for(predicate, timeout=5.0, interval=0.05):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        value = predicate()
+        if value:
+            return value
+        time.sleep(interval)
+    return predicate()
+
+
+def free_port():
+    sock = socket.socket()
+    sock.bind(("127.0.0.1", 0))
+    port = sock.getsockname()[1]
+    sock.close()
+    return port
+
+
+class Server:
+    """An ircserv process in its own directory, so snapshots, logs and configs never mix."""
+
+    def __init__(self, port=None, password="pw", config="", files=None, args=(), env=None):
+        self.port = port or free_port()
+        self.password = password
+        self.dir = tempfile.mkdtemp(prefix="ircserv-check-")
+        with open(os.path.join(self.dir, "ircserv.conf"), "w") as conf:
+            conf.write(config)
+        for name, contents in (files or {}).items():
+            with open(os.path.join(self.dir, name), "w") as out:
+                out.write(contents)
+        self.log_path = os.path.join(self.dir, "ircserv.log")
+        self.args = list(args)
+        self.env = dict(os.environ, **(env or {}))
+        self.process = None
+        self.start()
+
+    def start(self):
+        log = open(self.log_path, "a")
+        self.process = subprocess.Popen([IRCSERV, str(self.port), self.password] + self.args,
+                                        cwd=self.dir, stdout=log, stderr=subprocess.STDOUT, env=self.env)
+        log.close()
+        if not wait_for(self.listening):
+            raise CheckFailed("ircserv did not start on port %d:\n%s" % (self.port, self.log()))
+
+    def listening(self):
+        try:
+            socket.create_connection(("127.0.0.1", self.port), 0.2).close()
+            return True
+        except OSError:
+            return False
+
+    def log(self):
+        with open(self.log_path) as log:
+            return log.read()
+
+    def wait_log(self, pattern, timeout=5.0):
+        return wait_for(lambda: re.search(pattern, self.log()), timeout)
+
+    def signal(self, signum, pid=None):
+        os.kill(pid or self.process.pid, signum)
+
+    def stop(self, pid=None):
+        if pid:
+            try:
+                os.kill(pid, signal.SIGINT)
+            except OSError:
+                pass
+            wait_for(lambda: not os.path.exists("/proc/%d" % pid) or open("/proc/%d/stat" % pid).read().split()[2] == "Z", 5)
+        if self.process and self.process.poll() is None:
+            self.process.send_signal(signal.SIGINT)
+            try:
+                self.process.wait(5)
+            except subprocess.TimeoutExpired:
+                self.process.kill()
+                self.process.wait()
+        self.process = None
+
+    def cleanup(self):
+        self.stop()
+        shutil.rmtree(self.dir, ignore_errors=True)
+
+
+class Client:
+    """A line-oriented IRC connection, every line received is kept for expect()."""
+
+    def __init__(self, port, nick=None, password="pw", caps=(), register=True, source=None):
+        self.sock = socket.create_connection(("127.0.0.1", port), 5, (source, 0) if source else None)
+        self.sock.settimeout(0.1)
+        self.buffer = b""
+        self.lines = []
+        self.closed = False
+        self.nick = nick
+        if nick and register:
+            self.register(nick, password, caps)
+
+    def register(self, nick, password="pw", caps=()):
+        if caps:
+            self.send("CAP REQ :" + " ".join(caps))
+            self.send("CAP END")
+        if password is not None:
+            self.send("PASS " + password)
+        self.send("NICK " + nick)
+        self.send("USER %s 0 * :%s" % (nick, nick))
+        self.expect(r" 001 ")
+
+    def send(self, line):
+        self.sock.sendall((line + "\r\n").encode())
+
+    def read(self, timeout=0.1):
+        deadline = time.time() + timeout
+        while True:
+            try:
+                data = self.sock.recv(65536)
+                if not data:
+                    self.closed = True
+                    break
+                self.buffer += data
+            except socket.timeout:
+                pass
+            except OSError:
+                self.closed = True
+                break
+            if time.time() >= deadline:
+                break
+        while b"\r\n" in self.buffer:
+            line, self.buffer = self.buffer.split(b"\r\n", 1)
+            self.lines.append(line.decode("utf-8", "replace"))
+
+    def expect(self, pattern, timeout=5.0):
+        """Wait for a line matching pattern, consume the lines up to it and return it."""
+        deadline = time.time() + timeout
+        while True:
+            for i, line in enumerate(self.lines):
+                if re.search(pattern, line):
+                    del self.lines[:i + 1]
+                    return line
+            if self.closed or time.time() >= deadline:
+                raise CheckFailed("%s: no line matching %r, got %r" % (self.nick, pattern, self.lines[-10:]))
+            self.read()
+
+    def drain(self, timeout=0.2):
+        self.read(timeout)
+        lines, self.lines = self.lines, []
+        return lines
+
+    def close(self):
+        self.sock.close()
+
+
+def run(main):
+    """Run a check: print its result and exit with its status."""
+    name = os.path.basename(sys.argv[0])
+    if not os.path.exists(IRCSERV):
+        print("%s: build ircserv first" % name)
+        sys.exit(2)
+    try:
+        main()
+    except CheckFailed as failure:
+        print("  FAIL %s" % failure)
+        print("%s: failed" % name)
+        sys.exit(1)
+    print("%s: passed" % name)
@@ -0,0 +1,153 @@
+"""Server links on localhost: a hub and two leaves, routing, compression, topics, modes and kicks, a netsplit and the rejoin, and handshakes that must be refused."""
+
+import os
+import re
+import shutil
+import socket
+import subprocess
+import tempfile
+
+from irc import IRCSERV, Client, Server, check, free_port, run
+
+HUB = "hub.test"
+
+
+def leaf_config(name, sid, hub_port, password):
+    return ("server_name = %s\nserver_id = %s\n\n[link %s]\nsid = 1HB\nhost = 127.0.0.1\nport = %d\npassword = %s\ncompress = yes\n"
+            % (name, sid, HUB, hub_port, password))
+
+
+def hub_config():
+    return ("server_name = %s\nserver_id = 1HB\n\n"
+            "[link leaf-b.test]\nsid = 2LB\nhost = 127.0.0.1\npassword = b-secret\ncompress = yes\n\n"
+            "[link leaf-c.test]\nsid = 3LC\nhost = localhost\npassword = c-secret\n\n"
+            "[link leaf-d.test]\nsid = 4LD\nhost = 127.0.0.2\npassword = d-secret\n" % HUB)
+
+
+def established(server, count):
+    return server.wait_log(r"(?s)(Link: established.*){%d}" % count, 10)
+
+
+def refused_handshake(port, lines):
+    sock = socket.create_connection(("127.0.0.1", port), 5)
+    sock.sendall("".join(line + "\r\n" for line in lines).encode())
+    sock.settimeout(5)
+    received = b""
+    try:
+        while True:
+            data = sock.recv(4096)
+            if not data:
+                break
+            received += data
+    except socket.timeout:
+        return None
+    sock.close()
+    return received.decode()
+
+
+def main():
+    directory = tempfile.mkdtemp(prefix="ircserv-check-")
+    with open(os.path.join(directory, "ircserv.conf"), "w") as conf:
+        conf.write("[link peer.test]\nsid = 2AB\nhost = 127.0.0.1\npassword = secret\n")
+    result = subprocess.run([IRCSERV, str(free_port()), "pw"], cwd=directory, capture_output=True, text=True, timeout=5)
+    shutil.rmtree(directory, ignore_errors=True)
+    check(result.returncode != 0 and "server_id must be set" in result.stderr, "a server with links refuses to start without server_id")
+
+    hub = Server(config=hub_config())
+    servers = [hub]
+    try:
+        leaf_b = Server(config=leaf_config("leaf-b.test", "2LB", hub.port, "b-secret"))
+        servers.append(leaf_b)
+        leaf_c = Server(config=leaf_config("leaf-c.test", "3LC", hub.port, "c-secret"))
+        servers.append(leaf_c)
+        check(established(hub, 2) is not None, "both leaves linked to the hub, with their own SIDs and passwords")
+        check(re.search(r"established with leaf-b\.test \(2LB\), compressed", hub.log()) is not None
+              and re.search(r"established with leaf-c\.test \(3LC\)$", hub.log(), re.M) is not None,
+              "the link to leaf-b is compressed, leaf-c's is not since only one side asked for it")
+
+        a = Client(hub.port, "a")
+        b = Client(leaf_b.port, "b")
+        c = Client(leaf_c.port, "c")
+        a.send("JOIN #net")
+        a.expect(r" 353 ")
+        for client in (b, c):
+            client.send("JOIN #net")
+            a.expect(r":%s JOIN" % client.nick)
+        b.send("PRIVMSG #net :hello from b")
+        check("hello from b" in a.expect(r"PRIVMSG #net"), "a channel message reaches the hub")
+        check(c.expect(r"PRIVMSG #net").startswith(":b "), "and the other leaf, through the hub")
+        c.send("PRIVMSG b :direct")
+        check(b.expect(r"PRIVMSG b").startswith(":c "), "a private message crosses two links")
+        for i in range(30):
+            b.send("PRIVMSG #net :line %d of a chatty channel, the same words again and again" % i)
+        check("line 29 of" in c.expect(r"line 29 of"), "a burst of messages crosses the compressed link in order")
+        a.drain()
+        a.send("STATS n")
+        stats = {}
+        while True:
+            line = a.expect(r" (249|219) ")
+            if " 219 " in line:
+                break
+            stats[line.split(" :", 1)[1].split()[0]] = line
+        counters = re.search(r"out=(\d+)/(\d+) in=(\d+)/(\d+)", stats.get("leaf-b.test", ""))
+        check(counters is not None and int(counters.group(2)) > 0 and int(counters.group(4)) * 2 < int(counters.group(3)),
+              "STATS n shows the chatty leaf's traffic arriving in less than half the bytes: " + stats.get("leaf-b.test", "none"))
+        check("compressed" not in stats.get("leaf-c.test", "compressed"), "and leaf-c's link as uncompressed")
+        c.send("PART #net :bye")
+        check("bye" in a.expect(r":c PART #net"), "a part is relayed")
+
+        a.send("TOPIC #net :set on the hub")
+        check("set on the hub" in b.expect(r"TOPIC #net"), "a topic crosses the link")
+        a.send("MODE #net +t")
+        b.expect(r"MODE #net \+t")
+        b.send("TOPIC #net :not an operator")
+        check(b.expect(r" (482|TOPIC) ").split()[1] == "482", "and so does +t, the leaf refuses its non-operator")
+        a.send("MODE #net +b c!*@*")
+        b.expect(r"MODE #net \+b c!\*@\*")
+        c.drain()
+        c.send("JOIN #net")
+        check(c.expect(r" (474|353) ").split()[1] == "474", "a ban set on the hub keeps c out of #net on its own leaf")
+
+        c.send("JOIN #kick")
+        c.expect(r" 353 ")
+        a.send("JOIN #kick")
+        c.expect(r":a JOIN")
+        c.send("KICK #kick a :behave")
+        check("behave" in a.expect(r"KICK #kick a"), "a kick on leaf-c reaches the member on the hub")
+        a.send("PRIVMSG #kick :still here?")
+        check(a.expect(r" (442|PRIVMSG) ").split()[1] == "442", "whose server no longer counts it as a member")
+        c.send("PING :after-kick")
+        c.expect(r"after-kick")
+        check(not any("still here?" in line for line in c.drain()), "and nothing it says reaches the channel")
+
+        leaf_b.stop()
+        quit_line = a.expect(r":b QUIT")
+        check(HUB in quit_line and "leaf-b.test" in quit_line, "a netsplit shows the servers that split: " + quit_line)
+        leaf_b.start()
+        check(established(hub, 3) is not None, "the leaf links again after its restart")
+        b2 = Client(leaf_b.port, "b2")
+        b2.send("JOIN #net")
+        names = b2.expect(r" 353 ")
+        check(" a" in names or "@a" in names, "the burst gave the restarted leaf the members of #net: " + names)
+        check(a.expect(r"JOIN").startswith(":b2 "), "and its new user reaches the hub")
+        b2.send("TOPIC #net")
+        check("set on the hub" in b2.expect(r" 33[12] "), "the burst carried the topic")
+        b2.send("MODE #net b")
+        check("c!*@*" in b2.expect(r" 36[78] "), "and the ban list")
+
+        reply = refused_handshake(hub.port, ["PASS pw TS 6 :9ZZ", "CAPAB :QS", "SERVER evil.test 1 :evil"])
+        check(reply is not None and "ERROR :Link refused" in reply, "a client password and an unknown SID do not make a server")
+        reply = refused_handshake(hub.port, ["PASS pw TS 6 :3LC", "CAPAB :QS", "SERVER leaf-c.test 1 :evil"])
+        check(reply is not None and "ERROR :Link refused" in reply, "neither does a known SID with the wrong password")
+        reply = refused_handshake(hub.port, ["PASS d-secret TS 6 :4LD", "CAPAB :QS", "SERVER leaf-d.test 1 :evil"])
+        check(reply is not None and "ERROR :Link refused" in reply, "nor the right credentials from another address than the link's host")
+        check(hub.wait_log(r"no \[link\] section has SID 9ZZ") and hub.wait_log(r"wrong password") and hub.wait_log(r"not connecting from 127.0.0.2"),
+              "the hub logs why")
+        a.send("PRIVMSG #net :still linked")
+        check("still linked" in b2.expect(r"PRIVMSG #net"), "the real links were not disturbed")
+    finally:
+        for server in servers:
+            server.cleanup()
+
+
+run(main)
@@ -0,0 +1,98 @@
+"""Bot lookups against a stub HTTP server: identical requests share one fetch, answers are cached, and a slow service times out without stalling the bot."""
+
+import http.server
+import os
+import signal
+import subprocess
+import threading
+import time
+
+from irc import ROOT, Client, Server, check, free_port, run
+
+BOT = os.path.join(ROOT, "bot")
+TIMEOUT = 5.0   # BOT_LOOKUP_TIMEOUT_MS
+STUB_DELAY = 0.5
+
+
+class Stub(http.server.BaseHTTPRequestHandler):
+    """/weather/<city> answers after STUB_DELAY, cities starting with "slow" outlast the bot's timeout."""
+
+    fetches = {}
+    lock = threading.Lock()
+
+    def do_GET(self):
+        city = self.path.rsplit("/", 1)[-1]
+        with Stub.lock:
+            Stub.fetches[city] = Stub.fetches.get(city, 0) + 1
+        time.sleep(TIMEOUT + 3 if city.startswith("slow") else STUB_DELAY)
+        body = ("%s: sunny +20C\n" % city).encode()
+        try:
+            self.send_response(200)
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+        except OSError:
+            pass  # The bot gave up on a slow answer
+
+    def log_message(self, format, *args):
+        pass
+
+
+def bot_says(client, text, timeout):
+    return client.expect(r"^:lookupbot PRIVMSG #bots :.*%s" % text, timeout)
+
+
+def main():
+    if not os.path.exists(BOT):
+        check(False, "build the bot first (make bot)")
+    stub = http.server.ThreadingHTTPServer(("127.0.0.1", free_port()), Stub)
+    stub.daemon_threads = True
+    threading.Thread(target=stub.serve_forever, daemon=True).start()
+    server = Server()
+    bot = None
+    try:
+        alice = Client(server.port, "alice")
+        bob = Client(server.port, "bob")
+        for client in (alice, bob):
+            client.send("JOIN #bots")
+            client.expect(r" 353 ")
+        env = dict(os.environ, BOT_WEATHER_URL="http://127.0.0.1:%d/weather/%%s" % stub.server_address[1])
+        with open(os.path.join(server.dir, "bot.log"), "w") as log:
+            bot = subprocess.Popen([BOT, "127.0.0.1", str(server.port), "lookupbot", "pw", "#bots"],
+                                   cwd=server.dir, stdout=log, stderr=subprocess.STDOUT, env=env)
+        alice.expect(r"^:lookupbot JOIN", 10)
+        bob.drain()
+
+        alice.send("PRIVMSG #bots :!weather paris")
+        bob.send("PRIVMSG #bots :!weather paris")
+        bot_says(alice, "paris: sunny", 5)
+        bot_says(alice, "paris: sunny", 5)
+        check(Stub.fetches.get("paris") == 1, "two identical requests in flight made one fetch (%s)" % Stub.fetches.get("paris"))
+
+        started = time.time()
+        alice.send("PRIVMSG #bots :!weather paris")
+        bot_says(alice, "paris: sunny", 5)
+        elapsed = time.time() - started
+        check(elapsed < STUB_DELAY and Stub.fetches.get("paris") == 1,
+              "a repeat within the TTL is answered from the cache, in %.2fs without a fetch" % elapsed)
+
+        started = time.time()
+        alice.send("PRIVMSG #bots :!weather slowtown")
+        alice.send("PRIVMSG #bots :!hello")
+        bot_says(alice, "world!", 2)
+        check(time.time() - started < 2, "!hello is answered while the slow lookup is in flight")
+        bot_says(alice, "Lookup failed for slowtown: timed out", TIMEOUT + 3)
+        elapsed = time.time() - started
+        check(TIMEOUT - 0.5 < elapsed < TIMEOUT + 1.5, "the slow lookup is answered with a timeout after %.1fs" % elapsed)
+    finally:
+        if bot is not None:
+            bot.send_signal(signal.SIGTERM)
+            try:
+                bot.wait(5)
+            except subprocess.TimeoutExpired:
+                bot.kill()
+        stub.shutdown()
+        server.cleanup()
+
+
+run(main)
@@ -0,0 +1,82 @@
+"""USDT probes: the sample bpftrace scripts attach to probes the server defines, and a build with <sys/sdt.h> carries them all."""
+
+import glob
+import os
+import re
+import subprocess
+
+from irc import IRCSERV, ROOT, check, run
+
+
+def source_probes():
+    """Every IRC_PROBE<n>(name, ...) in srcs/, as {name: arity}."""
+    probes = {}
+    for path in glob.glob(os.path.join(ROOT, "srcs", "**", "*.cpp"), recursive=True):
+        with open(path) as source:
+            for arity, name in re.findall(r"IRC_PROBE(\d)\((\w+),", source.read()):
+                probes.setdefault(name, set()).add(int(arity))
+    return probes
+
+
+def documented_probes():
+    with open(os.path.join(ROOT, "includes", "Probes.hpp")) as header:
+        comment = header.read().split("*/", 1)[0]
+    return set(re.findall(r"^ \*   (\w+)\(", comment, re.M))
+
+
+def script_probes():
+    """The probes each .bt script attaches to, with the highest argN its block reads."""
+    uses = []
+    for path in sorted(glob.glob(os.path.join(ROOT, "scripts", "bpftrace", "*.bt"))):
+        with open(path) as script:
+            text = re.sub(r"/\*.*?\*/", "", script.read(), flags=re.S)
+        blocks = re.split(r"^(?=[A-Za-z])", text, flags=re.M)
+        for block in blocks:
+            probe = re.match(r"usdt:([^:\s]+):(\w+):(\w+)", block)
+            if probe:
+                args = [int(n) for n in re.findall(r"\barg(\d+)\b", block)]
+                uses.append((os.path.basename(path), probe.group(2), probe.group(3), max(args) if args else -1))
+    return uses
+
+
+def have_sdt():
+    if "HAVE_SDT" in os.environ:
+        return os.environ["HAVE_SDT"] == "yes"
+    result = subprocess.run(["c++", "-E", "-include", "sys/sdt.h", "-x", "c++", "/dev/null"], capture_output=True)
+    return result.returncode == 0
+
+
+def binary_probes():
+    """The stapsdt notes of ircserv, as {(provider, name): argument count}."""
+    notes = subprocess.run(["readelf", "-n", IRCSERV], capture_output=True, text=True, check=True).stdout
+    probes = {}
+    for provider, name, arguments in re.findall(r"Provider: (\S+)\s+Name: (\S+)\s+Location:.*?Arguments: ?([^\n]*)", notes, re.S):
+        probes[(provider, name)] = len(arguments.split())
+    return probes
+
+
+def main():
+    defined = source_probes()
+    check(len(defined) > 0, "the sources define %d probes" % len(defined))
+    check(documented_probes() == set(defined), "Probes.hpp documents exactly the probes the sources fire")
+    check(all(len(arities) == 1 for arities in defined.values()), "each probe always fires with the same number of arguments")
+
+    uses = script_probes()
+    check(len(uses) > 0, "the bpftrace scripts attach to %d probes" % len(uses))
+    for script, provider, name, max_arg in uses:
+        check(provider == "ircserv" and name in defined, "%s: ircserv:%s is a probe of the server" % (script, name))
+        arity = next(iter(defined.get(name, {0})))
+        check(max_arg < arity, "%s: %s reads only the %d arguments it is fired with" % (script, name, arity))
+
+    if not have_sdt():
+        check(not binary_probes(), "built without <sys/sdt.h>, the binary has no stapsdt note")
+        print("  skip <sys/sdt.h> is not installed, the probes in the binary are not checked")
+        return
+    notes = binary_probes()
+    for name, arities in sorted(defined.items()):
+        count = notes.get(("ircserv", name))
+        check(count is not None, "readelf -n finds the stapsdt note of ircserv:%s" % name)
+        check(count == next(iter(arities)), "and it carries %d arguments" % count)
+
+
+run(main)
@@ -0,0 +1,69 @@
+"""Host names: a reverse name is only used when its forward lookup leads back to the client, and a slow lookup gives up at the deadline."""
+
+import os
+import shutil
+import subprocess
+import tempfile
+import time
+
+from irc import ROOT, Client, Server, check, run
+
+HOSTS = """ptr 127.0.0.2 good.test
+a good.test 127.0.0.2
+ptr 127.0.0.3 spoofed.test
+a spoofed.test 127.0.0.9
+ptr 127.0.0.4 -
+ptr 127.0.0.5 slow.test 3000
+a slow.test 127.0.0.5
+"""
+
+
+def build_stub(directory):
+    stub = os.path.join(directory, "resolver_stub.so")
+    subprocess.run(["c++", "-Wall", "-Wextra", "-Werror", "-fPIC", "-shared", "-o", stub,
+                    os.path.join(ROOT, "scripts", "check", "resolver_stub.cpp"), "-ldl"], check=True)
+    return stub
+
+
+def lookup(port, nick, source):
+    """Register from a source address, return the outcome of the host lookup and how long it took."""
+    client = Client(port, nick, register=False, source=source)
+    client.send("PASS pw")
+    client.send("NICK " + nick)
+    started = time.time()
+    client.send("USER %s 0 * :%s" % (nick, nick))
+    notice = client.expect(r"\*\*\* (Found|Couldn't look up) your hostname")
+    elapsed = time.time() - started
+    client.expect(r" 004 ")
+    client.close()
+    return ("found" if "Found" in notice else "ip"), elapsed
+
+
+def main():
+    directory = tempfile.mkdtemp(prefix="ircserv-stub-")
+    server = None
+    try:
+        hosts = os.path.join(directory, "hosts")
+        with open(hosts, "w") as out:
+            out.write(HOSTS)
+        server = Server(config="resolve_deadline_ms = 500\n",
+                        env={"LD_PRELOAD": build_stub(directory), "IRCSERV_STUB_HOSTS": hosts})
+
+        check(lookup(server.port, "good", "127.0.0.2")[0] == "found", "a reverse name that resolves back to the client is used (FCrDNS pass)")
+        check(lookup(server.port, "spoofed", "127.0.0.3")[0] == "ip", "a reverse name that resolves elsewhere is not, the client keeps its IP")
+        check(lookup(server.port, "noptr", "127.0.0.4")[0] == "ip", "neither is a missing reverse name")
+
+        outcome, elapsed = lookup(server.port, "slow", "127.0.0.5")
+        check(outcome == "ip" and 0.4 < elapsed < 2.0,
+              "a lookup slower than resolve_deadline_ms lets registration go on with the IP after %.2fs" % elapsed)
+        time.sleep(3)
+        outcome, elapsed = lookup(server.port, "slow2", "127.0.0.5")
+        check(outcome == "found" and elapsed < 0.4, "the late answer still filled the cache for the next client from that address")
+        check(lookup(server.port, "good2", "127.0.0.2")[0] == "found", "and a cached pass is served again")
+    finally:
+        if server:
+            server.cleanup()
+        shutil.rmtree(directory, ignore_errors=True)
+
+
+run(main)
@@ -0,0 +1,90 @@
+/*
+ * A resolver stub for scripts/check/resolver.py, preloaded into ircserv with
+ * LD_PRELOAD. It answers getnameinfo and getaddrinfo from the file named by
+ * IRCSERV_STUB_HOSTS, and passes every other query to the libc resolver:
+ *
+ *   ptr <ip> <name> [delay_ms]    reverse lookup of <ip>, after a delay
+ *   ptr <ip> -                    no reverse name for <ip>
+ *   a <name> <ip>                 forward lookup of <name>
+*/
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <fstream>
+#include <netdb.h>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+typedef int (*getnameinfo_fn)(const struct sockaddr*, socklen_t, char*, socklen_t, char*, socklen_t, int);
+typedef int (*getaddrinfo_fn)(const char*, const char*, const struct addrinfo*, struct addrinfo**);
+
+/*
+ * @brief Find the entry of a query in the stub file
+ * @param kind "ptr" or "a"
+ * @param key The address or the name looked up
+ * @param answer Set to the answer
+ * @param delay_ms Set to how long to wait before answering
+ * @return True if the file has an entry for the query
+*/
+static bool find_entry(const char* kind, const std::string& key, std::string& answer, long& delay_ms) {
+    const char* path = getenv("IRCSERV_STUB_HOSTS");
+    if (path == NULL) {
+        return false;
+    }
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string entry_kind, entry_key;
+        delay_ms = 0;
+        if (fields >> entry_kind >> entry_key >> answer && entry_kind == kind && entry_key == key) {
+            fields >> delay_ms;
+            return true;
+        }
+    }
+    return false;
+}
+
+extern "C" int getnameinfo(const struct sockaddr* addr, socklen_t addrlen, char* host, socklen_t hostlen,
+                           char* serv, socklen_t servlen, int flags) {
+    char ip[INET6_ADDRSTRLEN] = "";
+    if (addr->sa_family == AF_INET) {
+        inet_ntop(AF_INET, &reinterpret_cast<const struct sockaddr_in*>(addr)->sin_addr, ip, sizeof(ip));
+    } else if (addr->sa_family == AF_INET6) {
+        inet_ntop(AF_INET6, &reinterpret_cast<const struct sockaddr_in6*>(addr)->sin6_addr, ip, sizeof(ip));
+    }
+    std::string name;
+    long delay_ms;
+    if (host != NULL && find_entry("ptr", ip, name, delay_ms)) {
+        usleep(delay_ms * 1000);
+        if (name == "-" || name.size() >= hostlen) {
+            return EAI_NONAME;
+        }
+        std::strcpy(host, name.c_str());
+        return 0;
+    }
+    getnameinfo_fn next = reinterpret_cast<getnameinfo_fn>(dlsym(RTLD_NEXT, "getnameinfo"));
+    return next(addr, addrlen, host, hostlen, serv, servlen, flags);
+}
+
+extern "C" int getaddrinfo(const char* node, const char* service, const struct addrinfo* hints, struct addrinfo** res) {
+    std::string ip;
+    long delay_ms;
+    getaddrinfo_fn next = reinterpret_cast<getaddrinfo_fn>(dlsym(RTLD_NEXT, "getaddrinfo"));
+    if (node != NULL && find_entry("a", node, ip, delay_ms)) {
+        usleep(delay_ms * 1000);
+        struct addrinfo numeric;
+        std::memset(&numeric, 0, sizeof(numeric));
+        if (hints != NULL) {
+            numeric = *hints;
+        }
+        numeric.ai_flags |= AI_NUMERICHOST; // The libc allocates the answer, freeaddrinfo stays the real one
+        return next(ip.c_str(), service, &numeric, res);
+    }
+    return next(node, service, hints, res);
+}
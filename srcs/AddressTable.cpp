@@ -0,0 +1,293 @@
+#include "AddressTable.hpp"
+
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+static const uint8_t v4_mapped_prefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+PeerAddress::PeerAddress() : valid(false) {
+    std::memset(bytes, 0, sizeof(bytes));
+}
+
+PeerAddress PeerAddress::fromSockaddr(const struct sockaddr* addr, socklen_t length) {
+    PeerAddress address;
+    if (addr->sa_family == AF_INET && length >= sizeof(struct sockaddr_in)) {
+        const struct sockaddr_in* in = reinterpret_cast<const struct sockaddr_in*>(addr);
+        std::memcpy(address.bytes, v4_mapped_prefix, sizeof(v4_mapped_prefix));
+        std::memcpy(address.bytes + 12, &in->sin_addr, 4);
+        address.valid = true;
+    } else if (addr->sa_family == AF_INET6 && length >= sizeof(struct sockaddr_in6)) {
+        const struct sockaddr_in6* in6 = reinterpret_cast<const struct sockaddr_in6*>(addr);
+        std::memcpy(address.bytes, &in6->sin6_addr, 16);
+        address.valid = true;
+    }
+    return address;
+}
+
+/*
+ * @brief Read the peer address of a connected socket
+ * @param fd The socket
+ * @return The address, invalid if the socket is not an inet socket
+*/
+PeerAddress PeerAddress::fromSocket(int fd) {
+    struct sockaddr_storage storage;
+    socklen_t length = sizeof(storage);
+    if (getpeername(fd, reinterpret_cast<struct sockaddr*>(&storage), &length) < 0) {
+        return PeerAddress();
+    }
+    return fromSockaddr(reinterpret_cast<struct sockaddr*>(&storage), length);
+}
+
+/*
+ * @brief Build a socket address for the system resolver, IPv4 peers as plain AF_INET
+ * @param storage The storage to fill
+ * @return The address length, 0 if the address is invalid
+*/
+socklen_t PeerAddress::toSockaddr(struct sockaddr_storage& storage) const {
+    std::memset(&storage, 0, sizeof(storage));
+    if (!valid) {
+        return 0;
+    }
+    if (isV4()) {
+        struct sockaddr_in* in = reinterpret_cast<struct sockaddr_in*>(&storage);
+        in->sin_family = AF_INET;
+        std::memcpy(&in->sin_addr, bytes + 12, 4);
+        return sizeof(struct sockaddr_in);
+    }
+    struct sockaddr_in6* in6 = reinterpret_cast<struct sockaddr_in6*>(&storage);
+    in6->sin6_family = AF_INET6;
+    std::memcpy(&in6->sin6_addr, bytes, 16);
+    return sizeof(struct sockaddr_in6);
+}
+
+bool PeerAddress::operator==(const PeerAddress& other) const {
+    return valid == other.valid && std::memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+}
+
+bool PeerAddress::isV4() const {
+    return std::memcmp(bytes, v4_mapped_prefix, sizeof(v4_mapped_prefix)) == 0;
+}
+
+std::string PeerAddress::toString() const {
+    char text[INET6_ADDRSTRLEN];
+    if (!valid) {
+        return "0";
+    }
+    if (isV4()) {
+        inet_ntop(AF_INET, bytes + 12, text, sizeof(text));
+    } else {
+        inet_ntop(AF_INET6, bytes, text, sizeof(text));
+    }
+    return text;
+}
+
+AddressTable::AddressTable() : used_count(0), max_per_ip(0), max_per_prefix(0), max_rate(0), rate_window(1), max_sasl_failures(0), sasl_window(1) {
+    rehash(64);
+}
+
+/*
+ * @brief Set the limits enforced by admit(), 0 disables a limit
+ * @param max_per_ip Connections allowed from one address
+ * @param max_per_prefix Connections allowed from one IPv6 /64
+ * @param max_rate Connections allowed from one address per rate window
+ * @param rate_window The rate window in seconds
+ * @return void
+*/
+void AddressTable::setLimits(uint32_t max_per_ip, uint32_t max_per_prefix, uint32_t max_rate, uint32_t rate_window) {
+    this->max_per_ip = max_per_ip;
+    this->max_per_prefix = max_per_prefix;
+    this->max_rate = max_rate;
+    this->rate_window = rate_window > 0 ? rate_window : 1;
+}
+
+/*
+ * @brief Set the limit enforced by saslAllowed(), 0 disables it
+ * @param max_failures Failed logins allowed from one address per window
+ * @param window The window in seconds
+ * @return void
+*/
+void AddressTable::setSaslLimits(uint32_t max_failures, uint32_t window) {
+    max_sasl_failures = max_failures;
+    sasl_window = window > 0 ? window : 1;
+}
+
+uint32_t AddressTable::hash(const uint8_t* key, uint8_t prefix_len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < 16; ++i) {
+        h = (h ^ key[i]) * 16777619u;
+    }
+    return (h ^ prefix_len) * 16777619u;
+}
+
+void AddressTable::makeKey(const PeerAddress& address, uint8_t prefix_len, uint8_t* key) {
+    std::memset(key, 0, 16);
+    std::memcpy(key, address.bytes, prefix_len / 8);
+}
+
+AddressTable::Slot* AddressTable::find(const uint8_t* key, uint8_t prefix_len) {
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash(key, prefix_len) & mask; slots[i].used; i = (i + 1) & mask) {
+        if (slots[i].prefix_len == prefix_len && std::memcmp(slots[i].key, key, 16) == 0) {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * @brief Find a slot or claim an empty one, the table must have room (see admit)
+*/
+AddressTable::Slot& AddressTable::insert(const uint8_t* key, uint8_t prefix_len) {
+    size_t mask = slots.size() - 1;
+    size_t i = hash(key, prefix_len) & mask;
+    for (; slots[i].used; i = (i + 1) & mask) {
+        if (slots[i].prefix_len == prefix_len && std::memcmp(slots[i].key, key, 16) == 0) {
+            return slots[i];
+        }
+    }
+    std::memcpy(slots[i].key, key, 16);
+    slots[i].prefix_len = prefix_len;
+    slots[i].used = 1;
+    ++used_count;
+    return slots[i];
+}
+
+void AddressTable::rehash(size_t capacity) {
+    std::vector<Slot> old;
+    old.swap(slots);
+    Slot empty;
+    std::memset(&empty, 0, sizeof(empty));
+    slots.assign(capacity, empty);
+    used_count = 0;
+    for (size_t i = 0; i < old.size(); ++i) {
+        if (old[i].used) {
+            insert(old[i].key, old[i].prefix_len) = old[i];
+        }
+    }
+}
+
+/*
+ * @brief Count a new connection if the address is within its limits
+ * @param address The peer address
+ * @param now The current time
+ * @return ADMIT_OK if the connection was counted, the reason for refusing it otherwise
+*/
+AdmitResult AddressTable::admit(const PeerAddress& address, time_t now) {
+    if ((used_count + 2) * 4 > slots.size() * 3) {
+        rehash(slots.size() * 2);
+    }
+
+    uint8_t key[16];
+    makeKey(address, 128, key);
+    Slot& ip = insert(key, 128);
+    if (now - static_cast<time_t>(ip.window_start) >= static_cast<time_t>(rate_window)) {
+        ip.window_start = static_cast<uint32_t>(now);
+        ip.window_count = 0;
+    }
+    if (max_per_ip && ip.connections >= max_per_ip) {
+        return ADMIT_TOO_MANY;
+    }
+    if (max_rate && ip.window_count >= max_rate) {
+        return ADMIT_TOO_FAST;
+    }
+
+    Slot* prefix = NULL;
+    if (!address.isV4()) {
+        makeKey(address, 64, key);
+        prefix = &insert(key, 64);
+        if (max_per_prefix && prefix->connections >= max_per_prefix) {
+            return ADMIT_TOO_MANY;
+        }
+        prefix->connections++;
+    }
+    ip.connections++;
+    ip.window_count++;
+    return ADMIT_OK;
+}
+
+/*
+ * @brief Forget a connection counted by admit()
+ * @param address The peer address
+ * @return void
+*/
+void AddressTable::release(const PeerAddress& address) {
+    uint8_t key[16];
+    makeKey(address, 128, key);
+    Slot* ip = find(key, 128);
+    if (ip && ip->connections > 0) {
+        ip->connections--;
+    }
+    if (!address.isV4()) {
+        makeKey(address, 64, key);
+        Slot* prefix = find(key, 64);
+        if (prefix && prefix->connections > 0) {
+            prefix->connections--;
+        }
+    }
+}
+
+/*
+ * @brief Whether an address may still have a password checked
+ * @param address The peer address, counted by admit()
+ * @param now The current time
+ * @return False once it failed max_failures logins in the current window
+*/
+bool AddressTable::saslAllowed(const PeerAddress& address, time_t now) {
+    uint8_t key[16];
+    makeKey(address, 128, key);
+    Slot* ip = find(key, 128);
+    if (!ip || !max_sasl_failures || now - static_cast<time_t>(ip->sasl_window_start) >= static_cast<time_t>(sasl_window)) {
+        return true;
+    }
+    return ip->sasl_failures < max_sasl_failures;
+}
+
+/*
+ * @brief Count a failed login of an address
+ * @param address The peer address, counted by admit()
+ * @param now The current time
+ * @return void
+*/
+void AddressTable::saslFailed(const PeerAddress& address, time_t now) {
+    uint8_t key[16];
+    makeKey(address, 128, key);
+    Slot* ip = find(key, 128);
+    if (!ip) {
+        return;
+    }
+    if (now - static_cast<time_t>(ip->sasl_window_start) >= static_cast<time_t>(sasl_window)) {
+        ip->sasl_window_start = static_cast<uint32_t>(now);
+        ip->sasl_failures = 0;
+    }
+    if (ip->sasl_failures < 0xffff) {
+        ip->sasl_failures++;
+    }
+}
+
+/*
+ * @brief Drop the addresses with no connection and no recent attempt
+ * @param now The current time
+ * @return void
+*/
+void AddressTable::sweep(time_t now) {
+    for (size_t i = 0; i < slots.size(); ++i) {
+        Slot& slot = slots[i];
+        if (slot.used && slot.connections == 0 && now - static_cast<time_t>(slot.window_start) >= static_cast<time_t>(rate_window)
+            && (slot.sasl_failures == 0 || now - static_cast<time_t>(slot.sasl_window_start) >= static_cast<time_t>(sasl_window))) {
+            slot.used = 0;
+        }
+    }
+    size_t capacity = slots.size();
+    rehash(capacity);
+    while (capacity > 64 && used_count * 8 < capacity) {
+        capacity /= 2;
+    }
+    if (capacity != slots.size()) {
+        rehash(capacity);
+    }
+}
+
+size_t AddressTable::size() const {
+    return used_count;
+}
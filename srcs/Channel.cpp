@@ -1,6 +1,11 @@
 #include "ft_irc.hpp"
+#include <strings.h>
 
-Channel::Channel() : channelLimit(100), clientNumber(0), tmode(false), inviteOnly(false), name(""), topic(""), channel_password("") {}
+unsigned long Channel::max_members = CHANNEL_MAX_MEMBERS;
+unsigned long Channel::default_limit = CHANNEL_DEFAULT_LIMIT;
+unsigned long Channel::max_masks = MAX_CHANNEL_MASKS;
+
+Channel::Channel() : channelLimit(default_limit), clientNumber(0), tmode(false), inviteOnly(false), name(""), topic(""), topic_time(0), creation_time(time(NULL)), channel_password("") {}
 
 Channel::~Channel() {}
 
@@ -8,22 +13,71 @@ Channel& Channel::operator=(const Channel& other) {
     if (this != &other) {
         name = other.name;
         topic = other.topic;
+        topic_time = other.topic_time;
+        creation_time = other.creation_time;
         channel_password = other.channel_password;
         clients = other.clients;
         operators = other.operators;
+        history = other.history;
+        for (int i = 0; i < MASK_LIST_COUNT; ++i) {
+            mask_lists[i] = other.mask_lists[i];
+            mask_matchers[i] = other.mask_matchers[i];
+        }
+        mask_cache.clear();
     }
     return *this;
 }
 
 void Channel::broadcast(const std::string& send_msg) {
+    broadcast(Message(send_msg, current_time_ms()), -1);
+}
+
+/*
+ * @brief Queue a message to every member, rendered once per capability combination present
+ * @param message The message
+ * @param except_fd A member to skip, usually the sender, or -1
+ * @return void
+*/
+void Channel::broadcast(const Message& message, int except_fd) {
+    std::string rendered[MESSAGE_VARIANTS];
+    int lane = Message::lane(message.getLine());
+    for (std::map<std::string, Client*>::iterator it = clients.begin(); it != clients.end(); ++it) {
+        Client* client = it->second;
+        if (client && (except_fd < 0 || client->getFd() != except_fd)) {
+            unsigned int variant = Message::variant(client->getCaps());
+            if (rendered[variant].empty()) {
+                rendered[variant] = message.render(variant);
+            }
+            client->queueMessage(rendered[variant], lane);
+        }
+    }
+    t_metrics->counters[METRIC_BROADCASTS]++;
+    t_metrics->counters[METRIC_BROADCAST_FANOUT] += clients.size();
+    IRC_PROBE2(broadcast, name.c_str(), clients.size());
+    if (g_log_level >= LOG_DEBUG) {
+        std::cout << message.getLine() << std::endl;
+    }
+}
+
+/*
+ * @brief Offer a lossy notification to the members that support message tags
+ * @param message The message, only worth sending with its client tags
+ * @param except_fd A member to skip, usually the sender, or -1
+ * @param key Sender and target, a newer notification with the same key replaces a pending one
+ * @return void
+*/
+void Channel::broadcastEphemeral(const Message& message, int except_fd, const std::string& key) {
+    std::string rendered[MESSAGE_VARIANTS];
     for (std::map<std::string, Client*>::iterator it = clients.begin(); it != clients.end(); ++it) {
         Client* client = it->second;
-        if (client) {
-            int client_fd = client->getFd();
-            send(client_fd, send_msg.c_str(), send_msg.size(), 0);
+        if (client && (client->getCaps() & CAP_MESSAGE_TAGS) && (except_fd < 0 || client->getFd() != except_fd)) {
+            unsigned int variant = Message::variant(client->getCaps());
+            if (rendered[variant].empty()) {
+                rendered[variant] = message.render(variant);
+            }
+            client->queueEphemeral(key, rendered[variant]);
         }
     }
-    std::cout << send_msg << std::endl;
 }
 
 std::string Channel::getNamesList() {
@@ -71,6 +125,27 @@ void Channel::setTmode(bool tmode) {
     this->tmode = tmode;
 }
 
+/*
+ * @brief Set the limits shared by every channel, from the configuration
+ * @param max_members The most members a channel can hold
+ * @param default_limit The +l value of channels without +l, limits must stay below it
+ * @param max_masks The most entries of each +b/+e/+I list
+ * @return void
+*/
+void Channel::setLimits(unsigned long max_members, unsigned long default_limit, unsigned long max_masks) {
+    Channel::max_members = max_members;
+    Channel::default_limit = default_limit;
+    Channel::max_masks = max_masks;
+}
+
+unsigned long Channel::getDefaultLimit() {
+    return default_limit;
+}
+
+bool Channel::hasUserLimit() const {
+    return channelLimit < default_limit;
+}
+
 uint16_t Channel::getChannelLimit() const {
     return this->channelLimit;
 }
@@ -105,6 +180,23 @@ bool Channel::isInvited(const std::string& nickname) const {
 
 void Channel::setTopic(const std::string& new_topic) {
     this->topic = new_topic;
+    this->topic_time = time(NULL);
+}
+
+time_t Channel::getTopicTime() const {
+    return topic_time;
+}
+
+void Channel::setTopicTime(time_t topic_time) {
+    this->topic_time = topic_time;
+}
+
+time_t Channel::getCreationTime() const {
+    return creation_time;
+}
+
+void Channel::setCreationTime(time_t creation_time) {
+    this->creation_time = creation_time;
 }
 
 const std::string& Channel::getPassword() const {
@@ -132,7 +224,7 @@ std::vector<std::string>& Channel::getOperators() {
 }
 
 void Channel::addClient(const std::string& nickname, Client* client) {
-    if (clientNumber < 1000)
+    if (clientNumber < max_members)
     {
         clients[nickname] = client;
         clientNumber++;
@@ -140,13 +232,27 @@ void Channel::addClient(const std::string& nickname, Client* client) {
 }
 
 void Channel::removeClient(const std::string& nickname) {
-    if (clientNumber > 0)
+    if (clientNumber > 0 && clients.erase(nickname))
     {
-        clients.erase(nickname);
         clientNumber--;
     }
 }
 
+void Channel::renameClient(const std::string& old_nickname, const std::string& new_nickname) {
+    std::map<std::string, Client*>::iterator it = clients.find(old_nickname);
+    if (it == clients.end()) {
+        return;
+    }
+    Client* client = it->second;
+    clients.erase(it);
+    clients[new_nickname] = client;
+
+    std::vector<std::string>::iterator op = std::find(operators.begin(), operators.end(), old_nickname);
+    if (op != operators.end()) {
+        *op = new_nickname;
+    }
+}
+
 void Channel::addOperator(const std::string& nickname, std::string server_name) {
     if (isOperator(nickname) == false && clients.find(nickname) != clients.end()) {
         operators.push_back(nickname);
@@ -176,3 +282,94 @@ bool Channel::isOperator(const std::string& nickname) const {
 bool Channel::isClient(const std::string& nickname) const {
     return clients.find(nickname) != clients.end();
 }
+
+const ChannelHistory& Channel::getHistory() const {
+    return history;
+}
+
+ChannelHistory& Channel::getHistory() {
+    return history;
+}
+
+/*
+ * @brief Add a mask to the ban (+b), exception (+e) or invite exception (+I) list
+ * @param list The list, a MaskList
+ * @param mask The normalized mask
+ * @param setter Who set it
+ * @param time When it was set
+ * @return True if added, false if already listed or the list is full
+*/
+bool Channel::addMask(int list, const std::string& mask, const std::string& setter, time_t time) {
+    std::vector<ChannelMask>& masks = mask_lists[list];
+    if (masks.size() >= max_masks) {
+        return false;
+    }
+    for (size_t i = 0; i < masks.size(); ++i) {
+        if (strcasecmp(masks[i].mask.c_str(), mask.c_str()) == 0) {
+            return false;
+        }
+    }
+    ChannelMask entry;
+    entry.mask = mask;
+    entry.setter = setter;
+    entry.time = time;
+    masks.push_back(entry);
+    mask_matchers[list].add(mask);
+    mask_cache.clear();
+    return true;
+}
+
+/*
+ * @brief Remove a mask from a list
+ * @param list The list, a MaskList
+ * @param mask The normalized mask
+ * @return True if it was listed, false otherwise
+*/
+bool Channel::removeMask(int list, const std::string& mask) {
+    std::vector<ChannelMask>& masks = mask_lists[list];
+    for (size_t i = 0; i < masks.size(); ++i) {
+        if (strcasecmp(masks[i].mask.c_str(), mask.c_str()) == 0) {
+            masks.erase(masks.begin() + i);
+            mask_matchers[list].remove(mask);
+            mask_cache.clear();
+            return true;
+        }
+    }
+    return false;
+}
+
+const std::vector<ChannelMask>& Channel::getMasks(int list) const {
+    return mask_lists[list];
+}
+
+/*
+ * @brief Match a client against the lists, cached until a list or the client's mask changes
+ * @param client The client
+ * @return The cached status
+*/
+const Channel::MaskStatus& Channel::maskStatus(const Client& client) {
+    std::map<uint32_t, MaskStatus>::iterator it = mask_cache.find(client.getId());
+    if (it != mask_cache.end() && it->second.generation == client.getMaskGeneration()) {
+        return it->second;
+    }
+    if (it == mask_cache.end()) {
+        if (mask_cache.size() >= MASK_CACHE_MAX) {
+            mask_cache.clear(); // Entries of clients that left are only dropped here
+        }
+        it = mask_cache.insert(std::make_pair(client.getId(), MaskStatus())).first;
+    }
+
+    std::string subject = client.getMask();
+    it->second.generation = client.getMaskGeneration();
+    it->second.banned = mask_matchers[MASK_BAN].matches(subject) && !mask_matchers[MASK_EXCEPTION].matches(subject);
+    it->second.invite_exempt = mask_matchers[MASK_INVITE].matches(subject);
+    return it->second;
+}
+
+bool Channel::isBanned(const Client& client) {
+    return mask_matchers[MASK_BAN].size() > 0 && maskStatus(client).banned;
+}
+
+bool Channel::isInviteExempt(const Client& client) {
+    return mask_matchers[MASK_INVITE].size() > 0 && maskStatus(client).invite_exempt;
+}
@@ -0,0 +1,138 @@
+#include "ChannelHistory.hpp"
+#include <cstring>
+
+ChannelHistory::ChannelHistory() : start(0), max_lines(0), max_bytes(0) {}
+
+void ChannelHistory::setLimits(size_t max_lines, size_t max_bytes) {
+    this->max_lines = max_lines;
+    this->max_bytes = max_bytes;
+    while (!offsets.empty() && (offsets.size() > max_lines || byteSize() > max_bytes)) {
+        evictFront();
+    }
+    compact();
+}
+
+/*
+ * @brief Store a line, dropping the oldest ones once a cap is exceeded
+ * @param time_ms The time the message was received, in milliseconds
+ * @param sender_id The id of the sending client
+ * @param line The wire-formatted line, including the trailing CRLF
+ * @return void
+*/
+void ChannelHistory::append(uint64_t time_ms, uint32_t sender_id, const std::string& line) {
+    size_t record_size = sizeof(RecordHeader) + line.size();
+    if (max_lines == 0 || record_size > max_bytes) {
+        return;
+    }
+
+    while (!offsets.empty() && (offsets.size() + 1 > max_lines || byteSize() + record_size > max_bytes)) {
+        evictFront();
+    }
+    if (start > 0 && start >= buffer.size() / 2) {
+        compact();
+    }
+
+    RecordHeader header;
+    header.time_ms = time_ms;
+    header.sender_id = sender_id;
+    header.length = static_cast<uint32_t>(line.size());
+
+    size_t offset = buffer.size();
+    buffer.resize(offset + record_size);
+    std::memcpy(&buffer[offset], &header, sizeof(header));
+    std::memcpy(&buffer[offset + sizeof(header)], line.data(), line.size());
+    offsets.push_back(offset);
+}
+
+void ChannelHistory::clear() {
+    std::vector<char>().swap(buffer);
+    offsets.clear();
+    start = 0;
+}
+
+size_t ChannelHistory::size() const {
+    return offsets.size();
+}
+
+size_t ChannelHistory::byteSize() const {
+    return buffer.size() - start;
+}
+
+size_t ChannelHistory::memoryUsage() const {
+    return buffer.capacity() + offsets.size() * sizeof(size_t);
+}
+
+ChannelHistory::Entry ChannelHistory::at(size_t index) const {
+    RecordHeader header;
+    std::memcpy(&header, &buffer[offsets[index]], sizeof(header));
+
+    Entry entry;
+    entry.time_ms = header.time_ms;
+    entry.sender_id = header.sender_id;
+    entry.data = &buffer[offsets[index] + sizeof(header)];
+    entry.length = header.length;
+    return entry;
+}
+
+/*
+ * @brief Find the first entry received at or after a time
+ * @param time_ms The time in milliseconds
+ * @return The index of the entry, size() if there is none
+*/
+size_t ChannelHistory::lowerBound(uint64_t time_ms) const {
+    size_t low = 0;
+    size_t high = offsets.size();
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (at(mid).time_ms < time_ms) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * @brief Find the first entry received strictly after a time
+ * @param time_ms The time in milliseconds
+ * @return The index of the entry, size() if there is none
+*/
+size_t ChannelHistory::upperBound(uint64_t time_ms) const {
+    size_t low = 0;
+    size_t high = offsets.size();
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (at(mid).time_ms <= time_ms) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void ChannelHistory::evictFront() {
+    size_t next = offsets.size() > 1 ? offsets[1] : buffer.size();
+    offsets.pop_front();
+    start = next;
+    if (offsets.empty()) {
+        buffer.clear();
+        start = 0;
+    }
+}
+
+/*
+ * @brief Move the live records back to the front of the buffer
+ * @return void
+*/
+void ChannelHistory::compact() {
+    if (start == 0) {
+        return;
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + start);
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        offsets[i] -= start;
+    }
+    start = 0;
+}
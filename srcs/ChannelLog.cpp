@@ -0,0 +1,371 @@
+#include "ft_irc.hpp"
+#include "Serializer.hpp"
+#include <sys/file.h>
+#include <sys/stat.h>
+
+static std::string lowercase(const std::string& text) {
+    std::string lower = text;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    return lower;
+}
+
+static bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+ChannelLog::ChannelLog() : all_channels(false), running(false), queued_bytes(0), stopping(false), dropped(0) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&has_work, NULL);
+}
+
+ChannelLog::~ChannelLog() {
+    stop();
+    pthread_cond_destroy(&has_work);
+    pthread_mutex_destroy(&lock);
+}
+
+/*
+ * @brief Set the log directory and the channels to log, from the loop
+ * @param dir The directory, empty disables logging
+ * @param channels Channel names, "*" logs every channel
+ * @return void
+ * Changing the directory flushes and closes every file before the writer restarts
+*/
+void ChannelLog::configure(const std::string& dir, const std::vector<std::string>& channels) {
+    this->channels.clear();
+    all_channels = false;
+    for (size_t i = 0; i < channels.size(); ++i) {
+        all_channels = all_channels || channels[i] == "*";
+        this->channels.insert(lowercase(channels[i]));
+    }
+    bool wanted = !dir.empty() && (all_channels || !this->channels.empty());
+    if (running && (!wanted || dir != this->dir)) {
+        stop();
+    }
+    this->dir = dir;
+    if (!wanted || running) {
+        return;
+    }
+    if (mkdir(dir.c_str(), 0750) < 0 && errno != EEXIST) {
+        std::cerr << "Channel log: cannot create " << dir << ": " << strerror(errno) << std::endl;
+        return;
+    }
+
+    // Signals are for the event loop, like in the worker pool
+    sigset_t blocked, previous;
+    sigfillset(&blocked);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    running = pthread_create(&thread, NULL, threadMain, this) == 0;
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+bool ChannelLog::isLogged(const std::string& channel) const {
+    return running && (all_channels || channels.count(lowercase(channel)));
+}
+
+/*
+ * @brief Queue a line for the writer, never blocks the loop on disk
+ * @param channel The channel
+ * @param time_ms The time the message was received
+ * @param line The IRC line, a trailing CRLF is not stored
+ * @param length The length of the line
+ * @return void
+ * Records past CHANNEL_LOG_QUEUE_MAX bytes of backlog are dropped and counted
+*/
+void ChannelLog::append(const std::string& channel, uint64_t time_ms, const char* line, size_t length) {
+    if (!isLogged(channel)) {
+        return;
+    }
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+        --length;
+    }
+    Record record;
+    record.channel = lowercase(channel);
+    record.time_ms = time_ms;
+
+    pthread_mutex_lock(&lock);
+    if (queued_bytes + length > CHANNEL_LOG_QUEUE_MAX) {
+        if (dropped++ == 0) {
+            std::cerr << "Channel log: writer is behind, dropping records" << std::endl;
+        }
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    queue.push_back(record);
+    queue.back().line.assign(line, length);
+    size_t before = queued_bytes;
+    queued_bytes += CHANNEL_LOG_RECORD_HEADER + length;
+    // The writer waits for the first record, then for a full batch or the commit delay
+    if (queue.size() == 1 || (before < CHANNEL_LOG_BATCH_BYTES && queued_bytes >= CHANNEL_LOG_BATCH_BYTES)) {
+        pthread_cond_signal(&has_work);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * @brief Write everything queued, fsync and close the files, and join the writer
+ * @return void
+*/
+void ChannelLog::stop() {
+    if (!running) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_signal(&has_work);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    stopping = false;
+    running = false;
+}
+
+const std::string& ChannelLog::getDir() const {
+    return dir;
+}
+
+uint64_t ChannelLog::getDropped() {
+    pthread_mutex_lock(&lock);
+    uint64_t count = dropped;
+    pthread_mutex_unlock(&lock);
+    return count;
+}
+
+void* ChannelLog::threadMain(void* arg) {
+    static_cast<ChannelLog*>(arg)->work();
+    return NULL;
+}
+
+static struct timespec deadline_in(uint64_t ms) {
+    uint64_t at = current_time_ms() + ms;
+    struct timespec deadline;
+    deadline.tv_sec = at / 1000;
+    deadline.tv_nsec = (at % 1000) * 1000000;
+    return deadline;
+}
+
+void ChannelLog::work() {
+    std::vector<Record> batch;
+    uint64_t next_sync = current_time_ms() + CHANNEL_LOG_FSYNC_MS;
+    pthread_mutex_lock(&lock);
+    while (true) {
+        if (queue.empty() && !stopping) {
+            struct timespec deadline = deadline_in(next_sync - std::min(next_sync, current_time_ms()));
+            pthread_cond_timedwait(&has_work, &lock, &deadline);
+        }
+        // Group commit: let a burst build up into one write per file
+        if (!queue.empty() && !stopping && queued_bytes < CHANNEL_LOG_BATCH_BYTES) {
+            struct timespec deadline = deadline_in(CHANNEL_LOG_COMMIT_MS);
+            while (!stopping && queued_bytes < CHANNEL_LOG_BATCH_BYTES
+                   && pthread_cond_timedwait(&has_work, &lock, &deadline) != ETIMEDOUT) {
+            }
+        }
+        bool done = stopping;
+        batch.swap(queue);
+        queued_bytes = 0;
+        pthread_mutex_unlock(&lock);
+
+        writeBatch(batch);
+        batch.clear();
+        uint64_t now = current_time_ms();
+        if (done || now >= next_sync) {
+            syncFiles(now, done);
+            next_sync = now + CHANNEL_LOG_FSYNC_MS;
+        }
+        if (done) {
+            return;
+        }
+        pthread_mutex_lock(&lock);
+    }
+}
+
+/*
+ * @brief Append a batch, one write() per file for the records and one for the index entries
+ * @param batch The records, in arrival order
+ * @return void
+*/
+void ChannelLog::writeBatch(std::vector<Record>& batch) {
+    std::map<File*, std::pair<std::string, std::string> > pending;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        File* file = openFile(batch[i].channel);
+        if (!file) {
+            continue;
+        }
+        std::pair<std::string, std::string>& bytes = pending[file];
+        if (file->next_index == 0) {
+            put_u64(bytes.second, batch[i].time_ms);
+            put_u64(bytes.second, file->size + bytes.first.size());
+            file->next_index = CHANNEL_LOG_INDEX_STRIDE;
+        }
+        --file->next_index;
+        put_u32(bytes.first, static_cast<uint32_t>(batch[i].line.size()));
+        put_u64(bytes.first, batch[i].time_ms);
+        bytes.first += batch[i].line;
+    }
+
+    uint64_t now = current_time_ms();
+    for (std::map<File*, std::pair<std::string, std::string> >::iterator it = pending.begin(); it != pending.end(); ++it) {
+        File* file = it->first;
+        // The index is written after the records it points to, so it never points past the end of the log
+        if (!write_all(file->fd, it->second.first.data(), it->second.first.size())
+            || !write_all(file->index_fd, it->second.second.data(), it->second.second.size())) {
+            std::cerr << "Channel log: write failed: " << strerror(errno) << std::endl;
+            // Reopening checks the tail again, a torn record is cut off there
+            for (std::map<std::string, File>::iterator f = files.begin(); f != files.end(); ++f) {
+                if (&f->second == file) {
+                    close(file->fd);
+                    close(file->index_fd);
+                    files.erase(f);
+                    break;
+                }
+            }
+            continue;
+        }
+        file->size += it->second.first.size();
+        file->dirty = true;
+        file->last_write_ms = now;
+    }
+}
+
+/*
+ * @brief The open files of a channel, opened (and their tail checked) on first use
+ * @param channel The lowercase channel name
+ * @return The files, NULL if they cannot be opened
+ * The records after the last index entry are scanned: a record cut short by a crash is
+ * truncated away, and the count tells when the next index entry is due
+*/
+ChannelLog::File* ChannelLog::openFile(const std::string& channel) {
+    std::map<std::string, File>::iterator it = files.find(channel);
+    if (it != files.end()) {
+        return &it->second;
+    }
+
+    std::string log_path = channel_log_path(dir, channel);
+    std::string index_path = log_path.substr(0, log_path.size() - 4) + ".idx";
+    File file;
+    file.fd = open(log_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+    file.index_fd = open(index_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+    struct stat log_stat, index_stat;
+    if (file.fd < 0 || file.index_fd < 0 || fstat(file.fd, &log_stat) < 0 || fstat(file.index_fd, &index_stat) < 0) {
+        std::cerr << "Channel log: cannot open " << log_path << ": " << strerror(errno) << std::endl;
+        if (file.fd >= 0) {
+            close(file.fd);
+        }
+        if (file.index_fd >= 0) {
+            close(file.index_fd);
+        }
+        return NULL;
+    }
+
+    uint64_t start = CHANNEL_LOG_MAGIC_SIZE;
+    uint64_t index_size = index_stat.st_size - index_stat.st_size % CHANNEL_LOG_INDEX_ENTRY;
+    uint64_t records = 0;
+    std::string tail;
+    if (log_stat.st_size == 0) {
+        index_size = 0;
+        if (!write_all(file.fd, CHANNEL_LOG_MAGIC, CHANNEL_LOG_MAGIC_SIZE)) {
+            std::cerr << "Channel log: cannot write " << log_path << ": " << strerror(errno) << std::endl;
+            close(file.fd);
+            close(file.index_fd);
+            return NULL;
+        }
+    } else {
+        char magic[CHANNEL_LOG_MAGIC_SIZE];
+        if (pread(file.fd, magic, sizeof(magic), 0) != CHANNEL_LOG_MAGIC_SIZE || std::memcmp(magic, CHANNEL_LOG_MAGIC, sizeof(magic)) != 0) {
+            std::cerr << "Channel log: " << log_path << " is not a channel log, not writing to it" << std::endl;
+            close(file.fd);
+            close(file.index_fd);
+            return NULL;
+        }
+        if (index_size > 0) {
+            char entry[CHANNEL_LOG_INDEX_ENTRY];
+            if (pread(file.index_fd, entry, sizeof(entry), index_size - sizeof(entry)) == CHANNEL_LOG_INDEX_ENTRY) {
+                uint64_t offset;
+                std::memcpy(&offset, entry + sizeof(uint64_t), sizeof(offset));
+                if (offset >= CHANNEL_LOG_MAGIC_SIZE && offset < static_cast<uint64_t>(log_stat.st_size)) {
+                    start = offset;
+                } else {
+                    index_size -= CHANNEL_LOG_INDEX_ENTRY; // Points past a truncated log
+                }
+            }
+        }
+        tail.resize(log_stat.st_size - std::min<uint64_t>(start, log_stat.st_size));
+        if (!tail.empty() && pread(file.fd, &tail[0], tail.size(), start) != static_cast<ssize_t>(tail.size())) {
+            tail.clear();
+        }
+    }
+
+    uint64_t valid = 0;
+    while (tail.size() - valid >= CHANNEL_LOG_RECORD_HEADER) {
+        uint32_t length;
+        std::memcpy(&length, tail.data() + valid, sizeof(length));
+        if (tail.size() - valid - CHANNEL_LOG_RECORD_HEADER < length) {
+            break;
+        }
+        valid += CHANNEL_LOG_RECORD_HEADER + length;
+        ++records;
+    }
+    file.size = std::max<uint64_t>(start + valid, CHANNEL_LOG_MAGIC_SIZE);
+    if (log_stat.st_size != 0 && file.size != static_cast<uint64_t>(log_stat.st_size)) {
+        std::cerr << "Channel log: " << log_path << ": dropping a torn record at offset " << file.size << std::endl;
+    }
+    bool cut_log = log_stat.st_size != 0 && file.size != static_cast<uint64_t>(log_stat.st_size);
+    bool cut_index = index_size != static_cast<uint64_t>(index_stat.st_size);
+    bool repaired = true;
+    if (cut_log || cut_index) {
+        // Readers map the files under a shared lock on the log, pages cut from under a mapping would fault (SIGBUS)
+        repaired = lock_file(file.fd, LOCK_EX)
+            && (!cut_log || ftruncate(file.fd, file.size) == 0)
+            && (!cut_index || ftruncate(file.index_fd, index_size) == 0);
+        int saved_errno = errno;
+        flock(file.fd, LOCK_UN);
+        errno = saved_errno;
+    }
+    if (!repaired) {
+        std::cerr << "Channel log: cannot repair " << log_path << ": " << strerror(errno) << std::endl;
+        close(file.fd);
+        close(file.index_fd);
+        return NULL;
+    }
+    // An index entry is due when the records since the last one make up a full stride, or the index is empty
+    file.next_index = index_size == 0 && file.size == CHANNEL_LOG_MAGIC_SIZE ? 0
+                    : records >= CHANNEL_LOG_INDEX_STRIDE ? 0 : CHANNEL_LOG_INDEX_STRIDE - records;
+    file.dirty = false;
+    file.last_write_ms = current_time_ms();
+    return &(files[channel] = file);
+}
+
+/*
+ * @brief fsync the files written since the last call, and close idle ones
+ * @param now_ms The current time
+ * @param closing Whether to close every file
+ * @return void
+*/
+void ChannelLog::syncFiles(uint64_t now_ms, bool closing) {
+    std::map<std::string, File>::iterator it = files.begin();
+    while (it != files.end()) {
+        File& file = it->second;
+        if (file.dirty) {
+            fdatasync(file.fd);
+            fdatasync(file.index_fd);
+            file.dirty = false;
+        }
+        if (closing || now_ms - file.last_write_ms >= CHANNEL_LOG_IDLE_CLOSE_MS) {
+            close(file.fd);
+            close(file.index_fd);
+            files.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,215 @@
+#include "ChannelLogReader.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char* map_file(const std::string& path, size_t& size) {
+    size = 0;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        ::close(fd);
+        return NULL;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    size = st.st_size;
+    return static_cast<const char*>(data);
+}
+
+ChannelLogReader::ChannelLogReader() : log(NULL), log_size(0), index(NULL), index_size(0), index_mapped(0), lock_fd(-1) {}
+
+ChannelLogReader::~ChannelLogReader() {
+    close();
+}
+
+/*
+ * @brief Map a log and its index, a missing index only makes queries scan from the start
+ * @param log_path The .log file
+ * @param error Set to the reason on failure
+ * @return False if the log cannot be mapped or is not a channel log
+*/
+bool ChannelLogReader::open(const std::string& log_path, std::string& error) {
+    close();
+    lock_fd = ::open(log_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (lock_fd < 0 || !lock_file(lock_fd, LOCK_SH)) {
+        error = log_path + ": " + strerror(errno);
+        close();
+        return false;
+    }
+    log = map_file(log_path, log_size);
+    if (!log) {
+        error = log_path + ": " + (errno ? strerror(errno) : "empty");
+        return false;
+    }
+    if (log_size < CHANNEL_LOG_MAGIC_SIZE || std::memcmp(log, CHANNEL_LOG_MAGIC, CHANNEL_LOG_MAGIC_SIZE) != 0) {
+        error = log_path + ": not a channel log";
+        close();
+        return false;
+    }
+    std::string index_path = log_path.substr(0, log_path.size() - (log_path.size() >= 4 && log_path.compare(log_path.size() - 4, 4, ".log") == 0 ? 4 : 0)) + ".idx";
+    index = map_file(index_path, index_mapped);
+    index_size = index_mapped - index_mapped % CHANNEL_LOG_INDEX_ENTRY; // Ignore a torn last entry
+    return true;
+}
+
+void ChannelLogReader::close() {
+    if (log) {
+        munmap(const_cast<char*>(log), log_size);
+    }
+    if (index) {
+        munmap(const_cast<char*>(index), index_mapped);
+    }
+    if (lock_fd >= 0) {
+        ::close(lock_fd); // Releases the shared lock, after the mappings are gone
+    }
+    log = NULL;
+    index = NULL;
+    log_size = 0;
+    index_size = 0;
+    index_mapped = 0;
+    lock_fd = -1;
+}
+
+/*
+ * @brief Find where to start reading for a time
+ * @param from_ms The earliest time wanted
+ * @return The offset of the last indexed record at or before from_ms, the first record if there is none
+*/
+size_t ChannelLogReader::seek(uint64_t from_ms) const {
+    size_t low = 0;
+    size_t high = index_size / CHANNEL_LOG_INDEX_ENTRY;
+    size_t offset = CHANNEL_LOG_MAGIC_SIZE;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        uint64_t entry[2];
+        std::memcpy(entry, index + mid * CHANNEL_LOG_INDEX_ENTRY, sizeof(entry));
+        if (entry[0] <= from_ms) {
+            if (entry[1] >= CHANNEL_LOG_MAGIC_SIZE && entry[1] < log_size) {
+                offset = entry[1];
+            }
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return offset;
+}
+
+/*
+ * @brief Read the record at an offset and move past it
+ * @param offset The offset of a record, from seek() or a previous next()
+ * @param record Set to the record
+ * @return False at the end of the log, or at a record cut short by a crash in the middle of a write
+*/
+bool ChannelLogReader::next(size_t& offset, LogRecord& record) const {
+    if (offset > log_size || log_size - offset < CHANNEL_LOG_RECORD_HEADER) {
+        return false;
+    }
+    uint32_t length;
+    std::memcpy(&length, log + offset, sizeof(length));
+    if (log_size - offset - CHANNEL_LOG_RECORD_HEADER < length) {
+        return false;
+    }
+    std::memcpy(&record.time_ms, log + offset + sizeof(length), sizeof(record.time_ms));
+    record.line.assign(log + offset + CHANNEL_LOG_RECORD_HEADER, length);
+    offset += CHANNEL_LOG_RECORD_HEADER + length;
+    return true;
+}
+
+/*
+ * @brief The offset of the first record at or after a time
+ * @param time_ms The time
+ * @return The offset, the end of the readable log if there is none
+*/
+size_t ChannelLogReader::lowerBound(uint64_t time_ms) const {
+    size_t offset = seek(time_ms);
+    size_t at = offset;
+    LogRecord record;
+    while (next(offset, record)) {
+        if (record.time_ms >= time_ms) {
+            break;
+        }
+        at = offset;
+    }
+    return at;
+}
+
+/*
+ * @brief The offset of the first record after a time
+ * @param time_ms The time
+ * @return The offset, the end of the readable log if there is none
+*/
+size_t ChannelLogReader::upperBound(uint64_t time_ms) const {
+    return time_ms == UINT64_MAX ? log_size : lowerBound(time_ms + 1);
+}
+
+/*
+ * @brief Read the records of a time range
+ * @param from_ms The earliest time, inclusive
+ * @param to_ms The latest time, inclusive
+ * @param limit The most records to return
+ * @param records Filled with the records, oldest first
+ * @return The number of records added
+*/
+size_t ChannelLogReader::query(uint64_t from_ms, uint64_t to_ms, size_t limit, std::vector<LogRecord>& records) const {
+    size_t added = 0;
+    size_t offset = seek(from_ms);
+    LogRecord record;
+    while (added < limit && next(offset, record) && record.time_ms <= to_ms) {
+        if (record.time_ms >= from_ms) {
+            records.push_back(record);
+            ++added;
+        }
+    }
+    return added;
+}
+
+/*
+ * @brief flock a file, retrying when a signal interrupts the wait
+ * @param fd The file
+ * @param operation LOCK_SH or LOCK_EX
+ * @return False if the lock could not be taken
+*/
+bool lock_file(int fd, int operation) {
+    while (flock(fd, operation) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * @brief The log file of a channel, with characters unsafe in file names escaped
+ * @param dir The log directory
+ * @param channel The channel name
+ * @return "<dir>/<escaped lowercase channel>.log"
+*/
+std::string channel_log_path(const std::string& dir, const std::string& channel) {
+    static const char hex[] = "0123456789abcdef";
+    std::string name;
+    for (size_t i = 0; i < channel.size(); ++i) {
+        unsigned char c = channel[i];
+        if (c >= 'A' && c <= 'Z') {
+            name += static_cast<char>(c - 'A' + 'a');
+        } else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '#' || c == '-' || c == '_') {
+            name += static_cast<char>(c);
+        } else {
+            name += '%';
+            name += hex[c >> 4];
+            name += hex[c & 15];
+        }
+    }
+    return dir + "/" + name + ".log";
+}
@@ -0,0 +1,316 @@
+#include "ft_irc.hpp"
+#include "ChannelSnapshot.hpp"
+#include "Serializer.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char SNAPSHOT_MAGIC[8] = {'I', 'R', 'C', 'S', 'N', 'A', 'P', '\0'};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+enum {
+    SNAPSHOT_INVITE_ONLY = 1 << 0,
+    SNAPSHOT_TOPIC_RESTRICTED = 1 << 1
+};
+
+ChannelSnapshot::ChannelSnapshot() : data(NULL), data_size(0), channel_count(0), index_offset(0) {}
+
+ChannelSnapshot::~ChannelSnapshot() {
+    close();
+}
+
+/*
+ * @brief Map a snapshot file, only the header is validated here
+ * @param path The snapshot path
+ * @return True if a valid snapshot was mapped, false otherwise
+*/
+bool ChannelSnapshot::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    Header header;
+    std::memcpy(&header, map, sizeof(header));
+    uint64_t index_end = header.index_offset + static_cast<uint64_t>(header.channel_count) * sizeof(uint64_t);
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.version != SNAPSHOT_VERSION
+        || header.index_offset < sizeof(Header) || index_end > static_cast<uint64_t>(st.st_size)) {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    data = static_cast<const char*>(map);
+    data_size = st.st_size;
+    channel_count = header.channel_count;
+    index_offset = header.index_offset;
+    return true;
+}
+
+void ChannelSnapshot::close() {
+    if (data) {
+        munmap(const_cast<char*>(data), data_size);
+    }
+    data = NULL;
+    data_size = 0;
+    channel_count = 0;
+    index_offset = 0;
+    consumed.clear();
+}
+
+size_t ChannelSnapshot::size() const {
+    return channel_count;
+}
+
+uint64_t ChannelSnapshot::recordOffset(uint32_t index) const {
+    uint64_t offset;
+    std::memcpy(&offset, data + index_offset + index * sizeof(uint64_t), sizeof(offset));
+    return offset;
+}
+
+bool ChannelSnapshot::recordName(uint64_t offset, std::string& name) const {
+    if (offset < sizeof(Header) || offset >= index_offset) {
+        return false;
+    }
+    ByteReader reader(data + offset, index_offset - offset);
+    return reader.readString(name);
+}
+
+/*
+ * @brief Binary search the index for a channel, touching only the pages it needs
+ * @param name The channel name
+ * @param offset The offset of the record
+ * @param size The size of the record
+ * @return True if the channel is in the snapshot, false otherwise
+*/
+bool ChannelSnapshot::findRecord(const std::string& name, uint64_t& offset, size_t& size) const {
+    uint32_t low = 0;
+    uint32_t high = channel_count;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        std::string mid_name;
+        if (!recordName(recordOffset(mid), mid_name)) {
+            return false;
+        }
+        if (mid_name < name) {
+            low = mid + 1;
+        } else if (name < mid_name) {
+            high = mid;
+        } else {
+            offset = recordOffset(mid);
+            uint64_t next = mid + 1 < channel_count ? recordOffset(mid + 1) : index_offset;
+            if (next < offset || next > index_offset) {
+                return false;
+            }
+            size = next - offset;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * @brief Load a channel from the snapshot, each channel is restored at most once
+ * @param name The channel name
+ * @param channel The channel to fill
+ * @return True if the channel was restored, false otherwise
+*/
+bool ChannelSnapshot::restore(const std::string& name, Channel& channel) {
+    uint64_t offset;
+    size_t size;
+
+    if (!data || consumed.count(name) || !findRecord(name, offset, size)) {
+        return false;
+    }
+    consumed.insert(name);
+    return deserializeChannel(data + offset, size, channel);
+}
+
+void ChannelSnapshot::serializeChannel(const Channel& channel, std::string& out) {
+    put_string(out, channel.getName());
+    put_string(out, channel.getTopic());
+    put_u64(out, static_cast<uint64_t>(channel.getTopicTime()));
+    put_string(out, channel.getPassword());
+    put_u16(out, channel.getChannelLimit());
+
+    uint16_t flags = 0;
+    if (channel.getInviteOnly()) {
+        flags |= SNAPSHOT_INVITE_ONLY;
+    }
+    if (channel.getTmode()) {
+        flags |= SNAPSHOT_TOPIC_RESTRICTED;
+    }
+    put_u16(out, flags);
+
+    const std::vector<std::string>& operators = channel.getOperators();
+    put_u16(out, static_cast<uint16_t>(operators.size()));
+    for (size_t i = 0; i < operators.size(); ++i) {
+        put_string(out, operators[i]);
+    }
+
+    const std::map<std::string, Client*>& invited = channel.getInvitedClients();
+    put_u16(out, static_cast<uint16_t>(invited.size()));
+    for (std::map<std::string, Client*>::const_iterator it = invited.begin(); it != invited.end(); ++it) {
+        put_string(out, it->first);
+    }
+
+    for (int list = 0; list < MASK_LIST_COUNT; ++list) {
+        const std::vector<ChannelMask>& masks = channel.getMasks(list);
+        put_u16(out, static_cast<uint16_t>(masks.size()));
+        for (size_t i = 0; i < masks.size(); ++i) {
+            put_string(out, masks[i].mask);
+            put_string(out, masks[i].setter);
+            put_u64(out, static_cast<uint64_t>(masks[i].time));
+        }
+    }
+}
+
+bool ChannelSnapshot::deserializeChannel(const char* record, size_t size, Channel& channel) {
+    ByteReader reader(record, size);
+    std::string name, topic, key;
+    uint64_t topic_time;
+    uint16_t limit, flags, count;
+
+    if (!reader.readString(name) || !reader.readString(topic) || !reader.read(&topic_time, sizeof(topic_time))
+        || !reader.readString(key) || !reader.read(&limit, sizeof(limit)) || !reader.read(&flags, sizeof(flags))) {
+        return false;
+    }
+
+    channel.setName(name);
+    channel.setTopic(topic);
+    channel.setTopicTime(static_cast<time_t>(topic_time));
+    channel.setPassword(key);
+    channel.setChannelLimit(limit);
+    channel.setInviteOnly(flags & SNAPSHOT_INVITE_ONLY);
+    channel.setTmode(flags & SNAPSHOT_TOPIC_RESTRICTED);
+
+    if (!reader.read(&count, sizeof(count))) {
+        return false;
+    }
+    std::vector<std::string>& operators = channel.getOperators();
+    for (uint16_t i = 0; i < count; ++i) {
+        std::string nickname;
+        if (!reader.readString(nickname)) {
+            return false;
+        }
+        operators.push_back(nickname);
+    }
+
+    if (!reader.read(&count, sizeof(count))) {
+        return false;
+    }
+    for (uint16_t i = 0; i < count; ++i) {
+        std::string nickname;
+        if (!reader.readString(nickname)) {
+            return false;
+        }
+        channel.inviteClient(nickname, NULL);
+    }
+
+    // Records written before mask lists existed end here
+    for (int list = 0; list < MASK_LIST_COUNT && reader.cur != reader.end; ++list) {
+        if (!reader.read(&count, sizeof(count))) {
+            return false;
+        }
+        for (uint16_t i = 0; i < count; ++i) {
+            std::string mask, setter;
+            uint64_t time;
+            if (!reader.readString(mask) || !reader.readString(setter) || !reader.read(&time, sizeof(time))) {
+                return false;
+            }
+            channel.addMask(list, mask, setter, static_cast<time_t>(time));
+        }
+    }
+    return true;
+}
+
+/*
+ * @brief Encode the live channels, plus the snapshot channels nobody has joined since startup
+ * @param channels The live channels
+ * @return The snapshot file contents
+*/
+std::string ChannelSnapshot::build(const std::map<std::string, Channel>& channels) const {
+    std::map<std::string, std::string> records;
+
+    for (uint32_t i = 0; data && i < channel_count; ++i) {
+        uint64_t offset = recordOffset(i);
+        uint64_t next = i + 1 < channel_count ? recordOffset(i + 1) : index_offset;
+        std::string name;
+        if (next < offset || !recordName(offset, name) || consumed.count(name) || channels.count(name)) {
+            continue;
+        }
+        records[name].assign(data + offset, next - offset);
+    }
+    for (std::map<std::string, Channel>::const_iterator it = channels.begin(); it != channels.end(); ++it) {
+        std::string& record = records[it->first];
+        record.clear();
+        serializeChannel(it->second, record);
+    }
+
+    std::string out(sizeof(Header), '\0');
+    std::vector<uint64_t> offsets;
+    offsets.reserve(records.size());
+    for (std::map<std::string, std::string>::const_iterator it = records.begin(); it != records.end(); ++it) {
+        offsets.push_back(out.size());
+        out += it->second;
+    }
+
+    Header header;
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.channel_count = static_cast<uint32_t>(offsets.size());
+    header.index_offset = out.size();
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        put_u64(out, offsets[i]);
+    }
+    std::memcpy(&out[0], &header, sizeof(header));
+    return out;
+}
+
+/*
+ * @brief Write a file crash-consistently: write a temporary file, fsync it, then rename it
+ * @param path The destination path
+ * @param contents The file contents
+ * @return True on success, false otherwise
+*/
+bool ChannelSnapshot::writeFile(const std::string& path, const std::string& contents) {
+    std::string tmp_path = path + ".tmp." + intToString(getpid());
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < contents.size()) {
+        ssize_t ret = write(fd, contents.data() + written, contents.size() - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ::close(fd);
+            unlink(tmp_path.c_str());
+            return false;
+        }
+        written += ret;
+    }
+
+    bool synced = fsync(fd) == 0;
+    if (::close(fd) < 0 || !synced) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return rename(tmp_path.c_str(), path.c_str()) == 0;
+}
@@ -1,10 +1,19 @@
 #include "ft_irc.hpp"
 
-Client::Client() : nickname(""), username(""), realname(""), authenticated(false), admin(false), fd(-1),
+static uint32_t next_client_id = 1;
+size_t Client::max_nickname_length = NICK_LENGTH;
+
+void Client::setMaxNicknameLength(size_t length) {
+    max_nickname_length = length;
+}
+
+Client::Client() : nickname(""), username(""), realname(""), authenticated(false), admin(false), bulk_partial(false), fd(-1), id(0), route_fd(-1), recv_load(0), hostname("localhost"), host_pending(false),
+                   cap_negotiating(false), caps(0), sasl_state(SASL_NONE), sasl_failures(0), mask_generation(0), flood_tokens(-1), flood_refill_ms(0), ping_sent(0),
                    registered(false), has_nick(false), has_user(false), time_to_connect(time(NULL)), 
                    last_activity_time(time(NULL)) {}
 
-Client::Client(int fd) : nickname(""), username(""), realname(""), authenticated(false), admin(false), fd(fd), 
+Client::Client(int fd) : nickname(""), username(""), realname(""), authenticated(false), admin(false), bulk_partial(false), fd(fd), id(next_client_id++), route_fd(-1), recv_load(0), hostname("localhost"), host_pending(false),
+                         cap_negotiating(false), caps(0), sasl_state(SASL_NONE), sasl_failures(0), mask_generation(0), flood_tokens(-1), flood_refill_ms(0), ping_sent(0),
                          registered(false), has_nick(false), has_user(false), time_to_connect(time(NULL)), 
                          last_activity_time(time(NULL)) {}
 
@@ -18,7 +27,29 @@ Client& Client::operator=(const Client& other) {
         authenticated = other.authenticated;
         admin = other.admin;
         fd = other.fd;
+        id = other.id;
+        uid = other.uid;
+        route_fd = other.route_fd;
+        recv_load = other.recv_load;
+        address = other.address;
+        hostname = other.hostname;
+        host_pending = other.host_pending;
+        cap_negotiating = other.cap_negotiating;
+        caps = other.caps;
+        account = other.account;
+        resume_token = other.resume_token;
+        sasl_state = other.sasl_state;
+        sasl_buffer = other.sasl_buffer;
+        sasl_failures = other.sasl_failures;
+        mask_generation = other.mask_generation;
+        flood_tokens = other.flood_tokens;
+        flood_refill_ms = other.flood_refill_ms;
+        ping_sent = other.ping_sent;
         buffer = other.buffer;
+        sendq = other.sendq;
+        controlq = other.controlq;
+        bulk_partial = other.bulk_partial;
+        ephemeral = other.ephemeral;
     }
     return *this;
 }
@@ -28,7 +59,7 @@ std::string Client::getNickname() const {
 }
 
 void Client::setNickname(const std::string& nickname) {
-    if (nickname.length() < 1 || nickname.length() > 9) {
+    if (nickname.length() < 1 || nickname.length() > max_nickname_length) {
         return;
     }
 
@@ -38,6 +69,7 @@ void Client::setNickname(const std::string& nickname) {
         }
     }
     this->nickname = nickname;
+    ++mask_generation;
 }
 
 std::string Client::getUsername() const {
@@ -51,6 +83,7 @@ void Client::setUsername(const std::string& username) {
         }
     }
     this->username = username;
+    ++mask_generation;
 }
 
 void Client::setRealname(const std::string& realname) {
@@ -94,10 +127,346 @@ void Client::setBuffer(const std::string& buffer) {
     this->buffer = buffer;
 }
 
+/*
+ * @brief Take the next complete line out of the input buffer
+ * @param line The line, without its trailing newline
+ * @return True if a complete line was available, false otherwise
+*/
+bool Client::extractLine(std::string& line) {
+    size_t pos = buffer.find('\n');
+    if (pos == std::string::npos) {
+        return false;
+    }
+    line = buffer.substr(0, pos);
+    buffer.erase(0, pos + 1);
+    return true;
+}
+
+/*
+ * @brief Append a message to one lane of the client's output, it is written on the next POLLOUT
+ * @param msg The message to queue
+ * @param lane LANE_CONTROL or LANE_BULK, a detached client buffers both in order for its replay
+ * @return void
+*/
+void Client::queueMessage(const std::string& msg, int lane) {
+    if (route_fd >= 0) {
+        return; // Remote clients are reached through their server link
+    }
+    std::string& queue = (lane == LANE_CONTROL && fd >= 0) ? controlq : sendq;
+    queue += msg;
+    IRC_PROBE3(enqueue, fd, msg.size(), queue.size());
+}
+
+void Client::queueMessage(const char* data, size_t length) {
+    if (route_fd >= 0) {
+        return;
+    }
+    sendq.append(data, length);
+    IRC_PROBE3(enqueue, fd, length, sendq.size());
+}
+
+/*
+ * @brief Replace all pending output, which may start in the middle of a line
+ * @param sendq The bytes to write, as bulk traffic
+ * @return void
+*/
+void Client::setSendQueue(const std::string& sendq) {
+    this->sendq = sendq;
+    controlq.clear();
+    bulk_partial = !sendq.empty();
+}
+
+const PeerAddress& Client::getAddress() const {
+    return address;
+}
+
+void Client::setAddress(const PeerAddress& address) {
+    this->address = address;
+}
+
+const std::string& Client::getHostname() const {
+    return hostname;
+}
+
+void Client::setHostname(const std::string& hostname) {
+    this->hostname = hostname;
+    ++mask_generation;
+}
+
+/*
+ * @brief Get the nick!user@host channel masks are matched against
+ * @return The mask
+*/
+std::string Client::getMask() const {
+    return nickname + "!" + (username.empty() ? "*" : username) + "@" + hostname;
+}
+
+uint32_t Client::getMaskGeneration() const {
+    return mask_generation;
+}
+
+bool Client::isHostPending() const {
+    return host_pending;
+}
+
+void Client::setHostPending(bool pending) {
+    host_pending = pending;
+}
+
+bool Client::isCapNegotiating() const {
+    return cap_negotiating;
+}
+
+void Client::setCapNegotiating(bool negotiating) {
+    cap_negotiating = negotiating;
+}
+
+unsigned int Client::getCaps() const {
+    return caps;
+}
+
+void Client::setCaps(unsigned int caps) {
+    this->caps = caps;
+}
+
+const std::string& Client::getAccount() const {
+    return account;
+}
+
+void Client::setAccount(const std::string& account) {
+    this->account = account;
+}
+
+int Client::getSaslState() const {
+    return sasl_state;
+}
+
+void Client::setSaslState(int state) {
+    sasl_state = state;
+}
+
+std::string& Client::getSaslBuffer() {
+    return sasl_buffer;
+}
+
+/*
+ * @brief Count a failed AUTHENTICATE attempt on this connection
+ * @return The number of failed attempts so far
+*/
+unsigned int Client::addSaslFailure() {
+    return ++sasl_failures;
+}
+
+const std::string& Client::getResumeToken() const {
+    return resume_token;
+}
+
+void Client::setResumeToken(const std::string& token) {
+    resume_token = token;
+}
+
+/*
+ * @brief Spend a token of the client's flood bucket, refilled at rate tokens per second up to burst
+ * @param now_ms The current time in milliseconds
+ * @param rate The refill rate, 0 disables flood control
+ * @param burst The bucket size
+ * @return True if the client may send the line, false if it is flooding
+*/
+bool Client::takeFloodToken(uint64_t now_ms, unsigned long rate, unsigned long burst) {
+    if (rate == 0) {
+        return true;
+    }
+    if (flood_tokens < 0) {
+        flood_tokens = burst;
+    } else {
+        flood_tokens = std::min<double>(burst, flood_tokens + (now_ms - flood_refill_ms) * rate / 1000.0);
+    }
+    flood_refill_ms = now_ms;
+    if (flood_tokens < 1) {
+        return false;
+    }
+    flood_tokens -= 1;
+    return true;
+}
+
+time_t Client::getPingSent() const {
+    return ping_sent;
+}
+
+void Client::setPingSent(time_t ping_sent) {
+    this->ping_sent = ping_sent;
+}
+
+void Client::addRecvLoad(size_t bytes) {
+    recv_load += bytes;
+}
+
+/*
+ * @brief Halve the received byte count, so the load follows recent traffic
+ * @return void
+*/
+void Client::decayRecvLoad() {
+    recv_load /= 2;
+}
+
+uint64_t Client::getRecvLoad() const {
+    return recv_load;
+}
+
+size_t Client::getSendQueueSize() const {
+    return sendq.size();
+}
+
+size_t Client::getControlQueueSize() const {
+    return controlq.size();
+}
+
+/*
+ * @brief All pending output, in the order flushSendQueue() would write it
+ * @return The bytes still to be written, lossy notifications aside
+*/
+std::string Client::getPendingOutput() const {
+    if (!bulk_partial || sendq.empty()) {
+        return controlq + sendq;
+    }
+    size_t line_end = sendq.find('\n');
+    size_t rest = line_end == std::string::npos ? sendq.size() : line_end + 1;
+    return sendq.substr(0, rest) + controlq + sendq.substr(rest);
+}
+
+/*
+ * @brief Forget the rest of a bulk line the socket stopped in the middle of
+ * @return void
+ * For output that moves to another connection, which never saw the start of that line
+*/
+void Client::dropPartialLine() {
+    if (bulk_partial && !sendq.empty()) {
+        size_t line_end = sendq.find('\n');
+        sendq.erase(0, line_end == std::string::npos ? sendq.size() : line_end + 1);
+    }
+    bulk_partial = false;
+}
+
+bool Client::hasPendingOutput() const {
+    return !sendq.empty() || !controlq.empty() || !ephemeral.empty();
+}
+
+/*
+ * @brief Queue a lossy notification, a newer one with the same key replaces it until it is written
+ * @param key Sender and target of the notification
+ * @param msg The rendered line
+ * @return False if it was dropped: the send queue is past TAGMSG_SENDQ_WATERMARK, too many are pending, or there is no socket
+ * The notifications wait for the send queue to drain, so they never delay regular traffic
+*/
+bool Client::queueEphemeral(const std::string& key, const std::string& msg) {
+    if (route_fd >= 0 || fd < 0) {
+        return false;
+    }
+    if (sendq.size() > TAGMSG_SENDQ_WATERMARK || (ephemeral.size() >= TAGMSG_PENDING_MAX && !ephemeral.count(key))) {
+        t_metrics->counters[METRIC_TAGMSG_DROPPED]++;
+        return false;
+    }
+    if (!ephemeral.insert(std::make_pair(key, msg)).second) {
+        ephemeral[key] = msg;
+        t_metrics->counters[METRIC_TAGMSG_REPLACED]++;
+    }
+    return true;
+}
+
+/*
+ * @brief Write the start of one lane
+ * @param lane The control or bulk queue
+ * @param length The number of bytes to try
+ * @return The number of bytes written, 0 if the socket is full, -1 if it is broken
+*/
+ssize_t Client::writeLane(std::string& lane, size_t length) {
+    ssize_t bytes_sent = send(fd, lane.data(), length, 0);
+    if (bytes_sent < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    if (&lane == &sendq && bytes_sent > 0) {
+        bulk_partial = lane[bytes_sent - 1] != '\n';
+    }
+    lane.erase(0, bytes_sent);
+    t_metrics->counters[METRIC_BYTES_OUT] += bytes_sent;
+    IRC_PROBE3(flush, fd, bytes_sent, lane.size());
+    return bytes_sent;
+}
+
+/*
+ * @brief Write as much pending output as the socket accepts: control traffic, then bulk, then lossy notifications
+ * @return False if the socket is broken, true otherwise
+ * Each lane keeps its order. A bulk line already started is finished first, so lines never interleave
+*/
+bool Client::flushSendQueue() {
+    if (bulk_partial && !sendq.empty()) {
+        size_t line_end = sendq.find('\n');
+        size_t length = line_end == std::string::npos ? sendq.size() : line_end + 1;
+        ssize_t sent = writeLane(sendq, length);
+        if (sent < 0 || static_cast<size_t>(sent) < length) {
+            return sent >= 0;
+        }
+    }
+    if (!controlq.empty()) {
+        ssize_t sent = writeLane(controlq, controlq.size());
+        if (sent < 0 || !controlq.empty()) {
+            return sent >= 0;
+        }
+    }
+
+    if (sendq.empty() && !ephemeral.empty()) {
+        for (std::map<std::string, std::string>::iterator it = ephemeral.begin(); it != ephemeral.end(); ++it) {
+            sendq += it->second;
+        }
+        ephemeral.clear();
+    }
+    return sendq.empty() || writeLane(sendq, sendq.size()) >= 0;
+}
+
 int Client::getFd() const {
     return fd;
 }
 
+uint32_t Client::getId() const {
+    return id;
+}
+
+/*
+ * @brief Restore the id of a client handed over by a previous process
+ * @param id The id to restore
+ * @return void
+*/
+void Client::setId(uint32_t id) {
+    this->id = id;
+    if (id >= next_client_id) {
+        next_client_id = id + 1;
+    }
+}
+
+const std::string& Client::getUid() const {
+    return uid;
+}
+
+void Client::setUid(const std::string& uid) {
+    this->uid = uid;
+}
+
+/*
+ * @brief Check if the client is connected to another server of the network
+ * @return True if the client is remote, false otherwise
+*/
+bool Client::isRemote() const {
+    return route_fd >= 0;
+}
+
+int Client::getRouteFd() const {
+    return route_fd;
+}
+
+void Client::setRouteFd(int route_fd) {
+    this->route_fd = route_fd;
+}
+
 void Client::setFd(int fd) {
     this->fd = fd;
 }
@@ -0,0 +1,399 @@
+#include "ft_irc.hpp"
+#include <fstream>
+
+struct ConfigKey {
+    const char* name;
+    unsigned long ServerConfig::*field;
+    unsigned long min;
+    unsigned long max;
+};
+
+struct ClassKey {
+    const char* name;
+    unsigned long ConnectionClass::*field;
+    unsigned long min;
+    unsigned long max;
+};
+
+static const ConfigKey config_keys[] = {
+    { "backlog", &ServerConfig::backlog, 1, 65535 },
+    { "worker_threads", &ServerConfig::worker_threads, 0, 64 },
+    { "max_clients", &ServerConfig::max_clients, 1, 1000000 },
+    { "max_connections_per_ip", &ServerConfig::max_connections_per_ip, 1, 1000000 },
+    { "max_connections_per_prefix", &ServerConfig::max_connections_per_prefix, 1, 1000000 },
+    { "connect_rate_limit", &ServerConfig::connect_rate_limit, 1, 1000000 },
+    { "connect_rate_window", &ServerConfig::connect_rate_window, 1, 86400 },
+    { "nick_length", &ServerConfig::nick_length, 1, 30 },
+    { "channel_max_members", &ServerConfig::channel_max_members, 1, 65535 },
+    { "channel_default_limit", &ServerConfig::channel_default_limit, 11, 65535 },
+    { "channel_max_masks", &ServerConfig::channel_max_masks, 0, 65535 },
+    { "history_max_lines", &ServerConfig::history_max_lines, 0, 1000000 },
+    { "history_max_bytes", &ServerConfig::history_max_bytes, 0, 1UL << 30 },
+    { "registration_timeout", &ServerConfig::registration_timeout, 0, 86400 },
+    { "resolve_deadline_ms", &ServerConfig::resolve_deadline_ms, 0, 60000 },
+    { "sasl_max_failures", &ServerConfig::sasl_max_failures, 1, 1000 },
+    { "sasl_ip_failures", &ServerConfig::sasl_ip_failures, 0, 1000000 },
+    { "sasl_failure_window", &ServerConfig::sasl_failure_window, 1, 86400 },
+    { "resume_grace", &ServerConfig::resume_grace, 0, 86400 },
+    { "resume_buffer", &ServerConfig::resume_buffer, 512, 1UL << 30 },
+    { "lag_defer_accept_ms", &ServerConfig::lag_defer_accept_ms, 1, 60000 },
+    { "lag_throttle_ms", &ServerConfig::lag_throttle_ms, 1, 60000 },
+    { "lag_reject_ms", &ServerConfig::lag_reject_ms, 1, 60000 },
+    { "latency_sample_rate", &ServerConfig::latency_sample_rate, 0, 1000000 },
+    { "slowlog_threshold_us", &ServerConfig::slowlog_threshold_us, 0, 60000000 }
+};
+
+static const ClassKey class_keys[] = {
+    { "sendq", &ConnectionClass::sendq, 512, 1UL << 30 },
+    { "flood_burst", &ConnectionClass::flood_burst, 1, 100000 },
+    { "flood_rate", &ConnectionClass::flood_rate, 0, 100000 },
+    { "ping_interval", &ConnectionClass::ping_interval, 0, 86400 },
+    { "ping_timeout", &ConnectionClass::ping_timeout, 1, 86400 }
+};
+
+static const char* class_names[CLASS_COUNT] = { "user", "account" };
+
+static bool parse_number(const std::string& text, unsigned long min, unsigned long max, unsigned long& value) {
+    if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) {
+        return false;
+    }
+    char* end = NULL;
+    errno = 0;
+    value = std::strtoul(text.c_str(), &end, 10);
+    return errno == 0 && *end == '\0' && value >= min && value <= max;
+}
+
+LinkBlock::LinkBlock() : port(0), compress(false) {}
+
+/*
+ * @brief Check a TS6 server id: a digit, then two digits or uppercase letters
+ * @param sid The server id
+ * @return True if it is valid
+*/
+static bool is_valid_server_id(const std::string& sid) {
+    return sid.size() == 3 && std::isdigit(static_cast<unsigned char>(sid[0]))
+        && (std::isdigit(static_cast<unsigned char>(sid[1])) || std::isupper(static_cast<unsigned char>(sid[1])))
+        && (std::isdigit(static_cast<unsigned char>(sid[2])) || std::isupper(static_cast<unsigned char>(sid[2])));
+}
+
+static bool is_valid_server_name(const std::string& name) {
+    return !name.empty() && name.size() <= HOSTLEN && name.find_first_of(" ,*?!@") == std::string::npos && name[0] != ':';
+}
+
+/*
+ * @brief Read one key of a "[link <name>]" section
+ * @param link The link being read
+ * @param key The key
+ * @param value The value
+ * @param valid Set to whether the value is valid
+ * @return False if the key is unknown
+*/
+static bool parse_link_key(LinkBlock& link, const std::string& key, const std::string& value, bool& valid) {
+    if (key == "sid") {
+        link.sid = value;
+        valid = is_valid_server_id(value);
+    } else if (key == "host") {
+        link.host = value;
+        valid = !value.empty() && value.find(' ') == std::string::npos;
+    } else if (key == "port") {
+        valid = parse_number(value, 1, 65535, link.port);
+    } else if (key == "password") {
+        link.password = value;
+        valid = !value.empty() && value.find(' ') == std::string::npos;
+    } else if (key == "compress") {
+        link.compress = value == "yes";
+        valid = value == "yes" || value == "no";
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * @brief Check the link sections once the whole file is read
+ * @param config The configuration
+ * @param error Set to the reason on failure
+ * @return True if every link is complete and none clashes with another or with this server
+*/
+static bool validate_links(const ServerConfig& config, std::string& error) {
+    if (!config.links.empty() && config.server_id.empty()) {
+        error = "server_id must be set to link servers";
+        return false;
+    }
+    for (size_t i = 0; i < config.links.size(); ++i) {
+        const LinkBlock& link = config.links[i];
+        if (link.sid.empty() || link.host.empty() || link.password.empty()) {
+            error = "link " + link.name + " needs a sid, a host and a password";
+            return false;
+        }
+        if (link.sid == config.server_id) {
+            error = "link " + link.name + " has the server_id of this server";
+            return false;
+        }
+        for (size_t j = 0; j < i; ++j) {
+            if (config.links[j].name == link.name || config.links[j].sid == link.sid) {
+                error = "links " + config.links[j].name + " and " + link.name + " share a name or a sid";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+ServerConfig::ServerConfig() {
+    backlog = BACKLOG;
+    worker_threads = WORKER_THREADS;
+    max_clients = MAX_CLIENTS;
+    max_connections_per_ip = MAX_CONNECTIONS_PER_IP;
+    max_connections_per_prefix = MAX_CONNECTIONS_PER_PREFIX;
+    connect_rate_limit = CONNECT_RATE_LIMIT;
+    connect_rate_window = CONNECT_RATE_WINDOW;
+    nick_length = NICK_LENGTH;
+    channel_max_members = CHANNEL_MAX_MEMBERS;
+    channel_default_limit = CHANNEL_DEFAULT_LIMIT;
+    channel_max_masks = MAX_CHANNEL_MASKS;
+    history_max_lines = HISTORY_MAX_LINES;
+    history_max_bytes = HISTORY_MAX_BYTES;
+    registration_timeout = REGISTRATION_TIMEOUT;
+    resolve_deadline_ms = RESOLVE_DEADLINE_MS;
+    sasl_max_failures = SASL_MAX_FAILURES;
+    sasl_ip_failures = SASL_IP_FAILURES;
+    sasl_failure_window = SASL_FAILURE_WINDOW;
+    resume_grace = RESUME_GRACE;
+    resume_buffer = RESUME_BUFFER_MAX;
+    lag_defer_accept_ms = LAG_DEFER_ACCEPT_MS;
+    lag_throttle_ms = LAG_THROTTLE_MS;
+    lag_reject_ms = LAG_REJECT_MS;
+    latency_sample_rate = LATENCY_SAMPLE_RATE;
+    slowlog_threshold_us = SLOWLOG_THRESHOLD_US;
+    filter_file = FILTER_PATH;
+    log_level = LOG_INFO;
+    for (int i = 0; i < CLASS_COUNT; ++i) {
+        classes[i].sendq = SENDQ_MAX;
+        classes[i].flood_burst = FLOOD_BURST;
+        classes[i].flood_rate = FLOOD_RATE;
+        classes[i].ping_interval = PING_INTERVAL;
+        classes[i].ping_timeout = PING_TIMEOUT;
+    }
+}
+
+/*
+ * @brief Read the configuration at startup, the defaults are used if the file does not exist
+ * @param path The file path
+ * @return The configuration, throws if the file exists but is invalid
+*/
+ServerConfig* read_startup_config(const std::string& path) {
+    ServerConfig* config = new ServerConfig();
+    std::string error;
+    if (access(path.c_str(), F_OK) == 0 && !config->load(path, error)) {
+        delete config;
+        throw std::runtime_error(error);
+    }
+    return config;
+}
+
+/*
+ * @brief Read a configuration file over the defaults: "key = value" lines, "[class <name>]" and "[link <name>]" sections
+ * @param path The file path
+ * @param error Set to "<path>:<line>: <reason>" on failure
+ * @return True if the whole file is valid, false otherwise (the config must then be discarded)
+*/
+bool ServerConfig::load(const std::string& path, std::string& error) {
+    std::ifstream file(path.c_str());
+    if (!file) {
+        error = path + ": cannot be read";
+        return false;
+    }
+
+    int section = -1;
+    bool in_link = false;
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        std::string where = path + ":" + intToString(number) + ": ";
+        line = line.substr(0, line.find('#'));
+        size_t begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) {
+            continue;
+        }
+        line = line.substr(begin, line.find_last_not_of(" \t\r") - begin + 1);
+
+        if (line[0] == '[') {
+            std::istringstream header(line.substr(1, line.find(']') - 1));
+            std::string kind, name;
+            header >> kind >> name;
+            section = -1;
+            for (int i = 0; i < CLASS_COUNT; ++i) {
+                if (kind == "class" && name == class_names[i]) {
+                    section = i;
+                }
+            }
+            in_link = kind == "link" && is_valid_server_name(name);
+            if (in_link) {
+                links.push_back(LinkBlock());
+                links.back().name = name;
+            }
+            if ((section < 0 && !in_link) || line[line.size() - 1] != ']') {
+                error = where + "unknown section " + line;
+                return false;
+            }
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            error = where + "expected key = value";
+            return false;
+        }
+        std::string key = line.substr(0, equals);
+        std::string value = line.substr(equals + 1);
+        key.erase(key.find_last_not_of(" \t") + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+
+        bool known = false;
+        bool valid = false;
+        if (in_link) {
+            known = parse_link_key(links.back(), key, value, valid);
+        } else if (section >= 0) {
+            for (size_t i = 0; i < sizeof(class_keys) / sizeof(class_keys[0]) && !known; ++i) {
+                known = key == class_keys[i].name;
+                if (known) {
+                    valid = parse_number(value, class_keys[i].min, class_keys[i].max, classes[section].*class_keys[i].field);
+                }
+            }
+        } else if (key == "plugin") {
+            known = true;
+            valid = !value.empty();
+            plugins.push_back(value);
+        } else if (key == "channel_log_dir") {
+            known = true;
+            valid = true;
+            channel_log_dir = value;
+        } else if (key == "channel_log") {
+            // '#' starts a comment, so channels are listed without it: "channel_log = general, dev"
+            known = true;
+            std::replace(value.begin(), value.end(), ',', ' ');
+            std::istringstream names(value);
+            std::string name;
+            while (names >> name) {
+                valid = true;
+                channel_logs.push_back(name == "*" ? name : "#" + name);
+            }
+        } else if (key == "filter_file") {
+            known = true;
+            valid = true;
+            filter_file = value;
+        } else if (key == "filter_report") {
+            // Written without the '#', like channel_log
+            known = true;
+            valid = value.find_first_of(" ,") == std::string::npos;
+            filter_report = value.empty() ? "" : "#" + value;
+        } else if (key == "server_name") {
+            known = true;
+            valid = is_valid_server_name(value);
+            server_name = value;
+        } else if (key == "server_id") {
+            known = true;
+            valid = is_valid_server_id(value);
+            server_id = value;
+        } else if (key == "log_level") {
+            known = true;
+            valid = value == "error" || value == "info" || value == "debug";
+            log_level = value == "error" ? LOG_ERROR : value == "debug" ? LOG_DEBUG : LOG_INFO;
+        } else {
+            for (size_t i = 0; i < sizeof(config_keys) / sizeof(config_keys[0]) && !known; ++i) {
+                known = key == config_keys[i].name;
+                if (known) {
+                    valid = parse_number(value, config_keys[i].min, config_keys[i].max, this->*config_keys[i].field);
+                }
+            }
+        }
+        if (!known) {
+            error = where + "unknown key " + key;
+            return false;
+        }
+        if (!valid) {
+            error = where + "invalid value for " + key + ": " + value;
+            return false;
+        }
+    }
+
+    if (!(lag_defer_accept_ms <= lag_throttle_ms && lag_throttle_ms <= lag_reject_ms)) {
+        error = path + ": lag thresholds must satisfy lag_defer_accept_ms <= lag_throttle_ms <= lag_reject_ms";
+        return false;
+    }
+    if (max_connections_per_ip > max_connections_per_prefix) {
+        error = path + ": max_connections_per_ip cannot exceed max_connections_per_prefix";
+        return false;
+    }
+    if (!validate_links(*this, error)) {
+        error = path + ": " + error;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * @brief Push the current configuration into the components that cache a limit
+ * @return void
+*/
+void Server::apply_config() {
+    history_max_lines = config->history_max_lines;
+    history_max_bytes = config->history_max_bytes;
+    latency_sample_rate = config->latency_sample_rate;
+    latency_countdown = latency_sample_rate;
+    slowlog_threshold_us = config->slowlog_threshold_us;
+    lag_thresholds_us[OVERLOAD_NONE] = 0;
+    lag_thresholds_us[OVERLOAD_DEFER_ACCEPT] = config->lag_defer_accept_ms * 1000.0;
+    lag_thresholds_us[OVERLOAD_THROTTLE] = config->lag_throttle_ms * 1000.0;
+    lag_thresholds_us[OVERLOAD_REJECT] = config->lag_reject_ms * 1000.0;
+    resolve_deadline_ms = config->resolve_deadline_ms;
+    address_table.setLimits(config->max_connections_per_ip, config->max_connections_per_prefix,
+                            config->connect_rate_limit, config->connect_rate_window);
+    address_table.setSaslLimits(config->sasl_ip_failures, config->sasl_failure_window);
+
+    // Channels still on the old default follow the new one, a +l set by an operator is kept
+    unsigned long old_default = Channel::getDefaultLimit();
+    for (std::map<std::string, Channel>::iterator it = channels.begin(); it != channels.end(); ++it) {
+        if (it->second.getChannelLimit() == old_default) {
+            it->second.setChannelLimit(config->channel_default_limit);
+        }
+        it->second.getHistory().setLimits(history_max_lines, history_max_bytes);
+    }
+    Channel::setLimits(config->channel_max_members, config->channel_default_limit, config->channel_max_masks);
+    Client::setMaxNicknameLength(config->nick_length);
+    channel_log.configure(config->channel_log_dir, config->channel_logs);
+    sync_link_peers();
+    search_index.configure(config->channel_logs.empty() ? "" : config->channel_log_dir);
+    rebuild_filter();
+    g_log_level = config->log_level;
+}
+
+/*
+ * @brief Re-read the configuration file on SIGHUP, from the loop between two iterations
+ * @return void
+ * An invalid file is reported and ignored, the running configuration is left untouched
+*/
+void Server::reload_config() {
+    ServerConfig* next = new ServerConfig();
+    std::string error;
+    if (!next->load(config_path, error)) {
+        std::cerr << "Configuration not reloaded: " << error << std::endl;
+        delete next;
+        return;
+    }
+    if (next->server_id != config->server_id || next->server_name != config->server_name) {
+        // Every UID and link is built on them
+        std::cerr << "Configuration not reloaded: server_id and server_name only change on restart" << std::endl;
+        delete next;
+        return;
+    }
+    if (next->backlog != config->backlog || next->worker_threads != config->worker_threads || next->plugins != config->plugins) {
+        std::cerr << "Configuration: backlog, worker_threads and plugins only change on restart" << std::endl;
+    }
+
+    const ServerConfig* previous = config;
+    config = next;
+    delete previous;
+    apply_config();
+    std::cout << "Configuration reloaded from " << config_path << std::endl;
+}
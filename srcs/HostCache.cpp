@@ -0,0 +1,65 @@
+#include "HostCache.hpp"
+
+HostCache::HostCache() : capacity(1024) {}
+
+void HostCache::setCapacity(size_t capacity) {
+    this->capacity = capacity;
+    while (entries.size() > capacity && !lru.empty()) {
+        entries.erase(lru.back());
+        lru.pop_back();
+    }
+}
+
+/*
+ * @brief Find a cached host name and mark it as recently used
+ * @param ip The address
+ * @param now The current time
+ * @param host Set to the host name, empty for a cached failure
+ * @return True if the address has a live entry, false otherwise
+*/
+bool HostCache::lookup(const std::string& ip, time_t now, std::string& host) {
+    std::map<std::string, Entry>::iterator it = entries.find(ip);
+    if (it == entries.end()) {
+        return false;
+    }
+    if (it->second.expires <= now) {
+        lru.erase(it->second.lru);
+        entries.erase(it);
+        return false;
+    }
+    lru.splice(lru.begin(), lru, it->second.lru);
+    host = it->second.host;
+    return true;
+}
+
+/*
+ * @brief Cache the result of a lookup, evicting the least recently used entry if full
+ * @param ip The address
+ * @param host The host name, empty if the lookup failed
+ * @param ttl How long the entry stays valid, in seconds
+ * @param now The current time
+ * @return void
+*/
+void HostCache::store(const std::string& ip, const std::string& host, time_t ttl, time_t now) {
+    if (capacity == 0) {
+        return;
+    }
+    std::map<std::string, Entry>::iterator it = entries.find(ip);
+    if (it != entries.end()) {
+        lru.splice(lru.begin(), lru, it->second.lru);
+    } else {
+        if (entries.size() >= capacity) {
+            entries.erase(lru.back());
+            lru.pop_back();
+        }
+        lru.push_front(ip);
+        it = entries.insert(std::make_pair(ip, Entry())).first;
+        it->second.lru = lru.begin();
+    }
+    it->second.host = host;
+    it->second.expires = now + ttl;
+}
+
+size_t HostCache::size() const {
+    return entries.size();
+}
@@ -0,0 +1,99 @@
+#include "LatencyHistogram.hpp"
+
+#include <cstring>
+#include <unistd.h>
+
+static double cycles_per_us = 1000.0; // Ticks are nanoseconds until calibrated
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * @brief Measure the tick rate of cycle_now() against the monotonic clock, once at startup
+ * @return void
+*/
+void calibrate_cycle_clock() {
+    uint64_t ns_start = monotonic_ns();
+    uint64_t start = cycle_now();
+    usleep(10000);
+    uint64_t ticks = cycle_now() - start;
+    uint64_t ns = monotonic_ns() - ns_start;
+    if (ns > 0 && ticks > 0) {
+        cycles_per_us = static_cast<double>(ticks) * 1000.0 / ns;
+    }
+}
+
+double cycles_to_us(uint64_t cycles) {
+    return cycles / cycles_per_us;
+}
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+int LatencyHistogram::bucketIndex(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return static_cast<int>(value);
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + static_cast<int>((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(int index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / SUB_BUCKETS - 1;
+    uint64_t lower = static_cast<uint64_t>(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    return lower + ((1ULL << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    counts[bucketIndex(value)]++;
+    total++;
+    if (value > max_value) {
+        max_value = value;
+    }
+}
+
+void LatencyHistogram::reset() {
+    std::memset(counts, 0, sizeof(counts));
+    total = 0;
+    max_value = 0;
+}
+
+uint64_t LatencyHistogram::count() const {
+    return total;
+}
+
+uint64_t LatencyHistogram::max() const {
+    return max_value;
+}
+
+/*
+ * @brief Find the value below which a share of the recorded values fall
+ * @param percent The share, between 0 and 100
+ * @return The upper bound of the bucket holding that value, capped by the max seen
+*/
+uint64_t LatencyHistogram::percentile(double percent) const {
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(percent / 100.0 * total + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            uint64_t bound = bucketUpperBound(i);
+            return bound < max_value ? bound : max_value;
+        }
+    }
+    return max_value;
+}
@@ -0,0 +1,143 @@
+#include "LinkStream.hpp"
+#include <cstring>
+
+LinkStream::LinkStream() : valid(false), raw_out(0), wire_out(0), raw_in(0), wire_in(0) {
+#ifdef HAVE_ZLIB
+    std::memset(&deflater, 0, sizeof(deflater));
+    std::memset(&inflater, 0, sizeof(inflater));
+    if (deflateInit(&deflater, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        return;
+    }
+    if (inflateInit(&inflater) != Z_OK) {
+        deflateEnd(&deflater);
+        return;
+    }
+    valid = true;
+#endif
+}
+
+LinkStream::~LinkStream() {
+#ifdef HAVE_ZLIB
+    if (valid) {
+        deflateEnd(&deflater);
+        inflateEnd(&inflater);
+    }
+#endif
+}
+
+/*
+ * @brief Whether this build can compress links at all
+ * @return True if it was built with zlib
+*/
+bool LinkStream::available() {
+#ifdef HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool LinkStream::isValid() const {
+    return valid;
+}
+
+/*
+ * @brief Queue raw output, it is compressed on the next flush
+ * @param data The lines to send
+ * @return void
+*/
+void LinkStream::write(const std::string& data) {
+    pending += data;
+    raw_out += data.size();
+}
+
+bool LinkStream::hasPending() const {
+    return !pending.empty();
+}
+
+/*
+ * @brief Compress everything written since the last flush, ending on a sync point
+ * @param out Appended with the compressed bytes
+ * @return False if zlib failed, the link must then be closed
+*/
+bool LinkStream::flush(std::string& out) {
+#ifdef HAVE_ZLIB
+    if (!valid) {
+        return false;
+    }
+    char chunk[16384];
+    deflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(pending.data()));
+    deflater.avail_in = pending.size();
+    do {
+        deflater.next_out = reinterpret_cast<Bytef*>(chunk);
+        deflater.avail_out = sizeof(chunk);
+        int status = deflate(&deflater, Z_SYNC_FLUSH);
+        if (status != Z_OK && status != Z_BUF_ERROR) {
+            return false;
+        }
+        size_t produced = sizeof(chunk) - deflater.avail_out;
+        out.append(chunk, produced);
+        wire_out += produced;
+    } while (deflater.avail_out == 0);
+    pending.clear();
+    return true;
+#else
+    (void)out;
+    return false;
+#endif
+}
+
+/*
+ * @brief Decompress bytes received from the peer
+ * @param data The received bytes
+ * @param length Their length
+ * @param out Appended with the decompressed bytes
+ * @return False if the stream is corrupt, the link must then be closed
+*/
+bool LinkStream::read(const char* data, size_t length, std::string& out) {
+#ifdef HAVE_ZLIB
+    if (!valid) {
+        return false;
+    }
+    char chunk[16384];
+    wire_in += length;
+    inflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    inflater.avail_in = length;
+    do {
+        inflater.next_out = reinterpret_cast<Bytef*>(chunk);
+        inflater.avail_out = sizeof(chunk);
+        int status = inflate(&inflater, Z_SYNC_FLUSH);
+        if (status == Z_BUF_ERROR) {
+            break; // Everything received so far is out
+        }
+        if (status != Z_OK) {
+            return false; // Z_STREAM_END included: a link stream never ends
+        }
+        size_t produced = sizeof(chunk) - inflater.avail_out;
+        out.append(chunk, produced);
+        raw_in += produced;
+    } while (inflater.avail_in > 0 || inflater.avail_out == 0);
+    return true;
+#else
+    (void)data;
+    (void)length;
+    (void)out;
+    return false;
+#endif
+}
+
+uint64_t LinkStream::getRawOut() const {
+    return raw_out;
+}
+
+uint64_t LinkStream::getWireOut() const {
+    return wire_out;
+}
+
+uint64_t LinkStream::getRawIn() const {
+    return raw_in;
+}
+
+uint64_t LinkStream::getWireIn() const {
+    return wire_in;
+}
@@ -0,0 +1,150 @@
+#include "ft_irc.hpp"
+
+static std::string fold(const std::string& str) {
+    std::string folded(str);
+    for (size_t i = 0; i < folded.size(); ++i) {
+        folded[i] = std::tolower(static_cast<unsigned char>(folded[i]));
+    }
+    return folded;
+}
+
+MaskMatcher::MaskMatcher() : prefixes(1), suffixes(1) {}
+
+void MaskMatcher::insert(std::vector<Node>& trie, const std::string& key, uint32_t id) {
+    uint32_t node = 0;
+    for (size_t i = 0; i < key.size(); ++i) {
+        std::map<char, uint32_t>::iterator it = trie[node].children.find(key[i]);
+        if (it == trie[node].children.end()) {
+            trie.push_back(Node());
+            it = trie[node].children.insert(std::make_pair(key[i], static_cast<uint32_t>(trie.size() - 1))).first;
+        }
+        node = it->second;
+    }
+    trie[node].masks.push_back(id);
+}
+
+/*
+ * @brief Compile a mask into the set, the mask is expected normalized
+ * @param mask The mask
+ * @return void
+*/
+void MaskMatcher::add(const std::string& mask) {
+    std::string folded = fold(mask);
+    uint32_t id = masks.size();
+    masks.push_back(folded);
+
+    size_t first = folded.find_first_of("*?");
+    if (first == std::string::npos) {
+        insert(prefixes, folded, id);
+        return;
+    }
+    size_t last = folded.find_last_of("*?");
+    size_t suffix_length = folded.size() - last - 1;
+    if (first == 0 && suffix_length == 0) {
+        fallback.push_back(id);
+    } else if (first >= suffix_length) {
+        insert(prefixes, folded.substr(0, first), id);
+    } else {
+        std::string suffix = folded.substr(last + 1);
+        insert(suffixes, std::string(suffix.rbegin(), suffix.rend()), id);
+    }
+}
+
+/*
+ * @brief Drop a mask, the tries are rebuilt from the remaining masks
+ * @param mask The mask
+ * @return void
+*/
+void MaskMatcher::remove(const std::string& mask) {
+    std::string folded = fold(mask);
+    std::vector<std::string> remaining;
+    for (size_t i = 0; i < masks.size(); ++i) {
+        if (masks[i] != folded) {
+            remaining.push_back(masks[i]);
+        }
+    }
+    clear();
+    for (size_t i = 0; i < remaining.size(); ++i) {
+        add(remaining[i]);
+    }
+}
+
+void MaskMatcher::clear() {
+    masks.clear();
+    prefixes.assign(1, Node());
+    suffixes.assign(1, Node());
+    fallback.clear();
+}
+
+/*
+ * @brief Follow the subject down a trie, glob-matching the masks filed along the way
+ * @param trie The trie
+ * @param subject The casefolded subject
+ * @param backward True to walk the subject from its end, for the suffix trie
+ * @return True if a mask matched, false otherwise
+*/
+bool MaskMatcher::walk(const std::vector<Node>& trie, const std::string& subject, bool backward) const {
+    uint32_t node = 0;
+    for (size_t i = 0; ; ++i) {
+        const std::vector<uint32_t>& filed = trie[node].masks;
+        for (size_t j = 0; j < filed.size(); ++j) {
+            if (match_mask(masks[filed[j]], subject)) {
+                return true;
+            }
+        }
+        if (i == subject.size()) {
+            return false;
+        }
+        char c = backward ? subject[subject.size() - 1 - i] : subject[i];
+        std::map<char, uint32_t>::const_iterator it = trie[node].children.find(c);
+        if (it == trie[node].children.end()) {
+            return false;
+        }
+        node = it->second;
+    }
+}
+
+/*
+ * @brief Check a nick!user@host against every mask of the set
+ * @param subject The nick!user@host
+ * @return True if a mask matches, false otherwise
+*/
+bool MaskMatcher::matches(const std::string& subject) const {
+    if (masks.empty()) {
+        return false;
+    }
+    std::string folded = fold(subject);
+    for (size_t i = 0; i < fallback.size(); ++i) {
+        if (match_mask(masks[fallback[i]], folded)) {
+            return true;
+        }
+    }
+    return walk(prefixes, folded, false) || walk(suffixes, folded, true);
+}
+
+size_t MaskMatcher::size() const {
+    return masks.size();
+}
+
+/*
+ * @brief Complete a partial mask: "nick" becomes "nick!*@*", "user@host" becomes "*!user@host"
+ * @param mask The mask as given to MODE
+ * @return The full nick!user@host mask
+*/
+std::string MaskMatcher::normalize(const std::string& mask) {
+    size_t bang = mask.find('!');
+    size_t at = mask.find('@', bang == std::string::npos ? 0 : bang);
+    std::string nick, user, host;
+    if (bang != std::string::npos) {
+        nick = mask.substr(0, bang);
+        user = mask.substr(bang + 1, at == std::string::npos ? std::string::npos : at - bang - 1);
+    } else if (at != std::string::npos) {
+        user = mask.substr(0, at);
+    } else {
+        nick = mask;
+    }
+    if (at != std::string::npos) {
+        host = mask.substr(at + 1);
+    }
+    return (nick.empty() ? "*" : nick) + "!" + (user.empty() ? "*" : user) + "@" + (host.empty() ? "*" : host);
+}
@@ -0,0 +1,67 @@
+#include "ft_irc.hpp"
+
+#define VARIANT_TIME 1
+#define VARIANT_TAGS 2
+
+Message::Message(const std::string& line, uint64_t time_ms) : line(line), client_tags(""), time_ms(time_ms) {}
+
+Message::Message(const std::string& line, uint64_t time_ms, const std::string& client_tags)
+    : line(line), client_tags(client_tags), time_ms(time_ms) {}
+
+/*
+ * @brief Map the capabilities of a recipient to the rendering it gets
+ * @param caps The capability bits of the recipient
+ * @return The variant index, below MESSAGE_VARIANTS
+*/
+unsigned int Message::variant(unsigned int caps) {
+    return ((caps & CAP_SERVER_TIME) ? VARIANT_TIME : 0) | ((caps & CAP_MESSAGE_TAGS) ? VARIANT_TAGS : 0);
+}
+
+/*
+ * @brief Pick the outbound lane of a line from its command
+ * @param line The wire-formatted line
+ * @return LANE_CONTROL for PING, PONG and ERROR, LANE_BULK otherwise
+ * Lines that change or report channel state stay in bulk, after the JOIN or message queued before them
+*/
+int Message::lane(const std::string& line) {
+    size_t start = 0;
+    for (int skip = 0; skip < 2 && start < line.size(); ++skip) {
+        if (line[start] != (skip == 0 ? '@' : ':')) {
+            continue;
+        }
+        start = line.find(' ', start);
+        start = start == std::string::npos ? line.size() : line.find_first_not_of(' ', start);
+        start = start == std::string::npos ? line.size() : start;
+    }
+    size_t end = line.find_first_of(" \r\n", start);
+    std::string command = line.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    return command == "PING" || command == "PONG" || command == "ERROR" ? LANE_CONTROL : LANE_BULK;
+}
+
+/*
+ * @brief Render the line with the tags of one variant
+ * @param variant The variant index, from variant()
+ * @return The wire-formatted line
+*/
+std::string Message::render(unsigned int variant) const {
+    std::string tags;
+    if (variant & VARIANT_TIME) {
+        tags = "time=" + format_server_time(time_ms);
+    }
+    if ((variant & VARIANT_TAGS) && !client_tags.empty()) {
+        tags += (tags.empty() ? "" : ";") + client_tags;
+    }
+    return tags.empty() ? line : "@" + tags + " " + line;
+}
+
+std::string Message::renderFor(unsigned int caps) const {
+    return render(variant(caps));
+}
+
+const std::string& Message::getLine() const {
+    return line;
+}
+
+uint64_t Message::getTime() const {
+    return time_ms;
+}
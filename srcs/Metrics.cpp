@@ -0,0 +1,111 @@
+#include "Metrics.hpp"
+
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static MetricsSlot scratch_slot;
+
+__thread MetricsSlot* t_metrics = &scratch_slot;
+
+Metrics::Metrics() : name(""), page(NULL) {}
+
+Metrics::~Metrics() {
+    close();
+}
+
+/*
+ * @brief Create (or take over) the shared-memory segment and attach the calling thread
+ * @param segment_name The POSIX shared-memory name, e.g. "/ircserv-6667"
+ * @return True if the segment is mapped, false otherwise
+*/
+bool Metrics::open(const std::string& segment_name) {
+    close();
+
+    int fd = shm_open(segment_name.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    if (ftruncate(fd, sizeof(MetricsPage)) < 0) {
+        ::close(fd);
+        return false;
+    }
+    void* addr = mmap(NULL, sizeof(MetricsPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    name = segment_name;
+    page = static_cast<MetricsPage*>(addr);
+
+    // A hot-upgraded process keeps the counters of the previous one
+    if (page->magic != METRICS_MAGIC || page->version != METRICS_VERSION) {
+        std::memset(page, 0, sizeof(MetricsPage));
+        page->version = METRICS_VERSION;
+        page->start_time = time(NULL);
+        page->magic = METRICS_MAGIC;
+    }
+    page->pid = getpid();
+    page->thread_count = 0;
+    page->verb_count = 0;
+    std::memset(page->verb_names, 0, sizeof(page->verb_names));
+    return attachThread();
+}
+
+/*
+ * @brief Unmap the segment, the name is only removed by the process that owns it
+ * @return void
+*/
+void Metrics::close() {
+    if (!page) {
+        return;
+    }
+    if (page->pid == getpid()) {
+        shm_unlink(name.c_str());
+    }
+    munmap(page, sizeof(MetricsPage));
+    page = NULL;
+    t_metrics = &scratch_slot;
+}
+
+/*
+ * @brief Give the calling thread its own slot, counters go to a scratch slot if none is left
+ * @return True if the thread got a slot, false otherwise
+*/
+bool Metrics::attachThread() {
+    if (!page) {
+        return false;
+    }
+    uint32_t index = __sync_fetch_and_add(&page->thread_count, 1);
+    if (index >= METRICS_MAX_THREADS) {
+        __sync_fetch_and_sub(&page->thread_count, 1);
+        return false;
+    }
+    t_metrics = &page->slots[index];
+    return true;
+}
+
+/*
+ * @brief Publish the name of a command so the reader can label its counter
+ * @param verb The command name
+ * @return The index in MetricsSlot::verbs, -1 if the table is full
+*/
+int Metrics::registerVerb(const std::string& verb) {
+    if (!page || page->verb_count >= METRICS_MAX_VERBS) {
+        return -1;
+    }
+    int index = page->verb_count;
+    std::strncpy(page->verb_names[index], verb.c_str(), METRICS_VERB_LEN - 1);
+    page->verb_count = index + 1;
+    return index;
+}
+
+std::string metrics_segment_name(int port) {
+    std::ostringstream oss;
+    oss << "/ircserv-" << port;
+    return oss.str();
+}
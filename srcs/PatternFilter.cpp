@@ -0,0 +1,337 @@
+#include "PatternFilter.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+static const char* action_names[] = { "tag", "report", "block" };
+
+PatternFilter::PatternFilter() : start_count(0), class_count(1) {
+    std::memset(classes, 0, sizeof(classes));
+    std::memset(starts, 0, sizeof(starts));
+}
+
+/*
+ * @brief Parse a comma separated list of actions
+ * @param text For example "block" or "tag,report"
+ * @param actions Set to the FilterAction bits
+ * @return False if a name is unknown or the list is empty
+*/
+bool PatternFilter::parseActions(const std::string& text, unsigned int& actions) {
+    actions = 0;
+    std::istringstream names(text);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        unsigned int found = 0;
+        for (size_t i = 0; i < sizeof(action_names) / sizeof(action_names[0]); ++i) {
+            found = name == action_names[i] ? 1U << i : found;
+        }
+        if (!found) {
+            return false;
+        }
+        actions |= found;
+    }
+    return actions != 0;
+}
+
+std::string PatternFilter::actionNames(unsigned int actions) {
+    std::string names;
+    for (size_t i = 0; i < sizeof(action_names) / sizeof(action_names[0]); ++i) {
+        if (actions & (1U << i)) {
+            names += (names.empty() ? "" : ",") + std::string(action_names[i]);
+        }
+    }
+    return names;
+}
+
+/*
+ * @brief Read a pattern file and compile it: "<actions> <pattern>" per line, '#' starts a comment line
+ * @param path The file path
+ * @param error Set to "<path>:<line>: <reason>" on failure
+ * @return True if the whole file is valid and compiled
+*/
+bool PatternFilter::load(const std::string& path, std::string& error) {
+    // Read with a close-on-exec descriptor, the server loads filters on a worker while the loop may start a hot upgrade
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = path + ": cannot be read";
+        return false;
+    }
+    std::string contents;
+    char chunk[65536];
+    ssize_t got;
+    while ((got = read(fd, chunk, sizeof(chunk))) > 0 || (got < 0 && errno == EINTR)) {
+        contents.append(chunk, got > 0 ? got : 0);
+    }
+    close(fd);
+    if (got < 0) {
+        error = path + ": cannot be read";
+        return false;
+    }
+
+    std::istringstream file(contents);
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        size_t begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos || line[begin] == '#') {
+            continue;
+        }
+        size_t space = line.find_first_of(" \t", begin);
+        size_t pattern_begin = space == std::string::npos ? space : line.find_first_not_of(" \t", space);
+        size_t pattern_end = line.find_last_not_of(" \t\r");
+        unsigned int actions = 0;
+        std::ostringstream where;
+        where << path << ":" << number << ": ";
+        if (!parseActions(line.substr(begin, space - begin), actions)) {
+            error = where.str() + "expected block, tag or report, or a list of them";
+            return false;
+        }
+        if (pattern_begin == std::string::npos || !add(line.substr(pattern_begin, pattern_end - pattern_begin + 1), actions)) {
+            std::ostringstream reason;
+            reason << "a pattern must be " << FILTER_PATTERN_MIN << " to " << FILTER_PATTERN_MAX << " bytes";
+            error = where.str() + reason.str();
+            return false;
+        }
+    }
+    return build(error);
+}
+
+/*
+ * @brief Add a pattern, build() must be called once they are all added
+ * @param pattern The text to find, case is ignored
+ * @param actions The FilterAction bits
+ * @return False if the pattern is too short or too long
+*/
+bool PatternFilter::add(const std::string& pattern, unsigned int actions) {
+    if (pattern.size() < FILTER_PATTERN_MIN || pattern.size() > FILTER_PATTERN_MAX) {
+        return false;
+    }
+    std::string folded = pattern;
+    for (size_t i = 0; i < folded.size(); ++i) {
+        if (folded[i] >= 'A' && folded[i] <= 'Z') {
+            folded[i] = folded[i] - 'A' + 'a';
+        }
+    }
+    patterns.push_back(folded);
+    pattern_actions.push_back(actions);
+    return true;
+}
+
+/*
+ * @brief Give a state the matches of its failure state, keeping the most severe pattern
+ * @param state The state
+ * @param from Its failure state
+ * @return void
+*/
+void PatternFilter::inherit(uint32_t state, uint32_t from) {
+    if (!state_actions[from]) {
+        return;
+    }
+    state_actions[state] |= state_actions[from];
+    int32_t candidate = state_pattern[from];
+    if (state_pattern[state] < 0 || pattern_actions[candidate] > pattern_actions[state_pattern[state]]) {
+        state_pattern[state] = candidate;
+    }
+}
+
+/*
+ * @brief Compile the patterns: a trie over byte classes, then failure links folded into a full transition table
+ * @param error Set if the automaton would exceed FILTER_MAX_STATES
+ * @return False if the pattern set is too large
+*/
+bool PatternFilter::build(std::string& error) {
+    std::memset(classes, 0, sizeof(classes));
+    class_count = 1;
+    for (size_t p = 0; p < patterns.size(); ++p) {
+        for (size_t i = 0; i < patterns[p].size(); ++i) {
+            unsigned char byte = patterns[p][i];
+            if (!classes[byte]) {
+                classes[byte] = class_count++;
+            }
+        }
+    }
+    for (int upper = 'A'; upper <= 'Z'; ++upper) {
+        classes[upper] = classes[upper - 'A' + 'a'];
+    }
+
+    delta.assign(class_count, 0);
+    state_actions.assign(1, 0);
+    state_pattern.assign(1, -1);
+    for (size_t p = 0; p < patterns.size(); ++p) {
+        uint32_t state = 0;
+        for (size_t i = 0; i < patterns[p].size(); ++i) {
+            size_t slot = state * class_count + classes[static_cast<unsigned char>(patterns[p][i])];
+            if (!delta[slot]) {
+                if (state_actions.size() >= FILTER_MAX_STATES) {
+                    std::ostringstream reason;
+                    reason << "the patterns need more than " << FILTER_MAX_STATES << " states";
+                    error = reason.str();
+                    return false;
+                }
+                delta[slot] = state_actions.size();
+                delta.resize(delta.size() + class_count, 0);
+                state_actions.push_back(0);
+                state_pattern.push_back(-1);
+            }
+            state = delta[slot];
+        }
+        state_actions[state] |= pattern_actions[p];
+        if (state_pattern[state] < 0 || pattern_actions[p] > pattern_actions[state_pattern[state]]) {
+            state_pattern[state] = p;
+        }
+    }
+
+    // Number the states breadth first, scans spend most of their time in the shallow ones and they now share cache lines
+    size_t state_count = state_actions.size();
+    std::vector<uint32_t> order(1, 0);
+    std::vector<uint32_t> rank(state_count, 0);
+    for (size_t head = 0; head < order.size(); ++head) {
+        for (size_t c = 0; c < class_count; ++c) {
+            uint32_t child = delta[order[head] * class_count + c];
+            if (child) {
+                rank[child] = order.size();
+                order.push_back(child);
+            }
+        }
+    }
+    std::vector<uint32_t> trie(delta.size(), 0);
+    std::vector<unsigned char> actions(state_count, 0);
+    std::vector<int32_t> pattern(state_count, -1);
+    for (size_t state = 0; state < state_count; ++state) {
+        for (size_t c = 0; c < class_count; ++c) {
+            trie[state * class_count + c] = rank[delta[order[state] * class_count + c]];
+        }
+        actions[state] = state_actions[order[state]];
+        pattern[state] = state_pattern[order[state]];
+    }
+    delta.swap(trie);
+    state_actions.swap(actions);
+    state_pattern.swap(pattern);
+
+    // In that order the failure state of a node is complete before the node is, the children of the root fail to it
+    std::vector<uint32_t> fail(state_count, 0);
+    for (size_t state = 1; state < state_count; ++state) {
+        for (size_t c = 0; c < class_count; ++c) {
+            size_t slot = state * class_count + c;
+            uint32_t fallback = delta[fail[state] * class_count + c];
+            if (delta[slot]) {
+                fail[delta[slot]] = fallback;
+                inherit(delta[slot], fallback);
+            } else {
+                delta[slot] = fallback;
+            }
+        }
+    }
+
+    start_count = 0;
+    for (int byte = 0; byte < 256; ++byte) {
+        starts[byte] = delta[classes[byte]] != 0;
+        if (starts[byte] && start_count < FILTER_SIMD_STARTS) {
+            start_bytes[start_count] = byte;
+        }
+        start_count += starts[byte];
+    }
+    return true;
+}
+
+/*
+ * @brief Skip the bytes that start no pattern, while the automaton is at its root
+ * @param byte Where to start
+ * @param end The end of the text
+ * @return The first byte that starts a pattern, or end
+ * With up to FILTER_SIMD_STARTS start bytes, 16 bytes are checked at once
+*/
+const unsigned char* PatternFilter::skipToStart(const unsigned char* byte, const unsigned char* end) const {
+#ifdef __SSE2__
+    if (start_count <= FILTER_SIMD_STARTS) {
+        for (; end - byte >= 16; byte += 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(byte));
+            __m128i hits = _mm_setzero_si128();
+            for (size_t i = 0; i < start_count; ++i) {
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(start_bytes[i])));
+            }
+            int mask = _mm_movemask_epi8(hits);
+            if (mask) {
+                return byte + __builtin_ctz(mask);
+            }
+        }
+    }
+#endif
+    while (byte < end && !starts[*byte]) {
+        ++byte;
+    }
+    return byte;
+}
+
+/*
+ * @brief Find the patterns in a text
+ * @param data The text
+ * @param length Its length
+ * @return The actions hit, stops at the first pattern that blocks
+ * When few bytes can start a pattern, the scan skips ahead to them from the root state. With many it would
+ * mostly mispredict, so the automaton then simply takes every byte
+*/
+FilterMatch PatternFilter::scan(const char* data, size_t length) const {
+    FilterMatch match;
+    match.actions = 0;
+    match.pattern = -1;
+    const unsigned char* byte = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = byte + length;
+    const uint32_t* table = &delta[0];
+    const unsigned char* actions = &state_actions[0];
+    size_t width = class_count;
+    bool skip = start_count <= FILTER_SKIP_STARTS;
+    uint32_t state = 0;
+    while (byte < end) {
+        if (state == 0 && skip) {
+            byte = skipToStart(byte, end);
+            if (byte == end) {
+                break;
+            }
+        }
+        state = table[state * width + classes[*byte++]];
+        if (actions[state]) {
+            int32_t pattern = state_pattern[state];
+            if (match.pattern < 0 || pattern_actions[pattern] > pattern_actions[match.pattern]) {
+                match.pattern = pattern;
+            }
+            match.actions |= actions[state];
+            if (match.actions & FILTER_BLOCK) {
+                break;
+            }
+        }
+    }
+    return match;
+}
+
+const std::string& PatternFilter::getPattern(int index) const {
+    return patterns[index];
+}
+
+unsigned int PatternFilter::getPatternActions(int index) const {
+    return pattern_actions[index];
+}
+
+size_t PatternFilter::getPatternCount() const {
+    return patterns.size();
+}
+
+size_t PatternFilter::getStateCount() const {
+    return state_actions.size();
+}
+
+size_t PatternFilter::getClassCount() const {
+    return class_count;
+}
+
+/*
+ * @brief Memory used by the compiled automaton
+ * @return Bytes of the transition table and per state data, the pattern texts aside
+*/
+size_t PatternFilter::getMemoryUsage() const {
+    return delta.size() * sizeof(uint32_t) + state_actions.size() * (sizeof(unsigned char) + sizeof(int32_t));
+}
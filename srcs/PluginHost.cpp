@@ -0,0 +1,331 @@
+#include "ft_irc.hpp"
+#include <dlfcn.h>
+
+/*
+ * A message sent by a threaded plugin, carried back to the loop through the
+ * worker pool's completion queue
+*/
+class ServiceMessageJob : public WorkerJob {
+private:
+    std::string service;
+    std::string command;
+    std::string target;
+    std::string text;
+
+public:
+    ServiceMessageJob(const std::string& service, const std::string& command, const std::string& target, const std::string& text)
+        : service(service), command(command), target(target), text(text) {}
+
+    void run() {}
+
+    void complete(Server& server) {
+        server.send_service_message(service, command, target, text);
+    }
+};
+
+PluginHost::PluginHost() : server(NULL), workers(NULL), event_mask(0) {}
+
+PluginHost::~PluginHost() {
+    unloadAll();
+}
+
+void PluginHost::attach(Server* server, WorkerPool* workers) {
+    this->server = server;
+    this->workers = workers;
+}
+
+/*
+ * @brief Load a plugin and initialize it
+ * @param spec "<path> [args]", the args are handed to init() as one string
+ * @param error Set to the reason on failure
+ * @return False if the library cannot be loaded, has no entry point, a wrong version, a taken name, or refuses to init
+*/
+bool PluginHost::load(const std::string& spec, std::string& error) {
+    size_t space = spec.find(' ');
+    std::string path = spec.substr(0, space);
+    size_t args_start = space == std::string::npos ? space : spec.find_first_not_of(' ', space);
+    std::string args = args_start == std::string::npos ? "" : spec.substr(args_start);
+
+    void* library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!library) {
+        error = dlerror();
+        return false;
+    }
+    irc_plugin_entry_fn entry = reinterpret_cast<irc_plugin_entry_fn>(reinterpret_cast<size_t>(dlsym(library, IRC_PLUGIN_ENTRY)));
+    const irc_plugin* plugin = entry ? entry() : NULL;
+    if (!plugin || plugin->version != IRC_PLUGIN_API_VERSION || !plugin->name || !plugin->init || !plugin->on_event) {
+        error = path + ": no " IRC_PLUGIN_ENTRY "() for API version " + intToString(IRC_PLUGIN_API_VERSION);
+        dlclose(library);
+        return false;
+    }
+    std::string name = plugin->name;
+    std::string key = name;
+    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+    if (name.empty() || name[0] == '#' || name.find_first_of(" ,*?!@:") != std::string::npos || services.count(key)) {
+        error = path + ": service name \"" + name + "\" is invalid or already taken";
+        dlclose(library);
+        return false;
+    }
+
+    LoadedPlugin* loaded = new LoadedPlugin();
+    loaded->host = this;
+    loaded->path = path;
+    loaded->name = name;
+    loaded->library = library;
+    loaded->plugin = plugin;
+    loaded->disabled = false;
+    loaded->overrun_streak = 0;
+    loaded->calls = 0;
+    loaded->overruns = 0;
+    loaded->dropped = 0;
+    loaded->threaded = false;
+    loaded->stopping = false;
+    loaded->api.version = IRC_PLUGIN_API_VERSION;
+    loaded->api.handle = loaded;
+    loaded->api.privmsg = apiPrivmsg;
+    loaded->api.notice = apiNotice;
+    loaded->api.log = apiLog;
+
+    loaded->state = plugin->init(&loaded->api, args.c_str());
+    if (!loaded->state) {
+        error = path + ": init() refused to start";
+        dlclose(library);
+        delete loaded;
+        return false;
+    }
+
+    // A threaded plugin needs the worker pool to send anything back, without it the plugin runs on the loop
+    if ((plugin->flags & IRC_PLUGIN_THREADED) && workers && workers->getEventFd() >= 0) {
+        pthread_mutex_init(&loaded->lock, NULL);
+        pthread_cond_init(&loaded->wake, NULL);
+        // Signals only set flags for the loop, they must land on the loop thread to interrupt its poll
+        sigset_t blocked, previous;
+        sigfillset(&blocked);
+        pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+        loaded->threaded = pthread_create(&loaded->thread, NULL, threadMain, loaded) == 0;
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+        if (!loaded->threaded) {
+            pthread_cond_destroy(&loaded->wake);
+            pthread_mutex_destroy(&loaded->lock);
+        }
+    }
+
+    plugins.push_back(loaded);
+    services[key] = loaded;
+    updateMask();
+    std::cout << "Loaded plugin " << name << " from " << path << (loaded->threaded ? " (own thread)" : "") << std::endl;
+    return true;
+}
+
+void PluginHost::unload(LoadedPlugin* loaded) {
+    if (loaded->threaded) {
+        pthread_mutex_lock(&loaded->lock);
+        loaded->stopping = true;
+        pthread_cond_signal(&loaded->wake);
+        pthread_mutex_unlock(&loaded->lock);
+        pthread_join(loaded->thread, NULL);
+        pthread_cond_destroy(&loaded->wake);
+        pthread_mutex_destroy(&loaded->lock);
+        loaded->threaded = false;
+    }
+    if (loaded->plugin->shutdown) {
+        loaded->plugin->shutdown(loaded->state);
+    }
+    dlclose(loaded->library);
+    delete loaded;
+}
+
+/*
+ * @brief Shut every plugin down, threaded ones are joined first
+ * @return void
+*/
+void PluginHost::unloadAll() {
+    for (size_t i = 0; i < plugins.size(); ++i) {
+        unload(plugins[i]);
+    }
+    plugins.clear();
+    services.clear();
+    event_mask = 0;
+}
+
+void PluginHost::updateMask() {
+    event_mask = 0;
+    for (size_t i = 0; i < plugins.size(); ++i) {
+        if (!plugins[i]->disabled) {
+            event_mask |= plugins[i]->plugin->events;
+        }
+    }
+}
+
+/*
+ * @brief Whether any plugin wants an event type, so the caller can skip building the event
+ * @param type The irc_event_type
+ * @return True if at least one enabled plugin asked for it
+*/
+bool PluginHost::wants(int type) const {
+    return (event_mask & type) != 0;
+}
+
+bool PluginHost::isService(const std::string& nick) const {
+    std::string key = nick;
+    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+    return services.count(key) != 0;
+}
+
+/*
+ * @brief Give an event to every plugin that asked for its type
+ * @param event The event
+ * @return void
+*/
+void PluginHost::dispatch(const PluginEvent& event) {
+    for (size_t i = 0; i < plugins.size(); ++i) {
+        if (!plugins[i]->disabled && (plugins[i]->plugin->events & event.type)) {
+            deliver(plugins[i], event);
+        }
+    }
+}
+
+/*
+ * @brief Give a private message to the service it was sent to
+ * @param service The service nickname
+ * @param event The IRC_EVENT_PRIVATE event
+ * @return False if no plugin has that name
+*/
+bool PluginHost::deliverPrivate(const std::string& service, const PluginEvent& event) {
+    std::string key = service;
+    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+    std::map<std::string, LoadedPlugin*>::iterator it = services.find(key);
+    if (it == services.end()) {
+        return false;
+    }
+    if (!it->second->disabled && (it->second->plugin->events & IRC_EVENT_PRIVATE)) {
+        deliver(it->second, event);
+    }
+    return true;
+}
+
+const std::vector<LoadedPlugin*>& PluginHost::getPlugins() const {
+    return plugins;
+}
+
+/*
+ * @brief The number of events a plugin handled, a threaded plugin counts them under its lock
+ * @param loaded The plugin
+ * @return The count
+*/
+uint64_t PluginHost::getCalls(LoadedPlugin* loaded) const {
+    if (!loaded->threaded) {
+        return loaded->calls;
+    }
+    pthread_mutex_lock(&loaded->lock);
+    uint64_t calls = loaded->calls;
+    pthread_mutex_unlock(&loaded->lock);
+    return calls;
+}
+
+void PluginHost::deliver(LoadedPlugin* loaded, const PluginEvent& event) {
+    if (!loaded->threaded) {
+        call(loaded, event);
+        return;
+    }
+    pthread_mutex_lock(&loaded->lock);
+    if (loaded->queue.size() < PLUGIN_QUEUE_MAX) {
+        loaded->queue.push_back(event);
+        pthread_cond_signal(&loaded->wake);
+    } else {
+        ++loaded->dropped; // A plugin that falls behind loses events rather than holding memory
+    }
+    pthread_mutex_unlock(&loaded->lock);
+}
+
+/*
+ * @brief Call a plugin on the loop and charge it for the time it took
+ * @param loaded The plugin
+ * @param event The event
+ * @return void
+ * A callback cannot be interrupted, so the budget is enforced after the fact: a plugin
+ * over budget PLUGIN_MAX_OVERRUNS times in a row is disabled
+*/
+void PluginHost::call(LoadedPlugin* loaded, const PluginEvent& event) {
+    irc_event view;
+    view.type = event.type;
+    view.nick = event.nick.c_str();
+    view.mask = event.mask.c_str();
+    view.account = event.account.c_str();
+    view.channel = event.channel.c_str();
+    view.text = event.text.c_str();
+    view.time_ms = event.time_ms;
+
+    uint64_t start = cycle_now();
+    loaded->plugin->on_event(loaded->state, &view);
+    double elapsed_us = cycles_to_us(cycle_now() - start);
+    if (loaded->threaded) {
+        return; // Counted by threadMain, under the lock STATS p reads it with
+    }
+    ++loaded->calls;
+    if (elapsed_us <= PLUGIN_CALLBACK_BUDGET_US) {
+        loaded->overrun_streak = 0;
+        return;
+    }
+    ++loaded->overruns;
+    if (++loaded->overrun_streak >= PLUGIN_MAX_OVERRUNS) {
+        loaded->disabled = true;
+        updateMask();
+        std::cerr << "Plugin " << loaded->name << " disabled: " << PLUGIN_MAX_OVERRUNS << " callbacks in a row over "
+                  << PLUGIN_CALLBACK_BUDGET_US << " us, last took " << static_cast<long>(elapsed_us) << " us" << std::endl;
+    }
+}
+
+void* PluginHost::threadMain(void* arg) {
+    LoadedPlugin* loaded = static_cast<LoadedPlugin*>(arg);
+    pthread_mutex_lock(&loaded->lock);
+    while (true) {
+        while (!loaded->stopping && loaded->queue.empty()) {
+            pthread_cond_wait(&loaded->wake, &loaded->lock);
+        }
+        if (loaded->stopping) {
+            break;
+        }
+        PluginEvent event = loaded->queue.front();
+        loaded->queue.pop_front();
+        pthread_mutex_unlock(&loaded->lock);
+
+        loaded->host->call(loaded, event);
+
+        pthread_mutex_lock(&loaded->lock);
+        ++loaded->calls;
+    }
+    pthread_mutex_unlock(&loaded->lock);
+    return NULL;
+}
+
+/*
+ * @brief Send for a plugin: directly when called on the loop, through the worker pool from the plugin's own thread
+ * @return 0 on success, -1 if the target does not exist (only known on the loop)
+*/
+int PluginHost::apiSend(void* handle, const char* command, const char* target, const char* text) {
+    LoadedPlugin* loaded = static_cast<LoadedPlugin*>(handle);
+    if (!target || !text) {
+        return -1;
+    }
+    if (loaded->threaded && pthread_equal(pthread_self(), loaded->thread)) {
+        loaded->host->workers->post(new ServiceMessageJob(loaded->name, command, target, text));
+        return 0;
+    }
+    return loaded->host->server->send_service_message(loaded->name, command, target, text) ? 0 : -1;
+}
+
+int PluginHost::apiPrivmsg(void* handle, const char* target, const char* text) {
+    return apiSend(handle, "PRIVMSG", target, text);
+}
+
+int PluginHost::apiNotice(void* handle, const char* target, const char* text) {
+    return apiSend(handle, "NOTICE", target, text);
+}
+
+void PluginHost::apiLog(void* handle, const char* text) {
+    // A single write, so lines from plugin threads do not interleave
+    std::string line = "[" + static_cast<LoadedPlugin*>(handle)->name + "] " + (text ? text : "") + "\n";
+    ssize_t written = write(STDOUT_FILENO, line.c_str(), line.size());
+    (void)written;
+}
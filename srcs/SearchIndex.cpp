@@ -0,0 +1,400 @@
+#include "ft_irc.hpp"
+#include <dirent.h>
+#include <sys/stat.h>
+
+static void put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static uint64_t get_varint(const std::string& in, size_t& pos) {
+    uint64_t value = 0;
+    for (int shift = 0; pos < in.size(); shift += 7) {
+        unsigned char byte = in[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    return value;
+}
+
+/*
+ * Walks a posting list. The skips allow starting at any block, so a lookup
+ * decodes at most one block of SEARCH_SKIP_INTERVAL gaps after a binary search
+*/
+class SearchIndex::Cursor {
+private:
+    const PostingList* list;
+    size_t pos;
+    size_t consumed;
+
+public:
+    uint64_t value;
+
+    explicit Cursor(const PostingList* list) : list(list), pos(0), consumed(0), value(0) {}
+
+    size_t size() const {
+        return list->count;
+    }
+
+    // The block whose postings would hold the first one at or above target
+    size_t blockOf(uint64_t target) const {
+        size_t low = 0;
+        size_t high = list->skips.size();
+        while (high - low > 1) {
+            size_t mid = low + (high - low) / 2;
+            if (list->skips[mid].first < target) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        return low;
+    }
+
+    void toBlock(size_t block) {
+        consumed = block * SEARCH_SKIP_INTERVAL;
+        pos = list->skips[block].second;
+        value = list->skips[block].first;
+    }
+
+    bool next() {
+        if (consumed >= list->count) {
+            return false;
+        }
+        value += get_varint(list->deltas, pos);
+        ++consumed;
+        return true;
+    }
+
+    // Moves to the first posting at or above target, backwards too
+    bool seek(uint64_t target) {
+        size_t block = consumed == 0 ? 0 : (consumed - 1) / SEARCH_SKIP_INTERVAL;
+        bool in_block = consumed > 0 && value <= target
+            && (block + 1 >= list->skips.size() || list->skips[block + 1].first >= target);
+        if (consumed > 0 && value == target) {
+            return true;
+        }
+        if (!in_block) {
+            toBlock(blockOf(target));
+        }
+        while (next()) {
+            if (value >= target) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+SearchIndex::SearchIndex() : running(false), stopping(false) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&wake, NULL);
+}
+
+SearchIndex::~SearchIndex() {
+    stop();
+    pthread_cond_destroy(&wake);
+    pthread_mutex_destroy(&lock);
+}
+
+/*
+ * @brief Index the logs of a directory, from the loop
+ * @param dir The channel log directory, empty stops indexing and drops the index
+ * @return void
+*/
+void SearchIndex::configure(const std::string& dir) {
+    if (running && dir == this->dir) {
+        return;
+    }
+    stop();
+    pthread_mutex_lock(&lock);
+    channels.clear();
+    pthread_mutex_unlock(&lock);
+    progress.clear();
+    this->dir = dir;
+    if (dir.empty()) {
+        return;
+    }
+
+    sigset_t blocked, previous;
+    sigfillset(&blocked);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    running = pthread_create(&thread, NULL, threadMain, this) == 0;
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+void SearchIndex::stop() {
+    if (!running) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    stopping = false;
+    running = false;
+}
+
+void* SearchIndex::threadMain(void* arg) {
+    static_cast<SearchIndex*>(arg)->work();
+    return NULL;
+}
+
+void SearchIndex::work() {
+    while (true) {
+        DIR* listing = opendir(dir.c_str());
+        if (listing) {
+            std::vector<std::string> paths;
+            while (struct dirent* entry = readdir(listing)) {
+                std::string name = entry->d_name;
+                if (name.size() > 4 && name.compare(name.size() - 4, 4, ".log") == 0) {
+                    paths.push_back(dir + "/" + name);
+                }
+            }
+            closedir(listing);
+            for (size_t i = 0; i < paths.size(); ++i) {
+                indexFile(paths[i]);
+            }
+        }
+
+        pthread_mutex_lock(&lock);
+        if (!stopping) {
+            uint64_t at = current_time_ms() + SEARCH_POLL_MS;
+            struct timespec deadline;
+            deadline.tv_sec = at / 1000;
+            deadline.tv_nsec = (at % 1000) * 1000000;
+            pthread_cond_timedwait(&wake, &lock, &deadline);
+        }
+        bool done = stopping;
+        pthread_mutex_unlock(&lock);
+        if (done) {
+            return;
+        }
+    }
+}
+
+/*
+ * @brief Index the records appended to a log since the last pass, SEARCH_BATCH_BYTES at a time
+ * @param path The .log file
+ * @return void
+ * Each batch is tokenized without the lock and merged under it, so a query waits at most one merge
+*/
+void SearchIndex::indexFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    uint64_t size = st.st_size;
+    uint64_t& done = progress[path];
+    if (size < done) {
+        // Replaced or cut back: start over
+        pthread_mutex_lock(&lock);
+        channels.erase(path);
+        pthread_mutex_unlock(&lock);
+        done = 0;
+    }
+    if (done == 0) {
+        char magic[CHANNEL_LOG_MAGIC_SIZE];
+        if (pread(fd, magic, sizeof(magic), 0) != CHANNEL_LOG_MAGIC_SIZE || std::memcmp(magic, CHANNEL_LOG_MAGIC, sizeof(magic)) != 0) {
+            close(fd);
+            return;
+        }
+        done = CHANNEL_LOG_MAGIC_SIZE;
+    }
+
+    std::string chunk;
+    std::vector<std::string> terms;
+    while (done < size) {
+        chunk.resize(std::min<uint64_t>(size - done, SEARCH_BATCH_BYTES));
+        ssize_t got = pread(fd, &chunk[0], chunk.size(), done);
+        if (got <= 0) {
+            break;
+        }
+        chunk.resize(got);
+
+        std::map<std::string, std::vector<uint64_t> > batch;
+        size_t pos = 0;
+        uint64_t records = 0;
+        while (chunk.size() - pos >= CHANNEL_LOG_RECORD_HEADER) {
+            uint32_t length;
+            std::memcpy(&length, chunk.data() + pos, sizeof(length));
+            if (chunk.size() - pos - CHANNEL_LOG_RECORD_HEADER < length) {
+                break; // Not written completely yet, or past the end of this chunk
+            }
+            // ":nick!user@host PRIVMSG #channel :text" gives the terms of the text and from:<nick>
+            const char* line = chunk.data() + pos + CHANNEL_LOG_RECORD_HEADER;
+            std::string text(line, length);
+            size_t trailing = text.find(" :", 1);
+            terms.clear();
+            if (trailing != std::string::npos) {
+                tokenize(text.data() + trailing + 2, text.size() - trailing - 2, terms);
+            }
+            if (!text.empty() && text[0] == ':') {
+                std::string nick = text.substr(1, text.find_first_of("! ") - 1);
+                std::transform(nick.begin(), nick.end(), nick.begin(), ::tolower);
+                terms.push_back("from:" + nick);
+            }
+            std::sort(terms.begin(), terms.end());
+            terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+            for (size_t i = 0; i < terms.size(); ++i) {
+                batch[terms[i]].push_back(done + pos);
+            }
+            pos += CHANNEL_LOG_RECORD_HEADER + length;
+            ++records;
+        }
+        if (records == 0) {
+            break;
+        }
+
+        pthread_mutex_lock(&lock);
+        ChannelIndex& index = channels[path];
+        for (std::map<std::string, std::vector<uint64_t> >::iterator it = batch.begin(); it != batch.end(); ++it) {
+            PostingList& list = index.terms[it->first];
+            for (size_t i = 0; i < it->second.size(); ++i) {
+                addPosting(list, it->second[i]);
+            }
+        }
+        index.records += records;
+        bool quit = stopping;
+        pthread_mutex_unlock(&lock);
+        done += pos;
+        if (quit) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+void SearchIndex::addPosting(PostingList& list, uint64_t offset) {
+    if (list.count % SEARCH_SKIP_INTERVAL == 0) {
+        list.skips.push_back(std::make_pair(list.last, static_cast<uint32_t>(list.deltas.size())));
+    }
+    put_varint(list.deltas, offset - list.last);
+    list.last = offset;
+    ++list.count;
+}
+
+/*
+ * @brief Find the latest records containing every term
+ * @param log_path The channel's log file
+ * @param terms The terms, from tokenize() or "from:<nick>"
+ * @param min_offset The offset of the first record to consider
+ * @param max_offset The offset past the last record to consider
+ * @param keep How many hits to return
+ * @param offsets Set to the record offsets of the latest hits, oldest first
+ * @return True if there are older hits than those returned
+ * The shortest list is walked newest block first and every other list only seeks
+ * to its postings, so the work stops as soon as enough hits are found
+*/
+bool SearchIndex::search(const std::string& log_path, const std::vector<std::string>& terms, uint64_t min_offset, uint64_t max_offset,
+                         size_t keep, std::vector<uint64_t>& offsets) {
+    offsets.clear();
+    if (terms.empty() || keep == 0 || min_offset >= max_offset) {
+        return false;
+    }
+    pthread_mutex_lock(&lock);
+    std::map<std::string, ChannelIndex>::iterator channel = channels.find(log_path);
+    std::vector<Cursor> cursors;
+    for (size_t i = 0; channel != channels.end() && i < terms.size(); ++i) {
+        std::map<std::string, PostingList>::iterator list = channel->second.terms.find(terms[i]);
+        if (list == channel->second.terms.end()) {
+            cursors.clear();
+            break;
+        }
+        cursors.push_back(Cursor(&list->second));
+    }
+    if (cursors.empty()) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    size_t lead = 0;
+    for (size_t i = 1; i < cursors.size(); ++i) {
+        if (cursors[i].size() < cursors[lead].size()) {
+            lead = i;
+        }
+    }
+    bool more = false;
+    std::vector<uint64_t> candidates;
+    std::vector<uint64_t> matched;
+    size_t first_block = cursors[lead].blockOf(min_offset);
+    for (size_t block = cursors[lead].blockOf(max_offset) + 1; block-- > first_block && !more;) {
+        candidates.clear();
+        cursors[lead].toBlock(block);
+        for (size_t n = 0; n < SEARCH_SKIP_INTERVAL && cursors[lead].next(); ++n) {
+            if (cursors[lead].value >= min_offset && cursors[lead].value < max_offset) {
+                candidates.push_back(cursors[lead].value);
+            }
+        }
+        matched.clear();
+        for (size_t c = 0; c < candidates.size(); ++c) {
+            bool all = true;
+            for (size_t i = 0; i < cursors.size() && all; ++i) {
+                all = i == lead || (cursors[i].seek(candidates[c]) && cursors[i].value == candidates[c]);
+            }
+            if (all) {
+                matched.push_back(candidates[c]);
+            }
+        }
+        for (size_t m = matched.size(); m-- > 0;) {
+            if (offsets.size() == keep) {
+                more = true;
+                break;
+            }
+            offsets.push_back(matched[m]);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    std::reverse(offsets.begin(), offsets.end());
+    return more;
+}
+
+void SearchIndex::getStats(uint64_t& records, uint64_t& terms, uint64_t& bytes) {
+    records = 0;
+    terms = 0;
+    bytes = 0;
+    pthread_mutex_lock(&lock);
+    for (std::map<std::string, ChannelIndex>::iterator it = channels.begin(); it != channels.end(); ++it) {
+        records += it->second.records;
+        terms += it->second.terms.size();
+        for (std::map<std::string, PostingList>::iterator list = it->second.terms.begin(); list != it->second.terms.end(); ++list) {
+            bytes += list->second.deltas.size() + list->second.skips.size() * sizeof(list->second.skips[0]);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * @brief Split text into lowercase terms: runs of letters and digits, bytes of UTF-8 characters count as letters
+ * @param text The text
+ * @param length Its length
+ * @param terms The terms are appended, those shorter than SEARCH_TERM_MIN are skipped and longer ones cut
+ * @return void
+*/
+void SearchIndex::tokenize(const char* text, size_t length, std::vector<std::string>& terms) {
+    size_t i = 0;
+    while (i < length) {
+        while (i < length && !std::isalnum(static_cast<unsigned char>(text[i])) && !(text[i] & 0x80)) {
+            ++i;
+        }
+        size_t start = i;
+        while (i < length && (std::isalnum(static_cast<unsigned char>(text[i])) || (text[i] & 0x80))) {
+            ++i;
+        }
+        if (i - start >= SEARCH_TERM_MIN) {
+            std::string term(text + start, std::min<size_t>(i - start, SEARCH_TERM_MAX));
+            std::transform(term.begin(), term.end(), term.begin(), ::tolower);
+            terms.push_back(term);
+        }
+    }
+}
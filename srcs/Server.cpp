@@ -1,6 +1,10 @@
 #include "ft_irc.hpp"
 
 Server* g_server_instance = NULL;
+volatile sig_atomic_t g_upgrade_requested = 0;
+volatile sig_atomic_t g_reload_requested = 0;
+volatile sig_atomic_t g_shutdown_requested = 0;
+int g_log_level = LOG_INFO;
 
 /*
  * @brief Init all the data and start the server
@@ -8,26 +12,48 @@ Server* g_server_instance = NULL;
  * @param password The password to require for clients to connect
  * @return void
 */
-Server::Server(int port, const std::string& password) : password(password) {
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
+Server::Server(int port, const std::string& password) : password(password), config(read_startup_config(CONFIG_PATH)), config_path(CONFIG_PATH) {
+    // Listen on IPv6 and IPv4 at once, fall back to IPv4 only on hosts without IPv6
+    server_fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool ipv6 = server_fd != -1;
+    if (!ipv6) {
+        server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    }
     if (server_fd == -1) {
         throw std::runtime_error("Socket creation failed");
     }
 
     fcntl(server_fd, F_SETFL, O_NONBLOCK);
 
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    memset(&(server_addr.sin_zero), '\0', 8);
+    int reuse = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    int bound;
+    if (ipv6) {
+        int v6only = 0;
+        setsockopt(server_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+
+        struct sockaddr_in6 server_addr;
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin6_family = AF_INET6;
+        server_addr.sin6_port = htons(port);
+        server_addr.sin6_addr = in6addr_any;
+        bound = bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    } else {
+        struct sockaddr_in server_addr;
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(port);
+        server_addr.sin_addr.s_addr = INADDR_ANY;
+        memset(&(server_addr.sin_zero), '\0', 8);
+        bound = bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    }
 
-    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+    if (bound == -1) {
         close(server_fd);
         throw std::runtime_error("Bind failed");
     }
 
-    if (listen(server_fd, BACKLOG) == -1) {
+    if (listen(server_fd, config->backlog) == -1) {
         close(server_fd);
         throw std::runtime_error("Listen failed");
     }
@@ -37,37 +63,118 @@ Server::Server(int port, const std::string& password) : password(password) {
     server_poll_fd.events = POLLIN;
     poll_fds.push_back(server_poll_fd);
 
-    server_name = "localhost:" + intToString(port);
+    initialize_server(port);
+}
+
+/*
+ * @brief Resume the server from the state handed over by a running process (hot upgrade)
+ * @param port The port the previous process listens on
+ * @param password The password to require for clients to connect
+ * @param handoff_fd The unix socket the previous process sends its state on
+ * @return void
+*/
+Server::Server(int port, const std::string& password, int handoff_fd)
+    : server_fd(-1), password(password), config(read_startup_config(CONFIG_PATH)), config_path(CONFIG_PATH) {
+    initialize_server(port);
+    receive_handoff(handoff_fd);
+}
+
+/*
+ * @brief Init the data shared by both constructors
+ * @param port The port the server listens on
+ * @return void
+*/
+void Server::initialize_server(int port) {
+    server_name = config->server_name.empty() ? "localhost:" + intToString(port) : config->server_name;
     server_version = "1.0";
     time_t now = time(0);
     char time[64];
     strftime(time, sizeof(time), "%a %b %d %H:%M:%S %Y", gmtime(&now));
     server_creation_date = time;
     requires_password = !password.empty();
+    sid = config->server_id.empty() ? make_server_id(port) : config->server_id;
+    snapshot_path = SNAPSHOT_PATH;
+    snapshot_pid = -1;
+    next_snapshot_time = now + SNAPSHOT_INTERVAL;
+    if (snapshot.open(snapshot_path)) {
+        std::cout << "Mapped channel snapshot " << snapshot_path << " (" << snapshot.size() << " channels)" << std::endl;
+    }
+
+    if (!metrics.open(metrics_segment_name(port))) {
+        std::cerr << "Failed to create metrics segment " << metrics_segment_name(port) << std::endl;
+    }
 
     initialize_command_map();
+    for (std::map<std::string, CommandHandler>::iterator it = command_map.begin(); it != command_map.end(); ++it) {
+        int index = command_verbs.size();
+        command_verbs[it->first] = index;
+        metrics.registerVerb(it->first);
+    }
+
+    calibrate_cycle_clock();
+    command_latency.resize(command_verbs.size());
+    message_filter = NULL;
+    filter_generation = 0;
+    filter_scanned_bytes = 0;
+    filter_scan_cycles = 0;
+    std::fill(filter_hits, filter_hits + 3, 0);
+    apply_config();
+
+    overload_stage = OVERLOAD_NONE;
+    overload_changed = now;
+    loop_lag_us = 0;
+    next_load_decay = now + 1;
+    next_address_sweep = now + ADDRESS_SWEEP_INTERVAL;
+
+    accounts_path = ACCOUNTS_PATH;
+    load_accounts();
+
+    host_cache.setCapacity(HOST_CACHE_SIZE);
+    if (config->worker_threads > 0 && workers.start(config->worker_threads, &metrics)) {
+        struct pollfd worker_poll_fd;
+        worker_poll_fd.fd = workers.getEventFd();
+        worker_poll_fd.events = POLLIN;
+        worker_poll_fd.revents = 0;
+        poll_fds.push_back(worker_poll_fd);
+    } else {
+        std::cerr << "Failed to start worker threads, host names will not be resolved" << std::endl;
+    }
+    load_plugins();
 }
 
 Server::~Server() {
+    plugins.unloadAll();
+    reap_snapshot_writer(true);
+    if (!save_snapshot()) {
+        std::cerr << "Failed to write channel snapshot " << snapshot_path << std::endl;
+    }
+
     for (size_t i = 0; i < poll_fds.size(); ++i) {
-        if (poll_fds[i].fd != server_fd) {
+        if (poll_fds[i].fd != server_fd && poll_fds[i].fd != workers.getEventFd()) {
             close(poll_fds[i].fd);
         }
     }
     close(server_fd);
+    for (std::map<int, LinkInfo>::iterator it = links.begin(); it != links.end(); ++it) {
+        delete it->second.stream;
+    }
+    delete message_filter;
+    delete config;
 }
 
-// Signal handler function
+/*
+ * @brief Record a signal for the loop, which acts on it between two polls
+ * @param signum The signal number
+ * @return void
+ * Only sig_atomic_t flags are set here: shutting down writes the snapshot and joins threads, none of it is async-signal-safe
+*/
 void signal_handler(int signum) {
-    if (signum == SIGINT || signum == SIGQUIT) {
-        std::cout << "\nSignal received (" << signum << "), shutting down..." << std::endl;
-
-        if (g_server_instance != NULL) {
-            delete g_server_instance;
-            g_server_instance = NULL;
-        }
-
-        exit(0);
+    if (signum == SIGUSR2) {
+        g_upgrade_requested = 1;
+    } else if (signum == SIGHUP) {
+        g_reload_requested = 1;
+    } else if (signum == SIGINT || signum == SIGQUIT) {
+        g_shutdown_requested = signum;
     }
 }
 
@@ -91,6 +198,14 @@ void setup_signal_handling() {
         std::cerr << "Error setting SIGQUIT handler" << std::endl;
         exit(1);
     }
+    if (sigaction(SIGUSR2, &sa, NULL) == -1) {
+        std::cerr << "Error setting SIGUSR2 handler" << std::endl;
+        exit(1);
+    }
+    if (sigaction(SIGHUP, &sa, NULL) == -1) {
+        std::cerr << "Error setting SIGHUP handler" << std::endl;
+        exit(1);
+    }
 }
 
 /*
@@ -103,30 +218,101 @@ void Server::run() {
     setup_signal_handling();
 
     while (true) {
+        if (g_shutdown_requested) {
+            std::cout << "\nSignal received (" << g_shutdown_requested << "), shutting down..." << std::endl;
+            return; // main deletes the server, outside of any signal handler
+        }
+        if (g_upgrade_requested) {
+            g_upgrade_requested = 0;
+            channel_log.stop(); // The new process appends to the same files, everything queued is written first
+            if (hot_upgrade()) {
+                return;
+            }
+            channel_log.configure(config->channel_log_dir, config->channel_logs);
+        }
+        if (g_reload_requested) {
+            g_reload_requested = 0;
+            reload_config();
+        }
+
+        flush_link_streams();
+        uint64_t sendq_bytes = 0;
+        uint64_t sendq_max = 0;
+        std::vector<int> sendq_exceeded;
         for (size_t i = 0; i < poll_fds.size(); ++i) {
             poll_fds[i].revents = 0;
+            if (poll_fds[i].fd == server_fd) {
+                // Leave new connections in the backlog while the loop catches up
+                bool defer = overload_stage == OVERLOAD_DEFER_ACCEPT || overload_stage == OVERLOAD_THROTTLE;
+                poll_fds[i].events = defer ? 0 : POLLIN;
+                continue;
+            }
+            if (poll_fds[i].fd == workers.getEventFd()) {
+                poll_fds[i].events = POLLIN;
+                continue;
+            }
+            poll_fds[i].events = throttled_fds.count(poll_fds[i].fd) ? 0 : POLLIN;
+            std::map<int, Client>::iterator it = clients.find(poll_fds[i].fd);
+            if (it != clients.end() && it->second.hasPendingOutput()) {
+                poll_fds[i].events |= POLLOUT;
+                sendq_bytes += it->second.getSendQueueSize() + it->second.getControlQueueSize();
+                sendq_max = std::max<uint64_t>(sendq_max, it->second.getSendQueueSize());
+                // Control traffic has its own budget, a bulk backlog never gets a client dropped for a PONG
+                unsigned long limit = client_class(it->second).sendq;
+                if ((it->second.getSendQueueSize() > limit || it->second.getControlQueueSize() > limit) && !links.count(it->first)) {
+                    sendq_exceeded.push_back(it->first);
+                }
+            }
+        }
+        for (size_t i = 0; i < sendq_exceeded.size(); ++i) {
+            drop_client(sendq_exceeded[i], "SendQ exceeded");
         }
+        metrics.setGauge(GAUGE_CLIENTS, clients.size());
+        metrics.setGauge(GAUGE_CHANNELS, channels.size());
+        metrics.setGauge(GAUGE_SENDQ_BYTES, sendq_bytes);
+        metrics.setGauge(GAUGE_SENDQ_MAX, sendq_max);
 
-        int poll_count = poll(&poll_fds[0], poll_fds.size(), -1);
+        int poll_count = poll(&poll_fds[0], poll_fds.size(), compute_poll_timeout());
+        t_metrics->counters[METRIC_LOOP_ITERATIONS]++;
         if (poll_count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
             std::cerr << "Poll failed" << std::endl;
             break;
         }
+        if (poll_count > 0) {
+            t_metrics->counters[METRIC_LOOP_WAKEUPS]++;
+        }
+        uint64_t woke_at = cycle_now();
+        uint64_t ready_cycles = 0;
 
         for (size_t i = 0; i < poll_fds.size(); ) {
             if (poll_fds[i].fd < 0) {
                 ++i;
                 continue;
             }
-            
+            if (poll_fds[i].revents) {
+                ready_cycles = std::max(ready_cycles, cycle_now() - woke_at);
+            }
+
             try {
                 if (poll_fds[i].fd == server_fd && (poll_fds[i].revents & POLLIN)) {
                     handle_new_connection();
                     ++i;
-                } else if (poll_fds[i].revents & POLLIN) {
-                    handle_client_data(i);
+                } else if (poll_fds[i].fd == workers.getEventFd()) {
+                    if (poll_fds[i].revents & POLLIN) {
+                        process_worker_completions();
+                    }
                     ++i;
                 } else {
+                    if ((poll_fds[i].revents & POLLOUT) && !flush_client(i)) {
+                        close_client(i, true);
+                        continue;
+                    }
+                    if (poll_fds[i].revents & POLLIN) {
+                        handle_client_data(i);
+                    }
                     ++i;
                 }
             } catch (const std::exception &e) {
@@ -134,51 +320,201 @@ void Server::run() {
                 close_client(i);
             }
         }
+
+        process_pending_lists();
+        run_timers();
+        update_loop_lag(cycle_now() - woke_at, ready_cycles);
     }
 }
 
-
+/*
+ * @brief Compute how long poll may block before a timer or pending work is due
+ * @return The timeout in milliseconds, -1 to block indefinitely
+*/
+int Server::compute_poll_timeout() {
+    if (has_runnable_lists()) {
+        return 0;
+    }
+    time_t now = time(NULL);
+    time_t next_timer = std::min(next_snapshot_time, next_load_decay);
+    for (size_t i = 0; i < link_peers.size(); ++i) {
+        if (link_peers[i].fd < 0 && link_peers[i].block.port && !link_peers[i].addresses.empty()) {
+            next_timer = std::min(next_timer, link_peers[i].next_attempt);
+        }
+    }
+    if (next_timer <= now) {
+        return 0;
+    }
+    int timeout = static_cast<int>(next_timer - now) * 1000;
+    if (!lookup_deadlines.empty()) {
+        uint64_t now_ms = current_time_ms();
+        for (std::map<int, uint64_t>::iterator it = lookup_deadlines.begin(); it != lookup_deadlines.end(); ++it) {
+            timeout = std::min<int>(timeout, it->second > now_ms ? static_cast<int>(it->second - now_ms) : 0);
+        }
+    }
+    if (overload_stage != OVERLOAD_NONE) {
+        timeout = std::min(timeout, LAG_CHECK_INTERVAL_MS); // Keep measuring so shedding stops once the lag is gone
+    }
+    return timeout;
+}
 
 /*
- * @brief Add a new client to the server (in the map of clients)
+ * @brief Run the periodic tasks that are due
  * @return void
 */
-void Server::handle_new_connection() {
-    if (poll_fds.size() - 1 >= MAX_CLIENTS) {
-        std::cerr << "Max clients reached. Refusing connection." << std::endl;
-        int temp_fd = accept(server_fd, NULL, NULL);
-        if (temp_fd != -1) {
-            const char *reject_message = "Server full, cannot accept more clients.\r\n";
-            send(temp_fd, reject_message, strlen(reject_message), 0);
-            close(temp_fd);
+void Server::run_timers() {
+    reap_snapshot_writer(false);
+    expire_host_lookups();
+
+    time_t now = time(NULL);
+    expire_sessions(now);
+    if (now >= next_snapshot_time) {
+        start_background_snapshot();
+        next_snapshot_time = now + SNAPSHOT_INTERVAL;
+    }
+
+    if (now >= next_load_decay) {
+        for (std::map<int, Client>::iterator it = clients.begin(); it != clients.end(); ++it) {
+            it->second.decayRecvLoad();
         }
+        if (overload_stage >= OVERLOAD_THROTTLE) {
+            select_throttled_clients();
+        }
+        check_client_timeouts(now);
+        next_load_decay = now + 1;
+    }
+
+    if (now >= next_address_sweep) {
+        address_table.sweep(now);
+        next_address_sweep = now + ADDRESS_SWEEP_INTERVAL;
+    }
+
+    for (size_t i = 0; i < link_peers.size(); ++i) {
+        LinkPeer& peer = link_peers[i];
+        if (!peer.resolving && (peer.resolved_at == 0 || now - peer.resolved_at >= LINK_RESOLVE_INTERVAL)) {
+            resolve_link_peer(peer);
+        }
+        if (peer.fd < 0 && peer.block.port && !peer.addresses.empty() && now >= peer.next_attempt) {
+            peer.next_attempt = now + peer.backoff;
+            connect_to_peer(peer);
+        }
+    }
+}
+
+/*
+ * @brief Queue a message for a client, it is written when the socket is ready
+ * @param client_fd The client file descriptor
+ * @param msg The message to send
+ * @return void
+*/
+void Server::send_to_client(int client_fd, const std::string& msg) {
+    std::map<int, Client>::iterator it = clients.find(client_fd);
+    if (it == clients.end()) {
         return;
     }
+    std::map<int, LinkInfo>::iterator link = links.find(client_fd);
+    if (link != links.end() && link->second.stream) {
+        link->second.stream->write(msg); // Compressed and queued by flush_link_streams()
+        return;
+    }
+    // A server link keeps a single lane, its peer relies on the order of everything it is sent
+    it->second.queueMessage(msg, link != links.end() ? LANE_BULK : Message::lane(msg));
+}
 
-    int client_fd = accept(server_fd, NULL, NULL);
-    if (client_fd < 0) {
-        std::cerr << "Accept failed" << std::endl;
-    } else {
-        if (fcntl(client_fd, F_SETFL, O_NONBLOCK) < 0) {
-            std::cerr << "Failed to set client socket to non-blocking" << std::endl;
-            close(client_fd);
+/*
+ * @brief Write the pending output of a client
+ * @param i The index of the client in the poll_fds vector
+ * @return False if the connection is broken, true otherwise
+*/
+bool Server::flush_client(size_t i) {
+    std::map<int, Client>::iterator it = clients.find(poll_fds[i].fd);
+    if (it == clients.end()) {
+        return true;
+    }
+    return it->second.flushSendQueue();
+}
+
+
+
+/*
+ * @brief Refuse a connection with a single write of a pre-built message, before any Client exists
+ * @param fd The accepted socket
+ * @param message The message to send
+ * @param length The message length
+ * @return void
+*/
+void Server::reject_connection(int fd, const char* message, size_t length) {
+    send(fd, message, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(fd);
+}
+
+/*
+ * @brief Accept every pending connection and add it to the server (in the map of clients)
+ * @return void
+*/
+void Server::handle_new_connection() {
+    static const char server_full_message[] = "Server full, cannot accept more clients.\r\n";
+    static const char too_many_message[] = "ERROR :Too many connections from your host\r\n";
+    static const char too_fast_message[] = "ERROR :Connecting too fast, try again later\r\n";
+    static const std::string overload_message = "ERROR :Server overloaded, try again in " + intToString(LAG_RETRY_AFTER) + " seconds\r\n";
+    time_t now = time(NULL);
+
+    while (true) {
+        struct sockaddr_storage peer;
+        socklen_t peer_length = sizeof(peer);
+        int client_fd = accept4(server_fd, reinterpret_cast<struct sockaddr*>(&peer), &peer_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "Accept failed" << std::endl;
+            }
             return;
         }
+
+        if (overload_stage == OVERLOAD_REJECT) {
+            reject_connection(client_fd, overload_message.data(), overload_message.size());
+            t_metrics->counters[METRIC_OVERLOAD_REJECTS]++;
+            continue;
+        }
+        if (clients.size() >= config->max_clients) {
+            std::cerr << "Max clients reached. Refusing connection." << std::endl;
+            reject_connection(client_fd, server_full_message, sizeof(server_full_message) - 1);
+            t_metrics->counters[METRIC_ACCEPT_REJECTS]++;
+            continue;
+        }
+
+        PeerAddress address = PeerAddress::fromSockaddr(reinterpret_cast<struct sockaddr*>(&peer), peer_length);
+        AdmitResult admitted = address_table.admit(address, now);
+        if (admitted != ADMIT_OK) {
+            if (admitted == ADMIT_TOO_MANY) {
+                reject_connection(client_fd, too_many_message, sizeof(too_many_message) - 1);
+            } else {
+                reject_connection(client_fd, too_fast_message, sizeof(too_fast_message) - 1);
+            }
+            t_metrics->counters[METRIC_ACCEPT_REJECTS]++;
+            continue;
+        }
+
         struct pollfd client_poll_fd;
         client_poll_fd.fd = client_fd;
         client_poll_fd.events = POLLIN;
+        client_poll_fd.revents = 0;
         poll_fds.push_back(client_poll_fd);
 
         std::string name = "Guest" + intToString(client_fd);
         clients[client_fd] = Client(client_fd);
         clients[client_fd].setNickname(name);
+        clients[client_fd].setAddress(address);
 
-        std::cout << "New client connected: " << client_fd << std::endl;
+        t_metrics->counters[METRIC_CONNECTIONS]++;
+        IRC_PROBE1(accept, client_fd);
+        std::cout << "New client connected: " << client_fd << " from " << address.toString() << std::endl;
 
         std::string welcome_msg = "Welcome to the server, " + name + "\r\n";
-        if (send(client_fd, welcome_msg.c_str(), welcome_msg.size(), 0) == -1) {
-            std::cerr << "Failed to send welcome message to client " << client_fd << std::endl;
-        }
+        send_to_client(client_fd, welcome_msg);
+        start_host_lookup(client_fd, true);
     }
 }
 
@@ -212,16 +548,18 @@ bool Server::is_command(const std::string& command) {
 */
 std::string Server::receive_data(int client_fd) {
     char buffer[1024];
-    int bytes_received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
+    int bytes_received = recv(client_fd, buffer, sizeof(buffer), 0);
 
     if (bytes_received == 0) {
         throw std::runtime_error("Client disconnected");
     } else if (bytes_received < 0) {
         return "";
     }
+    t_metrics->counters[METRIC_BYTES_IN] += bytes_received;
+    IRC_PROBE2(recv, client_fd, bytes_received);
+    clients[client_fd].addRecvLoad(bytes_received);
 
-    buffer[bytes_received] = '\0';
-    return std::string(buffer);
+    return std::string(buffer, bytes_received); // Compressed link data may hold NUL bytes
 }
 
 
@@ -232,8 +570,22 @@ std::string Server::receive_data(int client_fd) {
  * @param args The arguments
  * @return void
 */
-void Server::parse_command(const std::string& input, std::string& command, std::string& args) {
-
+void Server::parse_command(const std::string& raw_input, std::string& command, std::string& args) {
+    // Keep the client-only (+) tags for handlers that relay them, drop the rest
+    message_tags.clear();
+    std::string input = raw_input;
+    if (!input.empty() && input[0] == '@') {
+        size_t tags_end = input.find(' ');
+        std::string tags = input.substr(1, tags_end == std::string::npos ? std::string::npos : tags_end - 1);
+        input = tags_end == std::string::npos ? "" : input.substr(tags_end + 1);
+        std::istringstream tag_stream(tags);
+        std::string tag;
+        while (tags.size() <= MAX_CLIENT_TAGS_LENGTH && std::getline(tag_stream, tag, ';')) {
+            if (tag.size() > 1 && tag[0] == '+') {
+                message_tags += (message_tags.empty() ? "" : ";") + tag;
+            }
+        }
+    }
 
     std::string trimmed_input = my_trim(input);
     size_t space_pos = input.find(' ');
@@ -246,8 +598,10 @@ void Server::parse_command(const std::string& input, std::string& command, std::
         args = "";
     }
 
-    std::cout << "Command: |" << command << "|" << std::endl;
-    std::cout << "Args: |" << args << "|" << std::endl;
+    if (g_log_level >= LOG_DEBUG) {
+        std::cout << "Command: |" << command << "|" << std::endl;
+        std::cout << "Args: |" << args << "|" << std::endl;
+    }
 
     command = my_trim(command);
     if (!args.empty()) {
@@ -266,27 +620,49 @@ void Server::parse_command(const std::string& input, std::string& command, std::
 */
 void Server::process_command(int client_fd, const std::string& command, const std::string& args) {
     if (is_command(command)) {
-		std::cout << "Client is registered: " << std::boolalpha << clients[client_fd].isRegistered() << std::endl;
+        t_metrics->counters[METRIC_COMMANDS]++;
+        int verb_index = command_verbs[command];
+        if (verb_index < METRICS_MAX_VERBS) {
+            t_metrics->verbs[verb_index]++;
+        }
+
+        // Time one command out of latency_sample_rate, 0 disables sampling
+        bool sampled = latency_sample_rate > 0 && --latency_countdown == 0;
+        uint64_t start = sampled ? cycle_now() : 0;
+        IRC_PROBE2(command_start, client_fd, command.c_str());
+
+        if (g_log_level >= LOG_DEBUG) {
+            std::cout << "Client is registered: " << std::boolalpha << clients[client_fd].isRegistered() << std::endl;
+        }
 
         if (clients[client_fd].isRegistered() == false) {
-            if (command == "PASS" || command == "NICK" || command == "USER" || command == "CAP" || command == "PING" || command == "PONG" || command == "QUIT") {
-                std::cout << "Executing command handler for: " << command << std::endl;
+            if (command == "PASS" || command == "NICK" || command == "USER" || command == "CAP" || command == "AUTHENTICATE" || command == "RESUME" || command == "PING" || command == "PONG" || command == "QUIT") {
                 CommandHandler handler = command_map[command];
                 (this->*handler)(client_fd, args);
             } else {
                 std::string error_msg = ":" + server_name + " 451 " + clients[client_fd].getNickname() + " :You have not registered. Please complete registration.\r\n";
-                send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+                send_to_client(client_fd, error_msg);
+            }
+            if (clients.count(client_fd)) {
+                complete_registration(client_fd);
             }
-			complete_registration(client_fd);
         } else {
-            std::cout << "Executing command handler for: " << command << std::endl;
+            if (g_log_level >= LOG_DEBUG) {
+                std::cout << "Executing command handler for: " << command << std::endl;
+            }
             CommandHandler handler = command_map[command];
             (this->*handler)(client_fd, args);
         }
+
+        IRC_PROBE2(command_done, client_fd, command.c_str());
+        if (sampled) {
+            latency_countdown = latency_sample_rate;
+            record_command_latency(verb_index, command, args, cycle_now() - start);
+        }
     } else {
         if (!command.empty()) {
             std::string error_msg = ":" + server_name + " 421 " + clients[client_fd].getNickname() + " " + command + " :Unknown command\r\n";
-            send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+            send_to_client(client_fd, error_msg);
         }
     }
 }
@@ -299,24 +675,17 @@ void Server::process_command(int client_fd, const std::string& command, const st
 void Server::complete_registration(int client_fd) {
     Client& client = clients[client_fd];
 
-    if (client.isRegistered() == false && client.hasNick() && client.hasUser() && client.isAuthenticated()) {
+    if (client.isRegistered() == false && client.hasNick() && client.hasUser() && client.isAuthenticated() && !client.isHostPending()
+        && !client.isCapNegotiating() && client.getSaslState() != SASL_VERIFYING) {
         client.setRegistered(true);
         std::string nickname = client.getNickname();
 
-        std::string welcome_msg = ":" + server_name + " 001 " + nickname + " :Welcome to the IRC network, " + nickname + "\r\n";
-        send(client_fd, welcome_msg.c_str(), welcome_msg.size(), 0);
+        send_welcome(client_fd);
 
-        std::string yourhost_msg = ":" + server_name + " 002 " + nickname + " :Your host is " + server_name + ", running version " + server_version + "\r\n";
-        send(client_fd, yourhost_msg.c_str(), yourhost_msg.size(), 0);
-
-        std::string created_msg = ":" + server_name + " 003 " + nickname + " :This server was created " + server_creation_date + "\r\n";
-        send(client_fd, created_msg.c_str(), created_msg.size(), 0);
-
-        std::string myinfo_msg = ":" + server_name + " 004 " + nickname + " " + server_name + " " + server_version + " o o\r\n";
-        send(client_fd, myinfo_msg.c_str(), myinfo_msg.size(), 0);
-
-        std::string isupport_msg = ":" + server_name + " 005 " + nickname + " :are supported by this server\r\n";
-        send(client_fd, isupport_msg.c_str(), isupport_msg.size(), 0);
+        client.setUid(make_uid(client.getId()));
+        clients_by_uid[client.getUid()] = &client;
+        broadcast_to_links(make_uid_line(client), -1);
+        t_metrics->counters[METRIC_REGISTRATIONS]++;
 
         std::cout << "Client " << client_fd << " registered as " << nickname << std::endl;
     }
@@ -324,7 +693,68 @@ void Server::complete_registration(int client_fd) {
 
 void Server::send_ping(int client_fd) {
     std::string pingMessage = "PING :ServerCheck\r\n";
-    send(client_fd, pingMessage.c_str(), pingMessage.length(), 0);
+    send_to_client(client_fd, pingMessage);
+}
+
+/*
+ * @brief The connection class whose limits apply to a client
+ * @param client The client
+ * @return The "account" class for clients logged in to an account, the "user" class otherwise
+*/
+const ConnectionClass& Server::client_class(const Client& client) const {
+    return config->classes[client.getAccount().empty() ? CLASS_USER : CLASS_ACCOUNT];
+}
+
+/*
+ * @brief Drop unregistered clients past the registration timeout, ping idle clients and drop those that never answer
+ * @param now The current time
+ * @return void
+*/
+void Server::check_client_timeouts(time_t now) {
+    std::vector<std::pair<int, std::string> > expired;
+    for (std::map<int, Client>::iterator it = clients.begin(); it != clients.end(); ++it) {
+        Client& client = it->second;
+        if (client.isRemote() || links.count(it->first)) {
+            continue;
+        }
+        if (!client.isRegistered()) {
+            if (config->registration_timeout > 0 && now - client.getTimeToConnect() >= static_cast<time_t>(config->registration_timeout)) {
+                expired.push_back(std::make_pair(it->first, std::string("Registration timeout")));
+            }
+            continue;
+        }
+
+        const ConnectionClass& limits = client_class(client);
+        if (limits.ping_interval == 0) {
+            continue;
+        }
+        if (client.getPingSent() == 0) {
+            if (now - client.getLastActivityTime() >= static_cast<time_t>(limits.ping_interval)) {
+                send_ping(it->first);
+                client.setPingSent(now);
+            }
+        } else if (now - client.getPingSent() >= static_cast<time_t>(limits.ping_timeout)) {
+            expired.push_back(std::make_pair(it->first, "Ping timeout: " + intToString(limits.ping_timeout) + " seconds"));
+        }
+    }
+    for (size_t i = 0; i < expired.size(); ++i) {
+        // A client that stopped answering pings may be on a dead mobile connection, it can resume
+        drop_client(expired[i].first, expired[i].second, clients[expired[i].first].isRegistered());
+    }
+}
+
+/*
+ * @brief Disconnect a client for breaking a limit, with an ERROR line telling it why
+ * @param client_fd The client file descriptor
+ * @param reason The reason
+ * @param resumable Whether the client may resume its session
+ * @return void
+*/
+void Server::drop_client(int client_fd, const std::string& reason, bool resumable) {
+    std::string error = "ERROR :Closing Link: " + reason + "\r\n";
+    send(client_fd, error.c_str(), error.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    std::cout << "Client " << client_fd << " dropped: " << reason << std::endl;
+    disconnect_client(client_fd, resumable);
 }
 
 /*
@@ -334,28 +764,53 @@ void Server::send_ping(int client_fd) {
 void Server::handle_client_data(size_t i) {
     int client_fd = poll_fds[i].fd;
     try {
-        this->clientInput += receive_data(client_fd);
-
-        size_t pos;
-        while ((pos = this->clientInput.find("\n")) != std::string::npos) {
-            std::string input = this->clientInput.substr(0, pos);
-            this->clientInput.erase(0, pos + 1);
+        std::string data = receive_data(client_fd);
+        std::map<int, LinkInfo>::iterator link = links.find(client_fd);
+        if (link != links.end() && link->second.stream) {
+            std::string inflated;
+            if (!link->second.stream->read(data.data(), data.size(), inflated)) {
+                throw std::runtime_error("Corrupt compressed link data");
+            }
+            data.swap(inflated);
+        }
+        clients[client_fd].appendToBuffer(data);
+        clients[client_fd].setLastActivityTime(time(NULL));
+        clients[client_fd].setPingSent(0);
+        uint64_t now_ms = current_time_ms();
+
+        std::string input;
+        while (true) {
+            std::map<int, Client>::iterator it = clients.find(client_fd);
+            if (it == clients.end() || !it->second.extractLine(input)) {
+                break;
+            }
+            if (links.count(client_fd) || (!it->second.isRegistered() && is_link_handshake(input))) {
+                process_link_message(client_fd, input);
+                continue;
+            }
+            const ConnectionClass& limits = client_class(it->second);
+            if (!it->second.takeFloodToken(now_ms, limits.flood_rate, limits.flood_burst)) {
+                drop_client(client_fd, "Excess Flood");
+                break;
+            }
 
             std::string command, args;
             parse_command(input, command, args);
+            IRC_PROBE3(command_parsed, client_fd, command.c_str(), args.size());
             process_command(client_fd, command, args);
         }
     } catch (const std::exception& e) {
         std::cerr << "Error handling client " << client_fd << ": " << e.what() << std::endl;
-        close_client(i);
+        close_client(i, true);
     }
 }
 
 /*
  * @brief Close a client connection
  * @param i The index of the client in the poll_fds vector
+ * @param resumable Whether the connection was lost rather than closed on purpose, a client with a resume token is then kept
 */
-void Server::close_client(int i) {
+void Server::close_client(int i, bool resumable) {
     if (i < 0 || static_cast<size_t>(i) >= poll_fds.size()) {
         return;
     }
@@ -370,22 +825,49 @@ void Server::close_client(int i) {
 
     std::string nickname = it->second.getNickname();
 
-    for (std::map<std::string, Channel>::iterator ch_it = channels.begin(); ch_it != channels.end(); ++ch_it) {
-        ch_it->second.removeClient(nickname);
-        ch_it->second.removeOperator(nickname, server_name);
+    if (links.count(client_fd)) {
+        handle_link_lost(client_fd);
+    } else if (!resumable || !detach_session(it->second)) {
+        propagate_local_quit(it->second, "Client closed connection");
+        for (std::map<std::string, Channel>::iterator ch_it = channels.begin(); ch_it != channels.end(); ++ch_it) {
+            ch_it->second.removeClient(nickname);
+            ch_it->second.removeOperator(nickname, server_name);
+        }
     }
 
+    IRC_PROBE1(close, client_fd);
     close(client_fd);
 
+    if (it->second.getAddress().valid) {
+        address_table.release(it->second.getAddress());
+    }
+    forget_host_lookup(client_fd);
+    pending_lists.erase(client_fd);
+    throttled_fds.erase(client_fd);
     clients.erase(client_fd);
 
     poll_fds.erase(poll_fds.begin() + i);
+    t_metrics->counters[METRIC_DISCONNECTIONS]++;
 
     std::cout << "Client " << client_fd << " (" << nickname << ") disconnected" << std::endl;
 }
 
 
 
+/*
+ * @brief Close a client connection from its file descriptor
+ * @param client_fd The client file descriptor
+ * @param resumable As for close_client
+*/
+void Server::disconnect_client(int client_fd, bool resumable) {
+    for (size_t i = 0; i < poll_fds.size(); ++i) {
+        if (poll_fds[i].fd == client_fd) {
+            close_client(i, resumable);
+            return;
+        }
+    }
+}
+
 bool Server::is_valid_channel_name(const std::string& name) {
     return !name.empty() && name[0] == '#';
 }
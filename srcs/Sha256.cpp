@@ -0,0 +1,183 @@
+#include "Sha256.hpp"
+
+#include <cstring>
+
+static const uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+Sha256::Sha256() : length(0), used(0) {
+    state[0] = 0x6a09e667;
+    state[1] = 0xbb67ae85;
+    state[2] = 0x3c6ef372;
+    state[3] = 0xa54ff53a;
+    state[4] = 0x510e527f;
+    state[5] = 0x9b05688c;
+    state[6] = 0x1f83d9ab;
+    state[7] = 0x5be0cd19;
+}
+
+void Sha256::compress(const uint8_t* data) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t(data[i * 4]) << 24) | (uint32_t(data[i * 4 + 1]) << 16) | (uint32_t(data[i * 4 + 2]) << 8) | data[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + round_constants[i] + w[i];
+        uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void Sha256::update(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    length += size;
+    while (size > 0) {
+        size_t take = SHA256_BLOCK_SIZE - used;
+        if (take > size) {
+            take = size;
+        }
+        std::memcpy(block + used, bytes, take);
+        used += take;
+        bytes += take;
+        size -= take;
+        if (used == SHA256_BLOCK_SIZE) {
+            compress(block);
+            used = 0;
+        }
+    }
+}
+
+void Sha256::final(uint8_t digest[SHA256_DIGEST_SIZE]) {
+    uint64_t bits = length * 8;
+    uint8_t pad = 0x80;
+    update(&pad, 1);
+    pad = 0;
+    while (used != SHA256_BLOCK_SIZE - 8) {
+        update(&pad, 1);
+    }
+    uint8_t encoded[8];
+    for (int i = 0; i < 8; ++i) {
+        encoded[i] = static_cast<uint8_t>(bits >> (56 - i * 8));
+    }
+    update(encoded, 8);
+    for (int i = 0; i < 8; ++i) {
+        digest[i * 4] = static_cast<uint8_t>(state[i] >> 24);
+        digest[i * 4 + 1] = static_cast<uint8_t>(state[i] >> 16);
+        digest[i * 4 + 2] = static_cast<uint8_t>(state[i] >> 8);
+        digest[i * 4 + 3] = static_cast<uint8_t>(state[i]);
+    }
+}
+
+/*
+ * @brief Prepare the inner and outer HMAC states of a key, so each HMAC only hashes the message
+*/
+static void hmac_init(const std::string& key, Sha256& inner, Sha256& outer) {
+    uint8_t block[SHA256_BLOCK_SIZE];
+    std::memset(block, 0, sizeof(block));
+    if (key.size() > SHA256_BLOCK_SIZE) {
+        Sha256 hashed;
+        hashed.update(key.data(), key.size());
+        hashed.final(block);
+    } else {
+        std::memcpy(block, key.data(), key.size());
+    }
+
+    uint8_t pad[SHA256_BLOCK_SIZE];
+    for (int i = 0; i < SHA256_BLOCK_SIZE; ++i) {
+        pad[i] = block[i] ^ 0x36;
+    }
+    inner.update(pad, sizeof(pad));
+    for (int i = 0; i < SHA256_BLOCK_SIZE; ++i) {
+        pad[i] = block[i] ^ 0x5c;
+    }
+    outer.update(pad, sizeof(pad));
+}
+
+static void hmac_finish(Sha256 inner, Sha256 outer, const void* data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    uint8_t inner_digest[SHA256_DIGEST_SIZE];
+    inner.update(data, size);
+    inner.final(inner_digest);
+    outer.update(inner_digest, sizeof(inner_digest));
+    outer.final(digest);
+}
+
+void hmac_sha256(const std::string& key, const void* data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    Sha256 inner, outer;
+    hmac_init(key, inner, outer);
+    hmac_finish(inner, outer, data, size, digest);
+}
+
+/*
+ * @brief Derive a key from a password (PBKDF2-HMAC-SHA256, RFC 8018)
+ * @param password The password
+ * @param salt The salt
+ * @param iterations The iteration count, the cost of the derivation
+ * @param length The length of the derived key in bytes
+ * @return The derived key
+*/
+std::string pbkdf2_sha256(const std::string& password, const std::string& salt, uint32_t iterations, size_t length) {
+    Sha256 inner, outer;
+    hmac_init(password, inner, outer);
+
+    std::string derived;
+    for (uint32_t block_index = 1; derived.size() < length; ++block_index) {
+        std::string first = salt;
+        first += static_cast<char>(block_index >> 24);
+        first += static_cast<char>(block_index >> 16);
+        first += static_cast<char>(block_index >> 8);
+        first += static_cast<char>(block_index);
+
+        uint8_t u[SHA256_DIGEST_SIZE];
+        uint8_t t[SHA256_DIGEST_SIZE];
+        hmac_finish(inner, outer, first.data(), first.size(), u);
+        std::memcpy(t, u, sizeof(t));
+        for (uint32_t i = 1; i < iterations; ++i) {
+            hmac_finish(inner, outer, u, sizeof(u), u);
+            for (int j = 0; j < SHA256_DIGEST_SIZE; ++j) {
+                t[j] ^= u[j];
+            }
+        }
+        derived.append(reinterpret_cast<char*>(t), sizeof(t));
+    }
+    derived.resize(length);
+    return derived;
+}
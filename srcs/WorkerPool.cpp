@@ -0,0 +1,162 @@
+#include "WorkerPool.hpp"
+#include "Metrics.hpp"
+
+#include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+WorkerPool::WorkerPool() : event_fd(-1), stopping(false), metrics(NULL) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&has_work, NULL);
+}
+
+WorkerPool::~WorkerPool() {
+    stop();
+    pthread_cond_destroy(&has_work);
+    pthread_mutex_destroy(&lock);
+}
+
+/*
+ * @brief Create the eventfd and start the threads
+ * @param thread_count The number of threads
+ * @param metrics The metrics segment each thread attaches to, may be NULL
+ * @return True if the pool is running, false otherwise
+*/
+bool WorkerPool::start(size_t thread_count, Metrics* metrics) {
+    this->metrics = metrics;
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0) {
+        return false;
+    }
+
+    // Signals are for the event loop, workers never handle them
+    sigset_t blocked, previous;
+    sigfillset(&blocked);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    for (size_t i = 0; i < thread_count; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &WorkerPool::threadMain, this) != 0) {
+            break;
+        }
+        threads.push_back(thread);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    return !threads.empty();
+}
+
+/*
+ * @brief Stop the threads once they finish their current job, queued jobs are dropped
+ * @return void
+*/
+void WorkerPool::stop() {
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&has_work);
+    pthread_mutex_unlock(&lock);
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    threads.clear();
+
+    for (size_t i = 0; i < pending.size(); ++i) {
+        delete pending[i];
+    }
+    pending.clear();
+    for (size_t i = 0; i < completed.size(); ++i) {
+        delete completed[i];
+    }
+    completed.clear();
+
+    if (event_fd >= 0) {
+        close(event_fd);
+        event_fd = -1;
+    }
+}
+
+void* WorkerPool::threadMain(void* arg) {
+    static_cast<WorkerPool*>(arg)->work();
+    return NULL;
+}
+
+void WorkerPool::work() {
+    if (metrics) {
+        metrics->attachThread();
+    }
+
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (!stopping && pending.empty()) {
+            pthread_cond_wait(&has_work, &lock);
+        }
+        if (stopping) {
+            break;
+        }
+        WorkerJob* job = pending.front();
+        pending.pop_front();
+        pthread_mutex_unlock(&lock);
+
+        job->run();
+
+        pthread_mutex_lock(&lock);
+        completed.push_back(job);
+        uint64_t one = 1;
+        ssize_t written = write(event_fd, &one, sizeof(one));
+        (void)written; // The counter only overflows if the loop stopped draining it
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * @brief Queue a job, the pool owns it until takeCompleted() hands it back
+ * @param job The job
+ * @return void
+*/
+void WorkerPool::submit(WorkerJob* job) {
+    pthread_mutex_lock(&lock);
+    pending.push_back(job);
+    pthread_cond_signal(&has_work);
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * @brief Hand a job straight to the event loop without running it, from any thread
+ * @param job The job, only its complete() is called
+ * @return void
+*/
+void WorkerPool::post(WorkerJob* job) {
+    pthread_mutex_lock(&lock);
+    completed.push_back(job);
+    uint64_t one = 1;
+    ssize_t written = write(event_fd, &one, sizeof(one));
+    (void)written;
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * @brief Reset the eventfd and collect the finished jobs, called by the event loop
+ * @param jobs Filled with the finished jobs, the caller completes and deletes them
+ * @return void
+*/
+void WorkerPool::takeCompleted(std::vector<WorkerJob*>& jobs) {
+    uint64_t count;
+    ssize_t drained = read(event_fd, &count, sizeof(count));
+    (void)drained;
+
+    pthread_mutex_lock(&lock);
+    jobs.assign(completed.begin(), completed.end());
+    completed.clear();
+    pthread_mutex_unlock(&lock);
+}
+
+int WorkerPool::getEventFd() const {
+    return event_fd;
+}
+
+size_t WorkerPool::backlog() {
+    pthread_mutex_lock(&lock);
+    size_t size = pending.size();
+    pthread_mutex_unlock(&lock);
+    return size;
+}
@@ -0,0 +1,98 @@
+#include "bot/CommandRegistry.hpp"
+#include <cctype>
+#include <cstddef>
+
+#define REGISTRY_INITIAL_SLOTS 16
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+CommandRegistry::CommandRegistry() : _slots(REGISTRY_INITIAL_SLOTS, -1), _mask(REGISTRY_INITIAL_SLOTS - 1) {}
+
+/*
+ * @brief FNV-1a hash of a command name, case-insensitive
+ * @param name The command name
+ * @return The hash
+*/
+uint32_t CommandRegistry::hash(const std::string& name) {
+    uint32_t h = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < name.size(); ++i) {
+        h ^= static_cast<uint32_t>(std::tolower(static_cast<unsigned char>(name[i])));
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+void CommandRegistry::rehash(size_t capacity) {
+    _slots.assign(capacity, -1);
+    _mask = capacity - 1;
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        size_t slot = _entries[i].hash & _mask;
+        while (_slots[slot] >= 0) {
+            slot = (slot + 1) & _mask;
+        }
+        _slots[slot] = static_cast<int>(i);
+    }
+}
+
+/*
+ * @brief Register a command
+ * @param name The command name, without the '!'
+ * @param plugin The plugin that handles it
+ * @param id Passed back to the plugin in CommandContext::id
+ * @param help One line shown by !help
+ * @return False if the name is already taken
+*/
+bool CommandRegistry::add(const std::string& name, BotPlugin* plugin, int id, const std::string& help) {
+    if (name.empty() || find(name)) {
+        return false;
+    }
+    CommandEntry entry;
+    entry.name = name;
+    for (size_t i = 0; i < entry.name.size(); ++i) {
+        entry.name[i] = std::tolower(static_cast<unsigned char>(entry.name[i]));
+    }
+    entry.help = help;
+    entry.plugin = plugin;
+    entry.id = id;
+    entry.hash = hash(name);
+    _entries.push_back(entry);
+
+    // Keep the load factor under one half so probe chains stay short
+    if (_entries.size() * 2 > _slots.size()) {
+        rehash(_slots.size() * 2);
+    } else {
+        size_t slot = entry.hash & _mask;
+        while (_slots[slot] >= 0) {
+            slot = (slot + 1) & _mask;
+        }
+        _slots[slot] = static_cast<int>(_entries.size() - 1);
+    }
+    return true;
+}
+
+/*
+ * @brief Look a command up
+ * @param name The command name, in any case
+ * @return The entry, or NULL if no plugin registered it
+*/
+const CommandEntry* CommandRegistry::find(const std::string& name) const {
+    uint32_t h = hash(name);
+    for (size_t slot = h & _mask; _slots[slot] >= 0; slot = (slot + 1) & _mask) {
+        const CommandEntry& entry = _entries[_slots[slot]];
+        if (entry.hash != h || entry.name.size() != name.size()) {
+            continue;
+        }
+        size_t i = 0;
+        while (i < name.size() && std::tolower(static_cast<unsigned char>(name[i])) == entry.name[i]) {
+            ++i;
+        }
+        if (i == name.size()) {
+            return &entry;
+        }
+    }
+    return NULL;
+}
+
+const std::vector<CommandEntry>& CommandRegistry::entries() const {
+    return _entries;
+}
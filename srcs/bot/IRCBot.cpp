@@ -2,34 +2,72 @@
 #include <iostream>
 #include <cstring>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sstream>
+#include <sys/time.h>
 
-#define BUFFER_SIZE 512
+#define BUFFER_SIZE 4096
+#define RECVQ_MAX 8192
 
-Bot::Bot(const std::string& server, int port, const std::string& nickname, const std::string& password, const std::string& channel)
-    : _sockfd(-1), _server(server), _port(port), _nickname(nickname), _channel(channel), _password(password), _current_question_index(-1) {
-    memset(&_pfd, 0, sizeof(_pfd));
-    initialize_trivia();
+volatile sig_atomic_t g_bot_stop = 0;
+
+std::string bot_lowercase(const std::string& text) {
+    std::string lower = text;
+    for (size_t i = 0; i < lower.size(); ++i) {
+        lower[i] = std::tolower(static_cast<unsigned char>(lower[i]));
+    }
+    return lower;
 }
 
-Bot::Bot() : _sockfd(-1) {
-    memset(&_pfd, 0, sizeof(_pfd));
+uint64_t bot_time_ms() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<uint64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+Bot::Bot(const std::string& server, int port, const std::string& nickname, const std::string& password, const std::vector<std::string>& channels)
+    : _sockfd(-1), _server(server), _port(port), _nickname(nickname), _current_nick(nickname), _password(password),
+      _state(BOT_DISCONNECTED), _next_attempt(0), _state_deadline(0), _next_tick(0), _backoff(BOT_BACKOFF_MIN), _connect_started_ms(0) {
+    for (size_t i = 0; i < channels.size(); ++i) {
+        BotChannel channel;
+        channel.name = channels[i];
+        channel.joined = false;
+        channel.joined_at = 0;
+        _channels[bot_lowercase(channel.name)] = channel;
+    }
 }
 
 Bot::~Bot() {
     if (_sockfd >= 0) {
         close(_sockfd);
     }
+    for (size_t i = 0; i < _plugins.size(); ++i) {
+        delete _plugins[i];
+    }
+}
+
+/*
+ * @brief Add a plugin and let it register its commands, the bot takes ownership
+ * @param plugin The plugin
+ * @return void
+*/
+void Bot::add_plugin(BotPlugin* plugin) {
+    _plugins.push_back(plugin);
+    plugin->registerCommands(_commands);
 }
 
-bool Bot::connect_to_server() {
+/*
+ * @brief Start a non-blocking connection to the server
+ * @return False if no address could even be tried, the caller then backs off
+*/
+bool Bot::start_connect() {
     struct addrinfo hints, *res;
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
 
     std::ostringstream port_stream;
-    port_stream << _port;  // Convertir _port en string
+    port_stream << _port;
 
     int status = getaddrinfo(_server.c_str(), port_stream.str().c_str(), &hints, &res);
     if (status != 0) {
@@ -37,64 +75,384 @@ bool Bot::connect_to_server() {
         return false;
     }
 
-    _sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-    if (_sockfd < 0) {
-        std::cerr << "socket: " << strerror(errno) << std::endl;
-        return false;
+    _connect_started_ms = bot_time_ms();
+    for (struct addrinfo* ai = res; ai; ai = ai->ai_next) {
+        _sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (_sockfd < 0) {
+            continue;
+        }
+        fcntl(_sockfd, F_SETFL, O_NONBLOCK);
+        fcntl(_sockfd, F_SETFD, FD_CLOEXEC);
+        if (connect(_sockfd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS) {
+            break;
+        }
+        close(_sockfd);
+        _sockfd = -1;
     }
-
-    if (connect(_sockfd, res->ai_addr, res->ai_addrlen) < 0) {
+    freeaddrinfo(res);
+    if (_sockfd < 0) {
         std::cerr << "connect: " << strerror(errno) << std::endl;
         return false;
     }
 
-    _pfd.fd = _sockfd;
-    _pfd.events = POLLIN;
+    _state = BOT_CONNECTING;
+    _state_deadline = time(NULL) + BOT_CONNECT_TIMEOUT;
+    return true;
+}
 
+/*
+ * @brief The connect() finished: check it succeeded, then send the whole registration in one write
+ * @return void
+*/
+void Bot::on_connected() {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(_sockfd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+        disconnect(std::string("connect: ") + strerror(error ? error : errno));
+        return;
+    }
+
+    _state = BOT_REGISTERING;
+    _current_nick = _nickname;
+    _recvq.clear();
+    _sendq.clear();
+    // No reply is needed between these, so they leave in a single packet
     send_msg("PASS " + _password);
-    sleep(1);
-    send_msg("NICK " + _nickname);
-    sleep(1);
+    send_msg("NICK " + _current_nick);
     send_msg("USER " + _nickname + " 0 * :" + _nickname);
-    sleep(1);
-    send_msg("JOIN " + _channel);
-    sleep(1);
-    return true;
 }
 
+/*
+ * @brief Close the connection and schedule the next attempt
+ * @param reason Logged
+ * @return void
+*/
+void Bot::disconnect(const std::string& reason) {
+    std::cerr << "Disconnected: " << reason << std::endl;
+    if (_sockfd >= 0) {
+        close(_sockfd);
+        _sockfd = -1;
+    }
+    for (std::map<std::string, BotChannel>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
+        it->second.joined = false;
+    }
+    _recvq.clear();
+    _sendq.clear();
+    schedule_reconnect();
+}
 
+/*
+ * @brief Wait before the next attempt, doubling the delay each time up to BOT_BACKOFF_MAX
+ * @return void
+ * A random part of up to half the delay keeps bots restarted together from reconnecting in lockstep
+*/
+void Bot::schedule_reconnect() {
+    _state = BOT_DISCONNECTED;
+    _next_attempt = time(NULL) + _backoff + std::rand() % (_backoff / 2 + 1);
+    std::cerr << "Reconnecting in " << _next_attempt - time(NULL) << "s" << std::endl;
+    _backoff = _backoff * 2 > BOT_BACKOFF_MAX ? BOT_BACKOFF_MAX : _backoff * 2;
+}
+
+/*
+ * @brief Queue a line for the server and try to write it right away
+ * @param msg The line, without CRLF
+ * @return void
+ * Lines sent while disconnected are dropped, they would be stale by the time the bot is back
+*/
 void Bot::send_msg(const std::string& msg) {
-    std::string final_msg = msg + "\r\n";
-    send(_sockfd, final_msg.c_str(), final_msg.length(), 0);
+    if (_sockfd < 0 || _state == BOT_CONNECTING) {
+        return;
+    }
+    _sendq += msg + "\r\n";
+    flush();
 }
 
-void Bot::run() {
-    char buffer[BUFFER_SIZE];
-    std::string msg_from_server;
+/*
+ * @brief Write as much of the send queue as the socket takes
+ * @return False if the connection is broken or the queue is stuck over BOT_SENDQ_MAX
+*/
+bool Bot::flush() {
+    while (!_sendq.empty()) {
+        ssize_t sent = send(_sockfd, _sendq.data(), _sendq.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        _sendq.erase(0, sent);
+    }
+    return _sendq.size() <= BOT_SENDQ_MAX;
+}
 
+/*
+ * @brief Read everything available and handle each complete line
+ * @return False if the server closed the connection or sent an overlong line
+*/
+bool Bot::read_lines() {
+    char buffer[BUFFER_SIZE];
     while (true) {
-        int ret = poll(&_pfd, 1, -1);
+        ssize_t received = recv(_sockfd, buffer, sizeof(buffer), 0);
+        if (received == 0) {
+            return false;
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        _recvq.append(buffer, received);
+    }
+
+    size_t start = 0;
+    for (size_t end; (end = _recvq.find('\n', start)) != std::string::npos; start = end + 1) {
+        size_t length = end - start;
+        if (length > 0 && _recvq[end - 1] == '\r') {
+            --length;
+        }
+        handle_server_message(_recvq.substr(start, length));
+        if (_sockfd < 0) {
+            return true;
+        }
+    }
+    _recvq.erase(0, start);
+    return _recvq.size() <= RECVQ_MAX;
+}
+
+int Bot::poll_timeout(time_t now) const {
+    time_t wake = _state == BOT_DISCONNECTED ? _next_attempt : _state == BOT_READY ? _next_tick : _state_deadline;
+    if (wake <= now) {
+        return 0;
+    }
+    int timeout = static_cast<int>(wake - now) * 1000;
+    uint64_t lookup_deadline = _lookups.next_deadline();
+    if (lookup_deadline != 0) {
+        uint64_t now_ms = bot_time_ms();
+        int lookup_timeout = lookup_deadline <= now_ms ? 0 : static_cast<int>(lookup_deadline - now_ms);
+        timeout = lookup_timeout < timeout ? lookup_timeout : timeout;
+    }
+    return timeout;
+}
+
+/*
+ * @brief The event loop: connection, registration, reading and writing all go through one poll()
+ * @return void
+*/
+void Bot::run() {
+    if (!_lookups.start(BOT_LOOKUP_WORKERS)) {
+        std::cerr << "Lookups disabled: " << strerror(errno) << std::endl;
+    }
+    while (!g_bot_stop) {
+        time_t now = time(NULL);
+        if (_state == BOT_DISCONNECTED && now >= _next_attempt && !start_connect()) {
+            schedule_reconnect();
+        }
+        if ((_state == BOT_CONNECTING || _state == BOT_REGISTERING) && now >= _state_deadline) {
+            disconnect("Timed out before registration");
+        }
+        if (_state == BOT_READY && now >= _next_tick) {
+            for (size_t i = 0; i < _plugins.size(); ++i) {
+                _plugins[i]->onTick(*this, now);
+            }
+            _next_tick = now + BOT_TICK_INTERVAL;
+        }
+
+        _lookups.expire(*this, bot_time_ms());
+
+        // The lookup eventfd is always watched, the socket only while there is one
+        struct pollfd pfds[2];
+        pfds[0].fd = _lookups.get_fd();
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        pfds[1].fd = _sockfd;
+        pfds[1].events = POLLIN;
+        pfds[1].revents = 0;
+        if (_state == BOT_CONNECTING || !_sendq.empty()) {
+            pfds[1].events |= POLLOUT;
+        }
+        int ret = poll(pfds, _sockfd >= 0 ? 2 : 1, poll_timeout(now));
         if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             std::cerr << "poll: " << strerror(errno) << std::endl;
             break;
         }
+        if (pfds[0].revents & POLLIN) {
+            _lookups.complete(*this);
+        }
+        struct pollfd& pfd = pfds[1];
+        if (ret == 0 || _sockfd < 0 || pfd.revents == 0) {
+            continue;
+        }
 
-        if (_pfd.revents & POLLIN) {
-            memset(buffer, 0, BUFFER_SIZE);
-            int bytes_received = recv(_sockfd, buffer, BUFFER_SIZE, 0);
-            if (bytes_received < 0) {
-                std::cerr << "recv: " << strerror(errno) << std::endl;
-                continue;
-            }
+        if (_state == BOT_CONNECTING) {
+            on_connected();
+            continue;
+        }
+        if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) && !read_lines()) {
+            disconnect("Connection closed by the server");
+            continue;
+        }
+        if (_sockfd >= 0 && !flush()) {
+            disconnect("Write failed");
+        }
+    }
 
-            msg_from_server += std::string(buffer, bytes_received);
-            size_t pos = msg_from_server.find("\r\n");
-            while (pos != std::string::npos) {
-                std::string message = msg_from_server.substr(0, pos);
-                handle_server_message(message);
-                msg_from_server.erase(0, pos + 2);
-                pos = msg_from_server.find("\r\n");
+    if (_sockfd >= 0 && _state == BOT_READY) {
+        send_msg("QUIT :Bot shutting down");
+    }
+}
+
+/*
+ * @brief Handle one line from the server
+ * @param line The line, without CRLF
+ * @return void
+*/
+void Bot::handle_server_message(const std::string& line) {
+    IrcMessage msg;
+    if (!msg.parse(line)) {
+        return;
+    }
+
+    if (msg.command == "PING") {
+        send_msg("PONG :" + msg.param(0));
+    } else if (msg.command == "001" && _state == BOT_REGISTERING) {
+        _state = BOT_READY;
+        _backoff = BOT_BACKOFF_MIN;
+        _next_tick = time(NULL);
+        if (!msg.param(0).empty()) {
+            _current_nick = msg.param(0);
+        }
+        std::cout << "Registered as " << _current_nick << " in " << bot_time_ms() - _connect_started_ms << " ms" << std::endl;
+        join_channels();
+    } else if (msg.command == "433" && _state == BOT_REGISTERING) {
+        _current_nick += "_";
+        send_msg("NICK " + _current_nick);
+    } else if (msg.command == "PRIVMSG") {
+        handle_privmsg(msg);
+    } else if ((msg.command == "JOIN" || msg.command == "PART") && msg.nick() == _current_nick) {
+        std::map<std::string, BotChannel>::iterator it = _channels.find(bot_lowercase(msg.param(0)));
+        if (it == _channels.end()) {
+            return;
+        }
+        it->second.joined = msg.command == "JOIN";
+        if (it->second.joined) {
+            it->second.joined_at = time(NULL);
+            std::cout << "Joined " << it->second.name << " " << bot_time_ms() - _connect_started_ms << " ms after connecting" << std::endl;
+            for (size_t i = 0; i < _plugins.size(); ++i) {
+                _plugins[i]->onJoin(*this, it->second.name);
             }
         }
+    } else if (msg.command == "KICK" && msg.param(1) == _current_nick) {
+        std::map<std::string, BotChannel>::iterator it = _channels.find(bot_lowercase(msg.param(0)));
+        if (it != _channels.end()) {
+            it->second.joined = false;
+            send_msg("JOIN " + it->second.name);
+        }
+    } else if (msg.command == "NICK" && msg.nick() == _current_nick) {
+        _current_nick = msg.param(0);
+    } else if (msg.command == "ERROR") {
+        std::cerr << "Server error: " << msg.param(0) << std::endl;
+    } else if (msg.command == "471" || msg.command == "473" || msg.command == "474" || msg.command == "475") {
+        std::cerr << "Cannot join " << msg.param(1) << ": " << msg.param(2) << std::endl;
+    }
+}
+
+/*
+ * @brief Pass a message to the plugins, and dispatch it if it starts with a command
+ * @param msg The PRIVMSG
+ * @return void
+ * Only a "!" at the very start of the text makes a command, a "!word" elsewhere in the line is ignored
+*/
+void Bot::handle_privmsg(const IrcMessage& msg) {
+    std::string sender = msg.nick();
+    const std::string& text = msg.param(1);
+    if (sender == _current_nick) {
+        return;
+    }
+    std::string channel = !msg.param(0).empty() && msg.param(0)[0] == '#' ? msg.param(0) : "";
+
+    for (size_t i = 0; i < _plugins.size(); ++i) {
+        _plugins[i]->onMessage(*this, sender, channel, text);
+    }
+
+    if (text.size() < 2 || text[0] != BOT_COMMAND_PREFIX) {
+        return;
+    }
+    size_t space = text.find(' ');
+    std::string name = text.substr(1, space == std::string::npos ? std::string::npos : space - 1);
+    const CommandEntry* entry = _commands.find(name);
+    if (!entry) {
+        return;
+    }
+
+    CommandContext ctx;
+    ctx.sender = sender;
+    ctx.channel = channel;
+    ctx.target = channel.empty() ? sender : channel;
+    ctx.command = entry->name;
+    ctx.id = entry->id;
+    if (space != std::string::npos) {
+        size_t begin = text.find_first_not_of(' ', space);
+        size_t end = text.find_last_not_of(' ');
+        if (begin != std::string::npos) {
+            ctx.args = text.substr(begin, end - begin + 1);
+        }
     }
+    entry->plugin->handleCommand(*this, ctx);
+}
+
+/*
+ * @brief Join every configured channel, all JOINs leave in one write
+ * @return void
+*/
+void Bot::join_channels() {
+    for (std::map<std::string, BotChannel>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
+        _sendq += "JOIN " + it->second.name + "\r\n";
+    }
+    flush();
+}
+
+/*
+ * @brief Reply to a command where it was typed
+ * @param ctx The command
+ * @param text The reply
+ * @return void
+*/
+void Bot::reply(const CommandContext& ctx, const std::string& text) {
+    send_msg("PRIVMSG " + ctx.target + " :" + text);
+}
+
+/*
+ * @brief Fetch a URL without blocking the loop, the answer comes back through plugin->onLookup
+ * @param plugin The plugin to call back
+ * @param ctx The command being answered
+ * @param key The cache key, identical keys in flight share one request
+ * @param url The URL
+ * @param ttl Seconds to keep a successful answer
+ * @return void
+*/
+void Bot::lookup(BotPlugin* plugin, const CommandContext& ctx, const std::string& key, const std::string& url, unsigned int ttl) {
+    _lookups.request(*this, plugin, ctx, key, url, ttl);
+}
+
+const std::string& Bot::get_nickname() const {
+    return _current_nick;
+}
+
+const CommandRegistry& Bot::get_commands() const {
+    return _commands;
+}
+
+const BotChannel* Bot::find_channel(const std::string& name) const {
+    std::map<std::string, BotChannel>::const_iterator it = _channels.find(bot_lowercase(name));
+    return it == _channels.end() ? NULL : &it->second;
 }
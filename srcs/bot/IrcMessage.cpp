@@ -0,0 +1,69 @@
+#include "bot/IrcMessage.hpp"
+#include <cctype>
+
+/*
+ * @brief Split a line into prefix, command and parameters, message tags are skipped
+ * @param line The line, without its CRLF
+ * @return False if the line has no command
+*/
+bool IrcMessage::parse(const std::string& line) {
+    prefix.clear();
+    command.clear();
+    params.clear();
+
+    size_t pos = 0;
+    if (pos < line.size() && line[pos] == '@') {
+        pos = line.find(' ', pos);
+        if (pos == std::string::npos) {
+            return false;
+        }
+        pos = line.find_first_not_of(' ', pos);
+    }
+    if (pos != std::string::npos && pos < line.size() && line[pos] == ':') {
+        size_t end = line.find(' ', pos);
+        if (end == std::string::npos) {
+            return false;
+        }
+        prefix = line.substr(pos + 1, end - pos - 1);
+        pos = line.find_first_not_of(' ', end);
+    }
+    if (pos == std::string::npos || pos >= line.size()) {
+        return false;
+    }
+
+    size_t end = line.find(' ', pos);
+    command = line.substr(pos, end - pos);
+    for (size_t i = 0; i < command.size(); ++i) {
+        command[i] = std::toupper(static_cast<unsigned char>(command[i]));
+    }
+
+    pos = end == std::string::npos ? end : line.find_first_not_of(' ', end);
+    while (pos != std::string::npos && pos < line.size()) {
+        if (line[pos] == ':') {
+            params.push_back(line.substr(pos + 1));
+            break;
+        }
+        end = line.find(' ', pos);
+        params.push_back(line.substr(pos, end - pos));
+        pos = end == std::string::npos ? end : line.find_first_not_of(' ', end);
+    }
+    return true;
+}
+
+/*
+ * @brief The nickname part of the prefix
+ * @return The text before '!' or '@', the whole prefix for a server
+*/
+std::string IrcMessage::nick() const {
+    return prefix.substr(0, prefix.find_first_of("!@"));
+}
+
+/*
+ * @brief A parameter that may be missing
+ * @param index The parameter index
+ * @return The parameter, or an empty string if there are not that many
+*/
+const std::string& IrcMessage::param(size_t index) const {
+    static const std::string empty;
+    return index < params.size() ? params[index] : empty;
+}
@@ -0,0 +1,408 @@
+#include "bot/LookupService.hpp"
+#include "bot/IRCBot.hpp"
+#include <cstring>
+#include <cstdio>
+#include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+
+#define LOOKUP_MAX_RESPONSE 65536
+#define LOOKUP_CACHE_MAX 512
+#define LOOKUP_ERROR_TTL 10         // Seconds a failure is cached, so a dead API is not hammered
+
+LookupService::LookupService() : _next_id(1), _eventfd(-1), _stopping(false) {
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
+}
+
+LookupService::~LookupService() {
+    stop();
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_mutex);
+}
+
+/*
+ * @brief Start the worker threads
+ * @param workers How many lookups may run at once
+ * @return False if the eventfd or a thread could not be created
+*/
+bool LookupService::start(size_t workers) {
+    _eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_eventfd < 0) {
+        return false;
+    }
+    for (size_t i = 0; i < workers; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, this) != 0) {
+            stop();
+            return false;
+        }
+        _threads.push_back(thread);
+    }
+    return true;
+}
+
+/*
+ * @brief Stop the workers, waiting for the lookups they are running (each is bounded by its deadline)
+ * @return void
+*/
+void LookupService::stop() {
+    pthread_mutex_lock(&_mutex);
+    _stopping = true;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        pthread_join(_threads[i], NULL);
+    }
+    _threads.clear();
+    for (size_t i = 0; i < _queue.size(); ++i) {
+        delete _queue[i];
+    }
+    for (size_t i = 0; i < _done.size(); ++i) {
+        delete _done[i];
+    }
+    _queue.clear();
+    _done.clear();
+    if (_eventfd >= 0) {
+        close(_eventfd);
+        _eventfd = -1;
+    }
+}
+
+int LookupService::get_fd() const {
+    return _eventfd;
+}
+
+void* LookupService::worker_main(void* arg) {
+    static_cast<LookupService*>(arg)->worker_loop();
+    return NULL;
+}
+
+void LookupService::worker_loop() {
+    while (true) {
+        pthread_mutex_lock(&_mutex);
+        while (_queue.empty() && !_stopping) {
+            pthread_cond_wait(&_cond, &_mutex);
+        }
+        if (_stopping) {
+            pthread_mutex_unlock(&_mutex);
+            return;
+        }
+        Job* job = _queue.front();
+        _queue.pop_front();
+        pthread_mutex_unlock(&_mutex);
+
+        http_get(job->url, job->deadline_ms, job->result);
+
+        pthread_mutex_lock(&_mutex);
+        _done.push_back(job);
+        pthread_mutex_unlock(&_mutex);
+        uint64_t one = 1;
+        ssize_t written = write(_eventfd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+/*
+ * @brief Look a URL up for a plugin, the answer comes back through plugin->onLookup
+ * @param bot The bot
+ * @param plugin The plugin to call back
+ * @param ctx The command the lookup answers, passed back as is
+ * @param key The cache key, requests with the same key share one fetch and one cached answer
+ * @param url The URL, http:// only
+ * @param ttl Seconds to cache a successful answer
+ * @return void
+ * A cached answer is delivered before this returns
+*/
+void LookupService::request(Bot& bot, BotPlugin* plugin, const CommandContext& ctx, const std::string& key, const std::string& url, unsigned int ttl) {
+    std::map<std::string, CacheEntry>::iterator cached = _cache.find(key);
+    if (cached != _cache.end()) {
+        if (cached->second.expires > time(NULL)) {
+            plugin->onLookup(bot, ctx, cached->second.result);
+            return;
+        }
+        _cache.erase(cached);
+    }
+
+    Waiter waiter;
+    waiter.plugin = plugin;
+    waiter.ctx = ctx;
+    std::map<std::string, Pending>::iterator pending = _pending.find(key);
+    if (pending != _pending.end()) {
+        pending->second.waiters.push_back(waiter);
+        return;
+    }
+
+    if (_threads.empty()) {
+        LookupResult result;
+        result.ok = false;
+        result.status = 0;
+        result.error = "lookups are not available";
+        plugin->onLookup(bot, ctx, result);
+        return;
+    }
+
+    Job* job = new Job();
+    job->id = _next_id++;
+    job->key = key;
+    job->url = url;
+    job->deadline_ms = bot_time_ms() + BOT_LOOKUP_TIMEOUT_MS;
+    job->result.ok = false;
+    job->result.status = 0;
+
+    Pending& entry = _pending[key];
+    entry.id = job->id;
+    entry.deadline_ms = job->deadline_ms;
+    entry.ttl = ttl;
+    entry.waiters.push_back(waiter);
+
+    pthread_mutex_lock(&_mutex);
+    _queue.push_back(job);
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_mutex);
+}
+
+/*
+ * @brief Hand the finished lookups to their waiters, called when the eventfd is readable
+ * @param bot The bot
+ * @return void
+*/
+void LookupService::complete(Bot& bot) {
+    uint64_t count;
+    while (read(_eventfd, &count, sizeof(count)) > 0) {
+    }
+
+    std::deque<Job*> done;
+    pthread_mutex_lock(&_mutex);
+    done.swap(_done);
+    pthread_mutex_unlock(&_mutex);
+
+    for (size_t i = 0; i < done.size(); ++i) {
+        std::map<std::string, Pending>::iterator pending = _pending.find(done[i]->key);
+        // A lookup that already timed out has been answered, its late result is dropped
+        if (pending != _pending.end() && pending->second.id == done[i]->id) {
+            store(done[i]->key, done[i]->result, pending->second.ttl);
+            finish(bot, done[i]->key, done[i]->result);
+        }
+        delete done[i];
+    }
+}
+
+/*
+ * @brief Fail the lookups past their deadline
+ * @param bot The bot
+ * @param now_ms The current time in milliseconds
+ * @return void
+*/
+void LookupService::expire(Bot& bot, uint64_t now_ms) {
+    std::vector<std::string> expired;
+    for (std::map<std::string, Pending>::iterator it = _pending.begin(); it != _pending.end(); ++it) {
+        if (it->second.deadline_ms <= now_ms) {
+            expired.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < expired.size(); ++i) {
+        LookupResult result;
+        result.ok = false;
+        result.status = 0;
+        result.error = "timed out";
+        store(expired[i], result, 0);
+        finish(bot, expired[i], result);
+    }
+}
+
+/*
+ * @brief The earliest deadline of the lookups in flight
+ * @return The deadline in milliseconds, 0 if nothing is in flight
+*/
+uint64_t LookupService::next_deadline() const {
+    uint64_t next = 0;
+    for (std::map<std::string, Pending>::const_iterator it = _pending.begin(); it != _pending.end(); ++it) {
+        if (next == 0 || it->second.deadline_ms < next) {
+            next = it->second.deadline_ms;
+        }
+    }
+    return next;
+}
+
+void LookupService::finish(Bot& bot, const std::string& key, const LookupResult& result) {
+    std::vector<Waiter> waiters;
+    waiters.swap(_pending[key].waiters);
+    _pending.erase(key);
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        waiters[i].plugin->onLookup(bot, waiters[i].ctx, result);
+    }
+}
+
+void LookupService::store(const std::string& key, const LookupResult& result, unsigned int ttl) {
+    if (_cache.size() >= LOOKUP_CACHE_MAX) {
+        time_t now = time(NULL);
+        for (std::map<std::string, CacheEntry>::iterator it = _cache.begin(); it != _cache.end(); ) {
+            if (it->second.expires <= now) {
+                _cache.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+        if (_cache.size() >= LOOKUP_CACHE_MAX) {
+            _cache.erase(_cache.begin());
+        }
+    }
+    CacheEntry& entry = _cache[key];
+    entry.result = result;
+    entry.expires = time(NULL) + (result.ok ? ttl : LOOKUP_ERROR_TTL);
+}
+
+static int remaining_ms(uint64_t deadline_ms) {
+    uint64_t now = bot_time_ms();
+    return now >= deadline_ms ? 0 : static_cast<int>(deadline_ms - now);
+}
+
+static bool wait_for(int fd, short events, uint64_t deadline_ms) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    int ret;
+    do {
+        ret = poll(&pfd, 1, remaining_ms(deadline_ms));
+    } while (ret < 0 && errno == EINTR);
+    return ret > 0;
+}
+
+static void fail(LookupResult& result, const std::string& error) {
+    result.ok = false;
+    result.error = error;
+}
+
+/*
+ * @brief Fetch a URL with HTTP/1.0, every step bounded by the deadline
+ * @param url "http://host[:port][/path]"
+ * @param deadline_ms When to give up, in bot_time_ms() time
+ * @param result Filled with the status and body, or the error
+ * @return True for a 2xx answer
+ * Runs on a worker. Only name resolution is not bounded here, the loop times the lookup out anyway.
+*/
+bool http_get(const std::string& url, uint64_t deadline_ms, LookupResult& result) {
+    result.status = 0;
+    result.body.clear();
+    if (url.compare(0, 7, "http://") != 0) {
+        fail(result, "only http:// URLs are supported");
+        return false;
+    }
+    size_t host_end = url.find('/', 7);
+    std::string authority = url.substr(7, host_end == std::string::npos ? std::string::npos : host_end - 7);
+    std::string path = host_end == std::string::npos ? "/" : url.substr(host_end);
+    std::string host = authority;
+    std::string port = "80";
+    size_t colon = authority.rfind(':');
+    if (colon != std::string::npos && authority.find(']', colon) == std::string::npos) {
+        host = authority.substr(0, colon);
+        port = authority.substr(colon + 1);
+    }
+    if (!host.empty() && host[0] == '[') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+    if (status != 0) {
+        fail(result, gai_strerror(status));
+        return false;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, res->ai_protocol);
+    if (fd < 0) {
+        freeaddrinfo(res);
+        fail(result, strerror(errno));
+        return false;
+    }
+    bool connected = connect(fd, res->ai_addr, res->ai_addrlen) == 0
+        || (errno == EINPROGRESS && wait_for(fd, POLLOUT, deadline_ms));
+    freeaddrinfo(res);
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (!connected || getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+        close(fd);
+        fail(result, connected ? strerror(error) : "connect timed out");
+        return false;
+    }
+
+    std::string request = "GET " + path + " HTTP/1.0\r\nHost: " + authority + "\r\nUser-Agent: ft_irc-bot\r\nConnection: close\r\n\r\n";
+    size_t sent = 0;
+    while (sent < request.size()) {
+        ssize_t n = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            close(fd);
+            fail(result, strerror(errno));
+            return false;
+        } else if (!wait_for(fd, POLLOUT, deadline_ms)) {
+            close(fd);
+            fail(result, "timed out");
+            return false;
+        }
+    }
+
+    std::string response;
+    char buffer[4096];
+    while (response.size() < LOOKUP_MAX_RESPONSE) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n == 0) {
+            break;
+        }
+        if (n > 0) {
+            response.append(buffer, n);
+        } else if (errno != EAGAIN && errno != EINTR) {
+            close(fd);
+            fail(result, strerror(errno));
+            return false;
+        } else if (!wait_for(fd, POLLIN, deadline_ms)) {
+            close(fd);
+            fail(result, "timed out");
+            return false;
+        }
+    }
+    close(fd);
+
+    size_t header_end = response.find("\r\n\r\n");
+    int code = 0;
+    if (header_end == std::string::npos || std::sscanf(response.c_str(), "HTTP/%*d.%*d %d", &code) != 1) {
+        fail(result, "malformed HTTP response");
+        return false;
+    }
+    result.status = code;
+    result.body = response.substr(header_end + 4);
+    result.ok = code >= 200 && code < 300;
+    if (!result.ok) {
+        std::ostringstream reason;
+        reason << "HTTP " << code;
+        result.error = reason.str();
+    }
+    return result.ok;
+}
+
+/*
+ * @brief Percent-encode a string for a URL path or query
+ * @param text The raw text
+ * @return The encoded text, unreserved characters are kept
+*/
+std::string url_encode(const std::string& text) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string out;
+    for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = text[i];
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            out += c;
+        } else {
+            out += '%';
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+    }
+    return out;
+}
@@ -0,0 +1,108 @@
+#include "bot/Scoreboard.hpp"
+#include "bot/IRCBot.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+Scoreboard::Scoreboard(const std::string& path) : _path(path), _dirty(false) {}
+
+void Scoreboard::set_score(const std::string& name, unsigned long score) {
+    std::string key = bot_lowercase(name);
+    std::map<std::string, std::pair<std::string, unsigned long> >::iterator it = _players.find(key);
+    if (it != _players.end()) {
+        _ranking.erase(Rank(it->second.second, key));
+    }
+    _players[key] = std::make_pair(name, score);
+    _ranking.insert(Rank(score, key));
+}
+
+/*
+ * @brief Read the scores saved by save(), one "<name> <score>" per line
+ * @return void
+*/
+void Scoreboard::load() {
+    std::ifstream file(_path.c_str());
+    std::string name;
+    unsigned long points;
+    while (file >> name >> points) {
+        set_score(name, points);
+    }
+    _dirty = false;
+}
+
+/*
+ * @brief Write the scores to a temporary file and rename it over the old one
+ * @return False if the file could not be written, the scores stay dirty
+*/
+bool Scoreboard::save() {
+    std::string temporary = _path + ".tmp";
+    {
+        std::ofstream file(temporary.c_str(), std::ios::trunc);
+        for (std::set<Rank, ByScore>::const_iterator it = _ranking.begin(); it != _ranking.end(); ++it) {
+            file << _players.find(it->second)->second.first << " " << it->first << "\n";
+        }
+        if (!file.flush()) {
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), _path.c_str()) != 0) {
+        return false;
+    }
+    _dirty = false;
+    return true;
+}
+
+bool Scoreboard::is_dirty() const {
+    return _dirty;
+}
+
+/*
+ * @brief Give points to a player
+ * @param name The nickname
+ * @param points The points to add
+ * @return The new score
+*/
+unsigned long Scoreboard::add(const std::string& name, unsigned long points) {
+    unsigned long total = score(name) + points;
+    set_score(name, total);
+    _dirty = true;
+    return total;
+}
+
+unsigned long Scoreboard::score(const std::string& name) const {
+    std::map<std::string, std::pair<std::string, unsigned long> >::const_iterator it = _players.find(bot_lowercase(name));
+    return it == _players.end() ? 0 : it->second.second;
+}
+
+/*
+ * @brief The position of a player in the ranking
+ * @param name The nickname
+ * @return 1 for the leader, 0 if the player has no score
+ * Walks the ranking, which is fine for the occasional !score
+*/
+size_t Scoreboard::rank(const std::string& name) const {
+    std::string key = bot_lowercase(name);
+    std::map<std::string, std::pair<std::string, unsigned long> >::const_iterator it = _players.find(key);
+    if (it == _players.end()) {
+        return 0;
+    }
+    std::set<Rank, ByScore>::const_iterator position = _ranking.find(Rank(it->second.second, key));
+    size_t rank = 1;
+    for (std::set<Rank, ByScore>::const_iterator walk = _ranking.begin(); walk != position; ++walk) {
+        ++rank;
+    }
+    return rank;
+}
+
+/*
+ * @brief The best players
+ * @param count How many
+ * @return Up to count display names and scores, best first
+*/
+std::vector<std::pair<std::string, unsigned long> > Scoreboard::top(size_t count) const {
+    std::vector<std::pair<std::string, unsigned long> > result;
+    for (std::set<Rank, ByScore>::const_iterator it = _ranking.begin(); it != _ranking.end() && result.size() < count; ++it) {
+        result.push_back(std::make_pair(_players.find(it->second)->second.first, it->first));
+    }
+    return result;
+}
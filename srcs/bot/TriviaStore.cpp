@@ -0,0 +1,182 @@
+#include "bot/TriviaStore.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+TriviaStore::TriviaStore() : _data(NULL), _size(0) {}
+
+TriviaStore::~TriviaStore() {
+    unload();
+}
+
+void TriviaStore::unload() {
+    if (_data) {
+        munmap(const_cast<char*>(_data), _size);
+    }
+    _data = NULL;
+    _size = 0;
+    _entries.clear();
+}
+
+/*
+ * @brief Map a question file and index its lines, blank lines and lines starting with '#' are skipped
+ * @param path The file path
+ * @param error Set to the reason on failure
+ * @return False if the file cannot be mapped or holds no question, the store is then empty
+*/
+bool TriviaStore::load(const std::string& path, std::string& error) {
+    unload();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0 || static_cast<uint64_t>(st.st_size) > 0xffffffffULL) {
+        error = path + ": empty or too large";
+        close(fd);
+        return false;
+    }
+    void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+    _data = static_cast<const char*>(mapped);
+    _size = st.st_size;
+    madvise(mapped, _size, MADV_SEQUENTIAL);
+
+    for (size_t start = 0; start < _size; ) {
+        const char* newline = static_cast<const char*>(memchr(_data + start, '\n', _size - start));
+        size_t end = newline ? newline - _data : _size;
+        size_t length = end - start;
+        if (length > 0 && _data[end - 1] == '\r') {
+            --length;
+        }
+        const char* tab = static_cast<const char*>(memchr(_data + start, '\t', length));
+        if (length > 0 && _data[start] != '#' && tab && tab != _data + start && tab + 1 != _data + start + length) {
+            Entry entry;
+            entry.question = start;
+            entry.question_length = tab - (_data + start);
+            entry.answer = tab + 1 - _data;
+            entry.answer_length = start + length - entry.answer;
+            _entries.push_back(entry);
+        }
+        start = end + 1;
+    }
+    if (_entries.empty()) {
+        error = path + ": no \"question<TAB>answer\" line";
+        unload();
+        return false;
+    }
+    madvise(mapped, _size, MADV_RANDOM);
+    return true;
+}
+
+size_t TriviaStore::size() const {
+    return _entries.size();
+}
+
+std::string TriviaStore::question(size_t index) const {
+    return std::string(_data + _entries[index].question, _entries[index].question_length);
+}
+
+std::string TriviaStore::answer(size_t index) const {
+    return std::string(_data + _entries[index].answer, _entries[index].answer_length);
+}
+
+/*
+ * @brief Reduce an answer to what matters: lowercase letters and digits, single spaces, no leading article
+ * @param text The answer as typed
+ * @return The normalized answer, "The Pacific-Ocean!" gives "pacific ocean"
+*/
+std::string TriviaStore::normalize(const std::string& text) {
+    std::string out;
+    bool space = false;
+    for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = text[i];
+        if (std::isalnum(c) || c >= 0x80) {
+            if (space && !out.empty()) {
+                out += ' ';
+            }
+            out += std::tolower(c);
+            space = false;
+        } else if (c != '\'' && c != '.') {
+            space = true; // Other punctuation separates words, "D.C." and "O'Neil" stay whole
+        }
+    }
+    static const char* articles[] = { "the ", "a ", "an " };
+    for (size_t i = 0; i < sizeof(articles) / sizeof(articles[0]); ++i) {
+        size_t length = std::strlen(articles[i]);
+        if (out.size() > length && out.compare(0, length, articles[i]) == 0) {
+            return out.substr(length);
+        }
+    }
+    return out;
+}
+
+/*
+ * @brief Whether the edit distance between two strings is at most max
+ * @param a The first string
+ * @param b The second string
+ * @param max The bound
+ * @return True if a can be turned into b with at most max insertions, deletions or substitutions
+ * Only the diagonal band of width 2 * max + 1 is computed, and the scan stops as soon as a
+ * whole row exceeds max, so a wrong guess costs O(max * length) at worst.
+*/
+bool TriviaStore::within_distance(const std::string& a, const std::string& b, size_t max) {
+    size_t n = a.size();
+    size_t m = b.size();
+    if ((n > m ? n - m : m - n) > max) {
+        return false;
+    }
+    const size_t over = max + 1;
+    std::vector<size_t> previous(m + 1, over);
+    std::vector<size_t> current(m + 1, over);
+    for (size_t j = 0; j <= m && j <= max; ++j) {
+        previous[j] = j;
+    }
+    for (size_t i = 1; i <= n; ++i) {
+        size_t from = i > max ? i - max : 1;
+        size_t to = i + max < m ? i + max : m;
+        // Only the band and its two edges are read, the rest of the row keeps stale values
+        std::fill(current.begin() + (from - 1), current.begin() + std::min(to + 1, m) + 1, over);
+        current[0] = i <= max ? i : over;
+        size_t best = current[0];
+        for (size_t j = from; j <= to; ++j) {
+            size_t cost = previous[j - 1] + (a[i - 1] == b[j - 1] ? 0 : 1);
+            cost = std::min(cost, previous[j] + 1);
+            cost = std::min(cost, current[j - 1] + 1);
+            current[j] = std::min(cost, over);
+            best = std::min(best, current[j]);
+        }
+        if (best > max) {
+            return false;
+        }
+        previous.swap(current);
+    }
+    return previous[m] <= max;
+}
+
+/*
+ * @brief Check a guess against the accepted answers, allowing more typos in longer answers
+ * @param guess The normalized guess
+ * @param answers The normalized answers
+ * @return True if the guess is close enough to one of them
+*/
+bool TriviaStore::matches(const std::string& guess, const std::vector<std::string>& answers) {
+    for (size_t i = 0; i < answers.size(); ++i) {
+        size_t length = answers[i].size();
+        size_t max = length <= 3 ? 0 : length <= 6 ? 1 : length <= 12 ? 2 : 3;
+        if (within_distance(guess, answers[i], max)) {
+            return true;
+        }
+    }
+    return false;
+}
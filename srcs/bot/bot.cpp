@@ -1,190 +1,316 @@
 #include "bot/IRCBot.hpp"
+#include "bot/TriviaStore.hpp"
+#include "bot/Scoreboard.hpp"
 #include <sstream>
 #include <iomanip>
 #include <ctime>
 #include <vector>
-//#include <curl/curl.h>
-
-// Initialize trivia
-void Bot::initialize_trivia() {
-    _triviaQuestions["What is the capital of France?"] = "Paris";
-    _triviaQuestions["What is the capital of Japan?"] = "Tokyo";
-    _triviaQuestions["What is the capital of Italy?"] = "Rome";
-    _triviaQuestions["What is the capital of Spain?"] = "Madrid";
-    _triviaQuestions["What is the capital of Germany?"] = "Berlin";
-    _triviaQuestions["What is the capital of the United States?"] = "Washington";
-    _triviaQuestions["What is the capital of Canada?"] = "Ottawa";
-    _triviaQuestions["What is the capital of Australia?"] = "Canberra";
-    _triviaQuestions["What is the capital of Brazil?"] = "Brasilia";
-    _triviaQuestions["What is the capital of India?"] = "New Delhi";
-    
-    _triviaQuestions["What is the largest planet in our solar system?"] = "Jupiter";
-    _triviaQuestions["What is the smallest planet in our solar system?"] = "Mercury";
-    _triviaQuestions["What is the largest mammal in the world?"] = "Blue whale";
-    _triviaQuestions["What is the largest ocean in the world?"] = "Pacific Ocean";
-    _triviaQuestions["What is the largest continent in the world?"] = "Asia";
-    _triviaQuestions["What is the largest country in the world?"] = "Russia";
-    _triviaQuestions["What is the largest desert in the world?"] = "Antarctica";
-    _triviaQuestions["What is the largest mountain in the world?"] = "Mount Everest";
-    _triviaQuestions["What is the largest lake in the world?"] = "Caspian Sea";
-    _triviaQuestions["What is the largest river in the world?"] = "Nile River";
-
-    _triviaQuestions["What is the largest animal in the world?"] = "Blue whale";
-    _triviaQuestions["What is the smallest animal in the world?"] = "Bee hummingbird";
-    _triviaQuestions["What is the largest bird in the world?"] = "Ostrich";
-    _triviaQuestions["What is the smallest bird in the world?"] = "Bee hummingbird";
-    _triviaQuestions["What is the largest fish in the world?"] = "Whale shark";
-    _triviaQuestions["What is the smallest fish in the world?"] = "Paedocypris";
-    _triviaQuestions["What is the largest reptile in the world?"] = "Saltwater crocodile";
-    _triviaQuestions["What is the smallest reptile in the world?"] = "Brookesia micra";
-    _triviaQuestions["What is the largest amphibian in the world?"] = "Chinese giant salamander";
-    _triviaQuestions["What is the smallest amphibian in the world?"] = "Paedophryne amauensis";
-    _triviaQuestions["Answer to the Ultimate Question of Life, the Universe, and Everything."] = "42";
-}
+#include <iterator>
+
+enum CoreCommand {
+    CORE_HELLO,
+    CORE_HELP
+};
 
-void Bot::ask_trivia_question() {
-    std::vector<std::string> keys;
-    for (std::map<std::string, std::string>::iterator it = _triviaQuestions.begin(); it != _triviaQuestions.end(); ++it) {
-        keys.push_back(it->first);
+// Answers !hello and lists the registered commands on !help
+class CorePlugin : public BotPlugin {
+public:
+    const char* name() const {
+        return "core";
     }
 
-    int random_index = std::rand() % keys.size();
-    _current_question_index = random_index;
-    std::string question = keys[random_index];
-    
-    std::string response = "PRIVMSG " + _channel + " :" + question;
-    send_msg(response);
-}
+    void registerCommands(CommandRegistry& registry) {
+        registry.add("hello", this, CORE_HELLO, "say hello");
+        registry.add("help", this, CORE_HELP, "list the commands");
+    }
+
+    void handleCommand(Bot& bot, const CommandContext& ctx) {
+        if (ctx.id == CORE_HELLO) {
+            bot.reply(ctx, "world!");
+            return;
+        }
+        const std::vector<CommandEntry>& entries = bot.get_commands().entries();
+        std::string line;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            line += (line.empty() ? "" : ", ") + std::string(1, BOT_COMMAND_PREFIX) + entries[i].name + " (" + entries[i].help + ")";
+        }
+        bot.reply(ctx, "Commands: " + line);
+    }
+};
+
+enum TriviaCommand {
+    TRIVIA_ASK,
+    TRIVIA_ANSWER,
+    TRIVIA_SCORE,
+    TRIVIA_TOP
+};
+
+// An open question in a channel or private query
+struct TriviaRound {
+    size_t question;
+    std::vector<std::string> answers;   // Normalized
+    time_t deadline;
+};
+
+/*
+ * Questions come from the TriviaStore, each channel has its own round, and
+ * answers are matched fuzzily with TriviaStore::matches. In a channel, a plain
+ * message can answer too, but only correct guesses get a reply there.
+*/
+class TriviaPlugin : public BotPlugin {
+private:
+    TriviaStore _store;
+    Scoreboard _scores;
+    std::map<std::string, TriviaRound> _rounds;     // Lowercase target to its open round
+    std::map<std::string, size_t> _last_question;   // Lowercase target to its previous question, not asked twice in a row
+    time_t _next_save;
+
+    void ask(Bot& bot, const CommandContext& ctx) {
+        std::string key = bot_lowercase(ctx.target);
+        std::map<std::string, TriviaRound>::iterator open = _rounds.find(key);
+        if (open != _rounds.end()) {
+            bot.reply(ctx, "Still open: " + _store.question(open->second.question));
+            return;
+        }
+        if (_store.size() == 0) {
+            bot.reply(ctx, "No trivia questions are loaded.");
+            return;
+        }
+
+        size_t index = std::rand() % _store.size();
+        std::map<std::string, size_t>::iterator last = _last_question.find(key);
+        if (_store.size() > 1 && last != _last_question.end() && last->second == index) {
+            index = (index + 1) % _store.size();
+        }
+        TriviaRound round;
+        round.question = index;
+        round.deadline = time(NULL) + TRIVIA_ROUND_TIMEOUT;
+        std::string answers = _store.answer(index);
+        for (size_t start = 0; start <= answers.size(); ) {
+            size_t bar = answers.find('|', start);
+            std::string normalized = TriviaStore::normalize(answers.substr(start, bar == std::string::npos ? std::string::npos : bar - start));
+            if (!normalized.empty()) {
+                round.answers.push_back(normalized);
+            }
+            if (bar == std::string::npos) {
+                break;
+            }
+            start = bar + 1;
+        }
+        _rounds[key] = round;
+        _last_question[key] = index;
+        bot.reply(ctx, _store.question(index));
+    }
 
-void Bot::check_trivia_answer(const std::string& user_answer) {
-    if (_current_question_index == -1) {
-        std::string response = "PRIVMSG " + _channel + " :No question has been asked yet!";
-        send_msg(response);
-        return;
+    // Returns true if the guess closed the round
+    bool guess(Bot& bot, const CommandContext& ctx, bool quiet) {
+        std::map<std::string, TriviaRound>::iterator open = _rounds.find(bot_lowercase(ctx.target));
+        if (open == _rounds.end()) {
+            if (!quiet) {
+                bot.reply(ctx, "No question has been asked yet!");
+            }
+            return false;
+        }
+        if (!TriviaStore::matches(TriviaStore::normalize(ctx.args), open->second.answers)) {
+            if (!quiet) {
+                bot.reply(ctx, "Incorrect. Try again!");
+            }
+            return false;
+        }
+        std::string answer = _store.answer(open->second.question);
+        _rounds.erase(open);
+        unsigned long total = _scores.add(ctx.sender, 1);
+        bot.reply(ctx, "Correct, " + ctx.sender + "! The answer was " + answer.substr(0, answer.find('|')) + ". Score: " + to_string(total));
+        return true;
     }
-    std::vector<std::string> keys;
-    for (std::map<std::string, std::string>::iterator it = _triviaQuestions.begin(); it != _triviaQuestions.end(); ++it) {
-        keys.push_back(it->first);
+
+    static std::string to_string(unsigned long value) {
+        std::ostringstream out;
+        out << value;
+        return out.str();
     }
-    std::string current_question = keys[_current_question_index];
 
-    if (user_answer == _triviaQuestions[current_question]) {
-        std::string response = "PRIVMSG " + _channel + " :Correct!";
-        send_msg(response);
-    } else {
-        std::string response = "PRIVMSG " + _channel + " :Incorrect. Try again!";
-        send_msg(response);
+public:
+    TriviaPlugin(const std::string& questions_path, const std::string& scores_path) : _scores(scores_path), _next_save(0) {
+        std::string error;
+        if (!_store.load(questions_path, error)) {
+            std::cerr << "Trivia: " << error << std::endl;
+        } else {
+            std::cout << "Trivia: " << _store.size() << " questions loaded from " << questions_path << std::endl;
+        }
+        _scores.load();
+    }
+
+    ~TriviaPlugin() {
+        if (_scores.is_dirty()) {
+            _scores.save();
+        }
     }
-}
 
-// size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
-//     ((std::string*)userp)->append((char*)contents, size * nmemb);
-//     return size * nmemb;
-// }
-
-// std::string parse_weather_response(const std::string& json) {
-//     std::string description;
-//     std::string temperature;
-//     std::string humidity;
-//     std::string wind_speed;
-
-//     // Find and extract the weather description
-//     size_t desc_pos = json.find("\"description\":\"");
-//     if (desc_pos != std::string::npos) {
-//         size_t start = desc_pos + 15; // length of "description":" is 15
-//         size_t end = json.find("\"", start);
-//         description = json.substr(start, end - start);
-//     }
-
-//     // Find and extract the temperature
-//     size_t temp_pos = json.find("\"temp\":");
-//     if (temp_pos != std::string::npos) {
-//         size_t start = temp_pos + 7; // length of "temp": is 7
-//         size_t end = json.find(",", start);
-//         double temp_kelvin = std::atof(json.substr(start, end - start).c_str());
-//         double temp_celsius = temp_kelvin - 273.15; // Convert from Kelvin to Celsius
-
-//         std::ostringstream temp_stream;
-//         temp_stream << std::fixed << std::setprecision(1) << temp_celsius;
-//         temperature = temp_stream.str() + "°C";
-//     }
-
-//     // Find and extract the humidity
-//     size_t hum_pos = json.find("\"humidity\":");
-//     if (hum_pos != std::string::npos) {
-//         size_t start = hum_pos + 11; // length of "humidity": is 11
-//         size_t end = json.find(",", start);
-//         humidity = json.substr(start, end - start) + "%";
-//     }
-
-//     // Find and extract the wind speed
-//     size_t wind_pos = json.find("\"speed\":");
-//     if (wind_pos != std::string::npos) {
-//         size_t start = wind_pos + 8; // length of "speed": is 8
-//         size_t end = json.find(",", start);
-//         wind_speed = json.substr(start, end - start) + " m/s";
-//     }
-
-//     // Format the final message
-//     std::string weather_info = "\nWeather: " + description +
-//                                "\nTemp: " + temperature +
-//                                "\nHumidity: " + humidity +
-//                                "\nWind: " + wind_speed;
-//     return weather_info;
-// }
-
-// void Bot::fetch_weather(const std::string& location) {
-//     std::string api_key = "72bb9dab46b9ec3d65f423c63f27a9b8";
-//     std::string request_url = "http://api.openweathermap.org/data/2.5/weather?q=" + location + "&appid=" + api_key;
-
-//     CURL* curl;
-//     CURLcode res;
-//     std::string response_string;
-
-//     curl = curl_easy_init();
-//     if (curl) {
-//         std::string msg = "PRIVMSG " + _channel + " :Fetching weather data for " + location + "...";
-//         send_msg(msg);
-//         curl_easy_setopt(curl, CURLOPT_URL, request_url.c_str());
-//         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-//         curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_string);
-
-//         res = curl_easy_perform(curl);
-//         if (res != CURLE_OK) {
-//             std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
-//         }
-
-//         curl_easy_cleanup(curl);
-
-//         std::string clean_response = parse_weather_response(response_string);
-
-//         // Parse or process the response (you can use a JSON parser for structured data)
-//         std::string response = "PRIVMSG " + _channel + " :Weather data: " + clean_response;
-//         send_msg(response);
-//     } else {
-//         std::cerr << "Failed to initialize CURL" << std::endl;
-//     }
-// }
-
-void Bot::handle_server_message(const std::string& message) {
-    if (message.find("PRIVMSG") != std::string::npos) {
-        if (message.find("!hello") != std::string::npos) {
-            std::cout << "Handling hello message" << std::endl;
-            send_msg("PRIVMSG " + _channel + " :world!");
-        }
-        else if (message.find("!trivia") != std::string::npos) {
-            std::cout << "Handling trivia message" << std::endl;
-            ask_trivia_question();
-        }
-        else if (message.find("!answer ") != std::string::npos) {
-            std::cout << "Handling answer message" << std::endl;
-            std::string user_answer = message.substr(message.find("!answer ") + 8);
-            check_trivia_answer(user_answer);
-        }
-        // else if (message.find("!weather ") != std::string::npos) {
-        //     std::cout << "Handling weather message" << std::endl;
-        //     std::string location = message.substr(message.find("!weather ") + 9);
-        //     fetch_weather(location);
-        // }
+    const char* name() const {
+        return "trivia";
+    }
+
+    void registerCommands(CommandRegistry& registry) {
+        registry.add("trivia", this, TRIVIA_ASK, "ask a question");
+        registry.add("answer", this, TRIVIA_ANSWER, "answer the open question");
+        registry.add("score", this, TRIVIA_SCORE, "show a trivia score");
+        registry.add("top", this, TRIVIA_TOP, "show the best trivia players");
+    }
+
+    void handleCommand(Bot& bot, const CommandContext& ctx) {
+        switch (ctx.id) {
+            case TRIVIA_ASK:
+                ask(bot, ctx);
+                break;
+            case TRIVIA_ANSWER:
+                guess(bot, ctx, false);
+                break;
+            case TRIVIA_SCORE: {
+                std::string player = ctx.args.empty() ? ctx.sender : ctx.args.substr(0, ctx.args.find(' '));
+                size_t rank = _scores.rank(player);
+                bot.reply(ctx, rank == 0 ? player + " has no points yet."
+                    : player + " has " + to_string(_scores.score(player)) + " points, rank " + to_string(rank) + ".");
+                break;
+            }
+            case TRIVIA_TOP: {
+                unsigned long count = ctx.args.empty() ? TRIVIA_TOP_DEFAULT : std::strtoul(ctx.args.c_str(), NULL, 10);
+                count = count == 0 ? TRIVIA_TOP_DEFAULT : count > TRIVIA_TOP_MAX ? TRIVIA_TOP_MAX : count;
+                std::vector<std::pair<std::string, unsigned long> > best = _scores.top(count);
+                std::string line;
+                for (size_t i = 0; i < best.size(); ++i) {
+                    line += (i ? ", " : "") + to_string(i + 1) + ". " + best[i].first + " (" + to_string(best[i].second) + ")";
+                }
+                bot.reply(ctx, best.empty() ? "Nobody has scored yet." : "Top players: " + line);
+                break;
+            }
+        }
+    }
+
+    void onMessage(Bot& bot, const std::string& sender, const std::string& channel, const std::string& text) {
+        if (channel.empty() || text.empty() || text[0] == BOT_COMMAND_PREFIX || _rounds.empty()) {
+            return;
+        }
+        CommandContext ctx;
+        ctx.sender = sender;
+        ctx.channel = channel;
+        ctx.target = channel;
+        ctx.args = text;
+        ctx.id = TRIVIA_ANSWER;
+        guess(bot, ctx, true);
     }
+
+    void onTick(Bot& bot, time_t now) {
+        for (std::map<std::string, TriviaRound>::iterator it = _rounds.begin(); it != _rounds.end(); ) {
+            if (now < it->second.deadline) {
+                ++it;
+                continue;
+            }
+            std::string answer = _store.answer(it->second.question);
+            bot.send_msg("PRIVMSG " + it->first + " :Time's up! The answer was " + answer.substr(0, answer.find('|')) + ".");
+            _rounds.erase(it++);
+        }
+        if (now >= _next_save && _scores.is_dirty()) {
+            _scores.save();
+            _next_save = now + TRIVIA_SAVE_INTERVAL;
+        }
+    }
+};
+
+enum WebCommand {
+    WEB_WEATHER,
+    WEB_CRYPTO
+};
+
+/*
+ * Commands answered from HTTP APIs through Bot::lookup. The URL templates come
+ * from BOT_WEATHER_URL and BOT_CRYPTO_URL in the environment, so a local stub
+ * server can stand in for the real APIs.
+*/
+class WebPlugin : public BotPlugin {
+private:
+    std::string _weather_url;
+    std::string _crypto_url;
+
+    static std::string url_template(const char* variable, const char* fallback) {
+        const char* value = std::getenv(variable);
+        return value && *value ? value : fallback;
+    }
+
+    static std::string expand(const std::string& pattern, const std::string& argument) {
+        std::string url = pattern;
+        size_t at = url.find("%s");
+        if (at != std::string::npos) {
+            url.replace(at, 2, url_encode(argument));
+        }
+        return url;
+    }
+
+    // The first number after a "price..." key, for APIs answering {"priceUsd":"123.45"} or {"price": 123.45}
+    static std::string find_price(const std::string& body) {
+        size_t key = body.find("\"price");
+        if (key == std::string::npos) {
+            return "";
+        }
+        size_t start = body.find_first_of("0123456789", body.find(':', key));
+        if (start == std::string::npos) {
+            return "";
+        }
+        size_t end = body.find_first_not_of("0123456789.", start);
+        std::string price = body.substr(start, end - start);
+        size_t dot = price.find('.');
+        return dot == std::string::npos || price.size() - dot <= 3 ? price : price.substr(0, dot + 3);
+    }
+
+public:
+    WebPlugin() : _weather_url(url_template("BOT_WEATHER_URL", BOT_WEATHER_URL)),
+                  _crypto_url(url_template("BOT_CRYPTO_URL", BOT_CRYPTO_URL)) {}
+
+    const char* name() const {
+        return "web";
+    }
+
+    void registerCommands(CommandRegistry& registry) {
+        registry.add("weather", this, WEB_WEATHER, "current weather, !weather <city>");
+        registry.add("crypto", this, WEB_CRYPTO, "price in USD, !crypto <asset>");
+    }
+
+    void handleCommand(Bot& bot, const CommandContext& ctx) {
+        if (ctx.args.empty()) {
+            bot.reply(ctx, ctx.id == WEB_WEATHER ? "Usage: !weather <city>" : "Usage: !crypto <asset>");
+            return;
+        }
+        std::string argument = bot_lowercase(ctx.args);
+        if (ctx.id == WEB_WEATHER) {
+            bot.lookup(this, ctx, "weather:" + argument, expand(_weather_url, argument), BOT_WEATHER_TTL);
+        } else {
+            bot.lookup(this, ctx, "crypto:" + argument, expand(_crypto_url, argument), BOT_CRYPTO_TTL);
+        }
+    }
+
+    void onLookup(Bot& bot, const CommandContext& ctx, const LookupResult& result) {
+        if (!result.ok) {
+            bot.reply(ctx, "Lookup failed for " + ctx.args + ": " + result.error);
+            return;
+        }
+        if (ctx.id == WEB_WEATHER) {
+            std::string line = result.body.substr(0, result.body.find_first_of("\r\n"));
+            bot.reply(ctx, line.empty() ? "No weather for " + ctx.args : line.substr(0, 300));
+            return;
+        }
+        std::string price = find_price(result.body);
+        bot.reply(ctx, price.empty() ? "No price for " + ctx.args : ctx.args + ": $" + price);
+    }
+};
+
+BotPlugin* make_core_plugin() {
+    return new CorePlugin();
+}
+
+BotPlugin* make_trivia_plugin() {
+    return new TriviaPlugin(BOT_TRIVIA_PATH, BOT_SCORES_PATH);
+}
+
+BotPlugin* make_web_plugin() {
+    return new WebPlugin();
 }
@@ -1,8 +1,14 @@
 #include "bot/IRCBot.hpp"
+#include <unistd.h>
+
+static void handle_stop(int signum) {
+    (void)signum;
+    g_bot_stop = 1;
+}
 
 int main(int argc, char* argv[]) {
     if (argc != 6) {
-        std::cerr << "Usage: " << argv[0] << " <server> <port> <nickname> <password> <channel>\n";
+        std::cerr << "Usage: " << argv[0] << " <server> <port> <nickname> <password> <channel>[,<channel>...]\n";
         return 1;
     }
 
@@ -10,17 +16,34 @@ int main(int argc, char* argv[]) {
     int port = atoi(argv[2]);
     std::string nickname = argv[3];
     std::string password = argv[4];
-    std::string channel_tmp = argv[5];
-    std::string channel = "#" + channel_tmp;
-
-    Bot bot(server, port, nickname, password, channel);
 
-    if (bot.connect_to_server()) {
-        bot.run();
-    } else {
-        std::cerr << "Failed to connect to the server.\n";
-        return 1;
+    std::vector<std::string> channels;
+    std::string list = argv[5];
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        std::string channel = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        if (!channel.empty()) {
+            channels.push_back(channel[0] == '#' ? channel : "#" + channel);
+        }
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
     }
 
+    struct sigaction sa;
+    sa.sa_handler = handle_stop;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    std::srand(static_cast<unsigned int>(time(NULL)) ^ static_cast<unsigned int>(getpid()));
+
+    Bot bot(server, port, nickname, password, channels);
+    bot.add_plugin(make_core_plugin());
+    bot.add_plugin(make_trivia_plugin());
+    bot.add_plugin(make_web_plugin());
+    bot.run();
     return 0;
 }
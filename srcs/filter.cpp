@@ -0,0 +1,132 @@
+#include "ft_irc.hpp"
+
+/*
+ * Compiles a pattern file on a worker thread. The loop gets the finished
+ * filter and swaps it in, so a message is always scanned by a complete
+ * automaton, the old one or the new one.
+*/
+class FilterBuildJob : public WorkerJob {
+private:
+    std::string path;
+    uint64_t generation;
+    PatternFilter* filter;
+    std::string error;
+    uint64_t build_ms;
+
+public:
+    FilterBuildJob(const std::string& path, uint64_t generation) : path(path), generation(generation), filter(NULL), build_ms(0) {}
+
+    ~FilterBuildJob() {
+        delete filter;
+    }
+
+    void run() {
+        uint64_t start = current_time_ms();
+        filter = new PatternFilter();
+        if (!filter->load(path, error)) {
+            delete filter;
+            filter = NULL;
+        }
+        build_ms = current_time_ms() - start;
+    }
+
+    void complete(Server& server) {
+        server.install_filter(generation, filter, path, error, build_ms);
+        filter = NULL;
+    }
+};
+
+/*
+ * @brief Compile the configured pattern file again, on a worker thread once the pool runs
+ * @return void
+ * Filtering stops if the file does not exist. If it is invalid, the running filter is kept
+*/
+void Server::rebuild_filter() {
+    ++filter_generation;
+    if (config->filter_file.empty() || access(config->filter_file.c_str(), F_OK) != 0) {
+        install_filter(filter_generation, NULL, config->filter_file, "", 0);
+        return;
+    }
+    FilterBuildJob* job = new FilterBuildJob(config->filter_file, filter_generation);
+    if (workers.getEventFd() < 0) {
+        job->run();
+        job->complete(*this);
+        delete job;
+        return;
+    }
+    workers.submit(job);
+}
+
+/*
+ * @brief Swap in a compiled filter
+ * @param generation The rebuild it comes from, an older one than the last requested is discarded
+ * @param filter The filter, owned from now on, NULL to stop filtering or if it failed to compile
+ * @param path The pattern file
+ * @param error Why it failed to compile, empty if it did not
+ * @param build_ms How long the compilation took
+ * @return void
+*/
+void Server::install_filter(uint64_t generation, PatternFilter* filter, const std::string& path, const std::string& error, uint64_t build_ms) {
+    if (generation != filter_generation) {
+        delete filter;
+        return;
+    }
+    if (!error.empty()) {
+        std::cerr << "Filters not reloaded: " << error << std::endl;
+        return;
+    }
+    if (!filter && !message_filter) {
+        return;
+    }
+    delete message_filter;
+    message_filter = filter;
+    if (!filter) {
+        std::cout << "Message filter off, " << path << " does not exist" << std::endl;
+        return;
+    }
+    std::cout << "Loaded " << filter->getPatternCount() << " filter patterns from " << path << " (" << filter->getStateCount() << " states, "
+              << filter->getMemoryUsage() / 1024 << " KiB, " << build_ms << " ms)" << std::endl;
+}
+
+/*
+ * @brief Scan a message with the pattern filter and apply the actions of what it finds
+ * @param client_fd The sender
+ * @param target The channel or nickname it is sent to
+ * @param text The message text
+ * @param tags The client tags it is relayed with, FILTER_TAG_NAME is added for "tag"
+ * @return False if the message is blocked, the sender has been told
+*/
+bool Server::filter_message(int client_fd, const std::string& target, const std::string& text, std::string& tags) {
+    if (!message_filter) {
+        return true;
+    }
+    uint64_t start = cycle_now();
+    FilterMatch match = message_filter->scan(text.data(), text.size());
+    filter_scan_cycles += cycle_now() - start;
+    filter_scanned_bytes += text.size();
+    if (!match.actions) {
+        return true;
+    }
+
+    Client& client = clients[client_fd];
+    if (match.actions & FILTER_REPORT) {
+        ++filter_hits[1];
+        std::string report = "Filter: " + client.getMask() + " to " + target + " matched \"" + message_filter->getPattern(match.pattern) + "\" ("
+                           + PatternFilter::actionNames(message_filter->getPatternActions(match.pattern)) + ")";
+        std::cout << report << std::endl;
+        std::map<std::string, Channel>::iterator staff = channels.find(config->filter_report);
+        if (staff != channels.end()) {
+            staff->second.broadcast(":" + server_name + " NOTICE " + staff->first + " :" + report + "\r\n");
+        }
+    }
+    if (match.actions & FILTER_BLOCK) {
+        ++filter_hits[2];
+        send_to_client(client_fd, ":" + server_name + " FAIL PRIVMSG MESSAGE_BLOCKED " + target + " :Your message was blocked by a content filter\r\n");
+        return false;
+    }
+    if (match.actions & FILTER_TAG) {
+        ++filter_hits[0];
+        tags += (tags.empty() ? "" : ";") + std::string(FILTER_TAG_NAME);
+    }
+    return true;
+}
@@ -6,7 +6,12 @@ bool Server::already_taken_nickname(const std::string& nickname) {
             return true;
         }
     }
-    return false;
+    for (std::map<std::string, Client>::iterator it = remote_clients.begin(); it != remote_clients.end(); ++it) {
+        if (it->second.getNickname() == nickname) {
+            return true;
+        }
+    }
+    return find_detached_client(nickname) != NULL;
 }
 
 /*
@@ -20,20 +25,31 @@ void Server::handle_nick(int client_fd, const std::string& args) {
 
     if (nickname.empty()) {
         std::string error_msg = ":" + server_name + " 431 * :No nickname given\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
-    } else if (nickname.size() > 9) {
-        std::string error_msg = ":" + server_name + " 432 * " + nickname + " :Erroneous nickname (too long, max 9 characters)\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+    } else if (nickname == clients[client_fd].getNickname()) {
+        return; // Already theirs, e.g. the NICK a client sends right after RESUME
+    } else if (nickname.size() > config->nick_length) {
+        std::string error_msg = ":" + server_name + " 432 * " + nickname + " :Erroneous nickname (too long, max " + intToString(config->nick_length) + " characters)\r\n";
+        send_to_client(client_fd, error_msg);
         return;
-    } else if (already_taken_nickname(nickname)) {
+    } else if (already_taken_nickname(nickname) || plugins.isService(nickname)) {
         std::string error_msg = ":" + server_name + " 433 * " + nickname + " :Nickname is already in use\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
-    clients[client_fd].setNickname(nickname);
-    clients[client_fd].setHasNick(true);
+    Client& client = clients[client_fd];
+    std::string old_nickname = client.getNickname();
+    client.setNickname(nickname);
+    client.setHasNick(true);
+
+    if (client.isRegistered() && client.getNickname() != old_nickname) {
+        for (std::map<std::string, Channel>::iterator it = channels.begin(); it != channels.end(); ++it) {
+            it->second.renameClient(old_nickname, client.getNickname());
+        }
+        broadcast_to_links(":" + client.getUid() + " NICK " + client.getNickname() + " " + intToString(time(NULL)) + "\r\n", -1);
+    }
 
     std::cout << "Client " << client_fd << " set nickname to " << nickname << std::endl;
 }
@@ -50,7 +66,7 @@ void Server::handle_user(int client_fd, const std::string& args) {
 
     if (client.getUsername().empty() == false  && client.getNickname().empty() == false) {
         std::string error_msg = ":" + server_name + " 462 :You may not reregister\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
@@ -63,7 +79,7 @@ void Server::handle_user(int client_fd, const std::string& args) {
         if (first_space == std::string::npos || second_space == std::string::npos ||
             third_space == std::string::npos || colon == std::string::npos) {
             std::string error_msg = ":" + server_name + " 461 USER :Not enough parameters\r\n";
-            send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+            send_to_client(client_fd, error_msg);
             return;
         }
 
@@ -72,7 +88,7 @@ void Server::handle_user(int client_fd, const std::string& args) {
 
         if (username.empty() || realname.empty()) {
             std::string error_msg = ":" + server_name + " 461 USER :Not enough parameters\r\n";
-            send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+            send_to_client(client_fd, error_msg);
             return;
         }
 
@@ -86,13 +102,13 @@ void Server::handle_user(int client_fd, const std::string& args) {
         if (client.hasNick()) {
             std::string welcome_msg = ":" + server_name + " 001 " + client.getNickname() +
                                       " :Welcome to the Internet Relay Network " +
-                                      client.getNickname() + "!" + username + "@<host>\r\n";
-            send(client_fd, welcome_msg.c_str(), welcome_msg.size(), 0);
+                                      client.getNickname() + "!" + username + "@" + client.getHostname() + "\r\n";
+            send_to_client(client_fd, welcome_msg);
         }
 
     } else {
         std::string error_msg = ":" + server_name + " 461 USER :Not enough parameters\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
     }
 }
 
@@ -120,19 +136,19 @@ void Server::handle_part(int client_fd, const std::string& args) {
 
     if (channel_name.empty()) {
         std::string error_msg = ":" + server_name + " 461 " + clients[client_fd].getNickname() + " PART :Not enough parameters\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
     if (!is_valid_channel_name(channel_name)) {
         std::string error_msg = ":" + server_name + " 403 " + clients[client_fd].getNickname() + " " + channel_name + " :No such channel\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
     if (channels.find(channel_name) == channels.end()) {
         std::string error_msg = ":" + server_name + " 403 " + clients[client_fd].getNickname() + " " + channel_name + " :No such channel\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
@@ -142,14 +158,18 @@ void Server::handle_part(int client_fd, const std::string& args) {
 
     if (clients_in_channel.find(client_nickname) == clients_in_channel.end()) {
         std::string error_msg = ":" + server_name + " 442 " + client_nickname + " " + channel_name + " :You're not on that channel\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
     std::string part_msg = ":" + client_nickname + " PART " + channel_name + " :" + reason + "\r\n";
     channel.broadcast(part_msg);
-    send(client_fd, part_msg.c_str(), part_msg.size(), 0);
+    broadcast_to_links(":" + clients[client_fd].getUid() + " PART " + channel_name + " :" + reason + "\r\n", -1);
+    send_to_client(client_fd, part_msg);
     channel.removeClient(client_nickname);
+    if (plugins.wants(IRC_EVENT_PART)) {
+        plugins.dispatch(make_plugin_event(IRC_EVENT_PART, clients[client_fd], channel_name, reason));
+    }
 
     if (channel.isOperator(client_nickname)) {
         channel.removeOperator(client_nickname, server_name);
@@ -161,7 +181,7 @@ void Server::handle_part(int client_fd, const std::string& args) {
     }
 
     std::cout << "Client " << client_nickname << " left channel " << channel_name << " with reason: " << reason << std::endl;
-    channel.updateList(client_fd, server_name, client_nickname);
+    channel.updateList(clients[client_fd], server_name, client_nickname);
 
     if (channel.getClientNumber() == 0) {
         channels.erase(channel_name);
@@ -171,15 +191,14 @@ void Server::handle_part(int client_fd, const std::string& args) {
 
 
 void Channel::sendNumericRepliesToJoiner(Client& joiner, const std::string& server_name) {
-    int client_fd = joiner.getFd();
     std::string nickname = joiner.getNickname();
 
     std::string join_msg = ":" + nickname + " JOIN " + name + "\r\n";
-    send(client_fd, join_msg.c_str(), join_msg.size(), 0);
+    joiner.queueMessage(join_msg);
 
     if (!topic.empty()) {
         std::string topic_msg = ":" + server_name + " 332 " + nickname + " " + name + " " + topic + "\r\n";
-        send(client_fd, topic_msg.c_str(), topic_msg.size(), 0);
+        joiner.queueMessage(topic_msg);
     }
 
     std::string names_msg = ":" + server_name + " 353 " + nickname + " = " + name + " :";
@@ -190,10 +209,10 @@ void Channel::sendNumericRepliesToJoiner(Client& joiner, const std::string& serv
         names_msg += it->first;
     }
     names_msg += "\r\n";
-    send(client_fd, names_msg.c_str(), names_msg.size(), 0);
+    joiner.queueMessage(names_msg);
 
     std::string end_of_names_msg = ":" + server_name + " 366 " + nickname + " " + name + " :End of /NAMES list\r\n";
-    send(client_fd, end_of_names_msg.c_str(), end_of_names_msg.size(), 0);
+    joiner.queueMessage(end_of_names_msg);
 }
 
 /*
@@ -216,20 +235,24 @@ void Server::handle_join(int client_fd, const std::string& args) {
 
     if (channel_name.empty() || channel_name == "#") {
         std::string error_msg = ":" + server_name + " 461 " + clients[client_fd].getNickname() + " JOIN :Not enough parameters\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
     if (!is_valid_channel_name(channel_name)) {
         std::string error_msg = ":" + server_name + " 403 " + clients[client_fd].getNickname() + " " + channel_name + " :No such channel\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
+    if (channels.find(channel_name) == channels.end()) {
+        restore_channel(channel_name);
+    }
     if (channels.find(channel_name) == channels.end()) {
         channels[channel_name] = Channel();
         channels[channel_name].setPassword(password);
         channels[channel_name].setName(channel_name);
+        channels[channel_name].getHistory().setLimits(history_max_lines, history_max_bytes);
     }
 
     Channel& channel = channels[channel_name];
@@ -237,25 +260,31 @@ void Server::handle_join(int client_fd, const std::string& args) {
 
     if (channel.getClients().find(client_nickname) != channel.getClients().end()) {
         std::string already_joined_msg = ":" + server_name + " 443 " + client_nickname + " " + channel_name + " :is already on channel\r\n";
-        send(client_fd, already_joined_msg.c_str(), already_joined_msg.size(), 0);
+        send_to_client(client_fd, already_joined_msg);
         return;
     }
 
     if (!channel.getPassword().empty() && password != channel.getPassword()) {
         std::string error_msg = ":" + server_name + " 475 " + channel_name + " :Cannot join channel (bad key)\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
-    if (channel.getInviteOnly() && !channel.isInvited(client_nickname)) {
+    if (channel.isBanned(clients[client_fd]) && !channel.isInvited(client_nickname)) {
+        std::string error_msg = ":" + server_name + " 474 " + client_nickname + " " + channel_name + " :Cannot join channel (+b)\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+
+    if (channel.getInviteOnly() && !channel.isInvited(client_nickname) && !channel.isInviteExempt(clients[client_fd])) {
         std::string error_msg = ":" + server_name + " 473 " + channel_name + " :Cannot join channel (invite only)\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
     if (channel.getClientNumber() >= channel.getChannelLimit()) {
         std::string error_msg = ":" + server_name + " 471 " + channel_name + " :Cannot join channel (channel is full)\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
@@ -266,9 +295,10 @@ void Server::handle_join(int client_fd, const std::string& args) {
     // Notify the client of a successful join
     std::string join_msg = ":" + client_nickname + " JOIN :" + channel_name + "\r\n";
     channel.broadcast(join_msg);
+    broadcast_to_links(":" + clients[client_fd].getUid() + " JOIN " + intToString(channel.getCreationTime()) + " " + channel_name + " +\r\n", -1);
 
-    // Make the first client an operator
-    if (channel.getClientNumber() == 1) {
+    // Make the first client an operator, unless the channel kept its operators from a snapshot
+    if (channel.getClientNumber() == 1 && channel.getOperators().empty()) {
         channel.addOperator(client_nickname, server_name);
     }
 
@@ -276,11 +306,14 @@ void Server::handle_join(int client_fd, const std::string& args) {
     // Send topic if it exists
     if (!channel.getTopic().empty()) {
         std::string topic_msg = ":" + server_name + " 332 " + client_nickname + " " + channel_name + " " + channel.getTopic() + "\r\n";
-        send(client_fd, topic_msg.c_str(), topic_msg.size(), 0);
+        send_to_client(client_fd, topic_msg);
     }
 
     std::cout << "Client " << client_nickname << " joined channel " << channel_name << std::endl;
-    channel.updateList(client_fd, server_name, client_nickname);
+    channel.updateList(clients[client_fd], server_name, client_nickname);
+    if (plugins.wants(IRC_EVENT_JOIN)) {
+        plugins.dispatch(make_plugin_event(IRC_EVENT_JOIN, clients[client_fd], channel_name, ""));
+    }
 }
 
 
@@ -303,7 +336,7 @@ void Server::handle_privmsg(int client_fd, const std::string& args) {
     
     if (target.empty() || message.empty() || message[0] != ':') {
         std::string error_msg = ":" + server_name + " 411 " + clients[client_fd].getNickname() + " :No recipient or text to send\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
@@ -314,22 +347,36 @@ void Server::handle_privmsg(int client_fd, const std::string& args) {
     if (target[0] == '#') {
         if (channels.find(target) == channels.end()) {
             std::string error_msg = ":" + server_name + " 403 " + sender_nickname + " " + target + " :No such channel\r\n";
-            send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+            send_to_client(client_fd, error_msg);
             return;
         }
         Channel& channel = channels[target];
         std::map<std::string, Client*>& clients_in_channel = channel.getClients();
         if (clients_in_channel.find(sender_nickname) == clients_in_channel.end()) {
             std::string error_msg = ":" + server_name + " 442 " + sender_nickname + " " + target + " :You're not on that channel\r\n";
-            send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+            send_to_client(client_fd, error_msg);
+            return;
+        }
+        if (channel.isBanned(clients[client_fd]) && !channel.isOperator(sender_nickname)) {
+            std::string error_msg = ":" + server_name + " 404 " + sender_nickname + " " + target + " :Cannot send to channel (+b)\r\n";
+            send_to_client(client_fd, error_msg);
+            return;
+        }
+        std::string tags = message_tags;
+        if (!filter_message(client_fd, target, message, tags)) {
             return;
         }
-        for (std::map<std::string, Client*>::iterator it = clients_in_channel.begin(); it != clients_in_channel.end(); ++it) {
-            if (it->second->getFd() == client_fd)
-                continue;
-            std::string msg = ":" + sender_nickname + " PRIVMSG " + target + " :" + message + "\r\n";
-            send(it->second->getFd(), msg.c_str(), msg.size(), 0);
+        std::string msg = ":" + sender_nickname + " PRIVMSG " + target + " :" + message + "\r\n";
+        Message outgoing(msg, current_time_ms(), tags);
+        channel.broadcast(outgoing, (clients[client_fd].getCaps() & CAP_ECHO_MESSAGE) ? -1 : client_fd);
+        channel.getHistory().append(outgoing.getTime(), clients[client_fd].getId(), msg);
+        channel_log.append(target, outgoing.getTime(), msg.data(), msg.size());
+        route_to_channel_links(channel, ":" + clients[client_fd].getUid() + " PRIVMSG " + target + " :" + message + "\r\n", -1);
+        if (plugins.wants(IRC_EVENT_MESSAGE)) {
+            plugins.dispatch(make_plugin_event(IRC_EVENT_MESSAGE, clients[client_fd], target, message));
         }
+    } else if (plugins.isService(target)) {
+        plugins.deliverPrivate(target, make_plugin_event(IRC_EVENT_PRIVATE, clients[client_fd], "", message));
     } else {
         bool target_found = false;
         for (std::map<int, Client>::iterator it = clients.begin(); it != clients.end(); ++it) {
@@ -338,30 +385,126 @@ void Server::handle_privmsg(int client_fd, const std::string& args) {
                 break;
             }
         }
+        Client* remote_target = NULL;
+        for (std::map<std::string, Client>::iterator it = remote_clients.begin(); !target_found && it != remote_clients.end(); ++it) {
+            if (it->second.getNickname() == target) {
+                remote_target = &it->second;
+                target_found = true;
+            }
+        }
+        Client* detached_target = target_found ? NULL : find_detached_client(target);
+        target_found = target_found || detached_target;
         if (!target_found) {
             std::string error_msg = ":" + server_name + " 401 " + sender_nickname + " " + target + " :No such nick/channel\r\n";
-            send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+            send_to_client(client_fd, error_msg);
             return;
         }
 
         if (target == sender_nickname) {
             std::string error_msg = ":" + server_name + " 401 " + sender_nickname + " :You cannot send a message to yourself\r\n";
-            send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+            send_to_client(client_fd, error_msg);
+            return;
+        }
+
+        std::string tags = message_tags;
+        if (!filter_message(client_fd, target, message, tags)) {
+            return;
+        }
+
+        if (remote_target) {
+            std::string relay = ":" + clients[client_fd].getUid() + " PRIVMSG " + remote_target->getUid() + " :" + message + "\r\n";
+            send_to_client(remote_target->getRouteFd(), relay);
+            return;
+        }
+
+        if (detached_target) {
+            // Buffered with the channel traffic, replayed on RESUME
+            Message outgoing(":" + sender_nickname + " PRIVMSG " + target + " :" + message + "\r\n", current_time_ms(), tags);
+            detached_target->queueMessage(outgoing.renderFor(detached_target->getCaps()));
+            if (clients[client_fd].getCaps() & CAP_ECHO_MESSAGE) {
+                send_to_client(client_fd, outgoing.renderFor(clients[client_fd].getCaps()));
+            }
             return;
         }
 
         for (std::map<int, Client>::iterator it = clients.begin(); it != clients.end(); ++it) {
             if (it->second.getNickname() == target) {
-                std::string msg = ":" + sender_nickname + " PRIVMSG " + target + " :" + message + "\r\n";
-
-                send(it->first, msg.c_str(), msg.size(), 0);
-                std::cout << "Client " << clients[client_fd].getNickname() << " sent message to " << target << ": " << message << std::endl;
+                Message outgoing(":" + sender_nickname + " PRIVMSG " + target + " :" + message + "\r\n", current_time_ms(), tags);
+                it->second.queueMessage(outgoing.renderFor(it->second.getCaps()));
+                if (clients[client_fd].getCaps() & CAP_ECHO_MESSAGE) {
+                    send_to_client(client_fd, outgoing.renderFor(clients[client_fd].getCaps()));
+                }
+                if (g_log_level >= LOG_DEBUG) {
+                    std::cout << "Client " << clients[client_fd].getNickname() << " sent message to " << target << ": " << message << std::endl;
+                }
                 return;
             }
         }
     }
 }
 
+/*
+ * @brief Relay a tags-only message, such as a typing notification
+ * @param client_fd The client file descriptor
+ * @param args The target, a channel or a nickname
+ * @return void
+ * These are ephemeral: never stored in the history, the channel log or a detached session, dropped rather
+ * than queued behind a backed up send queue, and a newer one from the same sender to the same target
+ * replaces one not yet written. Only recipients with message-tags get them, and they stay on this server
+*/
+void Server::handle_tagmsg(int client_fd, const std::string& args) {
+    std::string target = my_trim(args.substr(0, args.find(' ')));
+    std::string sender_nickname = clients[client_fd].getNickname();
+    if (target.empty()) {
+        send_to_client(client_fd, ":" + server_name + " 411 " + sender_nickname + " :No recipient given (TAGMSG)\r\n");
+        return;
+    }
+    if (message_tags.empty()) {
+        return; // Nothing the recipients could be shown
+    }
+
+    Message outgoing(":" + clients[client_fd].getMask() + " TAGMSG " + target + "\r\n", current_time_ms(), message_tags);
+    std::string key = intToString(clients[client_fd].getId()) + " " + target;
+    bool echo = (clients[client_fd].getCaps() & CAP_ECHO_MESSAGE) != 0;
+
+    if (target[0] == '#') {
+        std::map<std::string, Channel>::iterator channel = channels.find(target);
+        if (channel == channels.end()) {
+            send_to_client(client_fd, ":" + server_name + " 403 " + sender_nickname + " " + target + " :No such channel\r\n");
+            return;
+        }
+        if (!channel->second.isClient(sender_nickname)) {
+            send_to_client(client_fd, ":" + server_name + " 442 " + sender_nickname + " " + target + " :You're not on that channel\r\n");
+            return;
+        }
+        if (channel->second.isBanned(clients[client_fd]) && !channel->second.isOperator(sender_nickname)) {
+            send_to_client(client_fd, ":" + server_name + " 404 " + sender_nickname + " " + target + " :Cannot send to channel (+b)\r\n");
+            return;
+        }
+        channel->second.broadcastEphemeral(outgoing, echo ? -1 : client_fd, key);
+        return;
+    }
+
+    Client* recipient = NULL;
+    for (std::map<int, Client>::iterator it = clients.begin(); !recipient && it != clients.end(); ++it) {
+        recipient = it->second.getNickname() == target ? &it->second : NULL;
+    }
+    bool elsewhere = !recipient && find_detached_client(target) != NULL;
+    for (std::map<std::string, Client>::iterator it = remote_clients.begin(); !recipient && !elsewhere && it != remote_clients.end(); ++it) {
+        elsewhere = it->second.getNickname() == target;
+    }
+    if (recipient || elsewhere) {
+        if (recipient && recipient->getFd() != client_fd && (recipient->getCaps() & CAP_MESSAGE_TAGS)) {
+            recipient->queueEphemeral(key, outgoing.renderFor(recipient->getCaps()));
+        }
+        if (echo) {
+            clients[client_fd].queueEphemeral(key, outgoing.renderFor(clients[client_fd].getCaps()));
+        }
+    } else {
+        send_to_client(client_fd, ":" + server_name + " 401 " + sender_nickname + " " + target + " :No such nick/channel\r\n");
+    }
+}
+
 /*
  * @brief Authenticate a client
  * @param client_fd The client file descriptor
@@ -372,17 +515,17 @@ void Server::handle_pass(int client_fd, const std::string& args) {
     std::string pass = my_trim(args);
     if (clients[client_fd].isAuthenticated()) {
         std::string error_msg = ":" + server_name + " 462 " + clients[client_fd].getNickname() + " :You may not reregister\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
     if (pass == password) {
         clients[client_fd].setAuthenticated(true);
         std::string msg = "Password accepted.\r\n";
-        send(client_fd, msg.c_str(), msg.size(), 0);
+        send_to_client(client_fd, msg);
         std::cout << "Client " << client_fd << " authenticated." << std::endl;
     } else {
         std::string error_msg = ":" + server_name + " 464 " + clients[client_fd].getNickname() + " :Password incorrect\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
     }
 }
 
@@ -409,22 +552,103 @@ void Server::handle_quit(int client_fd, const std::string& args) {
         if (client_it != clients_in_channel.end()) {
             clients_in_channel.erase(client_it);
         }
-        channel.updateList(client_fd, server_name, client_nickname);
+        channel.updateList(clients[client_fd], server_name, client_nickname);
     }
 
-    close_client(client_fd);
+    std::string reason = (!args.empty() && args[0] == ':') ? args.substr(1) : args;
+    propagate_local_quit(clients[client_fd], reason.empty() ? "Quit" : reason);
+    clients[client_fd].setUid("");
+    disconnect_client(client_fd);
 }
 
+struct CapabilityName {
+    const char* name;
+    unsigned int bit;
+};
+
+static const CapabilityName capability_names[] = {
+    { "batch", CAP_BATCH },
+    { "draft/resume-0.5", CAP_RESUME },
+    { "echo-message", CAP_ECHO_MESSAGE },
+    { "message-tags", CAP_MESSAGE_TAGS },
+    { "multi-prefix", CAP_MULTI_PREFIX },
+    { "no-implicit-names", CAP_NO_IMPLICIT_NAMES },
+    { "sasl", CAP_SASL },
+    { "server-time", CAP_SERVER_TIME }
+};
+
+static const size_t capability_count = sizeof(capability_names) / sizeof(capability_names[0]);
+
 /*
- * @brief Handle the CAP command
+ * @brief Handle the CAP command, registration waits for CAP END once a client starts negotiating
  * @param client_fd The client file descriptor
- * @param args The arguments
+ * @param args The subcommand (LS, LIST, REQ or END) and its parameters
  * @return void
 */
 void Server::handle_cap(int client_fd, const std::string& args) {
-    (void)args;
-    std::string response = "CAP * NAK :No supported capabilities\r\n";
-    send(client_fd, response.c_str(), response.size(), 0);
+    Client& client = clients[client_fd];
+    std::string nickname = client.getNickname().empty() ? "*" : client.getNickname();
+    std::istringstream iss(args);
+    std::string subcommand;
+    iss >> subcommand;
+    std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), ::toupper);
+    std::string params;
+    std::getline(iss, params);
+    params = my_trim(params);
+    if (!params.empty() && params[0] == ':') {
+        params.erase(0, 1);
+    }
+
+    // sasl is only offered when there are accounts to log in to
+    unsigned int offered = accounts.empty() ? ~static_cast<unsigned int>(CAP_SASL) : ~0u;
+
+    if (subcommand == "LS" || subcommand == "LIST") {
+        if (subcommand == "LS" && !client.isRegistered()) {
+            client.setCapNegotiating(true);
+        }
+        unsigned int shown = subcommand == "LS" ? offered : client.getCaps();
+        std::string list;
+        for (size_t i = 0; i < capability_count; ++i) {
+            if (shown & capability_names[i].bit) {
+                list += (list.empty() ? "" : " ") + std::string(capability_names[i].name);
+                if (capability_names[i].bit == CAP_SASL && subcommand == "LS" && std::atoi(params.c_str()) >= 302) {
+                    list += "=PLAIN";
+                }
+            }
+        }
+        send_to_client(client_fd, ":" + server_name + " CAP " + nickname + " " + subcommand + " :" + list + "\r\n");
+    } else if (subcommand == "REQ") {
+        if (!client.isRegistered()) {
+            client.setCapNegotiating(true);
+        }
+        // The request is applied as a whole or not at all
+        unsigned int caps = client.getCaps();
+        std::istringstream requested(params);
+        std::string name;
+        bool valid = !params.empty();
+        while (valid && requested >> name) {
+            bool removing = name[0] == '-';
+            if (removing) {
+                name.erase(0, 1);
+            }
+            size_t i = 0;
+            while (i < capability_count && name != capability_names[i].name) {
+                ++i;
+            }
+            valid = i < capability_count && (offered & capability_names[i].bit);
+            if (valid) {
+                caps = removing ? caps & ~capability_names[i].bit : caps | capability_names[i].bit;
+            }
+        }
+        if (valid) {
+            client.setCaps(caps);
+        }
+        send_to_client(client_fd, ":" + server_name + " CAP " + nickname + (valid ? " ACK :" : " NAK :") + params + "\r\n");
+    } else if (subcommand == "END") {
+        client.setCapNegotiating(false);
+    } else {
+        send_to_client(client_fd, ":" + server_name + " 410 " + nickname + " " + subcommand + " :Invalid CAP command\r\n");
+    }
 }
 
 /*
@@ -435,7 +659,7 @@ void Server::handle_cap(int client_fd, const std::string& args) {
 */
 void Server::handle_ping(int client_fd, const std::string& args) {
     std::string response = "PONG :" + args + "\r\n";
-    send(client_fd, response.c_str(), response.size(), 0);
+    send_to_client(client_fd, response);
 }
 
 /*
@@ -455,7 +679,7 @@ void Server::handle_kick(int client_fd, const std::string& args) {
     
     if (first_space == std::string::npos) {
         std::string error_msg = "Usage: /KICK <channel> <user> :<reason>\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
     
@@ -471,7 +695,7 @@ void Server::handle_kick(int client_fd, const std::string& args) {
 
     if (channels.find(channel_name) == channels.end()) {
         std::string error_msg = "Channel " + channel_name + " does not exist.\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
@@ -480,32 +704,36 @@ void Server::handle_kick(int client_fd, const std::string& args) {
 
     if (!channel.isOperator(sender_nickname)) {
         std::string notOperator = ":" + server_name + " 482 " + sender_nickname + " " + channel.getName() + " :You're not channel operator\r\n";
-        send(client_fd, notOperator.c_str(), notOperator.size(), 0);
+        send_to_client(client_fd, notOperator);
         return;
     }
     
     if (!channel.isClient(target_nickname)) {
         std::string error_msg = "User " + target_nickname + " is not in channel " + channel_name + ".\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
     Client* target_client = channel.getClients()[target_nickname];
     int target_fd = target_client->getFd();
+    std::string target_uid = target_client->getUid();
+    bool target_remote = target_client->isRemote();
 
     std::string kick_msg = ":" + sender_nickname + " KICK " + channel_name + " " + target_nickname + " :" + reason + "\r\n";
     std::map<std::string, Client*>& clients_in_channel = channel.getClients();
     for (std::map<std::string, Client*>::iterator it = clients_in_channel.begin(); it != clients_in_channel.end(); ++it) {
-        if (send(it->second->getFd(), kick_msg.c_str(), kick_msg.size(), 0) < 0) {
-            perror("send");
-        }
+        it->second->queueMessage(kick_msg);
     }
 
     channel.removeClient(target_nickname);
+    std::vector<std::string>& operators = channel.getOperators();
+    operators.erase(std::remove(operators.begin(), operators.end(), target_nickname), operators.end());
+    // The target's home server must drop it too, or it keeps talking into the channel
+    broadcast_to_links(":" + clients[client_fd].getUid() + " KICK " + channel_name + " " + target_uid + " :" + reason + "\r\n", -1);
 
-    std::string user_kicked_msg = "You have been kicked from " + channel_name + " by " + sender_nickname + " :" + reason + "\r\n";
-    if (send(target_fd, user_kicked_msg.c_str(), user_kicked_msg.size(), 0) < 0) {
-        perror("send");
+    if (!target_remote) {
+        std::string user_kicked_msg = "You have been kicked from " + channel_name + " by " + sender_nickname + " :" + reason + "\r\n";
+        send_to_client(target_fd, user_kicked_msg);
     }
 
     std::cout << "Client " << target_nickname << " was kicked from " << channel_name << " by " << sender_nickname << " with reason: " << reason << std::endl;
@@ -524,7 +752,7 @@ void Server::handle_topic(int client_fd, const std::string& args) {
 
     if (channels.find(channel_name) == channels.end()) {
         std::string msg = ":" + server_name + " 403 " + clients[client_fd].getNickname() + " " + channel_name + " :No such channel\r\n";
-        send(client_fd, msg.c_str(), msg.size(), 0);
+        send_to_client(client_fd, msg);
         return;
     }
 
@@ -534,23 +762,24 @@ void Server::handle_topic(int client_fd, const std::string& args) {
     if (topic.empty()) {
         if (channel.getTopic().empty()) {
             std::string msg = ":" + server_name + " 331 " + sender_nickname + " " + channel_name + " :No topic is set\r\n";
-            send(client_fd, msg.c_str(), msg.size(), 0);
+            send_to_client(client_fd, msg);
         } else {
             std::string msg = ":" + server_name + " 332 " + sender_nickname + " " + channel_name + " " + channel.getTopic() + "\r\n";
-            send(client_fd, msg.c_str(), msg.size(), 0);
+            send_to_client(client_fd, msg);
         }
         return;
     }
 
     if (channel.getTmode() && !channel.isOperator(sender_nickname)) {
         std::string notOperator = ":" + server_name + " 482 " + sender_nickname + " " + channel_name + " :You're not channel operator\r\n";
-        send(client_fd, notOperator.c_str(), notOperator.size(), 0);
+        send_to_client(client_fd, notOperator);
         return;
     }
 
     channel.setTopic(topic);
     std::string topic_msg = ":" + sender_nickname + "!" + clients[client_fd].getUsername() + " TOPIC " + channel_name + " " + topic + "\r\n";
     channel.broadcast(topic_msg);
+    broadcast_to_links(":" + clients[client_fd].getUid() + " TOPIC " + channel_name + " :" + (topic[0] == ':' ? topic.substr(1) : topic) + "\r\n", -1);
 
     std::cout << "Topic for channel " << channel_name << " set to " << topic << " by " << sender_nickname << std::endl;
 }
@@ -564,19 +793,19 @@ void Server::handle_invite(int client_fd, const std::string& args) {
 
     if (target_nickname.empty() || channel_name.empty()) {
         std::string error_msg = "Usage: INVITE <nickname> <channel>\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
     if (args.size() < target_nickname.size() + channel_name.size()) {
         std::string error_msg = "Error: invalid command format.\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
     if (channels.find(channel_name) == channels.end()) {
         std::string error_msg = "Channel " + channel_name + " does not exist.\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
@@ -585,7 +814,7 @@ void Server::handle_invite(int client_fd, const std::string& args) {
 
     if (!channel.isOperator(sender_nickname)) {
         std::string notOperator = ":" + server_name + " 482 " + sender_nickname + " " + channel.getName() + " :You're not channel operator\r\n";
-        send(client_fd, notOperator.c_str(), notOperator.size(), 0);
+        send_to_client(client_fd, notOperator);
         return;
     }
 
@@ -599,23 +828,23 @@ void Server::handle_invite(int client_fd, const std::string& args) {
 
     if (!target_client) {
         std::string error_msg = "User " + target_nickname + " not found.\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
     if (channel.isClient(target_nickname)) {
         std::string error_msg = target_nickname + " is already in the channel.\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
     channel.inviteClient(target_nickname, target_client);
 
     std::string invite_msg = "You have been invited to join channel " + channel_name + " by " + sender_nickname + "\r\n";
-    send(target_client->getFd(), invite_msg.c_str(), invite_msg.size(), 0);
+    target_client->queueMessage(invite_msg);
 
     std::string confirm_msg = "You have invited " + target_nickname + " to " + channel_name + ".\r\n";
-    send(client_fd, confirm_msg.c_str(), confirm_msg.size(), 0);
+    send_to_client(client_fd, confirm_msg);
 
     std::cout << "Client " << sender_nickname << " invited " << target_nickname << " to " << channel_name << std::endl;
 }
@@ -630,6 +859,7 @@ void Server::initialize_command_map() {
     command_map["USER"] = &Server::handle_user;
     command_map["JOIN"] = &Server::handle_join;
     command_map["PRIVMSG"] = &Server::handle_privmsg;
+    command_map["TAGMSG"] = &Server::handle_tagmsg;
     command_map["PASS"] = &Server::handle_pass;
     command_map["PART"] = &Server::handle_part;
     command_map["QUIT"] = &Server::handle_quit;
@@ -641,4 +871,11 @@ void Server::initialize_command_map() {
     command_map["TOPIC"] = &Server::handle_topic;
     command_map["MODE"] = &Server::handle_mode;
     command_map["WHO"] = &Server::handle_who;
+    command_map["LIST"] = &Server::handle_list;
+    command_map["CHATHISTORY"] = &Server::handle_chathistory;
+    command_map["CHANLOG"] = &Server::handle_chanlog;
+    command_map["SEARCH"] = &Server::handle_search;
+    command_map["RESUME"] = &Server::handle_resume;
+    command_map["STATS"] = &Server::handle_stats;
+    command_map["AUTHENTICATE"] = &Server::handle_authenticate;
 }
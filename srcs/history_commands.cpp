@@ -0,0 +1,291 @@
+#include "ft_irc.hpp"
+
+static uint32_t next_batch_id = 1;
+
+static void queue_history_line(Client& client, const std::string& batch, uint64_t time_ms, const char* data, size_t length) {
+    std::string tags;
+    if (!batch.empty()) {
+        tags = "batch=" + batch;
+    }
+    if (client.getCaps() & CAP_SERVER_TIME) {
+        tags += (tags.empty() ? "time=" : ";time=") + format_server_time(time_ms);
+    }
+    if (!tags.empty()) {
+        client.queueMessage("@" + tags + " ");
+    }
+    client.queueMessage(data, length);
+}
+
+/*
+ * @brief Copy a range of stored lines to a client, tagged with their time and wrapped in a batch if negotiated
+ * @param client The client to send to
+ * @param target The channel the history belongs to
+ * @param history The history to read from
+ * @param begin The index of the first entry
+ * @param end The index after the last entry
+ * @return void
+*/
+void Server::replay_history(Client& client, const std::string& target, const ChannelHistory& history, size_t begin, size_t end) {
+    std::string batch;
+    if (client.getCaps() & CAP_BATCH) {
+        batch = "h" + intToString(next_batch_id++);
+        client.queueMessage(":" + server_name + " BATCH +" + batch + " chathistory " + target + "\r\n");
+    }
+    for (size_t i = begin; i < end; ++i) {
+        ChannelHistory::Entry entry = history.at(i);
+        queue_history_line(client, batch, entry.time_ms, entry.data, entry.length);
+    }
+    if (!batch.empty()) {
+        client.queueMessage(":" + server_name + " BATCH -" + batch + "\r\n");
+    }
+}
+
+/*
+ * @brief Replay recent channel messages (IRCv3 CHATHISTORY LATEST/BEFORE/AFTER)
+ * @param client_fd The client file descriptor
+ * @param args <subcommand> <target> <* | timestamp=...> <limit>
+ * @return void
+*/
+void Server::handle_chathistory(int client_fd, const std::string& args) {
+    std::istringstream iss(args);
+    std::string subcommand, target, reference, limit_str;
+    iss >> subcommand >> target >> reference >> limit_str;
+    std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), ::toupper);
+
+    if (limit_str.empty()) {
+        std::string error_msg = ":" + server_name + " FAIL CHATHISTORY NEED_MORE_PARAMS " + subcommand + " :Missing parameters\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+
+    if (subcommand != "LATEST" && subcommand != "BEFORE" && subcommand != "AFTER") {
+        std::string error_msg = ":" + server_name + " FAIL CHATHISTORY INVALID_PARAMS " + subcommand + " :Unknown subcommand\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+
+    std::map<std::string, Channel>::iterator ch_it = channels.find(target);
+    if (ch_it == channels.end() || !ch_it->second.isClient(clients[client_fd].getNickname())) {
+        std::string error_msg = ":" + server_name + " FAIL CHATHISTORY INVALID_TARGET " + subcommand + " " + target + " :Messages could not be retrieved\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+
+    uint64_t reference_time = 0;
+    bool has_reference = false;
+    if (reference.compare(0, 10, "timestamp=") == 0) {
+        has_reference = parse_server_time(reference.substr(10), reference_time);
+        if (!has_reference) {
+            std::string error_msg = ":" + server_name + " FAIL CHATHISTORY INVALID_PARAMS " + subcommand + " " + reference + " :Invalid timestamp\r\n";
+            send_to_client(client_fd, error_msg);
+            return;
+        }
+    } else if (reference != "*" || subcommand != "LATEST") {
+        std::string error_msg = ":" + server_name + " FAIL CHATHISTORY INVALID_PARAMS " + subcommand + " " + reference + " :Only timestamp= references are supported\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+
+    long limit = std::atol(limit_str.c_str());
+    if (limit <= 0 || limit > CHATHISTORY_MAX_LIMIT) {
+        limit = CHATHISTORY_MAX_LIMIT;
+    }
+
+    const ChannelHistory& history = ch_it->second.getHistory();
+    size_t begin = 0;
+    size_t end = history.size();
+
+    if (subcommand == "LATEST") {
+        if (has_reference) {
+            begin = history.upperBound(reference_time);
+        }
+        if (end - begin > static_cast<size_t>(limit)) {
+            begin = end - limit;
+        }
+    } else if (subcommand == "BEFORE") {
+        end = history.lowerBound(reference_time);
+        if (end > static_cast<size_t>(limit)) {
+            begin = end - limit;
+        }
+    } else {
+        begin = history.upperBound(reference_time);
+        if (end - begin > static_cast<size_t>(limit)) {
+            end = begin + limit;
+        }
+    }
+
+    replay_history(clients[client_fd], target, history, begin, end);
+}
+
+static bool parse_log_time(const std::string& text, uint64_t& time_ms) {
+    if (text.compare(0, 10, "timestamp=") == 0) {
+        return parse_server_time(text.substr(10), time_ms);
+    }
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos || text.size() > 12) {
+        return false;
+    }
+    time_ms = std::strtoull(text.c_str(), NULL, 10) * 1000;
+    return true;
+}
+
+/*
+ * @brief Parse the time range of CHANLOG and SEARCH
+ * @param from_str Unix seconds, timestamp=..., or "*" for the beginning
+ * @param to_str Unix seconds, timestamp=..., "*" or empty for now
+ * @param from_ms Set to the start of the range
+ * @param to_ms Set to the end of the range, inclusive
+ * @return False if a time is invalid
+*/
+static bool parse_log_range(const std::string& from_str, const std::string& to_str, uint64_t& from_ms, uint64_t& to_ms) {
+    from_ms = 0;
+    to_ms = current_time_ms();
+    if ((from_str != "*" && !parse_log_time(from_str, from_ms)) || (!to_str.empty() && to_str != "*" && !parse_log_time(to_str, to_ms))) {
+        return false;
+    }
+    if (!to_str.empty() && to_str != "*" && to_str.compare(0, 10, "timestamp=") != 0) {
+        to_ms += 999; // A time in seconds covers the whole second
+    }
+    return true;
+}
+
+/*
+ * @brief Send records read from the channel log, tagged and batched like CHATHISTORY
+ * @param client The client to send to
+ * @param server_name The server prefix
+ * @param batch_type The batch type
+ * @param target The channel
+ * @param records The records, oldest first
+ * @return void
+*/
+static void replay_log_records(Client& client, const std::string& server_name, const std::string& batch_type, const std::string& target, std::vector<LogRecord>& records) {
+    std::string batch;
+    if (client.getCaps() & CAP_BATCH) {
+        batch = "h" + intToString(next_batch_id++);
+        client.queueMessage(":" + server_name + " BATCH +" + batch + " " + batch_type + " " + target + "\r\n");
+    }
+    for (size_t i = 0; i < records.size(); ++i) {
+        records[i].line += "\r\n";
+        queue_history_line(client, batch, records[i].time_ms, records[i].line.data(), records[i].line.size());
+    }
+    if (!batch.empty()) {
+        client.queueMessage(":" + server_name + " BATCH -" + batch + "\r\n");
+    }
+}
+
+/*
+ * @brief Replay a time range from the on-disk channel log, older than what CHATHISTORY keeps in memory
+ * @param client_fd The client file descriptor
+ * @param args <channel> <from> [<to> [<limit>]], times in unix seconds or timestamp=..., "*" for now
+ * @return void
+ * Records still queued for the writer (up to CHANNEL_LOG_COMMIT_MS old) are not visible yet
+*/
+void Server::handle_chanlog(int client_fd, const std::string& args) {
+    std::istringstream iss(args);
+    std::string target, from_str, to_str, limit_str;
+    iss >> target >> from_str >> to_str >> limit_str;
+
+    if (from_str.empty()) {
+        std::string error_msg = ":" + server_name + " FAIL CHANLOG NEED_MORE_PARAMS :Missing parameters\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+
+    std::map<std::string, Channel>::iterator ch_it = channels.find(target);
+    if (ch_it == channels.end() || !ch_it->second.isClient(clients[client_fd].getNickname()) || !channel_log.isLogged(target)) {
+        std::string error_msg = ":" + server_name + " FAIL CHANLOG INVALID_TARGET " + target + " :Channel is not logged\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+
+    uint64_t from_ms, to_ms;
+    if (!parse_log_range(from_str, to_str, from_ms, to_ms)) {
+        std::string error_msg = ":" + server_name + " FAIL CHANLOG INVALID_PARAMS " + target + " :Invalid time\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+    long limit = limit_str.empty() ? CHANLOG_MAX_LINES : std::atol(limit_str.c_str());
+    if (limit <= 0 || limit > CHANLOG_MAX_LINES) {
+        limit = CHANLOG_MAX_LINES;
+    }
+
+    ChannelLogReader reader;
+    std::vector<LogRecord> records;
+    std::string error;
+    if (reader.open(channel_log_path(channel_log.getDir(), target), error)) {
+        reader.query(from_ms, to_ms, limit, records);
+    }
+    replay_log_records(clients[client_fd], server_name, "chathistory", target, records);
+}
+
+/*
+ * @brief Search a logged channel for messages containing every word
+ * @param client_fd The client file descriptor
+ * @param args <channel> <from> <to> :<words>, times as for CHANLOG, "from:<nick>" matches the sender
+ * @return void
+ * Replies with the latest SEARCH_MAX_RESULTS matches, then a NOTICE saying whether older ones exist
+*/
+void Server::handle_search(int client_fd, const std::string& args) {
+    std::istringstream iss(args);
+    std::string target, from_str, to_str;
+    iss >> target >> from_str >> to_str;
+    size_t colon = args.find(" :");
+    std::string words = colon == std::string::npos ? "" : args.substr(colon + 2);
+    std::string nickname = clients[client_fd].getNickname();
+
+    if (to_str.empty() || words.empty()) {
+        std::string error_msg = ":" + server_name + " FAIL SEARCH NEED_MORE_PARAMS :Missing parameters\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+
+    std::map<std::string, Channel>::iterator ch_it = channels.find(target);
+    if (ch_it == channels.end() || !ch_it->second.isClient(nickname) || !channel_log.isLogged(target)) {
+        std::string error_msg = ":" + server_name + " FAIL SEARCH INVALID_TARGET " + target + " :Channel is not logged\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+
+    uint64_t from_ms, to_ms;
+    if (!parse_log_range(from_str, to_str, from_ms, to_ms)) {
+        std::string error_msg = ":" + server_name + " FAIL SEARCH INVALID_PARAMS " + target + " :Invalid time\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+
+    std::vector<std::string> terms;
+    std::istringstream word_stream(words);
+    std::string word;
+    while (word_stream >> word) {
+        if (word.compare(0, 5, "from:") == 0 && word.size() > 5) {
+            std::transform(word.begin(), word.end(), word.begin(), ::tolower);
+            terms.push_back(word);
+        } else {
+            SearchIndex::tokenize(word.data(), word.size(), terms);
+        }
+    }
+    if (terms.empty() || terms.size() > SEARCH_MAX_TERMS) {
+        std::string error_msg = ":" + server_name + " FAIL SEARCH INVALID_PARAMS " + target + " :Give 1 to " + intToString(SEARCH_MAX_TERMS) + " words of at least " + intToString(SEARCH_TERM_MIN) + " characters\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+
+    // The time index turns the range into an offset range, the postings are record offsets
+    ChannelLogReader reader;
+    std::vector<LogRecord> records;
+    std::vector<uint64_t> offsets;
+    std::string path = channel_log_path(channel_log.getDir(), target);
+    std::string error;
+    bool more = false;
+    if (reader.open(path, error)) {
+        more = search_index.search(path, terms, reader.lowerBound(from_ms), reader.upperBound(to_ms), SEARCH_MAX_RESULTS, offsets);
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            size_t offset = offsets[i];
+            LogRecord record;
+            if (reader.next(offset, record)) {
+                records.push_back(record);
+            }
+        }
+    }
+    replay_log_records(clients[client_fd], server_name, "search", target, records);
+    send_to_client(client_fd, ":" + server_name + " NOTICE " + nickname + " :SEARCH " + target + ": " + (more ? "latest " : "") + intToString(records.size()) + " matches" + (more ? ", more are older" : "") + "\r\n");
+}
@@ -0,0 +1,137 @@
+#include "PatternFilter.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sys/time.h>
+
+#define CORPUS_BYTES (64 * 1024 * 1024)
+#define NAIVE_BYTES (2 * 1024 * 1024)
+
+static uint64_t now_us() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+static uint32_t next_random(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static std::string random_word(uint32_t& seed, size_t min, size_t max) {
+    std::string word(min + next_random(seed) % (max - min + 1), 'a');
+    for (size_t i = 0; i < word.size(); ++i) {
+        word[i] = 'a' + next_random(seed) % 26;
+    }
+    return word;
+}
+
+/*
+ * @brief Make chat-like lines: short words, with one of the patterns in about one line in a hundred
+ * @param patterns Patterns to plant
+ * @param bytes Total size wanted
+ * @param lines Filled with the lines
+ * @return void
+*/
+static void make_corpus(const std::vector<std::string>& patterns, size_t bytes, std::vector<std::string>& lines) {
+    uint32_t seed = 2463534242U;
+    for (size_t total = 0; total < bytes; ) {
+        std::string line;
+        size_t length = 20 + next_random(seed) % 200;
+        while (line.size() < length) {
+            line += random_word(seed, 1, 9) + (next_random(seed) % 8 ? " " : ", ");
+        }
+        if (!patterns.empty() && next_random(seed) % 100 == 0) {
+            line += patterns[next_random(seed) % patterns.size()];
+        }
+        total += line.size();
+        lines.push_back(line);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || (std::string(argv[1]) == "-g" && argc < 3)) {
+        std::cerr << "Usage: " << argv[0] << " <patterns file | -g count> [corpus file]" << std::endl;
+        std::cerr << "Without a corpus, " << CORPUS_BYTES / (1024 * 1024) << " MB of random chat lines are scanned" << std::endl;
+        return 1;
+    }
+    bool generated = std::string(argv[1]) == "-g";
+    const char* corpus_path = argv[generated ? 3 : 2];
+
+    PatternFilter filter;
+    std::vector<std::string> patterns;
+    std::string error;
+    uint64_t start = now_us();
+    if (generated) {
+        uint32_t seed = 88172645U;
+        for (long count = std::strtol(argv[2], NULL, 10); count > 0; --count) {
+            patterns.push_back(random_word(seed, 6, 16));
+            filter.add(patterns.back(), next_random(seed) % 2 ? FILTER_BLOCK : FILTER_REPORT);
+        }
+        if (!filter.build(error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    } else if (!filter.load(argv[1], error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    uint64_t build_us = now_us() - start;
+    for (size_t i = patterns.size(); i < filter.getPatternCount(); ++i) {
+        patterns.push_back(filter.getPattern(i));
+    }
+    std::cout << "patterns " << filter.getPatternCount() << ", states " << filter.getStateCount() << ", classes " << filter.getClassCount()
+              << ", table " << filter.getMemoryUsage() / 1024 << " KiB, built in " << build_us / 1000 << " ms" << std::endl;
+
+    std::vector<std::string> lines;
+    if (corpus_path) {
+        std::ifstream file(corpus_path);
+        std::string line;
+        while (std::getline(file, line)) {
+            lines.push_back(line);
+        }
+    } else {
+        make_corpus(patterns, CORPUS_BYTES, lines);
+    }
+
+    // One scan per line, as the server scans one message at a time
+    size_t bytes = 0;
+    size_t matched = 0;
+    start = now_us();
+    for (size_t i = 0; i < lines.size(); ++i) {
+        matched += filter.scan(lines[i].data(), lines[i].size()).actions != 0;
+        bytes += lines[i].size();
+    }
+    uint64_t scan_us = std::max<uint64_t>(now_us() - start, 1);
+    std::cout << std::fixed << std::setprecision(1) << "aho-corasick  " << bytes / 1e6 << " MB in " << scan_us / 1000 << " ms, "
+              << bytes / static_cast<double>(scan_us) << " MB/s, " << matched << " of " << lines.size() << " lines matched" << std::endl;
+
+    // The same check with one std::string::find per pattern, on a sample, to compare speed and results
+    size_t naive_bytes = 0;
+    std::vector<bool> naive_found;
+    start = now_us();
+    for (size_t i = 0; i < lines.size() && naive_bytes < NAIVE_BYTES; ++i) {
+        std::string folded = lines[i];
+        for (size_t c = 0; c < folded.size(); ++c) {
+            folded[c] = (folded[c] >= 'A' && folded[c] <= 'Z') ? folded[c] - 'A' + 'a' : folded[c];
+        }
+        bool found = false;
+        for (size_t p = 0; p < patterns.size() && !found; ++p) {
+            found = folded.find(patterns[p]) != std::string::npos;
+        }
+        naive_found.push_back(found);
+        naive_bytes += lines[i].size();
+    }
+    uint64_t naive_us = std::max<uint64_t>(now_us() - start, 1);
+    size_t mismatches = 0;
+    for (size_t i = 0; i < naive_found.size(); ++i) {
+        mismatches += naive_found[i] != (filter.scan(lines[i].data(), lines[i].size()).actions != 0);
+    }
+    std::cout << "naive find    " << naive_bytes / 1e6 << " MB in " << naive_us / 1000 << " ms, "
+              << naive_bytes / static_cast<double>(naive_us) << " MB/s, " << mismatches << " lines disagree" << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+#include "ChannelLogReader.hpp"
+
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <sys/time.h>
+
+/*
+ * @brief Parse a time argument: unix seconds, or "-<seconds>" before now
+ * @param text The argument
+ * @param time_ms Set to the time in milliseconds
+ * @return False if the argument is not a time
+*/
+static bool parse_time(const char* text, uint64_t& time_ms) {
+    bool relative = text[0] == '-';
+    const char* digits = relative ? text + 1 : text;
+    char* end = NULL;
+    unsigned long long seconds = std::strtoull(digits, &end, 10);
+    if (end == digits || *end != '\0') {
+        return false;
+    }
+    if (!relative) {
+        time_ms = seconds * 1000;
+        return true;
+    }
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t now_ms = static_cast<uint64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+    time_ms = seconds * 1000 > now_ms ? 0 : now_ms - seconds * 1000;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t from_ms = 0;
+    uint64_t to_ms = UINT64_MAX;
+    if (argc < 2 || (argc > 2 && !parse_time(argv[2], from_ms)) || (argc > 3 && !parse_time(argv[3], to_ms))) {
+        std::cerr << "Usage: " << argv[0] << " <dir/channel.log> [from] [to] [limit]" << std::endl;
+        std::cerr << "Times are unix seconds, or -<seconds> before now" << std::endl;
+        return 1;
+    }
+    if (argc > 3) {
+        to_ms += 999; // A time in seconds covers the whole second
+    }
+    size_t limit = argc > 4 ? std::strtoul(argv[4], NULL, 10) : static_cast<size_t>(-1);
+
+    ChannelLogReader reader;
+    std::string error;
+    if (!reader.open(argv[1], error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    // Jump to the range through the index, then stream records until it ends
+    size_t offset = reader.seek(from_ms);
+    LogRecord record;
+    while (limit > 0 && reader.next(offset, record) && record.time_ms <= to_ms) {
+        if (record.time_ms < from_ms) {
+            continue;
+        }
+        time_t seconds = record.time_ms / 1000;
+        struct tm tm;
+        char stamp[32];
+        gmtime_r(&seconds, &tm);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+        std::cout << stamp << "." << static_cast<char>('0' + record.time_ms % 1000 / 100)
+                  << static_cast<char>('0' + record.time_ms % 100 / 10)
+                  << static_cast<char>('0' + record.time_ms % 10) << " " << record.line << "\n";
+        --limit;
+    }
+    std::cout.flush();
+    return 0;
+}
@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+#define BASELINE_MS 2000
+#define PROBE_INTERVAL_MS 100   // Under the default flood_rate of the probing client
+#define SETUP_TIMEOUT_MS 10000
+#define SOURCE_ADDRESSES 1000   // 127.0.<1-4>.<1-250>, so the per-address connection limits stay out of the way
+
+/*
+ * Login benchmark: how many SASL PLAIN logins per second the server sustains,
+ * and how much a login storm delays the messages of clients already connected.
+ * Two clients exchange a channel message every PROBE_INTERVAL_MS, first alone,
+ * then while <logins> connections log in, <concurrency> at a time.
+*/
+
+struct Login {
+    int fd;
+    bool sent;
+    uint64_t started_us;
+    std::string buffer;
+};
+
+static uint64_t now_us() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+static std::string base64_encode(const std::string& data) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < data.size(); i += 3) {
+        uint32_t chunk = static_cast<unsigned char>(data[i]) << 16;
+        if (i + 1 < data.size()) {
+            chunk |= static_cast<unsigned char>(data[i + 1]) << 8;
+        }
+        if (i + 2 < data.size()) {
+            chunk |= static_cast<unsigned char>(data[i + 2]);
+        }
+        out += table[(chunk >> 18) & 63];
+        out += table[(chunk >> 12) & 63];
+        out += i + 1 < data.size() ? table[(chunk >> 6) & 63] : '=';
+        out += i + 2 < data.size() ? table[chunk & 63] : '=';
+    }
+    return out;
+}
+
+/*
+ * @brief Open a non-blocking connection to the server on localhost
+ * @param port The server port
+ * @param source 0 for the default source address, otherwise which 127.0.x.y to connect from
+ * @return The socket, -1 on failure
+*/
+static int open_connection(int port, unsigned int source) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    if (source != 0) {
+        addr.sin_addr.s_addr = htonl((127U << 24) | ((1 + source / 250 % 4) << 8) | (1 + source % 250));
+        if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * @brief Read what is available and split it into lines
+ * @param fd The socket
+ * @param buffer The partial line kept between calls
+ * @param lines Appended with the complete lines
+ * @return False once the server closed the connection
+*/
+static bool read_lines(int fd, std::string& buffer, std::vector<std::string>& lines) {
+    char data[4096];
+    ssize_t got = recv(fd, data, sizeof(data), 0);
+    if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return false;
+    }
+    if (got > 0) {
+        buffer.append(data, got);
+    }
+    size_t end;
+    while ((end = buffer.find("\r\n")) != std::string::npos) {
+        lines.push_back(buffer.substr(0, end));
+        buffer.erase(0, end + 2);
+    }
+    return true;
+}
+
+static bool send_line(int fd, const std::string& line) {
+    std::string data = line + "\r\n";
+    return send(fd, data.data(), data.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+}
+
+/*
+ * @brief Wait for a line containing a text, during the setup
+ * @param fd The socket
+ * @param buffer Its partial line
+ * @param text The text to wait for
+ * @return True if it arrived before SETUP_TIMEOUT_MS
+*/
+static bool wait_for(int fd, std::string& buffer, const std::string& text) {
+    uint64_t deadline = now_us() + SETUP_TIMEOUT_MS * 1000ULL;
+    while (now_us() < deadline) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll(&pfd, 1, 100);
+        std::vector<std::string> lines;
+        if (!read_lines(fd, buffer, lines)) {
+            return false;
+        }
+        for (size_t i = 0; i < lines.size(); ++i) {
+            if (lines[i].find(text) != std::string::npos) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ * @brief Connect and register a probing client, and join the probe channel
+ * @param port The server port
+ * @param password The server password
+ * @param nick Its nickname
+ * @param buffer Its partial line
+ * @return The socket, -1 on failure
+*/
+static int open_prober(int port, const std::string& password, const std::string& nick, std::string& buffer) {
+    int fd = open_connection(port, 0);
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    if (fd < 0 || poll(&pfd, 1, SETUP_TIMEOUT_MS) != 1
+        || !send_line(fd, "PASS " + password) || !send_line(fd, "NICK " + nick) || !send_line(fd, "USER " + nick + " 0 * :" + nick)
+        || !wait_for(fd, buffer, " 001 ") || !send_line(fd, "JOIN #ircsasl") || !wait_for(fd, buffer, " 353 ")) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static uint64_t percentile(std::vector<uint64_t> values, size_t p) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, values.size() * p / 100)];
+}
+
+static void print_latency(const char* label, const std::vector<uint64_t>& values) {
+    std::cout << label << values.size() << " samples, p50 " << percentile(values, 50) / 1000.0 << " ms, p99 "
+              << percentile(values, 99) / 1000.0 << " ms, max " << percentile(values, 100) / 1000.0 << " ms" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        std::cerr << "Usage: " << argv[0] << " <port> <password> <account> <account password> [logins] [concurrency]" << std::endl;
+        std::cerr << "The account must exist in the ircserv.accounts of the server, and its max_clients leave room for concurrency + 2 clients" << std::endl;
+        return 1;
+    }
+    int port = std::atoi(argv[1]);
+    std::string password = argv[2];
+    std::string payload = base64_encode(std::string(argv[3]) + '\0' + argv[3] + '\0' + argv[4]);
+    long total = argc > 5 ? std::atol(argv[5]) : 200;
+    long concurrency = argc > 6 ? std::atol(argv[6]) : 8;
+    std::string login_request = "CAP REQ :sasl\r\nAUTHENTICATE PLAIN\r\nAUTHENTICATE " + payload + "\r\n";
+
+    std::string tx_buffer, rx_buffer;
+    int tx = open_prober(port, password, "sasl_tx", tx_buffer);
+    int rx = open_prober(port, password, "sasl_rx", rx_buffer);
+    if (tx < 0 || rx < 0) {
+        std::cerr << "Cannot register the probing clients on port " << port << std::endl;
+        return 1;
+    }
+    fcntl(tx, F_SETFL, O_NONBLOCK);
+    fcntl(rx, F_SETFL, O_NONBLOCK);
+
+    std::map<unsigned long, std::pair<uint64_t, bool> > probes; // Sequence -> sent at, during the storm
+    std::vector<uint64_t> baseline_latency, storm_latency, login_latency;
+    std::vector<Login> logins;
+    unsigned long sequence = 0;
+    long started = 0, succeeded = 0, failed = 0;
+    uint64_t next_probe = now_us();
+    uint64_t storm_at = now_us() + BASELINE_MS * 1000ULL;
+    uint64_t storm_start = 0, storm_end = 0;
+
+    while (storm_end == 0 || !probes.empty()) {
+        uint64_t now = now_us();
+        bool storm = now >= storm_at;
+        if (storm && storm_start == 0) {
+            storm_start = now;
+        }
+        while (storm && storm_end == 0 && started < total && static_cast<long>(logins.size()) < concurrency) {
+            Login login;
+            login.fd = open_connection(port, 1 + started % SOURCE_ADDRESSES);
+            login.sent = false;
+            login.started_us = now_us();
+            ++started;
+            if (login.fd < 0) {
+                ++failed;
+                continue;
+            }
+            logins.push_back(login);
+        }
+        if (storm && storm_end == 0 && started == total && logins.empty()) {
+            storm_end = now;
+        }
+        if (storm_end != 0 && now > storm_end + 2000000) {
+            break; // Probes lost for good
+        }
+        if (now >= next_probe && storm_end == 0) {
+            std::ostringstream line;
+            line << "PRIVMSG #ircsasl :" << ++sequence;
+            probes[sequence] = std::make_pair(now, storm);
+            send_line(tx, line.str());
+            next_probe = now + PROBE_INTERVAL_MS * 1000ULL;
+        }
+
+        std::vector<struct pollfd> fds(2 + logins.size());
+        fds[0].fd = tx;
+        fds[1].fd = rx;
+        for (size_t i = 0; i < fds.size(); ++i) {
+            if (i >= 2) {
+                fds[i].fd = logins[i - 2].fd;
+            }
+            fds[i].events = (i >= 2 && !logins[i - 2].sent) ? POLLOUT : POLLIN;
+            fds[i].revents = 0;
+        }
+        int timeout = next_probe > now ? static_cast<int>((next_probe - now) / 1000) + 1 : 0;
+        if (poll(&fds[0], fds.size(), std::min(timeout, PROBE_INTERVAL_MS)) < 0 && errno != EINTR) {
+            std::cerr << "poll: " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        now = now_us();
+
+        std::vector<std::string> lines;
+        if ((fds[0].revents & POLLIN && !read_lines(tx, tx_buffer, lines)) || (fds[1].revents & POLLIN && !read_lines(rx, rx_buffer, lines))) {
+            std::cerr << "The server closed a probing client" << std::endl;
+            return 1;
+        }
+        for (size_t i = 0; i < lines.size(); ++i) {
+            size_t text = lines[i].find("PRIVMSG #ircsasl :");
+            std::map<unsigned long, std::pair<uint64_t, bool> >::iterator probe;
+            if (text == std::string::npos || (probe = probes.find(std::strtoul(lines[i].c_str() + text + 18, NULL, 10))) == probes.end()) {
+                continue;
+            }
+            (probe->second.second ? storm_latency : baseline_latency).push_back(now - probe->second.first);
+            probes.erase(probe);
+        }
+
+        std::vector<Login> active;
+        for (size_t i = 0; i < logins.size(); ++i) {
+            Login& login = logins[i];
+            short revents = fds[i + 2].revents;
+            bool done = false;
+            if (!login.sent && revents) {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                getsockopt(login.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                login.sent = error == 0 && send(login.fd, login_request.data(), login_request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(login_request.size());
+                done = !login.sent;
+                failed += done;
+            } else if (login.sent && revents) {
+                std::vector<std::string> replies;
+                bool open = read_lines(login.fd, login.buffer, replies);
+                for (size_t r = 0; r < replies.size() && !done; ++r) {
+                    if (replies[r].find(" 903 ") != std::string::npos) {
+                        login_latency.push_back(now - login.started_us);
+                        ++succeeded;
+                        done = true;
+                    } else if (replies[r].find(" 904 ") != std::string::npos || replies[r].compare(0, 5, "ERROR") == 0) {
+                        ++failed;
+                        done = true;
+                    }
+                }
+                if (!open && !done) {
+                    ++failed;
+                    done = true;
+                }
+            }
+            if (done) {
+                send_line(login.fd, "QUIT");
+                close(login.fd);
+            } else {
+                active.push_back(login);
+            }
+        }
+        logins.swap(active);
+    }
+
+    double storm_seconds = storm_end > storm_start ? (storm_end - storm_start) / 1e6 : 0;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "logins        " << succeeded << " of " << total << " in " << storm_seconds << " s, "
+              << (storm_seconds > 0 ? succeeded / storm_seconds : 0) << " per second, " << concurrency << " at a time, " << failed << " failed" << std::endl;
+    print_latency("login time    ", login_latency);
+    print_latency("message idle  ", baseline_latency);
+    print_latency("message storm ", storm_latency);
+    if (!probes.empty()) {
+        std::cout << probes.size() << " probe messages never arrived" << std::endl;
+    }
+    send_line(tx, "QUIT");
+    send_line(rx, "QUIT");
+    close(tx);
+    close(rx);
+    return failed == 0 && probes.empty() ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+#include "Metrics.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static const char* counter_names[METRIC_COUNTER_COUNT] = {
+    "connections",
+    "disconnections",
+    "registrations",
+    "bytes_in",
+    "bytes_out",
+    "commands",
+    "broadcasts",
+    "broadcast_fanout",
+    "loop_iterations",
+    "loop_wakeups",
+    "overload_transitions",
+    "overload_rejects",
+    "accept_rejects",
+    "tagmsg_dropped",
+    "tagmsg_replaced"
+};
+
+struct Totals {
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    uint64_t verbs[METRICS_MAX_VERBS];
+};
+
+/*
+ * @brief Sum the slots of every thread
+ * @param page The mapped metrics page
+ * @param totals The totals to fill
+ * @return void
+*/
+static void collect(const volatile MetricsPage* page, Totals& totals) {
+    std::memset(&totals, 0, sizeof(totals));
+    for (size_t t = 0; t < METRICS_MAX_THREADS; ++t) {
+        for (size_t c = 0; c < METRIC_COUNTER_COUNT; ++c) {
+            totals.counters[c] += page->slots[t].counters[c];
+        }
+        for (size_t v = 0; v < METRICS_MAX_VERBS; ++v) {
+            totals.verbs[v] += page->slots[t].verbs[v];
+        }
+    }
+}
+
+static double rate(uint64_t now, uint64_t before, unsigned int interval) {
+    if (now < before) {
+        return 0; // The server restarted its counters
+    }
+    return static_cast<double>(now - before) / interval;
+}
+
+static void print_report(const volatile MetricsPage* page, const Totals& now, const Totals& before, unsigned int interval) {
+    std::cout << "pid " << page->pid << "  threads " << page->thread_count
+              << "  clients " << page->gauges[GAUGE_CLIENTS]
+              << "  channels " << page->gauges[GAUGE_CHANNELS]
+              << "  sendq " << page->gauges[GAUGE_SENDQ_BYTES] << "B (max " << page->gauges[GAUGE_SENDQ_MAX] << "B)" << std::endl;
+    std::cout << "lag " << page->gauges[GAUGE_LOOP_LAG_US] << "us  ready " << page->gauges[GAUGE_READY_LAG_US]
+              << "us  iteration " << page->gauges[GAUGE_ITERATION_US] << "us  overload stage " << page->gauges[GAUGE_OVERLOAD_STAGE]
+              << "  throttled " << page->gauges[GAUGE_THROTTLED_CLIENTS] << std::endl;
+
+    std::cout << std::fixed << std::setprecision(1);
+    for (size_t c = 0; c < METRIC_COUNTER_COUNT; ++c) {
+        std::cout << "  " << std::left << std::setw(22) << counter_names[c]
+                  << std::right << std::setw(14) << now.counters[c]
+                  << std::setw(12) << rate(now.counters[c], before.counters[c], interval) << "/s" << std::endl;
+    }
+
+    uint32_t verb_count = page->verb_count;
+    for (uint32_t v = 0; v < verb_count && v < METRICS_MAX_VERBS; ++v) {
+        if (now.verbs[v] == 0) {
+            continue;
+        }
+        char verb[METRICS_VERB_LEN];
+        for (size_t i = 0; i < METRICS_VERB_LEN; ++i) {
+            verb[i] = page->verb_names[v][i];
+        }
+        verb[METRICS_VERB_LEN - 1] = '\0';
+        std::cout << "  cmd " << std::left << std::setw(18) << verb
+                  << std::right << std::setw(14) << now.verbs[v]
+                  << std::setw(12) << rate(now.verbs[v], before.verbs[v], interval) << "/s" << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <port> [interval] [count]" << std::endl;
+        return 1;
+    }
+
+    std::string name = metrics_segment_name(std::atoi(argv[1]));
+    unsigned int interval = argc > 2 ? std::atoi(argv[2]) : 1;
+    int count = argc > 3 ? std::atoi(argv[3]) : -1;
+    if (interval == 0) {
+        interval = 1;
+    }
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cerr << "No metrics segment " << name << ", is ircserv running on this port?" << std::endl;
+        return 1;
+    }
+    void* addr = mmap(NULL, sizeof(MetricsPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Failed to map " << name << std::endl;
+        return 1;
+    }
+    const volatile MetricsPage* page = static_cast<const volatile MetricsPage*>(addr);
+    if (page->magic != METRICS_MAGIC || page->version != METRICS_VERSION) {
+        std::cerr << "Unsupported metrics segment " << name << std::endl;
+        return 1;
+    }
+
+    Totals before;
+    Totals now;
+    collect(page, before);
+    while (count != 0) {
+        sleep(interval);
+        if (kill(static_cast<pid_t>(page->pid), 0) < 0 && errno == ESRCH) {
+            std::cerr << "ircserv exited" << std::endl;
+            break;
+        }
+        collect(page, now);
+        print_report(page, now, before, interval);
+        before = now;
+        if (count > 0) {
+            --count;
+        }
+    }
+
+    munmap(addr, sizeof(MetricsPage));
+    return 0;
+}
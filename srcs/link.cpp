@@ -0,0 +1,1140 @@
+#include "ft_irc.hpp"
+#include <netdb.h>
+#include <set>
+
+/*
+ * Server-to-server links (a subset of the TS6 protocol).
+ *
+ * Handshake:  PASS <password> TS 6 :<sid>, CAPAB, SERVER <name> 1 :<description>
+ *             Only servers listed in a [link] section are accepted, with the
+ *             password, SID and name given there, and from the address of its host.
+ *             When both sides offer ZIP in their CAPAB, everything each side
+ *             sends after its SERVER line is a zlib stream (see LinkStream)
+ * Burst:      UID for every known client, SJOIN for every channel with members,
+ *             followed by TB for its topic and BMASK for its b/e/I lists
+ * Afterwards: UID/NICK/QUIT/KILL, JOIN/PART/KICK, TOPIC and TMODE (one channel
+ *             mode change, o with a UID) keep the network state in sync and are
+ *             sent to every link; PRIVMSG is only routed to the links behind
+ *             which the target channel has members, and dropped when its sender
+ *             is not a member or is banned. The network must be a tree.
+*/
+
+static const char B36[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+LinkInfo::LinkInfo() : sid(""), name(""), outgoing(false), authenticated(false), established(false), offered_zip(false), peer_zip(false), stream(NULL) {}
+
+LinkPeer::LinkPeer() : resolved_at(0), resolving(false), fd(-1), next_attempt(0), backoff(LINK_RETRY_MIN) {}
+
+/*
+ * Forward lookup of the host of a [link] section, off the event loop
+*/
+class LinkResolveJob : public WorkerJob {
+private:
+    std::string name;
+    std::string host;
+    std::vector<PeerAddress> addresses;
+
+public:
+    LinkResolveJob(const std::string& name, const std::string& host) : name(name), host(host) {}
+
+    void run() {
+        struct addrinfo hints;
+        struct addrinfo* res;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), NULL, &hints, &res) != 0) {
+            return;
+        }
+        for (struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next) {
+            addresses.push_back(PeerAddress::fromSockaddr(ai->ai_addr, ai->ai_addrlen));
+        }
+        freeaddrinfo(res);
+    }
+
+    void complete(Server& server) {
+        server.finish_link_resolve(name, host, addresses);
+    }
+};
+
+/*
+ * @brief Compare two secrets in a time that does not depend on where they differ
+ * @param given The secret received
+ * @param expected The configured secret
+ * @return True if they are equal
+*/
+static bool same_secret(const std::string& given, const std::string& expected) {
+    unsigned char diff = given.size() != expected.size();
+    for (size_t i = 0; i < expected.size(); ++i) {
+        diff |= static_cast<unsigned char>(expected[i] ^ (i < given.size() ? given[i] : 0));
+    }
+    return diff == 0;
+}
+
+/*
+ * @brief Split a line into its prefix, command and parameters (the trailing parameter included)
+ * @param line The raw line
+ * @param prefix The prefix, without the colon
+ * @param command The command, uppercased
+ * @param params The parameters
+ * @return void
+*/
+static void split_irc_line(const std::string& line, std::string& prefix, std::string& command, std::vector<std::string>& params) {
+    size_t pos = 0;
+    size_t end = line.find_last_not_of("\r\n");
+    std::string input = end == std::string::npos ? "" : line.substr(0, end + 1);
+
+    prefix.clear();
+    command.clear();
+    params.clear();
+
+    if (!input.empty() && input[0] == ':') {
+        size_t space = input.find(' ');
+        prefix = input.substr(1, space == std::string::npos ? std::string::npos : space - 1);
+        pos = space == std::string::npos ? input.size() : space + 1;
+    }
+    while (pos < input.size()) {
+        while (pos < input.size() && input[pos] == ' ') {
+            ++pos;
+        }
+        if (pos >= input.size()) {
+            break;
+        }
+        if (input[pos] == ':' && !command.empty()) {
+            params.push_back(input.substr(pos + 1));
+            break;
+        }
+        size_t space = input.find(' ', pos);
+        std::string token = input.substr(pos, space == std::string::npos ? std::string::npos : space - pos);
+        if (command.empty()) {
+            command = token;
+            std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+        } else {
+            params.push_back(token);
+        }
+        pos = space == std::string::npos ? input.size() : space + 1;
+    }
+}
+
+/*
+ * @brief Derive a TS6 server id ([0-9][A-Z][A-Z0-9]) from the listening port, for a server that is not linked
+ * @param port The port
+ * @return The server id, linked servers set server_id instead since they may share a port
+*/
+std::string make_server_id(int port) {
+    std::string id;
+    id += B36[port % 10];
+    id += B36[10 + (port / 10) % 26];
+    id += B36[(port / 260) % 36];
+    return id;
+}
+
+/*
+ * @brief Build the network-wide id of a local client: the server id followed by 6 characters
+ * @param id The local client id
+ * @return The UID
+*/
+std::string Server::make_uid(uint32_t id) const {
+    std::string uid = sid;
+    char suffix[7];
+    for (int i = 5; i >= 0; --i) {
+        suffix[i] = B36[id % 36];
+        id /= 36;
+    }
+    suffix[6] = '\0';
+    return uid + suffix;
+}
+
+bool Server::is_link_handshake(const std::string& line) const {
+    return line.compare(0, 5, "PASS ") == 0 && line.find(" TS ") != std::string::npos;
+}
+
+/*
+ * @brief Follow the [link] sections of the configuration: add the new peers, update the others, drop the removed ones
+ * @return void
+*/
+void Server::sync_link_peers() {
+    std::vector<LinkPeer> peers;
+    for (size_t i = 0; i < config->links.size(); ++i) {
+        LinkPeer peer;
+        LinkPeer* existing = find_link_peer(config->links[i].name);
+        if (existing) {
+            peer = *existing;
+            if (peer.block.host != config->links[i].host) {
+                peer.addresses.clear();
+                peer.resolved_at = 0;
+            }
+        }
+        peer.block = config->links[i];
+        peers.push_back(peer);
+    }
+    for (size_t i = 0; i < link_peers.size(); ++i) {
+        bool kept = false;
+        for (size_t j = 0; j < peers.size(); ++j) {
+            kept = kept || peers[j].block.name == link_peers[i].block.name;
+        }
+        if (!kept && link_peers[i].fd >= 0) {
+            send_to_client(link_peers[i].fd, "ERROR :Link removed from the configuration\r\n");
+            flush_link_streams();
+            clients[link_peers[i].fd].flushSendQueue();
+            disconnect_client(link_peers[i].fd);
+        }
+    }
+    link_peers.swap(peers);
+}
+
+LinkPeer* Server::find_link_peer(const std::string& name) {
+    for (size_t i = 0; i < link_peers.size(); ++i) {
+        if (link_peers[i].block.name == name) {
+            return &link_peers[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * @brief Find the addresses of a peer: at once for an IP address, on a worker thread for a name
+ * @param peer The peer
+ * @return void
+*/
+void Server::resolve_link_peer(LinkPeer& peer) {
+    struct addrinfo hints;
+    struct addrinfo* res;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST; // Never blocks
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(peer.block.host.c_str(), NULL, &hints, &res) == 0) {
+        std::vector<PeerAddress> addresses(1, PeerAddress::fromSockaddr(res->ai_addr, res->ai_addrlen));
+        freeaddrinfo(res);
+        finish_link_resolve(peer.block.name, peer.block.host, addresses);
+        return;
+    }
+    LinkResolveJob* job = new LinkResolveJob(peer.block.name, peer.block.host);
+    peer.resolving = true;
+    if (workers.getEventFd() < 0) {
+        job->run();
+        job->complete(*this);
+        delete job;
+        return;
+    }
+    workers.submit(job);
+}
+
+/*
+ * @brief Store the addresses a peer resolved to
+ * @param name The [link] section
+ * @param host The host that was resolved, the result is stale if the section changed since
+ * @param addresses The addresses, empty if the lookup failed
+ * @return void
+*/
+void Server::finish_link_resolve(const std::string& name, const std::string& host, const std::vector<PeerAddress>& addresses) {
+    LinkPeer* peer = find_link_peer(name);
+    if (!peer || peer->block.host != host) {
+        return;
+    }
+    peer->resolving = false;
+    peer->resolved_at = time(NULL);
+    if (addresses.empty()) {
+        std::cerr << "Link: cannot resolve " << host << " for " << name << ", keeping " << peer->addresses.size() << " known addresses" << std::endl;
+        return;
+    }
+    peer->addresses = addresses;
+}
+
+/*
+ * @brief Open the outgoing connection of a peer, to the first address its host resolved to
+ * @param peer The peer, resolved and with a port
+ * @return void
+*/
+void Server::connect_to_peer(LinkPeer& peer) {
+    struct sockaddr_storage storage;
+    socklen_t length = peer.addresses[0].toSockaddr(storage);
+    if (length == 0) {
+        return;
+    }
+    if (storage.ss_family == AF_INET6) {
+        reinterpret_cast<struct sockaddr_in6*>(&storage)->sin6_port = htons(peer.block.port);
+    } else {
+        reinterpret_cast<struct sockaddr_in*>(&storage)->sin_port = htons(peer.block.port);
+    }
+
+    int fd = socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&storage), length) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return;
+    }
+
+    struct pollfd link_poll_fd;
+    link_poll_fd.fd = fd;
+    link_poll_fd.events = POLLIN | POLLOUT;
+    link_poll_fd.revents = 0;
+    poll_fds.push_back(link_poll_fd);
+
+    clients[fd] = Client(fd);
+    LinkInfo& link = links[fd];
+    link.outgoing = true;
+    link.peer = peer.block.name;
+    peer.fd = fd;
+
+    send_link_handshake(fd);
+    std::cout << "Link: connecting to " << peer.block.name << " at " << peer.block.host << ":" << peer.block.port << std::endl;
+}
+
+void Server::send_link_handshake(int link_fd) {
+    LinkInfo& link = links[link_fd];
+    LinkPeer* peer = find_link_peer(link.peer);
+    link.offered_zip = peer && peer->block.compress && LinkStream::available();
+    std::string handshake = "PASS " + (peer ? peer->block.password : "*") + " TS 6 :" + sid + "\r\n"
+        + "CAPAB :QS" + (link.offered_zip ? " ZIP" : "") + "\r\n"
+        + "SERVER " + server_name + " 1 :ft_irc\r\n";
+    send_to_client(link_fd, handshake);
+}
+
+/*
+ * @brief Switch a link to compression once the peer's SERVER line is read, if both sides offered ZIP
+ * @param link_fd The link
+ * @return void
+ * Whatever the peer sent after its SERVER line is already compressed and is inflated here
+*/
+void Server::start_link_compression(int link_fd) {
+    LinkInfo& link = links[link_fd];
+    if (!link.offered_zip || !link.peer_zip || link.stream) {
+        return;
+    }
+    link.stream = new LinkStream();
+    std::string buffered = clients[link_fd].getBuffer();
+    std::string inflated;
+    if (!link.stream->isValid() || !link.stream->read(buffered.data(), buffered.size(), inflated)) {
+        delete link.stream;
+        link.stream = NULL;
+        reject_link(link_fd, "cannot start compression");
+        return;
+    }
+    clients[link_fd].setBuffer(inflated);
+}
+
+/*
+ * @brief Compress what every compressed link was sent during this loop iteration, in one block per link
+ * @return void
+*/
+void Server::flush_link_streams() {
+    std::vector<int> broken;
+    for (std::map<int, LinkInfo>::iterator it = links.begin(); it != links.end(); ++it) {
+        if (!it->second.stream || !it->second.stream->hasPending()) {
+            continue;
+        }
+        std::string out;
+        if (!it->second.stream->flush(out)) {
+            broken.push_back(it->first);
+            continue;
+        }
+        clients[it->first].queueMessage(out.data(), out.size());
+    }
+    for (size_t i = 0; i < broken.size(); ++i) {
+        std::cerr << "Link: compression failed on " << links[broken[i]].name << std::endl;
+        disconnect_client(broken[i]);
+    }
+}
+
+std::string Server::make_uid_line(const Client& client) const {
+    return ":" + client.getUid().substr(0, 3) + " UID " + client.getNickname() + " 1 " + intToString(client.getTimeToConnect())
+        + " +i " + client.getUsername() + " " + client.getHostname() + " " + client.getAddress().toString() + " " + client.getUid() + " :" + client.getRealname() + "\r\n";
+}
+
+/*
+ * @brief Build the SJOIN describing a channel, its modes and the members not behind except_fd
+ * @param channel The channel
+ * @param except_fd The link the line is for, its own members are left out
+ * @return The line, empty if there is no member to announce
+*/
+std::string Server::make_sjoin_line(const Channel& channel, int except_fd) const {
+    std::string members;
+    const std::map<std::string, Client*>& channel_clients = channel.getClients();
+    for (std::map<std::string, Client*>::const_iterator it = channel_clients.begin(); it != channel_clients.end(); ++it) {
+        if (it->second->getUid().empty() || it->second->getRouteFd() == except_fd) {
+            continue;
+        }
+        if (!members.empty()) {
+            members += " ";
+        }
+        if (channel.isOperator(it->first)) {
+            members += "@";
+        }
+        members += it->second->getUid();
+    }
+    if (members.empty()) {
+        return "";
+    }
+
+    std::string modes = "+";
+    std::string mode_params;
+    if (channel.getInviteOnly()) {
+        modes += "i";
+    }
+    if (channel.getTmode()) {
+        modes += "t";
+    }
+    if (!channel.getPassword().empty()) {
+        modes += "k";
+        mode_params += " " + channel.getPassword();
+    }
+    if (channel.hasUserLimit()) {
+        modes += "l";
+        mode_params += " " + intToString(channel.getChannelLimit());
+    }
+    return ":" + sid + " SJOIN " + intToString(channel.getCreationTime()) + " " + channel.getName() + " " + modes + mode_params + " :" + members + "\r\n";
+}
+
+/*
+ * @brief Send every client and channel this server knows to a new link
+ * @param link_fd The link
+ * @return void
+*/
+void Server::send_burst(int link_fd) {
+    for (std::map<std::string, Client*>::iterator it = clients_by_uid.begin(); it != clients_by_uid.end(); ++it) {
+        if (it->second->getRouteFd() != link_fd) {
+            send_to_client(link_fd, make_uid_line(*it->second));
+        }
+    }
+    static const char list_flags[] = { 'b', 'e', 'I' };
+    for (std::map<std::string, Channel>::iterator it = channels.begin(); it != channels.end(); ++it) {
+        Channel& channel = it->second;
+        std::string sjoin = make_sjoin_line(channel, link_fd);
+        if (sjoin.empty()) {
+            continue;
+        }
+        send_to_client(link_fd, sjoin);
+        if (!channel.getTopic().empty()) {
+            std::string topic = channel.getTopic()[0] == ':' ? channel.getTopic().substr(1) : channel.getTopic();
+            send_to_client(link_fd, ":" + sid + " TB " + channel.getName() + " " + intToString(channel.getTopicTime()) + " :" + topic + "\r\n");
+        }
+        for (int list = 0; list < MASK_LIST_COUNT; ++list) {
+            const std::vector<ChannelMask>& masks = channel.getMasks(list);
+            std::string line = ":" + sid + " BMASK " + intToString(channel.getCreationTime()) + " " + channel.getName() + " " + list_flags[list] + " :";
+            for (size_t i = 0; i < masks.size(); ++i) {
+                line += (i ? " " : "") + masks[i].mask; // At most channel_max_masks
+            }
+            if (!masks.empty()) {
+                send_to_client(link_fd, line + "\r\n");
+            }
+        }
+    }
+    send_to_client(link_fd, ":" + sid + " EOB\r\n");
+}
+
+void Server::broadcast_to_links(const std::string& line, int except_fd) {
+    for (std::map<int, LinkInfo>::iterator it = links.begin(); it != links.end(); ++it) {
+        if (it->first != except_fd && it->second.established) {
+            send_to_client(it->first, line);
+        }
+    }
+}
+
+/*
+ * @brief Send a line once to every link behind which the channel has members
+ * @param channel The channel
+ * @param line The line
+ * @param except_fd The link the line came from
+ * @return void
+*/
+void Server::route_to_channel_links(Channel& channel, const std::string& line, int except_fd) {
+    std::set<int> targets;
+    std::map<std::string, Client*>& channel_clients = channel.getClients();
+    for (std::map<std::string, Client*>::iterator it = channel_clients.begin(); it != channel_clients.end(); ++it) {
+        int route_fd = it->second->getRouteFd();
+        if (route_fd >= 0 && route_fd != except_fd) {
+            targets.insert(route_fd);
+        }
+    }
+    for (std::set<int>::iterator it = targets.begin(); it != targets.end(); ++it) {
+        send_to_client(*it, line);
+    }
+}
+
+/*
+ * @brief Tell the links about a channel mode a local client changed
+ * @param client_fd The client
+ * @param channel The channel
+ * @param change The sign and the mode, like "+b"
+ * @param param The mode parameter, a UID for o, empty if none
+ * @return void
+*/
+void Server::propagate_channel_mode(int client_fd, const Channel& channel, const std::string& change, const std::string& param) {
+    broadcast_to_links(":" + clients[client_fd].getUid() + " TMODE " + intToString(channel.getCreationTime()) + " " + channel.getName() + " "
+        + change + (param.empty() ? "" : " " + param) + "\r\n", -1);
+}
+
+/*
+ * @brief Tell the network a local client left
+ * @param client The client
+ * @param reason The quit reason
+ * @return void
+*/
+void Server::propagate_local_quit(Client& client, const std::string& reason) {
+    if (client.getUid().empty()) {
+        return;
+    }
+    broadcast_to_links(":" + client.getUid() + " QUIT :" + reason + "\r\n", -1);
+    clients_by_uid.erase(client.getUid());
+}
+
+/*
+ * @brief Refuse a link during its handshake
+ * @param link_fd The link
+ * @param reason Logged here, the peer only learns the link was refused
+ * @return void
+*/
+void Server::reject_link(int link_fd, const std::string& reason) {
+    std::cerr << "Link: refused " << clients[link_fd].getAddress().toString() << " (" << links[link_fd].peer << "): " << reason << std::endl;
+    send_to_client(link_fd, "ERROR :Link refused\r\n");
+    clients[link_fd].flushSendQueue();
+    disconnect_client(link_fd);
+}
+
+/*
+ * @brief Authenticate a link: its SID, password and address must match a [link] section, then its SERVER name
+ * @param link_fd The link
+ * @param command PASS, CAPAB or SERVER, anything else before them is ignored
+ * @param params The parameters
+ * @return void
+*/
+void Server::handle_link_handshake(int link_fd, const std::string& command, const std::vector<std::string>& params) {
+    LinkInfo& link = links[link_fd];
+
+    if (command == "PASS") {
+        if (link.authenticated || params.size() < 4 || params[1] != "TS") {
+            reject_link(link_fd, "malformed PASS");
+            return;
+        }
+        LinkPeer* peer = NULL;
+        for (size_t i = 0; i < link_peers.size() && !peer; ++i) {
+            peer = link_peers[i].block.sid == params[3] ? &link_peers[i] : NULL;
+        }
+        if (!peer || (link.outgoing && peer->block.name != link.peer)) {
+            reject_link(link_fd, "no [link] section has SID " + params[3]);
+            return;
+        }
+        link.peer = peer->block.name;
+        if (!same_secret(params[0], peer->block.password)) {
+            reject_link(link_fd, "wrong password");
+            return;
+        }
+        if (!link.outgoing) {
+            bool allowed = false;
+            for (size_t i = 0; i < peer->addresses.size(); ++i) {
+                allowed = allowed || peer->addresses[i] == clients[link_fd].getAddress();
+            }
+            if (!allowed) {
+                reject_link(link_fd, "not connecting from " + peer->block.host);
+                return;
+            }
+            if (peer->fd >= 0) {
+                reject_link(link_fd, "already linked or connecting");
+                return;
+            }
+            peer->fd = link_fd;
+        }
+        link.sid = params[3];
+        link.authenticated = true;
+    } else if (command == "CAPAB") {
+        for (size_t i = 0; i < params.size(); ++i) {
+            std::istringstream capabs(params[i]);
+            std::string capab;
+            while (capabs >> capab) {
+                link.peer_zip = link.peer_zip || capab == "ZIP";
+            }
+        }
+    } else if (command == "SERVER") {
+        LinkPeer* peer = find_link_peer(link.peer);
+        if (!link.authenticated || !peer || params.empty() || params[0] != peer->block.name) {
+            reject_link(link_fd, params.empty() ? "SERVER without a name" : "SERVER " + params[0] + " does not match its [link] section");
+            return;
+        }
+        for (std::map<int, LinkInfo>::iterator it = links.begin(); it != links.end(); ++it) {
+            if (it->first != link_fd && it->second.established && it->second.sid == link.sid) {
+                reject_link(link_fd, "SID " + link.sid + " is already linked");
+                return;
+            }
+        }
+        link.name = params[0];
+        if (!link.outgoing) {
+            send_link_handshake(link_fd);
+        }
+        start_link_compression(link_fd);
+        if (links.find(link_fd) == links.end()) {
+            return;
+        }
+        link.established = true;
+        clients[link_fd].setRegistered(true);
+        send_burst(link_fd);
+        peer->backoff = LINK_RETRY_MIN;
+        std::cout << "Link: established with " << link.name << " (" << link.sid << ")" << (link.stream ? ", compressed" : "") << std::endl;
+    }
+}
+
+/*
+ * @brief Introduce a remote client, resolving nick collisions by nick timestamp
+ * @param link_fd The link the client is behind
+ * @param prefix The server that introduced it
+ * @param params <nick> <hops> <ts> <umodes> <user> <host> <ip> <uid> <realname>
+ * @return void
+*/
+void Server::link_uid(int link_fd, const std::string& prefix, const std::vector<std::string>& params) {
+    (void)prefix;
+    if (params.size() < 9 || clients_by_uid.count(params[7])) {
+        return;
+    }
+    const std::string& nickname = params[0];
+    time_t nick_ts = static_cast<time_t>(std::atol(params[2].c_str()));
+    const std::string& uid = params[7];
+
+    for (std::map<std::string, Client*>::iterator it = clients_by_uid.begin(); it != clients_by_uid.end(); ++it) {
+        Client* existing = it->second;
+        if (existing->getNickname() != nickname) {
+            continue;
+        }
+        if (existing->getTimeToConnect() <= nick_ts) {
+            send_to_client(link_fd, ":" + sid + " KILL " + uid + " :Nick collision\r\n");
+            return;
+        }
+        std::string existing_uid = existing->getUid();
+        broadcast_to_links(":" + sid + " KILL " + existing_uid + " :Nick collision\r\n", link_fd);
+        if (existing->isRemote()) {
+            remove_remote_client(existing_uid, "Nick collision");
+        } else {
+            send_to_client(existing->getFd(), "ERROR :Nick collision\r\n");
+            existing->flushSendQueue();
+            disconnect_client(existing->getFd());
+        }
+        break;
+    }
+
+    Client& client = remote_clients.insert(std::make_pair(uid, Client(-1))).first->second; // Its own id, for the ban cache
+    client.setUid(uid);
+    client.setRouteFd(link_fd);
+    client.setNickname(nickname);
+    client.setUsername(params[4]);
+    client.setHostname(params[5]);
+    client.setRealname(params[8]);
+    client.setTimeToConnect(nick_ts);
+    client.setHasNick(true);
+    client.setHasUser(true);
+    client.setAuthenticated(true);
+    client.setRegistered(true);
+    clients_by_uid[uid] = &client;
+
+    broadcast_to_links(make_uid_line(client), link_fd);
+}
+
+/*
+ * @brief Add remote members to a channel, the channel with the older timestamp keeps its modes
+ * @param link_fd The link the members are behind
+ * @param members The member UIDs, '@' marks operators
+ * @param channel_name The channel
+ * @param ts The channel timestamp on the remote side
+ * @param modes The mode string and its parameters
+ * @return void
+*/
+void Server::link_join(int link_fd, const std::vector<std::string>& members, const std::string& channel_name, time_t ts, const std::vector<std::string>& modes) {
+    if (!is_valid_channel_name(channel_name)) {
+        return;
+    }
+    bool created = false;
+    if (channels.find(channel_name) == channels.end()) {
+        restore_channel(channel_name);
+    }
+    if (channels.find(channel_name) == channels.end()) {
+        channels[channel_name] = Channel();
+        channels[channel_name].setName(channel_name);
+        channels[channel_name].getHistory().setLimits(history_max_lines, history_max_bytes);
+        created = true;
+    }
+    Channel& channel = channels[channel_name];
+
+    bool remote_wins = created || ts < channel.getCreationTime();
+    bool keep_ops = remote_wins || ts == channel.getCreationTime();
+    if (remote_wins) {
+        channel.setCreationTime(ts);
+        if (!created) {
+            std::vector<std::string> operators = channel.getOperators();
+            for (size_t i = 0; i < operators.size(); ++i) {
+                channel.removeOperator(operators[i], server_name);
+            }
+        }
+        if (!modes.empty() && modes[0].size() > 1) {
+            size_t param = 1;
+            channel.setInviteOnly(false);
+            channel.setTmode(false);
+            for (size_t i = 1; i < modes[0].size(); ++i) {
+                char mode = modes[0][i];
+                if (mode == 'i') {
+                    channel.setInviteOnly(true);
+                } else if (mode == 't') {
+                    channel.setTmode(true);
+                } else if (mode == 'k' && param < modes.size()) {
+                    channel.setPassword(modes[param++]);
+                } else if (mode == 'l' && param < modes.size()) {
+                    channel.setChannelLimit(std::atoi(modes[param++].c_str()));
+                }
+            }
+        }
+    }
+
+    std::vector<std::string> accepted;
+    for (size_t i = 0; i < members.size(); ++i) {
+        std::string uid = members[i];
+        bool op = false;
+        while (!uid.empty() && (uid[0] == '@' || uid[0] == '+')) {
+            op = op || uid[0] == '@';
+            uid.erase(0, 1);
+        }
+        std::map<std::string, Client>::iterator it = remote_clients.find(uid);
+        if (it == remote_clients.end() || it->second.getRouteFd() != link_fd || channel.isClient(it->second.getNickname())) {
+            continue;
+        }
+        Client& client = it->second;
+        channel.addClient(client.getNickname(), &client);
+        channel.broadcast(":" + client.getNickname() + " JOIN :" + channel_name + "\r\n");
+        if (op && keep_ops) {
+            channel.addOperator(client.getNickname(), server_name);
+        }
+        accepted.push_back(members[i]);
+    }
+    if (accepted.empty()) {
+        return;
+    }
+
+    std::string line = ":" + sid + " SJOIN " + intToString(channel.getCreationTime()) + " " + channel_name + " +";
+    line += " :";
+    for (size_t i = 0; i < accepted.size(); ++i) {
+        line += (i ? " " : "") + accepted[i];
+    }
+    broadcast_to_links(line + "\r\n", link_fd);
+}
+
+void Server::link_part(int link_fd, const std::string& prefix, const std::vector<std::string>& params) {
+    std::map<std::string, Client>::iterator it = remote_clients.find(prefix);
+    if (params.empty() || it == remote_clients.end()) {
+        return;
+    }
+    std::map<std::string, Channel>::iterator ch_it = channels.find(params[0]);
+    Client& client = it->second;
+    if (ch_it == channels.end() || !ch_it->second.isClient(client.getNickname())) {
+        return;
+    }
+    std::string reason = params.size() > 1 ? params[1] : "Leaving";
+
+    Channel& channel = ch_it->second;
+    channel.broadcast(":" + client.getNickname() + " PART " + params[0] + " :" + reason + "\r\n");
+    channel.removeClient(client.getNickname());
+    channel.removeOperator(client.getNickname(), server_name);
+    broadcast_to_links(":" + prefix + " PART " + params[0] + " :" + reason + "\r\n", link_fd);
+
+    if (channel.getClientNumber() == 0) {
+        channels.erase(ch_it);
+    }
+}
+
+/*
+ * @brief Deliver a message from a remote client to local recipients and forward it further
+ * @param link_fd The link the message came from
+ * @param prefix The sender UID
+ * @param params <target> <text>
+ * @return void
+*/
+void Server::link_privmsg(int link_fd, const std::string& prefix, const std::vector<std::string>& params) {
+    std::map<std::string, Client>::iterator sender = remote_clients.find(prefix);
+    if (params.size() < 2 || sender == remote_clients.end()) {
+        return;
+    }
+    const std::string& target = params[0];
+    std::string relay = ":" + prefix + " PRIVMSG " + target + " :" + params[1] + "\r\n";
+
+    if (target[0] == '#') {
+        std::map<std::string, Channel>::iterator ch_it = channels.find(target);
+        if (ch_it == channels.end()) {
+            return;
+        }
+        // A kick or ban made here may not have reached the sender's server yet
+        Channel& channel = ch_it->second;
+        const std::string& nickname = sender->second.getNickname();
+        if (!channel.isClient(nickname) || (channel.isBanned(sender->second) && !channel.isOperator(nickname))) {
+            return;
+        }
+        std::string msg = ":" + sender->second.getNickname() + " PRIVMSG " + target + " :" + params[1] + "\r\n";
+        ch_it->second.broadcast(msg);
+        uint64_t now_ms = current_time_ms();
+        ch_it->second.getHistory().append(now_ms, sender->second.getId(), msg);
+        channel_log.append(target, now_ms, msg.data(), msg.size());
+        route_to_channel_links(ch_it->second, relay, link_fd);
+        return;
+    }
+
+    std::map<std::string, Client*>::iterator recipient = clients_by_uid.find(target);
+    if (recipient == clients_by_uid.end()) {
+        return;
+    }
+    if (recipient->second->isRemote()) {
+        if (recipient->second->getRouteFd() != link_fd) {
+            send_to_client(recipient->second->getRouteFd(), relay);
+        }
+        return;
+    }
+    std::string msg = ":" + sender->second.getNickname() + " PRIVMSG " + recipient->second->getNickname() + " :" + params[1] + "\r\n";
+    recipient->second->queueMessage(msg);
+}
+
+void Server::link_nick(int link_fd, const std::string& prefix, const std::vector<std::string>& params) {
+    std::map<std::string, Client>::iterator it = remote_clients.find(prefix);
+    if (params.empty() || it == remote_clients.end()) {
+        return;
+    }
+    Client& client = it->second;
+    std::string old_nickname = client.getNickname();
+    client.setNickname(params[0]);
+    if (client.getNickname() == old_nickname) {
+        return;
+    }
+
+    std::string nick_msg = ":" + old_nickname + " NICK " + client.getNickname() + "\r\n";
+    for (std::map<std::string, Channel>::iterator ch_it = channels.begin(); ch_it != channels.end(); ++ch_it) {
+        if (ch_it->second.isClient(old_nickname)) {
+            ch_it->second.renameClient(old_nickname, client.getNickname());
+            ch_it->second.broadcast(nick_msg);
+        }
+    }
+    broadcast_to_links(":" + prefix + " NICK " + client.getNickname() + " " + (params.size() > 1 ? params[1] : "0") + "\r\n", link_fd);
+}
+
+void Server::link_kill(int link_fd, const std::vector<std::string>& params) {
+    if (params.empty()) {
+        return;
+    }
+    std::string reason = params.size() > 1 ? params[1] : "Killed";
+    std::map<std::string, Client*>::iterator it = clients_by_uid.find(params[0]);
+    if (it == clients_by_uid.end()) {
+        return;
+    }
+    broadcast_to_links(":" + sid + " KILL " + params[0] + " :" + reason + "\r\n", link_fd);
+    if (it->second->isRemote()) {
+        remove_remote_client(params[0], reason);
+    } else {
+        int fd = it->second->getFd();
+        send_to_client(fd, "ERROR :Killed (" + reason + ")\r\n");
+        it->second->flushSendQueue();
+        clients_by_uid.erase(it);
+        disconnect_client(fd);
+    }
+}
+
+/*
+ * @brief Remove a member kicked on another server
+ * @param link_fd The link the kick came from
+ * @param prefix The kicker UID, or a SID
+ * @param params <channel> <target UID> <reason>
+ * @return void
+*/
+void Server::link_kick(int link_fd, const std::string& prefix, const std::vector<std::string>& params) {
+    if (params.size() < 2) {
+        return;
+    }
+    std::map<std::string, Channel>::iterator ch_it = channels.find(params[0]);
+    std::map<std::string, Client*>::iterator target = clients_by_uid.find(params[1]);
+    if (ch_it == channels.end() || target == clients_by_uid.end() || !ch_it->second.isClient(target->second->getNickname())) {
+        return;
+    }
+    std::map<std::string, Client*>::iterator kicker = clients_by_uid.find(prefix);
+    std::string source = kicker != clients_by_uid.end() ? kicker->second->getNickname() : server_name;
+    std::string nickname = target->second->getNickname();
+    std::string reason = params.size() > 2 ? params[2] : nickname;
+
+    Channel& channel = ch_it->second;
+    channel.broadcast(":" + source + " KICK " + params[0] + " " + nickname + " :" + reason + "\r\n");
+    channel.removeClient(nickname);
+    std::vector<std::string>& operators = channel.getOperators();
+    operators.erase(std::remove(operators.begin(), operators.end(), nickname), operators.end());
+    broadcast_to_links(":" + prefix + " KICK " + params[0] + " " + params[1] + " :" + reason + "\r\n", link_fd);
+
+    if (channel.getClientNumber() == 0) {
+        channels.erase(ch_it);
+    }
+}
+
+/*
+ * @brief Set a topic received from another server
+ * @param link_fd The link the topic came from
+ * @param prefix The UID of the client that set it, or a SID
+ * @param params TOPIC: <channel> <topic>, TB (burst): <channel> <topic_ts> <topic>
+ * @param burst Whether it is a TB, only applied over no topic or a newer one
+ * @return void
+*/
+void Server::link_topic(int link_fd, const std::string& prefix, const std::vector<std::string>& params, bool burst) {
+    if (params.size() < (burst ? 3u : 2u)) {
+        return;
+    }
+    std::map<std::string, Channel>::iterator ch_it = channels.find(params[0]);
+    if (ch_it == channels.end()) {
+        return;
+    }
+    Channel& channel = ch_it->second;
+    time_t topic_ts = burst ? static_cast<time_t>(std::atol(params[1].c_str())) : time(NULL);
+    if (burst && !channel.getTopic().empty() && channel.getTopicTime() <= topic_ts) {
+        return;
+    }
+    const std::string& topic = params.back();
+    std::map<std::string, Client*>::iterator setter = clients_by_uid.find(prefix);
+    std::string source = setter != clients_by_uid.end() ? setter->second->getNickname() + "!" + setter->second->getUsername() : server_name;
+
+    channel.setTopic(":" + topic);
+    channel.setTopicTime(topic_ts);
+    channel.broadcast(":" + source + " TOPIC " + params[0] + " :" + topic + "\r\n");
+    if (burst) {
+        broadcast_to_links(":" + prefix + " TB " + params[0] + " " + params[1] + " :" + topic + "\r\n", link_fd);
+    } else {
+        broadcast_to_links(":" + prefix + " TOPIC " + params[0] + " :" + topic + "\r\n", link_fd);
+    }
+}
+
+/*
+ * @brief Apply one channel mode change made on another server
+ * @param link_fd The link the change came from
+ * @param prefix The UID of the client that made it
+ * @param params <channel_ts> <channel> <+x|-x> [parameter]
+ * @return void
+ * A change made to a newer channel than ours lost with its timestamp, as in link_join
+*/
+void Server::link_tmode(int link_fd, const std::string& prefix, const std::vector<std::string>& params) {
+    if (params.size() < 3 || params[2].size() != 2 || (params[2][0] != '+' && params[2][0] != '-')) {
+        return;
+    }
+    std::map<std::string, Channel>::iterator ch_it = channels.find(params[1]);
+    if (ch_it == channels.end() || static_cast<time_t>(std::atol(params[0].c_str())) > ch_it->second.getCreationTime()) {
+        return;
+    }
+    Channel& channel = ch_it->second;
+    bool adding = params[2][0] == '+';
+    char flag = params[2][1];
+    std::string param = params.size() > 3 ? params[3] : "";
+    std::map<std::string, Client*>::iterator setter = clients_by_uid.find(prefix);
+    std::string source = setter != clients_by_uid.end() ? setter->second->getNickname() : server_name;
+    std::string shown = param;
+
+    if (flag == 'i') {
+        channel.setInviteOnly(adding);
+    } else if (flag == 't') {
+        channel.setTmode(adding);
+    } else if (flag == 'k') {
+        if (adding && param.empty()) {
+            return;
+        }
+        channel.setPassword(adding ? param : "");
+        shown = adding ? param : "";
+    } else if (flag == 'l') {
+        int limit = std::atoi(param.c_str());
+        if (adding && limit <= 0) {
+            return;
+        }
+        channel.setChannelLimit(adding ? limit : Channel::getDefaultLimit());
+        shown = adding ? param : "";
+    } else if (flag == 'o') {
+        std::map<std::string, Client*>::iterator target = clients_by_uid.find(param);
+        if (target == clients_by_uid.end() || !channel.isClient(target->second->getNickname())) {
+            return;
+        }
+        shown.clear(); // addOperator and removeOperator announce it themselves
+        if (adding) {
+            channel.addOperator(target->second->getNickname(), server_name);
+        } else {
+            channel.removeOperator(target->second->getNickname(), server_name);
+        }
+    } else if (flag == 'b' || flag == 'e' || flag == 'I') {
+        int list = flag == 'b' ? MASK_BAN : flag == 'e' ? MASK_EXCEPTION : MASK_INVITE;
+        std::string mask = MaskMatcher::normalize(param);
+        bool changed = adding ? channel.addMask(list, mask, setter != clients_by_uid.end() ? setter->second->getMask() : server_name, time(NULL))
+                              : channel.removeMask(list, mask);
+        if (!changed) {
+            return;
+        }
+        shown = mask;
+    } else {
+        return;
+    }
+    if (flag != 'o') {
+        channel.broadcast(":" + source + " MODE " + params[1] + " " + params[2] + (shown.empty() ? "" : " " + shown) + "\r\n");
+    }
+    broadcast_to_links(":" + prefix + " TMODE " + params[0] + " " + params[1] + " " + params[2] + (param.empty() ? "" : " " + param) + "\r\n", link_fd);
+}
+
+/*
+ * @brief Merge a b/e/I list received in a burst
+ * @param link_fd The link the list came from
+ * @param params <channel_ts> <channel> <b|e|I> <masks>
+ * @return void
+*/
+void Server::link_bmask(int link_fd, const std::vector<std::string>& params) {
+    if (params.size() < 4 || params[2].size() != 1) {
+        return;
+    }
+    std::map<std::string, Channel>::iterator ch_it = channels.find(params[1]);
+    char flag = params[2][0];
+    if (ch_it == channels.end() || static_cast<time_t>(std::atol(params[0].c_str())) > ch_it->second.getCreationTime()
+        || (flag != 'b' && flag != 'e' && flag != 'I')) {
+        return;
+    }
+    Channel& channel = ch_it->second;
+    int list = flag == 'b' ? MASK_BAN : flag == 'e' ? MASK_EXCEPTION : MASK_INVITE;
+    std::istringstream iss(params[3]);
+    std::string mask;
+    std::string added;
+    while (iss >> mask) {
+        mask = MaskMatcher::normalize(mask);
+        if (channel.addMask(list, mask, server_name, time(NULL))) {
+            channel.broadcast(":" + server_name + " MODE " + params[1] + " +" + flag + " " + mask + "\r\n");
+            added += (added.empty() ? "" : " ") + mask;
+        }
+    }
+    if (!added.empty()) {
+        broadcast_to_links(":" + sid + " BMASK " + params[0] + " " + params[1] + " " + flag + " :" + added + "\r\n", link_fd);
+    }
+}
+
+/*
+ * @brief Forget a remote client, local members of its channels see it quit
+ * @param uid The client UID
+ * @param reason The quit reason
+ * @return void
+*/
+void Server::remove_remote_client(const std::string& uid, const std::string& reason) {
+    std::map<std::string, Client>::iterator it = remote_clients.find(uid);
+    if (it == remote_clients.end()) {
+        return;
+    }
+    std::string nickname = it->second.getNickname();
+    std::string quit_msg = ":" + nickname + " QUIT :" + reason + "\r\n";
+    std::set<Client*> notified;
+
+    std::map<std::string, Channel>::iterator ch_it = channels.begin();
+    while (ch_it != channels.end()) {
+        Channel& channel = ch_it->second;
+        if (!channel.isClient(nickname)) {
+            ++ch_it;
+            continue;
+        }
+        channel.removeClient(nickname);
+        channel.removeOperator(nickname, server_name);
+        std::map<std::string, Client*>& members = channel.getClients();
+        for (std::map<std::string, Client*>::iterator m = members.begin(); m != members.end(); ++m) {
+            if (notified.insert(m->second).second) {
+                m->second->queueMessage(quit_msg);
+            }
+        }
+        if (channel.getClientNumber() == 0) {
+            channels.erase(ch_it++);
+        } else {
+            ++ch_it;
+        }
+    }
+    clients_by_uid.erase(uid);
+    remote_clients.erase(it);
+}
+
+/*
+ * @brief Netsplit: every client behind the lost link quits, the peer is retried later
+ * @param link_fd The link that was closed
+ * @return void
+*/
+void Server::handle_link_lost(int link_fd) {
+    std::map<int, LinkInfo>::iterator link = links.find(link_fd);
+    if (link == links.end()) {
+        return;
+    }
+    std::string reason = server_name + " " + (link->second.name.empty() ? "*.split" : link->second.name);
+
+    std::vector<std::string> lost;
+    for (std::map<std::string, Client>::iterator it = remote_clients.begin(); it != remote_clients.end(); ++it) {
+        if (it->second.getRouteFd() == link_fd) {
+            lost.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < lost.size(); ++i) {
+        broadcast_to_links(":" + lost[i] + " QUIT :" + reason + "\r\n", link_fd);
+        remove_remote_client(lost[i], reason);
+    }
+    delete link->second.stream;
+    links.erase(link);
+
+    for (size_t i = 0; i < link_peers.size(); ++i) {
+        if (link_peers[i].fd == link_fd) {
+            link_peers[i].fd = -1;
+            link_peers[i].next_attempt = time(NULL) + link_peers[i].backoff;
+            link_peers[i].backoff = std::min(link_peers[i].backoff * 2, LINK_RETRY_MAX);
+        }
+    }
+    std::cout << "Link: lost, " << lost.size() << " remote clients split off" << std::endl;
+}
+
+/*
+ * @brief Handle one line received from another server
+ * @param link_fd The link
+ * @param line The line
+ * @return void
+*/
+void Server::process_link_message(int link_fd, const std::string& line) {
+    std::string prefix, command;
+    std::vector<std::string> params;
+    split_irc_line(line, prefix, command, params);
+    if (command.empty()) {
+        return;
+    }
+
+    LinkInfo& link = links[link_fd];
+    if (!link.established) {
+        handle_link_handshake(link_fd, command, params);
+        return;
+    }
+
+    if (command == "UID") {
+        link_uid(link_fd, prefix, params);
+    } else if (command == "SJOIN" && params.size() >= 4) {
+        std::istringstream iss(params.back());
+        std::vector<std::string> members;
+        std::string member;
+        while (iss >> member) {
+            members.push_back(member);
+        }
+        std::vector<std::string> modes(params.begin() + 2, params.end() - 1);
+        link_join(link_fd, members, params[1], static_cast<time_t>(std::atol(params[0].c_str())), modes);
+    } else if (command == "JOIN" && params.size() >= 2) {
+        link_join(link_fd, std::vector<std::string>(1, prefix), params[1], static_cast<time_t>(std::atol(params[0].c_str())), std::vector<std::string>());
+    } else if (command == "PART") {
+        link_part(link_fd, prefix, params);
+    } else if (command == "PRIVMSG") {
+        link_privmsg(link_fd, prefix, params);
+    } else if (command == "NICK") {
+        link_nick(link_fd, prefix, params);
+    } else if (command == "QUIT") {
+        if (remote_clients.count(prefix) && remote_clients[prefix].getRouteFd() == link_fd) {
+            std::string reason = params.empty() ? "Quit" : params[0];
+            broadcast_to_links(":" + prefix + " QUIT :" + reason + "\r\n", link_fd);
+            remove_remote_client(prefix, reason);
+        }
+    } else if (command == "KILL") {
+        link_kill(link_fd, params);
+    } else if (command == "KICK") {
+        link_kick(link_fd, prefix, params);
+    } else if (command == "TOPIC" || command == "TB") {
+        link_topic(link_fd, prefix, params, command == "TB");
+    } else if (command == "TMODE") {
+        link_tmode(link_fd, prefix, params);
+    } else if (command == "BMASK") {
+        link_bmask(link_fd, params);
+    } else if (command == "PING") {
+        send_to_client(link_fd, ":" + sid + " PONG " + (params.empty() ? sid : params.back()) + "\r\n");
+    } else if (command == "SQUIT" || command == "ERROR") {
+        disconnect_client(link_fd);
+    }
+}
@@ -0,0 +1,186 @@
+#include "ft_irc.hpp"
+
+ListQuery::ListQuery() : min_users(-1), max_users(-1), topic_newer_than(-1), topic_older_than(-1), cursor(""), started(false) {}
+
+/*
+ * @brief Parse an ELIST condition (>N, <N, T<N, T>N) into the query
+ * @param token The condition to parse
+ * @param query The query to fill
+ * @return True if the token was a condition, false if it is a channel mask
+*/
+bool Server::parse_list_filter(const std::string& token, ListQuery& query) {
+    if (token.size() >= 2 && (token[0] == '>' || token[0] == '<')) {
+        long value = std::atol(token.c_str() + 1);
+        if (token[0] == '>') {
+            query.min_users = value;
+        } else {
+            query.max_users = value;
+        }
+        return true;
+    }
+    if (token.size() >= 3 && (token[0] == 'T' || token[0] == 't') && (token[1] == '<' || token[1] == '>')) {
+        long minutes = std::atol(token.c_str() + 2);
+        if (token[1] == '<') {
+            query.topic_newer_than = minutes * 60;
+        } else {
+            query.topic_older_than = minutes * 60;
+        }
+        return true;
+    }
+    return false;
+}
+
+/*
+ * @brief Check if a channel passes every filter of a LIST query
+ * @param query The query
+ * @param channel The channel to check
+ * @param now The current time
+ * @return True if the channel should be listed, false otherwise
+*/
+bool Server::list_entry_matches(const ListQuery& query, const Channel& channel, time_t now) {
+    long users = channel.getClientNumber();
+
+    if (query.min_users >= 0 && users <= query.min_users) {
+        return false;
+    }
+    if (query.max_users >= 0 && users >= query.max_users) {
+        return false;
+    }
+    if (query.topic_newer_than >= 0 || query.topic_older_than >= 0) {
+        if (channel.getTopic().empty()) {
+            return false;
+        }
+        long age = static_cast<long>(now - channel.getTopicTime());
+        if (query.topic_newer_than >= 0 && age >= query.topic_newer_than) {
+            return false;
+        }
+        if (query.topic_older_than >= 0 && age <= query.topic_older_than) {
+            return false;
+        }
+    }
+    if (query.masks.empty()) {
+        return true;
+    }
+    for (size_t i = 0; i < query.masks.size(); ++i) {
+        if (match_mask(query.masks[i], channel.getName())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Server::send_list_entry(int client_fd, const Channel& channel) {
+    std::string topic = channel.getTopic();
+    if (!topic.empty() && topic[0] == ':') {
+        topic.erase(0, 1);
+    }
+    std::string entry = ":" + server_name + " 322 " + clients[client_fd].getNickname() + " " + channel.getName() + " " + intToString(channel.getClientNumber()) + " :" + topic + "\r\n";
+    send_to_client(client_fd, entry);
+}
+
+/*
+ * @brief Emit the next slice of a LIST reply, resuming after the last listed channel
+ * @param client_fd The client file descriptor
+ * @param query The query and its cursor
+ * @return True once the listing is complete, false if it must be resumed later
+*/
+bool Server::continue_list(int client_fd, ListQuery& query) {
+    Client& client = clients[client_fd];
+    time_t now = time(NULL);
+    int emitted = 0;
+    int scanned = 0;
+
+    std::map<std::string, Channel>::iterator it = query.started ? channels.upper_bound(query.cursor) : channels.begin();
+    query.started = true;
+
+    for (; it != channels.end(); ++it) {
+        if (emitted >= LIST_BATCH_SIZE || scanned >= LIST_SCAN_BUDGET || client.getSendQueueSize() >= LIST_SENDQ_WATERMARK) {
+            return false;
+        }
+        query.cursor = it->first;
+        ++scanned;
+        if (list_entry_matches(query, it->second, now)) {
+            send_list_entry(client_fd, it->second);
+            ++emitted;
+        }
+    }
+
+    std::string end_msg = ":" + server_name + " 323 " + client.getNickname() + " :End of /LIST\r\n";
+    send_to_client(client_fd, end_msg);
+    return true;
+}
+
+/*
+ * @brief Advance every pending LIST by one slice, called once per loop iteration
+ * @return void
+*/
+void Server::process_pending_lists() {
+    std::map<int, ListQuery>::iterator it = pending_lists.begin();
+    while (it != pending_lists.end()) {
+        std::map<int, ListQuery>::iterator current = it++;
+        if (clients[current->first].getSendQueueSize() >= LIST_SENDQ_WATERMARK) {
+            continue;
+        }
+        if (continue_list(current->first, current->second)) {
+            pending_lists.erase(current);
+        }
+    }
+}
+
+/*
+ * @brief Check if a pending LIST can make progress without waiting for its client to drain
+ * @return True if the loop should not block in poll, false otherwise
+*/
+bool Server::has_runnable_lists() {
+    for (std::map<int, ListQuery>::iterator it = pending_lists.begin(); it != pending_lists.end(); ++it) {
+        if (clients[it->first].getSendQueueSize() < LIST_SENDQ_WATERMARK) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * @brief List channels, large listings are streamed over several loop iterations
+ * @param client_fd The client file descriptor
+ * @param args Optional comma separated channel masks and ELIST conditions
+ * @return void
+*/
+void Server::handle_list(int client_fd, const std::string& args) {
+    ListQuery query;
+    bool literal_only = true;
+
+    std::istringstream iss(args);
+    std::string param;
+    while (iss >> param) {
+        std::istringstream tokens(param);
+        std::string token;
+        while (std::getline(tokens, token, ',')) {
+            if (token.empty() || parse_list_filter(token, query)) {
+                continue;
+            }
+            if (token.find_first_of("*?") != std::string::npos) {
+                literal_only = false;
+            }
+            query.masks.push_back(token);
+        }
+    }
+
+    std::string start_msg = ":" + server_name + " 321 " + clients[client_fd].getNickname() + " Channel :Users  Name\r\n";
+    send_to_client(client_fd, start_msg);
+
+    if (literal_only && !query.masks.empty()) {
+        time_t now = time(NULL);
+        for (size_t i = 0; i < query.masks.size(); ++i) {
+            std::map<std::string, Channel>::iterator it = channels.find(query.masks[i]);
+            if (it != channels.end() && list_entry_matches(query, it->second, now)) {
+                send_list_entry(client_fd, it->second);
+            }
+        }
+        std::string end_msg = ":" + server_name + " 323 " + clients[client_fd].getNickname() + " :End of /LIST\r\n";
+        send_to_client(client_fd, end_msg);
+        return;
+    }
+
+    pending_lists[client_fd] = query;
+}
@@ -1,8 +1,18 @@
 #include "ft_irc.hpp"
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
+    if (argc == 3 && std::string(argv[1]) == "--mkpasswd") {
+        std::string hash = make_password_hash(argv[2], PBKDF2_ITERATIONS);
+        if (hash.empty()) {
+            std::cerr << "Failed to read a salt from /dev/urandom" << std::endl;
+            return 1;
+        }
+        std::cout << hash << std::endl;
+        return 0;
+    }
+    if (argc < 3) {
         std::cerr << "Usage: " << argv[0] << " <port> <password>" << std::endl;
+        std::cerr << "       " << argv[0] << " --mkpasswd <password>" << std::endl;
         return 1;
     }
 
@@ -12,7 +22,15 @@ int main(int argc, char* argv[]) {
     try {
         setup_signal_handling();
 
-        g_server_instance = new Server(port, password); // Assign global pointer
+        const char* handoff_fd = getenv(HANDOFF_ENV);
+        if (handoff_fd != NULL) {
+            int fd = std::atoi(handoff_fd);
+            unsetenv(HANDOFF_ENV);
+            g_server_instance = new Server(port, password, fd); // Resume a hot upgrade
+        } else {
+            g_server_instance = new Server(port, password); // Assign global pointer
+        }
+        g_server_instance->set_upgrade_command(argc, argv);
         g_server_instance->run();
 
         delete g_server_instance;  // Cleanup after server stops
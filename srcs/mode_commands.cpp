@@ -6,26 +6,28 @@ void Server::handle_invite_only_mode(int client_fd, Channel& channel, bool addin
     if (adding_mode) {
         if (channel.getInviteOnly()) {
             std::string already_enabled_msg = ":" + server_name + " 324 " + client_nickname + " " + channel.getName() + " +i :Invite-only mode is already enabled\r\n";
-            send(client_fd, already_enabled_msg.c_str(), already_enabled_msg.size(), 0);
+            send_to_client(client_fd, already_enabled_msg);
             return;
         }
 
         channel.setInviteOnly(true);
         std::string mode_msg = ":" + client_nickname + " MODE " + channel.getName() + " +i\r\n";
         channel.broadcast(mode_msg);
+        propagate_channel_mode(client_fd, channel, "+i", "");
 
         std::cout << "Invite-only mode enabled for channel " << channel.getName() << " by " << client_nickname << std::endl;
 
     } else {
         if (!channel.getInviteOnly()) {
             std::string already_disabled_msg = ":" + server_name + " 324 " + client_nickname + " " + channel.getName() + " -i :Invite-only mode is already disabled\r\n";
-            send(client_fd, already_disabled_msg.c_str(), already_disabled_msg.size(), 0);
+            send_to_client(client_fd, already_disabled_msg);
             return;
         }
 
         channel.setInviteOnly(false);
         std::string mode_msg = ":" + client_nickname + " MODE " + channel.getName() + " -i\r\n";
         channel.broadcast(mode_msg);
+        propagate_channel_mode(client_fd, channel, "-i", "");
 
         std::cout << "Invite-only mode disabled for channel " << channel.getName() << " by " << client_nickname << std::endl;
     }
@@ -49,6 +51,7 @@ void Server::handle_channel_key_mode(int client_fd, Channel& channel, bool addin
 
         std::string add_msg = ":" + client_nickname + " MODE " + channel.getName() + " +k " + parameters + "\r\n";
         channel.broadcast(add_msg);
+        propagate_channel_mode(client_fd, channel, "+k", parameters);
 
     } else {
         if (parameters.empty() == true) {
@@ -63,6 +66,7 @@ void Server::handle_channel_key_mode(int client_fd, Channel& channel, bool addin
         std::string remove_msg = ":" + client_nickname + " MODE " + channel.getName() + " -k" + "\r\n";
         channel.broadcast(remove_msg);
         channel.setPassword("");
+        propagate_channel_mode(client_fd, channel, "-k", "");
     }
 }
 
@@ -74,34 +78,38 @@ void Server::handle_operator_mode(int client_fd, Channel& channel, bool adding_m
     if (adding_mode) {
         if (channel.isOperator(parameters)) {
             std::string error_msg = ":" + server_name + " 481 " + client_nickname + " :User is already an operator";
-            send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+            send_to_client(client_fd, error_msg);
             return;
         }
 
         if (channel.getClients().find(parameters) == channel.getClients().end()) {
             std::string error_msg = ":" + server_name + " 441 " + client_nickname + " " + parameters + " :They aren't on the channel";
-            send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+            send_to_client(client_fd, error_msg);
             return;
         }
 
         channel.addOperator(parameters, server_name);
+        propagate_channel_mode(client_fd, channel, "+o", channel.getClients()[parameters]->getUid());
 
         std::string promotion_msg = ":" + server_name + " 381 " + client_nickname + " " + parameters + " :User is now an operator";
-        send(client_fd, promotion_msg.c_str(), promotion_msg.size(), 0);
+        send_to_client(client_fd, promotion_msg);
 
         std::cout << "User " << parameters << " has been promoted to operator by " << client_nickname << std::endl;
 
     } else {
         if (!channel.isOperator(parameters)) {
             std::string error_msg = ":" + server_name + " 481 " + client_nickname + " :User is not an operator";
-            send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+            send_to_client(client_fd, error_msg);
             return;
         }
 
         channel.removeOperator(parameters, server_name);
+        if (channel.isClient(parameters)) {
+            propagate_channel_mode(client_fd, channel, "-o", channel.getClients()[parameters]->getUid());
+        }
 
         std::string unpromotion_msg = ":" + server_name + " 381 " + client_nickname + " " + parameters + " :User is no longer an operator";
-        send(client_fd, unpromotion_msg.c_str(), unpromotion_msg.size(), 0);
+        send_to_client(client_fd, unpromotion_msg);
 
         std::cout << "User " << parameters << " has been unpromoted from operator by " << client_nickname << std::endl;
     }
@@ -113,25 +121,27 @@ void Server::handle_topic_restriction_mode(int client_fd, Channel& channel, bool
     if (adding_mode) {
         if (channel.getTmode()) {
             std::string already_enabled_msg = ":" + server_name + " 324 " + client_nickname + " " + channel.getName() + " +t :topic restriction mode is already enabled\r\n";
-            send(client_fd, already_enabled_msg.c_str(), already_enabled_msg.size(), 0);
+            send_to_client(client_fd, already_enabled_msg);
             return;
         }
 
         channel.setTmode(true);
         std::string success_msg = ":" + client_nickname + " MODE " + channel.getName() + " +t\r\n";
-        send(client_fd, success_msg.c_str(), success_msg.size(), 0);
+        send_to_client(client_fd, success_msg);
+        propagate_channel_mode(client_fd, channel, "+t", "");
         std::cout << "Topic-restriction mode enabled for channel " << channel.getName() << std::endl;
 
     } else {
         if (!channel.getTmode()) {
             std::string already_disabled_msg = ":" + server_name + " 324 " + client_nickname + " " + channel.getName() + " -t :Topic restriction mode is already disabled\r\n";
-            send(client_fd, already_disabled_msg.c_str(), already_disabled_msg.size(), 0);
+            send_to_client(client_fd, already_disabled_msg);
             return;
         }
 
         channel.setTmode(false);
         std::string success_msg = ":" + client_nickname + " MODE " + channel.getName() + " -t\r\n";
-        send(client_fd, success_msg.c_str(), success_msg.size(), 0);
+        send_to_client(client_fd, success_msg);
+        propagate_channel_mode(client_fd, channel, "-t", "");
         std::cout << "Topic restriction mode disabled for channel " << channel.getName() << std::endl;
     }
 }
@@ -147,26 +157,84 @@ void Server::handle_user_limit_mode(int client_fd, Channel& channel, bool adding
     std::string already_disabled_msg = ":" + server_name + " 500 " + client_nickname + " :Channel limit already disabled\r\n";
 
     if (adding_mode) {
-        if (limit >= 10 && limit < 100) {
+        if (limit >= 10 && static_cast<unsigned long>(limit) < Channel::getDefaultLimit()) {
             std::string success_msg = ":" + client_nickname + " MODE " + channel.getName() + " +l " + parameters + "\r\n";
             std::cout << success_msg<< std::endl;
-            send(client_fd, success_msg.c_str(), success_msg.size(), 0);
+            send_to_client(client_fd, success_msg);
             std::cout << client_fd << std::endl;
             channel.setChannelLimit(limit);
+            propagate_channel_mode(client_fd, channel, "+l", intToString(limit));
         } else {
-            send(client_fd, invalid_param_msg.c_str(), invalid_param_msg.size(), 0);
+            send_to_client(client_fd, invalid_param_msg);
         }
     } else {
-        if (channel.getChannelLimit() != 100) {
+        if (channel.hasUserLimit()) {
             std::cout << client_fd << std::endl;
             std::string limit_removed_msg = ":" + client_nickname + " MODE " + channel.getName() + " -l\r\n";
-            send(client_fd, limit_removed_msg.c_str(), limit_removed_msg.size(), 0);
+            send_to_client(client_fd, limit_removed_msg);
             std::cout << client_fd << std::endl;
-            channel.setChannelLimit(99);
+            channel.setChannelLimit(Channel::getDefaultLimit());
+            propagate_channel_mode(client_fd, channel, "-l", "");
         } else {
-            send(client_fd, already_disabled_msg.c_str(), already_disabled_msg.size(), 0);
+            send_to_client(client_fd, already_disabled_msg);
+        }
+    }
+}
+
+static int mask_list_index(char flag) {
+    return flag == 'b' ? MASK_BAN : flag == 'e' ? MASK_EXCEPTION : MASK_INVITE;
+}
+
+/*
+ * @brief Send a ban (367/368), exception (348/349) or invite exception (346/347) list
+ * @param client_fd The client file descriptor
+ * @param channel The channel
+ * @param flag The list mode, b, e or I
+ * @return void
+*/
+void Server::send_mask_list(int client_fd, Channel& channel, char flag) {
+    static const char* entry_numerics[] = { "367", "348", "346" };
+    static const char* end_numerics[] = { "368", "349", "347" };
+    static const char* end_texts[] = { "End of channel ban list", "End of channel exception list", "End of channel invite list" };
+    int list = mask_list_index(flag);
+    std::string nickname = clients[client_fd].getNickname();
+
+    const std::vector<ChannelMask>& masks = channel.getMasks(list);
+    for (size_t i = 0; i < masks.size(); ++i) {
+        std::string entry_msg = ":" + server_name + " " + entry_numerics[list] + " " + nickname + " " + channel.getName() + " " + masks[i].mask
+            + " " + masks[i].setter + " " + intToString(masks[i].time) + "\r\n";
+        send_to_client(client_fd, entry_msg);
+    }
+    std::string end_msg = ":" + server_name + " " + end_numerics[list] + " " + nickname + " " + channel.getName() + " :" + end_texts[list] + "\r\n";
+    send_to_client(client_fd, end_msg);
+}
+
+void Server::handle_mask_list_mode(int client_fd, Channel& channel, char flag, bool adding_mode, const std::string& parameters) {
+    std::string client_nickname = clients[client_fd].getNickname();
+    if (parameters.empty()) {
+        send_mask_list(client_fd, channel, flag);
+        return;
+    }
+
+    int list = mask_list_index(flag);
+    std::string mask = MaskMatcher::normalize(parameters.substr(0, parameters.find(' ')));
+    if (adding_mode) {
+        if (channel.getMasks(list).size() >= config->channel_max_masks) {
+            std::string full_msg = ":" + server_name + " 478 " + client_nickname + " " + channel.getName() + " " + mask + " :Channel list is full\r\n";
+            send_to_client(client_fd, full_msg);
+            return;
+        }
+        if (!channel.addMask(list, mask, clients[client_fd].getMask(), time(NULL))) {
+            return;
         }
+    } else if (!channel.removeMask(list, mask)) {
+        return;
     }
+
+    std::string mode_msg = ":" + client_nickname + " MODE " + channel.getName() + (adding_mode ? " +" : " -") + flag + " " + mask + "\r\n";
+    channel.broadcast(mode_msg);
+    propagate_channel_mode(client_fd, channel, std::string(adding_mode ? "+" : "-") + flag, mask);
+    std::cout << "Mask " << mask << (adding_mode ? " added to" : " removed from") << " the +" << flag << " list of " << channel.getName() << std::endl;
 }
 
 std::string Channel::getModes() const {
@@ -177,7 +245,7 @@ std::string Channel::getModes() const {
         modes += "t";
     if (!channel_password.empty())
         modes += "k";
-    if (channelLimit < 100)
+    if (hasUserLimit())
         modes += "l";
     return modes;
 }
@@ -191,13 +259,13 @@ void Server::handle_mode(int client_fd, const std::string& args) {
         std::string channel_name = my_trim(args);
         if (channels.find(channel_name) == channels.end()) {
             std::string error_msg = "Channel " + channel_name + " does not exist.\r\n";
-            send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+            send_to_client(client_fd, error_msg);
         } else {
             Channel& channel = channels[channel_name];
             std::string current_modes = channel.getModes();
             std::cout << "User requested current modes for channel: " << channel_name << std::endl;
             std::string response = ":" + server_name + " 324 " + clients[client_fd].getNickname() + " " + channel_name + " " + current_modes + "\r\n";
-            send(client_fd, response.c_str(), response.size(), 0);
+            send_to_client(client_fd, response);
         }
         return;
     }
@@ -208,16 +276,21 @@ void Server::handle_mode(int client_fd, const std::string& args) {
 
     if (channels.find(channel_name) == channels.end()) {
         std::string error_msg = "Channel " + channel_name + " does not exist.\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
     Channel& channel = channels[channel_name];
 
+    if (second_space == std::string::npos && (flags == "b" || flags == "+b" || flags == "e" || flags == "+e" || flags == "I" || flags == "+I")) {
+        send_mask_list(client_fd, channel, flags[flags.size() - 1]);
+        return;
+    }
+
     std::string nickName = clients[client_fd].getNickname();
     if (!channel.isOperator(nickName)) {
         std::string notOperator = ":" + server_name + " 482 " + nickName + " " + channel.getName() + " :You're not channel operator\r\n";
-        send(client_fd, notOperator.c_str(), notOperator.size(), 0);
+        send_to_client(client_fd, notOperator);
         return;
     }
 
@@ -229,13 +302,13 @@ void Server::handle_mode(int client_fd, const std::string& args) {
         std::string current_modes = channel.getModes();
         std::cout << "User requested current modes for channel: " << channel_name << std::endl;
         std::string response = ":" + server_name + " 324 " + clients[client_fd].getNickname() + " " + channel_name + " " + current_modes + "\r\n";
-        send(client_fd, response.c_str(), response.size(), 0);
+        send_to_client(client_fd, response);
         return;
     }
 
     if (!isValidModeString(flags)) {
         std::string error_msg = "Invalid mode string: " + flags + "\r\n";
-        send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+        send_to_client(client_fd, error_msg);
         return;
     }
 
@@ -269,12 +342,17 @@ void Server::handle_mode(int client_fd, const std::string& args) {
                 case 'l':
                     handle_user_limit_mode(client_fd, channel, adding_mode, parameters);
                     break;
+                case 'b':
+                case 'e':
+                case 'I':
+                    handle_mask_list_mode(client_fd, channel, flag, adding_mode, parameters);
+                    break;
                 default:
                     std::string error_msg = "Unknown mode flag: " + std::string(1, flag) + "\r\n";
-                    send(client_fd, error_msg.c_str(), error_msg.size(), 0);
+                    send_to_client(client_fd, error_msg);
                     break;
             }
         }
     }
-    channel.updateList(client_fd, server_name, client_nickname);
+    channel.updateList(clients[client_fd], server_name, client_nickname);
 }
@@ -0,0 +1,64 @@
+#include "ft_irc.hpp"
+
+static const char* overload_stage_names[] = { "normal", "deferring accepts", "throttling heavy clients", "rejecting connections" };
+
+/*
+ * @brief Fold the duration of a loop iteration into the lag estimate and move between shedding stages
+ * @param iteration_cycles Time from poll returning to the end of the iteration
+ * @param ready_cycles Longest time a ready socket waited in this iteration before being handled
+ * @return void
+*/
+void Server::update_loop_lag(uint64_t iteration_cycles, uint64_t ready_cycles) {
+    double iteration_us = cycles_to_us(iteration_cycles);
+    loop_lag_us = loop_lag_us * 0.875 + iteration_us * 0.125;
+
+    metrics.setGauge(GAUGE_LOOP_LAG_US, static_cast<uint64_t>(loop_lag_us));
+    metrics.setGauge(GAUGE_READY_LAG_US, static_cast<uint64_t>(cycles_to_us(ready_cycles)));
+    metrics.setGauge(GAUGE_ITERATION_US, static_cast<uint64_t>(iteration_us));
+
+    // Escalate straight to the matching stage, calm down one stage at a time once lag stayed well below it
+    time_t now = time(NULL);
+    int stage = overload_stage;
+    while (stage < OVERLOAD_REJECT && loop_lag_us >= lag_thresholds_us[stage + 1]) {
+        ++stage;
+    }
+    if (stage == overload_stage && stage > OVERLOAD_NONE && loop_lag_us < lag_thresholds_us[stage] / 2
+        && now - overload_changed >= LAG_STAGE_HOLD) {
+        --stage;
+    }
+    if (stage == overload_stage) {
+        return;
+    }
+
+    std::cout << "Loop lag " << static_cast<long>(loop_lag_us) << "us, overload stage " << overload_stage_names[overload_stage]
+              << " -> " << overload_stage_names[stage] << std::endl;
+    overload_stage = stage;
+    overload_changed = now;
+    t_metrics->counters[METRIC_OVERLOAD_TRANSITIONS]++;
+    metrics.setGauge(GAUGE_OVERLOAD_STAGE, overload_stage);
+    select_throttled_clients();
+}
+
+/*
+ * @brief Stop reading from the clients that sent the most data lately, while the loop is overloaded
+ * @return void
+*/
+void Server::select_throttled_clients() {
+    throttled_fds.clear();
+
+    if (overload_stage >= OVERLOAD_THROTTLE) {
+        std::vector<std::pair<uint64_t, int> > loads;
+        for (std::map<int, Client>::iterator it = clients.begin(); it != clients.end(); ++it) {
+            if (!links.count(it->first) && it->second.getRecvLoad() > 0) {
+                loads.push_back(std::make_pair(it->second.getRecvLoad(), it->first));
+            }
+        }
+        std::sort(loads.rbegin(), loads.rend());
+
+        size_t count = std::max<size_t>(1, clients.size() / THROTTLE_SHARE);
+        for (size_t i = 0; i < loads.size() && i < count; ++i) {
+            throttled_fds.insert(loads[i].second);
+        }
+    }
+    metrics.setGauge(GAUGE_THROTTLED_CLIENTS, throttled_fds.size());
+}
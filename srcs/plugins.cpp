@@ -0,0 +1,84 @@
+#include "ft_irc.hpp"
+
+/*
+ * @brief Load the plugins listed in the configuration, a plugin that fails to load is reported and skipped
+ * @return void
+*/
+void Server::load_plugins() {
+    plugins.attach(this, &workers);
+    for (size_t i = 0; i < config->plugins.size(); ++i) {
+        std::string error;
+        if (!plugins.load(config->plugins[i], error)) {
+            std::cerr << "Plugin not loaded: " << error << std::endl;
+        }
+    }
+}
+
+/*
+ * @brief Build the event handed to plugins for something a client did
+ * @param type The irc_event_type
+ * @param client The client
+ * @param channel The channel, empty for a private message
+ * @param text The message text or part reason
+ * @return The event
+*/
+PluginEvent Server::make_plugin_event(int type, const Client& client, const std::string& channel, const std::string& text) const {
+    PluginEvent event;
+    event.type = type;
+    event.nick = client.getNickname();
+    event.mask = client.getMask();
+    event.account = client.getAccount();
+    event.channel = channel;
+    event.text = text;
+    event.time_ms = current_time_ms();
+    return event;
+}
+
+/*
+ * @brief Send a message on behalf of a service plugin, straight into the fan-out path
+ * @param service The service nickname
+ * @param command PRIVMSG or NOTICE
+ * @param target A channel or a local nickname
+ * @param text The text, cut at the first line break and at SERVICE_MESSAGE_MAX bytes
+ * @return False if the target does not exist
+*/
+bool Server::send_service_message(const std::string& service, const std::string& command, const std::string& target, const std::string& text) {
+    std::string clean = text.substr(0, text.find_first_of("\r\n"));
+    if (clean.size() > SERVICE_MESSAGE_MAX) {
+        clean.resize(SERVICE_MESSAGE_MAX);
+    }
+    std::string line = ":" + service + "!service@" + server_name + " " + command + " " + target + " :" + clean + "\r\n";
+
+    if (!target.empty() && target[0] == '#') {
+        std::map<std::string, Channel>::iterator it = channels.find(target);
+        if (it == channels.end()) {
+            return false;
+        }
+        it->second.broadcast(Message(line, current_time_ms()), -1);
+        return true;
+    }
+    for (std::map<int, Client>::iterator it = clients.begin(); it != clients.end(); ++it) {
+        if (it->second.getNickname() == target && it->second.isRegistered()) {
+            send_to_client(it->first, Message(line, current_time_ms()).renderFor(it->second.getCaps()));
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * @brief STATS p: one line per plugin with its mode, calls, budget overruns and dropped events
+ * @param client_fd The client file descriptor
+ * @return void
+*/
+void Server::report_plugin_stats(int client_fd) {
+    std::string nickname = clients[client_fd].getNickname();
+    const std::vector<LoadedPlugin*>& loaded = plugins.getPlugins();
+    for (size_t i = 0; i < loaded.size(); ++i) {
+        std::ostringstream oss;
+        oss << ":" << server_name << " 249 " << nickname << " p :" << loaded[i]->name
+            << (loaded[i]->threaded ? " thread" : " loop") << (loaded[i]->disabled ? " disabled" : "")
+            << " calls=" << plugins.getCalls(loaded[i]) << " overruns=" << loaded[i]->overruns << " dropped=" << loaded[i]->dropped << "\r\n";
+        send_to_client(client_fd, oss.str());
+    }
+}
@@ -0,0 +1,196 @@
+#include "ft_irc.hpp"
+#include <netdb.h>
+
+/*
+ * Reverse lookup of one address, confirmed by a forward lookup of the name
+*/
+class ResolveJob : public WorkerJob {
+private:
+    PeerAddress address;
+    std::string host;
+
+    static bool isValidHostname(const std::string& name) {
+        if (name.empty() || name.size() > HOSTLEN || name[0] == '.' || name[0] == '-') {
+            return false;
+        }
+        for (size_t i = 0; i < name.size(); ++i) {
+            if (!std::isalnum(static_cast<unsigned char>(name[i])) && name[i] != '.' && name[i] != '-') {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    ResolveJob(const PeerAddress& address) : address(address), host("") {}
+
+    void run() {
+        struct sockaddr_storage storage;
+        socklen_t length = address.toSockaddr(storage);
+        char name[NI_MAXHOST];
+        if (length == 0 || getnameinfo(reinterpret_cast<struct sockaddr*>(&storage), length, name, sizeof(name), NULL, 0, NI_NAMEREQD) != 0) {
+            return;
+        }
+        if (!isValidHostname(name)) {
+            return;
+        }
+
+        struct addrinfo hints;
+        struct addrinfo* res;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(name, NULL, &hints, &res) != 0) {
+            return;
+        }
+        for (struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next) {
+            if (PeerAddress::fromSockaddr(ai->ai_addr, ai->ai_addrlen) == address) {
+                host = name;
+                break;
+            }
+        }
+        freeaddrinfo(res);
+    }
+
+    void complete(Server& server) {
+        server.finish_host_lookup(address, host);
+    }
+};
+
+/*
+ * @brief Start resolving the host name of a new client, from the cache if possible
+ * @param client_fd The client file descriptor
+ * @param announce True to tell the client with the usual "*** Looking up your hostname" notices
+ * @return void
+*/
+void Server::start_host_lookup(int client_fd, bool announce) {
+    Client& client = clients[client_fd];
+    std::string ip = client.getAddress().toString();
+    client.setHostname(ip[0] == ':' ? "0" + ip : ip); // "::1" would read as a trailing parameter
+    if (!client.getAddress().valid) {
+        return;
+    }
+    if (announce) {
+        send_to_client(client_fd, ":" + server_name + " NOTICE * :*** Looking up your hostname...\r\n");
+    }
+
+    std::string host;
+    if (host_cache.lookup(ip, time(NULL), host)) {
+        apply_host_lookup(client_fd, host, announce);
+        return;
+    }
+    if (workers.getEventFd() < 0) {
+        apply_host_lookup(client_fd, "", announce);
+        return;
+    }
+
+    // Clients from the same address share one lookup
+    bool in_flight = pending_lookups.count(ip) > 0;
+    pending_lookups[ip].push_back(client_fd);
+    if (!in_flight) {
+        workers.submit(new ResolveJob(client.getAddress()));
+    }
+    client.setHostPending(true);
+    if (announce) {
+        lookup_deadlines[client_fd] = current_time_ms() + resolve_deadline_ms;
+    }
+}
+
+/*
+ * @brief Give a client its host name, or keep its IP, and let registration go on
+ * @param client_fd The client file descriptor
+ * @param host The confirmed host name, empty if the lookup failed or timed out
+ * @param announce True to notice the client
+ * @return void
+*/
+void Server::apply_host_lookup(int client_fd, const std::string& host, bool announce) {
+    Client& client = clients[client_fd];
+    client.setHostPending(false);
+    lookup_deadlines.erase(client_fd);
+
+    if (!host.empty()) {
+        client.setHostname(host);
+    }
+    if (announce) {
+        std::string notice = host.empty() ? "*** Couldn't look up your hostname, using your IP address instead" : "*** Found your hostname";
+        send_to_client(client_fd, ":" + server_name + " NOTICE * :" + notice + "\r\n");
+    }
+    complete_registration(client_fd);
+}
+
+/*
+ * @brief Cache the result of a reverse lookup and hand it to every client waiting on that address
+ * @param address The address that was resolved
+ * @param host The confirmed host name, empty if the lookup failed
+ * @return void
+*/
+void Server::finish_host_lookup(const PeerAddress& address, const std::string& host) {
+    std::string ip = address.toString();
+    time_t now = time(NULL);
+    host_cache.store(ip, host, host.empty() ? HOST_CACHE_NEGATIVE_TTL : HOST_CACHE_TTL, now);
+
+    std::map<std::string, std::vector<int> >::iterator it = pending_lookups.find(ip);
+    if (it == pending_lookups.end()) {
+        return;
+    }
+    std::vector<int> waiting;
+    waiting.swap(it->second);
+    pending_lookups.erase(it);
+
+    for (size_t i = 0; i < waiting.size(); ++i) {
+        std::map<int, Client>::iterator client = clients.find(waiting[i]);
+        if (client == clients.end() || !client->second.isHostPending() || !(client->second.getAddress() == address)) {
+            continue;
+        }
+        apply_host_lookup(waiting[i], host, lookup_deadlines.count(waiting[i]) > 0);
+    }
+}
+
+/*
+ * @brief Stop waiting for lookups past their deadline, the client keeps its IP
+ * @return void
+*/
+void Server::expire_host_lookups() {
+    uint64_t now = current_time_ms();
+    std::vector<int> expired;
+    for (std::map<int, uint64_t>::iterator it = lookup_deadlines.begin(); it != lookup_deadlines.end(); ++it) {
+        if (it->second <= now) {
+            expired.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < expired.size(); ++i) {
+        forget_host_lookup(expired[i]);
+        apply_host_lookup(expired[i], "", true);
+    }
+}
+
+/*
+ * @brief Remove a client from the lookups it waits on, the lookup itself still fills the cache
+ * @param client_fd The client file descriptor
+ * @return void
+*/
+void Server::forget_host_lookup(int client_fd) {
+    lookup_deadlines.erase(client_fd);
+    std::map<int, Client>::iterator client = clients.find(client_fd);
+    if (client == clients.end() || !client->second.isHostPending()) {
+        return;
+    }
+    client->second.setHostPending(false);
+    std::map<std::string, std::vector<int> >::iterator it = pending_lookups.find(client->second.getAddress().toString());
+    if (it != pending_lookups.end()) {
+        it->second.erase(std::remove(it->second.begin(), it->second.end(), client_fd), it->second.end());
+    }
+}
+
+/*
+ * @brief Run the completion of every job the workers finished
+ * @return void
+*/
+void Server::process_worker_completions() {
+    std::vector<WorkerJob*> jobs;
+    workers.takeCompleted(jobs);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        jobs[i]->complete(*this);
+        delete jobs[i];
+    }
+}
@@ -0,0 +1,214 @@
+#include "ft_irc.hpp"
+
+ResumeSession::ResumeSession(const Client& client, time_t expires) : client(client), expires(expires) {}
+
+/*
+ * @brief A fresh resume token
+ * @return RESUME_TOKEN_SIZE random bytes in hex, empty if /dev/urandom cannot be read
+*/
+static std::string make_resume_token() {
+    char bytes[RESUME_TOKEN_SIZE];
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return "";
+    }
+    ssize_t got = read(fd, bytes, sizeof(bytes));
+    close(fd);
+    if (got != static_cast<ssize_t>(sizeof(bytes))) {
+        return "";
+    }
+    return hex_encode(std::string(bytes, sizeof(bytes)));
+}
+
+/*
+ * @brief Point the channels and the UID table at the Client object now holding a session
+ * @param client The client, at its new address
+ * @return void
+*/
+static void repoint_memberships(Client& client, std::map<std::string, Channel>& channels, std::map<std::string, Client*>& clients_by_uid) {
+    for (std::map<std::string, Channel>::iterator it = channels.begin(); it != channels.end(); ++it) {
+        std::map<std::string, Client*>& members = it->second.getClients();
+        std::map<std::string, Client*>::iterator member = members.find(client.getNickname());
+        if (member != members.end()) {
+            member->second = &client;
+        }
+    }
+    if (!client.getUid().empty()) {
+        clients_by_uid[client.getUid()] = &client;
+    }
+}
+
+/*
+ * @brief Send the 001-005 burst that tells a client it is registered
+ * @param client_fd The client file descriptor
+ * @return void
+*/
+void Server::send_welcome(int client_fd) {
+    Client& client = clients[client_fd];
+    std::string nickname = client.getNickname();
+
+    std::string welcome_msg = ":" + server_name + " 001 " + nickname + " :Welcome to the IRC network, " + nickname + "\r\n";
+    send_to_client(client_fd, welcome_msg);
+
+    std::string yourhost_msg = ":" + server_name + " 002 " + nickname + " :Your host is " + server_name + ", running version " + server_version + "\r\n";
+    send_to_client(client_fd, yourhost_msg);
+
+    std::string created_msg = ":" + server_name + " 003 " + nickname + " :This server was created " + server_creation_date + "\r\n";
+    send_to_client(client_fd, created_msg);
+
+    std::string myinfo_msg = ":" + server_name + " 004 " + nickname + " " + server_name + " " + server_version + " o o\r\n";
+    send_to_client(client_fd, myinfo_msg);
+
+    std::string isupport_msg = ":" + server_name + " 005 " + nickname + " CHATHISTORY=" + intToString(CHATHISTORY_MAX_LIMIT) + " NICKLEN=" + intToString(config->nick_length) + " :are supported by this server\r\n";
+    send_to_client(client_fd, isupport_msg);
+
+    // A client that asked for draft/resume gets a token for its next connection
+    if ((client.getCaps() & CAP_RESUME) && config->resume_grace > 0) {
+        client.setResumeToken(make_resume_token());
+        if (!client.getResumeToken().empty()) {
+            send_to_client(client_fd, ":" + server_name + " RESUME TOKEN " + client.getResumeToken() + "\r\n");
+        }
+    }
+}
+
+/*
+ * @brief Keep a client whose connection dropped in its channels for the grace period
+ * @param client The client, about to be erased from the clients map
+ * @return False if the client has no resume token, it is then removed as usual
+ * Nothing is broadcast: to the other members the client is still there
+*/
+bool Server::detach_session(Client& client) {
+    if (!client.isRegistered() || client.getResumeToken().empty() || config->resume_grace == 0) {
+        return false;
+    }
+    std::map<std::string, ResumeSession>::iterator session = detached_sessions.insert(
+        std::make_pair(client.getResumeToken(), ResumeSession(client, time(NULL) + config->resume_grace))).first;
+    session->second.client.setFd(-1);
+    session->second.client.dropPartialLine();
+    repoint_memberships(session->second.client, channels, clients_by_uid);
+    std::cout << "Client " << client.getFd() << " (" << client.getNickname() << ") detached, resumable for " << config->resume_grace << " seconds" << std::endl;
+    return true;
+}
+
+/*
+ * @brief Finally remove a detached client: QUIT in its channels, and on the links
+ * @param session The session
+ * @param reason The quit reason
+ * @return void
+*/
+void Server::end_session(std::map<std::string, ResumeSession>::iterator session, const std::string& reason) {
+    Client& client = session->second.client;
+    std::string nickname = client.getNickname();
+    std::string quit_msg = ":" + client.getMask() + " QUIT :" + reason + "\r\n";
+    for (std::map<std::string, Channel>::iterator it = channels.begin(); it != channels.end(); ++it) {
+        if (it->second.isClient(nickname)) {
+            // The QUIT covers the operator status too, no MODE -o
+            std::vector<std::string>& operators = it->second.getOperators();
+            operators.erase(std::remove(operators.begin(), operators.end(), nickname), operators.end());
+            it->second.removeClient(nickname);
+            it->second.broadcast(quit_msg);
+        }
+    }
+    propagate_local_quit(client, reason);
+    std::cout << "Session of " << nickname << " ended: " << reason << std::endl;
+    detached_sessions.erase(session);
+}
+
+/*
+ * @brief End the sessions past their grace period or over their buffer
+ * @param now The current time
+ * @return void
+*/
+void Server::expire_sessions(time_t now) {
+    std::map<std::string, ResumeSession>::iterator it = detached_sessions.begin();
+    while (it != detached_sessions.end()) {
+        std::map<std::string, ResumeSession>::iterator current = it++;
+        if (now >= current->second.expires) {
+            end_session(current, "Connection timed out");
+        } else if (current->second.client.getSendQueueSize() > config->resume_buffer) {
+            end_session(current, "Resume buffer exceeded");
+        }
+    }
+}
+
+Client* Server::find_detached_client(const std::string& nickname) {
+    for (std::map<std::string, ResumeSession>::iterator it = detached_sessions.begin(); it != detached_sessions.end(); ++it) {
+        if (it->second.client.getNickname() == nickname) {
+            return &it->second.client;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * @brief Take over a detached session on a new connection (draft/resume)
+ * @param client_fd The new, unregistered connection
+ * @param args The token from RESUME TOKEN
+ * @return void
+ * The new socket gets the session's nickname, channels and missed messages; nobody else sees anything
+*/
+void Server::handle_resume(int client_fd, const std::string& args) {
+    std::string token = my_trim(args);
+    if (!token.empty() && token[0] == ':') {
+        token.erase(0, 1);
+    }
+    token = token.substr(0, token.find(' '));
+
+    if (clients[client_fd].isRegistered()) {
+        send_to_client(client_fd, ":" + server_name + " FAIL RESUME REGISTRATION_IS_COMPLETED :Cannot resume after registration\r\n");
+        return;
+    }
+    if (!clients[client_fd].isAuthenticated()) {
+        send_to_client(client_fd, ":" + server_name + " FAIL RESUME INVALID_TOKEN :Password required before resuming\r\n");
+        return;
+    }
+
+    // The old connection may still look alive if the drop has not been noticed yet
+    int old_fd = -1;
+    for (std::map<int, Client>::iterator it = clients.begin(); !token.empty() && it != clients.end(); ++it) {
+        if (it->first != client_fd && it->second.getResumeToken() == token && it->second.isRegistered() && !links.count(it->first)) {
+            old_fd = it->first;
+            break;
+        }
+    }
+    std::map<std::string, ResumeSession>::iterator session = detached_sessions.find(token);
+    const Client* old = old_fd >= 0 ? &clients[old_fd] : (session != detached_sessions.end() ? &session->second.client : NULL);
+    // The missed lines are already rendered for the old connection's capabilities
+    if (old != NULL && (old->getCaps() & CAP_RENDERING) != (clients[client_fd].getCaps() & CAP_RENDERING)) {
+        send_to_client(client_fd, ":" + server_name + " FAIL RESUME CANNOT_RESUME :Capabilities differ from the session's, request the same ones\r\n");
+        return;
+    }
+    if (old_fd >= 0) {
+        disconnect_client(old_fd, true);
+        session = detached_sessions.find(token);
+    }
+    if (token.empty() || session == detached_sessions.end()) {
+        send_to_client(client_fd, ":" + server_name + " FAIL RESUME INVALID_TOKEN :Cannot resume connection, token is not valid\r\n");
+        return;
+    }
+
+    // Keep what belongs to the new connection: socket, address, capabilities and unread input
+    Client& current = clients[client_fd];
+    Client resumed(session->second.client);
+    resumed.setFd(client_fd);
+    resumed.setAddress(current.getAddress());
+    resumed.setHostname(current.getHostname());
+    resumed.setHostPending(current.isHostPending());
+    resumed.setCaps(current.getCaps());
+    resumed.setCapNegotiating(current.isCapNegotiating());
+    resumed.setBuffer(current.getBuffer());
+    resumed.setPingSent(0);
+    resumed.setLastActivityTime(time(NULL));
+    std::string missed = resumed.getPendingOutput();
+    resumed.setSendQueue(current.getPendingOutput());
+    detached_sessions.erase(session);
+
+    clients.erase(client_fd);
+    Client& client = clients.insert(std::make_pair(client_fd, resumed)).first->second;
+    repoint_memberships(client, channels, clients_by_uid);
+
+    send_welcome(client_fd);
+    send_to_client(client_fd, ":" + server_name + " RESUME SUCCESS " + client.getNickname() + "\r\n");
+    client.queueMessage(missed);
+    std::cout << "Client " << client_fd << " resumed the session of " << client.getNickname() << " (" << missed.size() << " bytes missed)" << std::endl;
+}
@@ -0,0 +1,279 @@
+#include "ft_irc.hpp"
+#include <fstream>
+
+#define PASSWORD_HASH_SCHEME "pbkdf2-sha256"
+#define PASSWORD_SALT_SIZE 16
+
+/*
+ * @brief Hash a password for the accounts file
+ * @param password The password
+ * @param iterations The PBKDF2 iteration count
+ * @return The record "pbkdf2-sha256$<iterations>$<salt hex>$<hash hex>", empty if no salt could be read
+*/
+std::string make_password_hash(const std::string& password, uint32_t iterations) {
+    char salt[PASSWORD_SALT_SIZE];
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return "";
+    }
+    ssize_t got = read(fd, salt, sizeof(salt));
+    close(fd);
+    if (got != static_cast<ssize_t>(sizeof(salt))) {
+        return "";
+    }
+
+    std::string salt_bytes(salt, sizeof(salt));
+    std::string hash = pbkdf2_sha256(password, salt_bytes, iterations, SHA256_DIGEST_SIZE);
+    std::ostringstream record;
+    record << PASSWORD_HASH_SCHEME << "$" << iterations << "$" << hex_encode(salt_bytes) << "$" << hex_encode(hash);
+    return record.str();
+}
+
+/*
+ * @brief Check a password against a record of make_password_hash, in constant time for a given record
+ * @param record The stored record
+ * @param password The password to check
+ * @return True if the password matches, false otherwise or if the record is malformed
+*/
+bool check_password_hash(const std::string& record, const std::string& password) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    for (size_t end; (end = record.find('$', start)) != std::string::npos; start = end + 1) {
+        fields.push_back(record.substr(start, end - start));
+    }
+    fields.push_back(record.substr(start));
+
+    std::string salt, expected;
+    char* end = NULL;
+    unsigned long iterations = fields.size() == 4 ? std::strtoul(fields[1].c_str(), &end, 10) : 0;
+    if (fields.size() != 4 || fields[0] != PASSWORD_HASH_SCHEME || *end != '\0' || iterations == 0 || iterations > 0xffffffffUL
+        || !hex_decode(fields[2], salt) || !hex_decode(fields[3], expected) || expected.empty()) {
+        return false;
+    }
+
+    std::string hash = pbkdf2_sha256(password, salt, static_cast<uint32_t>(iterations), expected.size());
+    unsigned char diff = 0;
+    for (size_t i = 0; i < hash.size(); ++i) {
+        diff |= static_cast<unsigned char>(hash[i] ^ expected[i]);
+    }
+    return diff == 0;
+}
+
+/*
+ * Verification of a SASL PLAIN password, run on a worker so the loop never
+ * spends PBKDF2 time on it
+*/
+class PasswordJob : public WorkerJob {
+private:
+    int fd;
+    uint32_t client_id;
+    std::string account;
+    std::string password;
+    std::string record;
+    bool known;
+    bool accepted;
+
+public:
+    PasswordJob(int fd, uint32_t client_id, const std::string& account, const std::string& password, const std::string& record, bool known)
+        : fd(fd), client_id(client_id), account(account), password(password), record(record), known(known), accepted(false) {}
+
+    void run() {
+        // Unknown accounts are checked against a dummy record, so they take as long as a wrong password
+        accepted = check_password_hash(record, password) && known;
+        std::fill(password.begin(), password.end(), '\0');
+    }
+
+    void complete(Server& server) {
+        server.finish_sasl(fd, client_id, account, accepted);
+    }
+};
+
+static std::string reply_nick(const Client& client) {
+    return client.getNickname().empty() ? "*" : client.getNickname();
+}
+
+/*
+ * @brief Read the accounts file, one "<account> <password hash>" per line
+ * @return void
+*/
+void Server::load_accounts() {
+    accounts.clear();
+    std::ifstream file(accounts_path.c_str());
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string name, record;
+        if (!(fields >> name >> record) || name[0] == '#') {
+            continue;
+        }
+        accounts[name] = record;
+    }
+    if (accounts.empty()) {
+        return;
+    }
+
+    dummy_password_hash = make_password_hash("", PBKDF2_ITERATIONS);
+    std::cout << "Loaded " << accounts.size() << " accounts from " << accounts_path << std::endl;
+}
+
+/*
+ * @brief Handle the AUTHENTICATE command, SASL PLAIN only
+ * @param client_fd The client file descriptor
+ * @param args The mechanism, then the base64 payload in chunks of SASL_CHUNK_SIZE
+ * @return void
+*/
+void Server::handle_authenticate(int client_fd, const std::string& args) {
+    Client& client = clients[client_fd];
+    std::string arg = my_trim(args);
+    if (!arg.empty() && arg[0] == ':') {
+        arg.erase(0, 1);
+    }
+
+    if (!(client.getCaps() & CAP_SASL)) {
+        send_to_client(client_fd, ":" + server_name + " 904 " + reply_nick(client) + " :SASL authentication failed\r\n");
+        return;
+    }
+    if (!client.getAccount().empty()) {
+        send_to_client(client_fd, ":" + server_name + " 907 " + reply_nick(client) + " :You have already authenticated using SASL\r\n");
+        return;
+    }
+
+    switch (client.getSaslState()) {
+        case SASL_VERIFYING:
+            return; // The worker answers for the attempt in flight
+        case SASL_NONE:
+            if (arg == "*") {
+                abort_sasl(client_fd, "906", "SASL authentication aborted");
+            } else if (arg == "PLAIN" || arg == "plain") {
+                client.setSaslState(SASL_AWAITING_PAYLOAD);
+                client.getSaslBuffer().clear();
+                send_to_client(client_fd, "AUTHENTICATE +\r\n");
+            } else {
+                send_to_client(client_fd, ":" + server_name + " 908 " + reply_nick(client) + " PLAIN :are available SASL mechanisms\r\n");
+                abort_sasl(client_fd, "904", "SASL authentication failed");
+            }
+            return;
+        default:
+            break;
+    }
+
+    if (arg == "*") {
+        abort_sasl(client_fd, "906", "SASL authentication aborted");
+        return;
+    }
+    if (arg.size() > SASL_CHUNK_SIZE || client.getSaslBuffer().size() + arg.size() > SASL_MAX_PAYLOAD) {
+        abort_sasl(client_fd, "905", "SASL message too long");
+        return;
+    }
+    if (arg != "+") {
+        client.getSaslBuffer() += arg;
+    }
+    if (arg.size() == SASL_CHUNK_SIZE) {
+        return; // A full chunk means more follows
+    }
+
+    std::string payload;
+    payload.swap(client.getSaslBuffer());
+    verify_sasl_plain(client_fd, payload);
+}
+
+/*
+ * @brief Decode a PLAIN payload and hand the password check to the workers
+ * @param client_fd The client file descriptor
+ * @param payload The base64 payload "authzid\0authcid\0password"
+ * @return void
+*/
+void Server::verify_sasl_plain(int client_fd, const std::string& payload) {
+    Client& client = clients[client_fd];
+    std::string decoded;
+    size_t first, second;
+    if (!base64_decode(payload, decoded) || (first = decoded.find('\0')) == std::string::npos
+        || (second = decoded.find('\0', first + 1)) == std::string::npos) {
+        abort_sasl(client_fd, "904", "SASL authentication failed");
+        return;
+    }
+    std::string authzid = decoded.substr(0, first);
+    std::string authcid = decoded.substr(first + 1, second - first - 1);
+    std::string secret = decoded.substr(second + 1);
+    std::fill(decoded.begin(), decoded.end(), '\0');
+    if (authcid.empty() || (!authzid.empty() && authzid != authcid)) {
+        abort_sasl(client_fd, "904", "SASL authentication failed");
+        return;
+    }
+
+    if (!address_table.saslAllowed(client.getAddress(), time(NULL))) {
+        std::cout << "Client " << client_fd << ": too many failed logins from " << client.getAddress().toString() << ", password not checked" << std::endl;
+        fail_sasl(client_fd);
+        return;
+    }
+
+    std::map<std::string, std::string>::iterator it = accounts.find(authcid);
+    bool known = it != accounts.end();
+    PasswordJob* job = new PasswordJob(client_fd, client.getId(), authcid, secret, known ? it->second : dummy_password_hash, known);
+    std::fill(secret.begin(), secret.end(), '\0');
+    client.setSaslState(SASL_VERIFYING);
+    if (workers.getEventFd() < 0) {
+        job->run();
+        job->complete(*this);
+        delete job;
+        return;
+    }
+    workers.submit(job);
+}
+
+/*
+ * @brief Give a client the outcome of its password check
+ * @param client_fd The client file descriptor
+ * @param client_id The id of the client that asked, the fd may have been reused since
+ * @param account The account name
+ * @param accepted True if the password matched
+ * @return void
+*/
+void Server::finish_sasl(int client_fd, uint32_t client_id, const std::string& account, bool accepted) {
+    std::map<int, Client>::iterator it = clients.find(client_fd);
+    if (it == clients.end() || it->second.getId() != client_id || it->second.getSaslState() != SASL_VERIFYING) {
+        return;
+    }
+    Client& client = it->second;
+    if (!accepted) {
+        address_table.saslFailed(client.getAddress(), time(NULL));
+        fail_sasl(client_fd);
+        return;
+    }
+
+    client.setSaslState(SASL_NONE);
+    client.setAccount(account);
+    client.setAuthenticated(true); // An account login stands in for the server password
+    std::string mask = reply_nick(client) + "!" + (client.getUsername().empty() ? "*" : client.getUsername()) + "@" + client.getHostname();
+    send_to_client(client_fd, ":" + server_name + " 900 " + reply_nick(client) + " " + mask + " " + account + " :You are now logged in as " + account + "\r\n");
+    send_to_client(client_fd, ":" + server_name + " 903 " + reply_nick(client) + " :SASL authentication successful\r\n");
+    std::cout << "Client " << client_fd << " logged in as " << account << std::endl;
+    complete_registration(client_fd);
+}
+
+/*
+ * @brief Refuse a password, the connection is closed after sasl_max_failures of them
+ * @param client_fd The client file descriptor
+ * @return void
+*/
+void Server::fail_sasl(int client_fd) {
+    abort_sasl(client_fd, "904", "SASL authentication failed");
+    if (clients[client_fd].addSaslFailure() >= config->sasl_max_failures) {
+        clients[client_fd].flushSendQueue();
+        drop_client(client_fd, "Too many failed SASL attempts");
+    }
+}
+
+/*
+ * @brief End a SASL exchange without logging the client in
+ * @param client_fd The client file descriptor
+ * @param numeric The numeric to reply with, 904 to 906
+ * @param reason The reason
+ * @return void
+*/
+void Server::abort_sasl(int client_fd, const std::string& numeric, const std::string& reason) {
+    Client& client = clients[client_fd];
+    client.setSaslState(SASL_NONE);
+    client.getSaslBuffer().clear();
+    send_to_client(client_fd, ":" + server_name + " " + numeric + " " + reply_nick(client) + " :" + reason + "\r\n");
+}
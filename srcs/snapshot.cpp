@@ -0,0 +1,87 @@
+#include "ft_irc.hpp"
+
+/*
+ * @brief Recreate a channel from the snapshot the first time it is joined after a restart
+ * @param channel_name The channel name
+ * @return True if the channel was found in the snapshot, false otherwise
+*/
+bool Server::restore_channel(const std::string& channel_name) {
+    Channel restored;
+    if (!snapshot.restore(channel_name, restored)) {
+        return false;
+    }
+
+    Channel& channel = channels[channel_name];
+    channel.setName(restored.getName());
+    channel.setTopic(restored.getTopic());
+    channel.setTopicTime(restored.getTopicTime());
+    channel.setPassword(restored.getPassword());
+    channel.setChannelLimit(restored.getChannelLimit());
+    channel.setInviteOnly(restored.getInviteOnly());
+    channel.setTmode(restored.getTmode());
+    channel.getOperators() = restored.getOperators();
+    for (int list = 0; list < MASK_LIST_COUNT; ++list) {
+        const std::vector<ChannelMask>& masks = restored.getMasks(list);
+        for (size_t i = 0; i < masks.size(); ++i) {
+            channel.addMask(list, masks[i].mask, masks[i].setter, masks[i].time);
+        }
+    }
+    const std::map<std::string, Client*>& invited = restored.getInvitedClients();
+    for (std::map<std::string, Client*>::const_iterator it = invited.begin(); it != invited.end(); ++it) {
+        channel.inviteClient(it->first, NULL);
+    }
+    channel.getHistory().setLimits(history_max_lines, history_max_bytes);
+
+    std::cout << "Channel " << channel_name << " restored from snapshot" << std::endl;
+    return true;
+}
+
+/*
+ * @brief Write the snapshot from a forked child, the event loop only pays for the fork
+ * @return void
+*/
+void Server::start_background_snapshot() {
+    if (snapshot_pid > 0) {
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "Failed to fork the snapshot writer" << std::endl;
+        return;
+    }
+    if (pid == 0) {
+        bool ok = ChannelSnapshot::writeFile(snapshot_path, snapshot.build(channels));
+        _exit(ok ? 0 : 1);
+    }
+    snapshot_pid = pid;
+}
+
+/*
+ * @brief Collect the snapshot writer once it has exited
+ * @param wait Block until the writer exits
+ * @return void
+*/
+void Server::reap_snapshot_writer(bool wait) {
+    if (snapshot_pid <= 0) {
+        return;
+    }
+
+    int status;
+    pid_t ret = waitpid(snapshot_pid, &status, wait ? 0 : WNOHANG);
+    if (ret == 0) {
+        return;
+    }
+    if (ret < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "Background snapshot to " << snapshot_path << " failed" << std::endl;
+    }
+    snapshot_pid = -1;
+}
+
+/*
+ * @brief Write the snapshot synchronously, used on shutdown
+ * @return True on success, false otherwise
+*/
+bool Server::save_snapshot() {
+    return ChannelSnapshot::writeFile(snapshot_path, snapshot.build(channels));
+}
@@ -0,0 +1,217 @@
+#include "ft_irc.hpp"
+
+/*
+ * @brief Report how much memory the channel histories use
+ * @param client_fd The client file descriptor
+ * @return void
+*/
+void Server::report_history_stats(int client_fd) {
+    size_t lines = 0;
+    size_t bytes = 0;
+    size_t memory = 0;
+
+    for (std::map<std::string, Channel>::iterator it = channels.begin(); it != channels.end(); ++it) {
+        const ChannelHistory& history = it->second.getHistory();
+        lines += history.size();
+        bytes += history.byteSize();
+        memory += history.memoryUsage();
+    }
+
+    std::ostringstream oss;
+    oss << ":" << server_name << " 249 " << clients[client_fd].getNickname() << " h :History " << channels.size()
+        << " channels, " << lines << " lines, " << bytes << " bytes stored, " << memory << " bytes allocated"
+        << " (cap " << history_max_lines << " lines / " << history_max_bytes << " bytes per channel)\r\n";
+    send_to_client(client_fd, oss.str());
+}
+
+/*
+ * @brief Record how long a sampled command took, and log it if it was slow
+ * @param verb_index The index of the command in command_latency
+ * @param command The command name
+ * @param args The command arguments
+ * @param cycles The duration in cycle_now() ticks
+ * @return void
+*/
+void Server::record_command_latency(int verb_index, const std::string& command, const std::string& args, uint64_t cycles) {
+    command_latency[verb_index].record(cycles);
+
+    double duration_us = cycles_to_us(cycles);
+    if (duration_us < slowlog_threshold_us) {
+        return;
+    }
+
+    SlowCommand entry;
+    entry.time = time(NULL);
+    entry.verb = command;
+    entry.args_length = args.size();
+    entry.channel_size = -1;
+    std::string target = args.substr(0, args.find_first_of(" ,"));
+    std::map<std::string, Channel>::iterator channel = channels.find(target);
+    if (channel != channels.end()) {
+        entry.channel_size = channel->second.getClientNumber();
+    }
+    entry.duration_us = duration_us;
+
+    slowlog.push_back(entry);
+    if (slowlog.size() > SLOWLOG_MAX_ENTRIES) {
+        slowlog.pop_front();
+    }
+}
+
+/*
+ * @brief Report p50/p99/max latency of every command that was sampled
+ * @param client_fd The client file descriptor
+ * @return void
+*/
+void Server::report_latency_stats(int client_fd) {
+    std::string nickname = clients[client_fd].getNickname();
+
+    for (std::map<std::string, int>::iterator it = command_verbs.begin(); it != command_verbs.end(); ++it) {
+        const LatencyHistogram& histogram = command_latency[it->second];
+        if (histogram.count() == 0) {
+            continue;
+        }
+        std::ostringstream oss;
+        oss.setf(std::ios::fixed);
+        oss.precision(1);
+        oss << ":" << server_name << " 249 " << nickname << " l :" << it->first << " count=" << histogram.count()
+            << " p50=" << cycles_to_us(histogram.percentile(50)) << "us"
+            << " p99=" << cycles_to_us(histogram.percentile(99)) << "us"
+            << " max=" << cycles_to_us(histogram.max()) << "us\r\n";
+        send_to_client(client_fd, oss.str());
+    }
+
+    std::ostringstream oss;
+    oss << ":" << server_name << " 249 " << nickname << " l :Sampling 1/" << latency_sample_rate << " commands\r\n";
+    send_to_client(client_fd, oss.str());
+}
+
+/*
+ * @brief Report the commands that went over the slow log threshold, newest first
+ * @param client_fd The client file descriptor
+ * @return void
+*/
+void Server::report_slowlog(int client_fd) {
+    std::string nickname = clients[client_fd].getNickname();
+    time_t now = time(NULL);
+
+    for (std::deque<SlowCommand>::reverse_iterator it = slowlog.rbegin(); it != slowlog.rend(); ++it) {
+        std::ostringstream oss;
+        oss.setf(std::ios::fixed);
+        oss.precision(1);
+        oss << ":" << server_name << " 249 " << nickname << " s :" << it->verb << " " << it->duration_us << "us"
+            << " args=" << it->args_length;
+        if (it->channel_size >= 0) {
+            oss << " channel_users=" << it->channel_size;
+        }
+        oss << " age=" << (now - it->time) << "s\r\n";
+        send_to_client(client_fd, oss.str());
+    }
+
+    std::ostringstream oss;
+    oss << ":" << server_name << " 249 " << nickname << " s :" << slowlog.size() << " commands over " << slowlog_threshold_us << "us\r\n";
+    send_to_client(client_fd, oss.str());
+}
+
+/*
+ * @brief Report the channel log writer and the search index (STATS g)
+ * @param client_fd The client file descriptor
+ * @return void
+*/
+void Server::report_log_stats(int client_fd) {
+    uint64_t records, terms, bytes;
+    search_index.getStats(records, terms, bytes);
+    std::ostringstream oss;
+    oss << ":" << server_name << " 249 " << clients[client_fd].getNickname() << " g :dir=" << (channel_log.getDir().empty() ? "-" : channel_log.getDir())
+        << " dropped=" << channel_log.getDropped() << " indexed=" << records << " terms=" << terms << " postings_bytes=" << bytes << "\r\n";
+    send_to_client(client_fd, oss.str());
+}
+
+/*
+ * @brief Report the message filter: its size, what it matched, and the scan throughput
+ * @param client_fd The client file descriptor
+ * @return void
+*/
+void Server::report_filter_stats(int client_fd) {
+    std::ostringstream oss;
+    oss << ":" << server_name << " 249 " << clients[client_fd].getNickname() << " f :";
+    if (!message_filter) {
+        oss << "off\r\n";
+        send_to_client(client_fd, oss.str());
+        return;
+    }
+    double scan_us = cycles_to_us(filter_scan_cycles);
+    oss << "patterns=" << message_filter->getPatternCount() << " states=" << message_filter->getStateCount()
+        << " classes=" << message_filter->getClassCount() << " memory=" << message_filter->getMemoryUsage()
+        << " scanned=" << filter_scanned_bytes << " mb_per_s=" << static_cast<long>(scan_us > 0 ? filter_scanned_bytes / scan_us : 0)
+        << " tagged=" << filter_hits[0] << " reported=" << filter_hits[1] << " blocked=" << filter_hits[2] << "\r\n";
+    send_to_client(client_fd, oss.str());
+}
+
+/*
+ * @brief Report every server link, and how much compression saves on it (STATS n)
+ * @param client_fd The client file descriptor
+ * @return void
+*/
+void Server::report_link_stats(int client_fd) {
+    std::string nickname = clients[client_fd].getNickname();
+    for (std::map<int, LinkInfo>::iterator it = links.begin(); it != links.end(); ++it) {
+        const LinkInfo& link = it->second;
+        std::ostringstream oss;
+        oss << ":" << server_name << " 249 " << nickname << " n :" << (link.name.empty() ? link.peer : link.name)
+            << " sid=" << (link.sid.empty() ? "-" : link.sid) << " state=" << (link.established ? "established" : "handshake");
+        if (link.stream) {
+            oss << " compressed out=" << link.stream->getRawOut() << "/" << link.stream->getWireOut()
+                << " in=" << link.stream->getRawIn() << "/" << link.stream->getWireIn();
+        }
+        oss << "\r\n";
+        send_to_client(client_fd, oss.str());
+    }
+}
+
+/*
+ * @brief Report server statistics
+ * @param client_fd The client file descriptor
+ * @param args The statistics letter
+ * @return void
+*/
+void Server::handle_stats(int client_fd, const std::string& args) {
+    std::string nickname = clients[client_fd].getNickname();
+    std::string query = my_trim(args);
+
+    if (query.empty()) {
+        std::string error_msg = ":" + server_name + " 461 " + nickname + " STATS :Not enough parameters\r\n";
+        send_to_client(client_fd, error_msg);
+        return;
+    }
+
+    char letter = query[0];
+    switch (letter) {
+        case 'h':
+            report_history_stats(client_fd);
+            break;
+        case 'l':
+            report_latency_stats(client_fd);
+            break;
+        case 's':
+            report_slowlog(client_fd);
+            break;
+        case 'p':
+            report_plugin_stats(client_fd);
+            break;
+        case 'g':
+            report_log_stats(client_fd);
+            break;
+        case 'f':
+            report_filter_stats(client_fd);
+            break;
+        case 'n':
+            report_link_stats(client_fd);
+            break;
+        default:
+            break;
+    }
+
+    std::string end_msg = ":" + server_name + " 219 " + nickname + " " + std::string(1, letter) + " :End of /STATS report\r\n";
+    send_to_client(client_fd, end_msg);
+}
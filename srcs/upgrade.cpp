@@ -0,0 +1,513 @@
+#include "ft_irc.hpp"
+#include "Serializer.hpp"
+#include <climits>
+
+#define HANDOFF_MAGIC 0x4952434b // Bumped with the format, an old and a new binary refuse each other's state
+#define HANDOFF_FDS_PER_MESSAGE 200
+
+enum {
+    HANDOFF_AUTHENTICATED = 1 << 0,
+    HANDOFF_REGISTERED = 1 << 1,
+    HANDOFF_HAS_NICK = 1 << 2,
+    HANDOFF_HAS_USER = 1 << 3,
+    HANDOFF_ADMIN = 1 << 4
+};
+
+static bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t ret = write(fd, data, size);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+static bool read_all(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t ret = read(fd, data, size);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+/*
+ * @brief Pass file descriptors over a unix socket (SCM_RIGHTS), in chunks
+ * @param sock The unix socket
+ * @param fds The descriptors to pass
+ * @return True on success, false otherwise
+*/
+static bool send_fds(int sock, const std::vector<int>& fds) {
+    for (size_t sent = 0; sent < fds.size(); ) {
+        size_t count = std::min(fds.size() - sent, static_cast<size_t>(HANDOFF_FDS_PER_MESSAGE));
+        char control[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MESSAGE)];
+        std::memset(control, 0, sizeof(control));
+        char byte = 'F';
+
+        struct iovec iov;
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        std::memcpy(CMSG_DATA(cmsg), &fds[sent], sizeof(int) * count);
+
+        if (sendmsg(sock, &msg, 0) != 1) {
+            return false;
+        }
+        sent += count;
+    }
+    return true;
+}
+
+static bool receive_fds(int sock, size_t expected, std::vector<int>& fds) {
+    while (fds.size() < expected) {
+        char control[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MESSAGE)];
+        char byte;
+
+        struct iovec iov;
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        // Close-on-exec like every descriptor of the server, a later upgrade hands them over explicitly
+        if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1 || (msg.msg_flags & MSG_CTRUNC)) {
+            return false;
+        }
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; ++i) {
+                int fd;
+                std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                fds.push_back(fd);
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * @brief Encode what the next process needs of a client, connected or detached
+ * @param out Appended with the record
+ * @param client The client
+ * @return void
+*/
+static void put_client(std::string& out, const Client& client) {
+    uint16_t flags = 0;
+    flags |= client.isAuthenticated() ? HANDOFF_AUTHENTICATED : 0;
+    flags |= client.isRegistered() ? HANDOFF_REGISTERED : 0;
+    flags |= client.hasNick() ? HANDOFF_HAS_NICK : 0;
+    flags |= client.hasUser() ? HANDOFF_HAS_USER : 0;
+    flags |= client.isAdmin() ? HANDOFF_ADMIN : 0;
+
+    put_u32(out, client.getId());
+    put_string(out, client.getNickname());
+    put_string(out, client.getUsername());
+    put_string(out, client.getRealname());
+    put_string(out, client.getAccount());
+    put_string(out, client.getHostname());
+    put_string(out, client.getResumeToken());
+    put_u32(out, client.getCaps());
+    put_u16(out, flags);
+    put_u64(out, static_cast<uint64_t>(client.getTimeToConnect()));
+    put_u64(out, static_cast<uint64_t>(client.getLastActivityTime()));
+    put_blob(out, client.getBuffer());
+    put_blob(out, client.getPendingOutput());
+}
+
+/*
+ * @brief Decode a record written by put_client
+ * @param reader The state
+ * @param client The client to fill, its socket already set
+ * @return False if the state is cut short
+*/
+static bool read_client(ByteReader& reader, Client& client) {
+    uint32_t id, caps;
+    uint16_t flags;
+    uint64_t connect_time, activity_time;
+    std::string nickname, username, realname, account, hostname, token, input, sendq;
+
+    if (!reader.read(&id, sizeof(id)) || !reader.readString(nickname) || !reader.readString(username)
+        || !reader.readString(realname) || !reader.readString(account) || !reader.readString(hostname) || !reader.readString(token)
+        || !reader.read(&caps, sizeof(caps)) || !reader.read(&flags, sizeof(flags)) || !reader.read(&connect_time, sizeof(connect_time))
+        || !reader.read(&activity_time, sizeof(activity_time)) || !reader.readBlob(input) || !reader.readBlob(sendq)) {
+        return false;
+    }
+    client.setId(id);
+    client.setNickname(nickname);
+    client.setUsername(username);
+    client.setRealname(realname);
+    client.setAccount(account);
+    client.setHostname(hostname);
+    client.setResumeToken(token);
+    client.setCaps(caps);
+    client.setAuthenticated(flags & HANDOFF_AUTHENTICATED);
+    client.setRegistered(flags & HANDOFF_REGISTERED);
+    client.setHasNick(flags & HANDOFF_HAS_NICK);
+    client.setHasUser(flags & HANDOFF_HAS_USER);
+    client.setAdmin(flags & HANDOFF_ADMIN);
+    client.setTimeToConnect(static_cast<time_t>(connect_time));
+    client.setLastActivityTime(static_cast<time_t>(activity_time));
+    client.setBuffer(input);
+    client.queueMessage(sendq);
+    return true;
+}
+
+/*
+ * @brief Remember how this process was started, a hot upgrade executes the same command
+ * @param argc The argument count
+ * @param argv The arguments
+ * @return void
+*/
+void Server::set_upgrade_command(int argc, char** argv) {
+    upgrade_argv.assign(argv, argv + argc);
+
+    char resolved[PATH_MAX];
+    if (realpath(argv[0], resolved) != NULL) {
+        upgrade_argv[0] = resolved;
+    } else {
+        upgrade_argv[0] = "/proc/self/exe";
+    }
+}
+
+/*
+ * @brief Encode the clients, detached sessions and channels, fds receives the descriptors in the order they are referenced
+ * @param fds The listening socket followed by every client socket
+ * @return The encoded state
+*/
+std::string Server::serialize_state(std::vector<int>& fds) {
+    std::string out;
+    put_u32(out, HANDOFF_MAGIC);
+    put_string(out, server_creation_date);
+
+    fds.clear();
+    fds.push_back(server_fd);
+
+    std::string client_data;
+    uint32_t client_count = 0;
+    for (size_t i = 0; i < poll_fds.size(); ++i) {
+        std::map<int, Client>::iterator it = clients.find(poll_fds[i].fd);
+        if (it == clients.end() || links.count(it->first)) {
+            continue;
+        }
+        put_client(client_data, it->second);
+        fds.push_back(it->first);
+        ++client_count;
+    }
+    put_u32(out, client_count);
+    out += client_data;
+
+    // Detached sessions stay resumable: no socket, their buffered lines and the time left
+    put_u32(out, static_cast<uint32_t>(detached_sessions.size()));
+    for (std::map<std::string, ResumeSession>::iterator it = detached_sessions.begin(); it != detached_sessions.end(); ++it) {
+        put_u64(out, static_cast<uint64_t>(it->second.expires));
+        put_client(out, it->second.client);
+    }
+
+    put_u32(out, static_cast<uint32_t>(channels.size()));
+    for (std::map<std::string, Channel>::iterator it = channels.begin(); it != channels.end(); ++it) {
+        Channel& channel = it->second;
+        std::string record;
+        ChannelSnapshot::serializeChannel(channel, record);
+        put_blob(out, record);
+
+        const std::map<std::string, Client*>& members = channel.getClients();
+        put_u32(out, static_cast<uint32_t>(members.size()));
+        for (std::map<std::string, Client*>::const_iterator m = members.begin(); m != members.end(); ++m) {
+            put_string(out, m->first);
+            put_u32(out, m->second->getId());
+        }
+
+        const ChannelHistory& history = channel.getHistory();
+        put_u32(out, static_cast<uint32_t>(history.size()));
+        for (size_t i = 0; i < history.size(); ++i) {
+            ChannelHistory::Entry entry = history.at(i);
+            put_u64(out, entry.time_ms);
+            put_u32(out, entry.sender_id);
+            put_blob(out, std::string(entry.data, entry.length));
+        }
+    }
+    return out;
+}
+
+/*
+ * @brief Rebuild the clients, detached sessions and channels handed over by the previous process
+ * @param state The encoded state
+ * @param fds The listening socket followed by every client socket
+ * @return True if the state is consistent, false otherwise
+*/
+bool Server::restore_state(const std::string& state, const std::vector<int>& fds) {
+    ByteReader reader(state.data(), state.size());
+    uint32_t magic, client_count, session_count, channel_count;
+
+    if (!reader.read(&magic, sizeof(magic)) || magic != HANDOFF_MAGIC || !reader.readString(server_creation_date)
+        || !reader.read(&client_count, sizeof(client_count)) || fds.size() != client_count + 1) {
+        return false;
+    }
+
+    server_fd = fds[0];
+    struct pollfd server_poll_fd;
+    server_poll_fd.fd = server_fd;
+    server_poll_fd.events = POLLIN;
+    server_poll_fd.revents = 0;
+    poll_fds.push_back(server_poll_fd);
+
+    std::map<uint32_t, Client*> clients_by_id;
+    for (uint32_t i = 0; i < client_count; ++i) {
+        int fd = fds[i + 1];
+        clients[fd] = Client(fd);
+        Client& client = clients[fd];
+        if (!read_client(reader, client)) {
+            return false;
+        }
+        if (client.isRegistered()) {
+            client.setUid(make_uid(client.getId()));
+            clients_by_uid[client.getUid()] = &client;
+        }
+        clients_by_id[client.getId()] = &client;
+
+        PeerAddress address = PeerAddress::fromSocket(fd);
+        if (address.valid && address_table.admit(address, time(NULL)) == ADMIT_OK) {
+            client.setAddress(address);
+            start_host_lookup(fd, false);
+        }
+
+        struct pollfd client_poll_fd;
+        client_poll_fd.fd = fd;
+        client_poll_fd.events = POLLIN;
+        client_poll_fd.revents = 0;
+        poll_fds.push_back(client_poll_fd);
+    }
+
+    if (!reader.read(&session_count, sizeof(session_count))) {
+        return false;
+    }
+    for (uint32_t i = 0; i < session_count; ++i) {
+        uint64_t expires;
+        Client detached(-1);
+        if (!reader.read(&expires, sizeof(expires)) || !read_client(reader, detached) || detached.getResumeToken().empty()) {
+            return false;
+        }
+        Client& client = detached_sessions.insert(std::make_pair(detached.getResumeToken(),
+            ResumeSession(detached, static_cast<time_t>(expires)))).first->second.client;
+        client.setUid(make_uid(client.getId()));
+        clients_by_uid[client.getUid()] = &client;
+        clients_by_id[client.getId()] = &client;
+    }
+
+    if (!reader.read(&channel_count, sizeof(channel_count))) {
+        return false;
+    }
+    for (uint32_t i = 0; i < channel_count; ++i) {
+        std::string record;
+        Channel restored;
+        if (!reader.readBlob(record) || !ChannelSnapshot::deserializeChannel(record.data(), record.size(), restored)) {
+            return false;
+        }
+
+        Channel& channel = channels[restored.getName()];
+        channel.setName(restored.getName());
+        channel.setTopic(restored.getTopic());
+        channel.setTopicTime(restored.getTopicTime());
+        channel.setPassword(restored.getPassword());
+        channel.setChannelLimit(restored.getChannelLimit());
+        channel.setInviteOnly(restored.getInviteOnly());
+        channel.setTmode(restored.getTmode());
+        channel.getOperators() = restored.getOperators();
+        for (int list = 0; list < MASK_LIST_COUNT; ++list) {
+            const std::vector<ChannelMask>& masks = restored.getMasks(list);
+            for (size_t i = 0; i < masks.size(); ++i) {
+                channel.addMask(list, masks[i].mask, masks[i].setter, masks[i].time);
+            }
+        }
+        channel.getHistory().setLimits(history_max_lines, history_max_bytes);
+
+        uint32_t member_count, history_count;
+        if (!reader.read(&member_count, sizeof(member_count))) {
+            return false;
+        }
+        for (uint32_t m = 0; m < member_count; ++m) {
+            std::string nickname;
+            uint32_t id;
+            if (!reader.readString(nickname) || !reader.read(&id, sizeof(id))) {
+                return false;
+            }
+            std::map<uint32_t, Client*>::iterator member = clients_by_id.find(id);
+            if (member != clients_by_id.end()) {
+                channel.addClient(nickname, member->second);
+            }
+        }
+
+        const std::map<std::string, Client*>& invited = restored.getInvitedClients();
+        for (std::map<std::string, Client*>::const_iterator it = invited.begin(); it != invited.end(); ++it) {
+            Client* invited_client = NULL;
+            for (std::map<uint32_t, Client*>::iterator c = clients_by_id.begin(); c != clients_by_id.end(); ++c) {
+                if (c->second->getNickname() == it->first) {
+                    invited_client = c->second;
+                    break;
+                }
+            }
+            channel.inviteClient(it->first, invited_client);
+        }
+
+        if (!reader.read(&history_count, sizeof(history_count))) {
+            return false;
+        }
+        for (uint32_t h = 0; h < history_count; ++h) {
+            uint64_t time_ms;
+            uint32_t sender_id;
+            std::string line;
+            if (!reader.read(&time_ms, sizeof(time_ms)) || !reader.read(&sender_id, sizeof(sender_id)) || !reader.readBlob(line)) {
+                return false;
+            }
+            channel.getHistory().append(time_ms, sender_id, line);
+        }
+    }
+    return true;
+}
+
+/*
+ * @brief Receive the state and sockets of the previous process, then acknowledge the handoff
+ * @param handoff_fd The unix socket connected to the previous process
+ * @return void
+*/
+void Server::receive_handoff(int handoff_fd) {
+    uint64_t length;
+    uint32_t fd_count;
+    std::string state;
+    std::vector<int> fds;
+
+    bool ok = read_all(handoff_fd, reinterpret_cast<char*>(&length), sizeof(length))
+        && read_all(handoff_fd, reinterpret_cast<char*>(&fd_count), sizeof(fd_count));
+    if (ok) {
+        state.resize(length);
+        ok = (length == 0 || read_all(handoff_fd, &state[0], length)) && receive_fds(handoff_fd, fd_count, fds);
+    }
+    if (!ok || !restore_state(state, fds)) {
+        for (size_t i = 0; i < fds.size(); ++i) {
+            close(fds[i]);
+        }
+        close(handoff_fd);
+        throw std::runtime_error("Hot upgrade handoff failed");
+    }
+
+    char ack = 'K';
+    write_all(handoff_fd, &ack, 1);
+    close(handoff_fd);
+    std::cout << "Resumed " << clients.size() << " clients, " << detached_sessions.size() << " detached sessions and " << channels.size() << " channels from the previous process" << std::endl;
+}
+
+/*
+ * @brief Start the new binary and hand it the listening socket and every client socket
+ * @return True if the new process took over and this one must exit, false otherwise
+ * Server links are closed rather than handed over, see below
+*/
+bool Server::hot_upgrade() {
+    if (upgrade_argv.empty()) {
+        return false;
+    }
+    std::cout << "Hot upgrade requested, starting " << upgrade_argv[0] << std::endl;
+
+    // Every descriptor is opened close-on-exec, the end of this pair given to the child is the only one it inherits
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        std::cerr << "Hot upgrade: socketpair failed" << std::endl;
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "Hot upgrade: fork failed" << std::endl;
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        fcntl(sv[1], F_SETFD, 0);
+        setenv(HANDOFF_ENV, intToString(sv[1]).c_str(), 1);
+
+        std::vector<char*> argv;
+        for (size_t i = 0; i < upgrade_argv.size(); ++i) {
+            argv.push_back(const_cast<char*>(upgrade_argv[i].c_str()));
+        }
+        argv.push_back(NULL);
+        execv(argv[0], &argv[0]);
+        _exit(127);
+    }
+    close(sv[1]);
+
+    std::vector<int> fds;
+    std::string state = serialize_state(fds);
+    uint64_t length = state.size();
+    uint32_t fd_count = static_cast<uint32_t>(fds.size());
+
+    bool ok = write_all(sv[0], reinterpret_cast<const char*>(&length), sizeof(length))
+        && write_all(sv[0], reinterpret_cast<const char*>(&fd_count), sizeof(fd_count))
+        && write_all(sv[0], state.data(), state.size())
+        && send_fds(sv[0], fds);
+
+    char ack = 0;
+    if (ok) {
+        struct pollfd pfd;
+        pfd.fd = sv[0];
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        ok = poll(&pfd, 1, HANDOFF_TIMEOUT_MS) == 1 && read(sv[0], &ack, 1) == 1 && ack == 'K';
+    }
+    close(sv[0]);
+
+    if (!ok) {
+        std::cerr << "Hot upgrade failed, keeping the current process" << std::endl;
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return false;
+    }
+
+    std::cout << "Hot upgrade complete, new process " << pid << " took over" << std::endl;
+
+    // Links are not handed over: their remote state lives in this process. The peers see a netsplit and the new process links again
+    if (!links.empty()) {
+        for (std::map<int, LinkInfo>::iterator it = links.begin(); it != links.end(); ++it) {
+            std::string error = "ERROR :Restarting (hot upgrade)\r\n";
+            if (it->second.stream) {
+                it->second.stream->write(error);
+                error.clear();
+                it->second.stream->flush(error);
+            }
+            send(it->first, error.data(), error.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+        std::cout << "Hot upgrade: " << links.size() << " server links closed, the new process links again" << std::endl;
+    }
+    return true;
+}
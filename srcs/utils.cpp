@@ -39,6 +39,156 @@ bool user_in_channel(const std::map<std::string, Client*>& clients_in_channel, c
     return clients_in_channel.find(nickname) != clients_in_channel.end();
 }
 
+/*
+ * @brief Case-insensitive glob match supporting '*' and '?'
+ * @param mask The glob pattern
+ * @param str The string to test
+ * @return True if the string matches the pattern, false otherwise
+*/
+bool match_mask(const std::string& mask, const std::string& str) {
+    size_t m = 0;
+    size_t s = 0;
+    size_t star = std::string::npos;
+    size_t backtrack = 0;
+
+    while (s < str.size()) {
+        if (m < mask.size() && (mask[m] == '?' || std::tolower(mask[m]) == std::tolower(str[s]))) {
+            ++m;
+            ++s;
+        } else if (m < mask.size() && mask[m] == '*') {
+            star = m++;
+            backtrack = s;
+        } else if (star != std::string::npos) {
+            m = star + 1;
+            s = ++backtrack;
+        } else {
+            return false;
+        }
+    }
+    while (m < mask.size() && mask[m] == '*') {
+        ++m;
+    }
+    return m == mask.size();
+}
+
+/*
+ * @brief Get the wall clock time in milliseconds
+ * @return The number of milliseconds since the epoch
+*/
+uint64_t current_time_ms() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<uint64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+/*
+ * @brief Format a time as an IRCv3 server-time timestamp (YYYY-MM-DDThh:mm:ss.sssZ)
+ * @param time_ms The time in milliseconds since the epoch
+ * @return The formatted timestamp
+*/
+std::string format_server_time(uint64_t time_ms) {
+    time_t seconds = static_cast<time_t>(time_ms / 1000);
+    struct tm tm_utc;
+    gmtime_r(&seconds, &tm_utc);
+
+    char buffer[32];
+    size_t len = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm_utc);
+    snprintf(buffer + len, sizeof(buffer) - len, ".%03uZ", static_cast<unsigned>(time_ms % 1000));
+    return buffer;
+}
+
+/*
+ * @brief Decode standard base64 (RFC 4648), as used by AUTHENTICATE
+ * @param text The encoded text
+ * @param out The decoded bytes
+ * @return True if the text is valid base64, false otherwise
+*/
+bool base64_decode(const std::string& text, std::string& out) {
+    static const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    out.clear();
+    if (text.size() % 4 != 0) {
+        return false;
+    }
+    uint32_t bits = 0;
+    int count = 0;
+    size_t padding = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '=') {
+            if (i < text.size() - 2) {
+                return false;
+            }
+            ++padding;
+            bits <<= 6;
+        } else {
+            size_t value = alphabet.find(text[i]);
+            if (value == std::string::npos || padding) {
+                return false;
+            }
+            bits = (bits << 6) | value;
+        }
+        if (++count == 4) {
+            out += static_cast<char>(bits >> 16);
+            out += static_cast<char>(bits >> 8);
+            out += static_cast<char>(bits);
+            bits = 0;
+            count = 0;
+        }
+    }
+    out.resize(out.size() - padding);
+    return true;
+}
+
+std::string hex_encode(const std::string& bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        out += digits[static_cast<unsigned char>(bytes[i]) >> 4];
+        out += digits[static_cast<unsigned char>(bytes[i]) & 0xf];
+    }
+    return out;
+}
+
+bool hex_decode(const std::string& text, std::string& out) {
+    out.clear();
+    if (text.size() % 2 != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < text.size(); i += 2) {
+        if (!isxdigit(text[i]) || !isxdigit(text[i + 1])) {
+            return false;
+        }
+        out += static_cast<char>(std::strtol(text.substr(i, 2).c_str(), NULL, 16));
+    }
+    return true;
+}
+
+/*
+ * @brief Parse an IRCv3 server-time timestamp
+ * @param text The timestamp (YYYY-MM-DDThh:mm:ss[.sss]Z)
+ * @param time_ms The parsed time in milliseconds since the epoch
+ * @return True if the timestamp is valid, false otherwise
+*/
+bool parse_server_time(const std::string& text, uint64_t& time_ms) {
+    struct tm tm_utc;
+    std::memset(&tm_utc, 0, sizeof(tm_utc));
+    unsigned millis = 0;
+
+    int fields = sscanf(text.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d.%3u", &tm_utc.tm_year, &tm_utc.tm_mon, &tm_utc.tm_mday,
+                        &tm_utc.tm_hour, &tm_utc.tm_min, &tm_utc.tm_sec, &millis);
+    if (fields < 6) {
+        return false;
+    }
+    tm_utc.tm_year -= 1900;
+    tm_utc.tm_mon -= 1;
+
+    time_t seconds = timegm(&tm_utc);
+    if (seconds == static_cast<time_t>(-1)) {
+        return false;
+    }
+    time_ms = static_cast<uint64_t>(seconds) * 1000 + millis;
+    return true;
+}
+
 bool isValidModeString(const std::string& flags) {
     char last_sign = '\0';
     for (size_t i = 0; i < flags.size(); ++i) {
@@ -52,7 +202,7 @@ bool isValidModeString(const std::string& flags) {
             }
             last_sign = c;
         } else if (isalpha(c)) {
-            if (c != 'i' && c != 't' && c != 'k' && c != 'o' && c != 'l') {
+            if (c != 'i' && c != 't' && c != 'k' && c != 'o' && c != 'l' && c != 'b' && c != 'e' && c != 'I') {
                 return false;
             }
             last_sign = '\0';
@@ -66,7 +216,7 @@ bool isValidModeString(const std::string& flags) {
 
 #include <algorithm>
 
-void Channel::updateList(int client_fd, std::string server_name, std::string client_nickname) {
+void Channel::updateList(Client& client, std::string server_name, std::string client_nickname) {
     std::vector<std::string>::iterator it_ope = std::find(operators.begin(), operators.end(), client_nickname);
     std::map<std::string, Client*>::iterator it_client = clients.find(client_nickname);   
     if (it_ope != operators.end() && it_client == clients.end()) {
@@ -81,9 +231,14 @@ void Channel::updateList(int client_fd, std::string server_name, std::string cli
     }
 
     std::string names_list = getNamesList();
-    std::cout << "Generated names list for channel " << name << ": " << names_list << std::endl;
+    if (g_log_level >= LOG_DEBUG) {
+        std::cout << "Generated names list for channel " << name << ": " << names_list << std::endl;
+    }
 
+    if (client.getCaps() & CAP_NO_IMPLICIT_NAMES) {
+        return;
+    }
     std::string names_reply = ":" + server_name + " 353 " + client_nickname + " = " + name + " :" + names_list + "\r\n";
-    send(client_fd, names_reply.c_str(), names_reply.size(), 0);
+    client.queueMessage(names_reply);
 }
 